@@ -23,7 +23,7 @@ namespace Utils {
             static constexpr bool desired = true;
             bool expected = false;
 
-            if (!pvt_lock.compare_exchange(expected, desired)) {
+            if (!pvt_lock.compare_exchange<MemoryOrder::ACQUIRE>(expected, desired)) {
                 return false;
             }
 
@@ -31,11 +31,14 @@ namespace Utils {
         }
 
         inline void lock() noexcept {
-            while (!trylock()) { __asm__ volatile("pause"); }
+            while (!trylock()) {
+                // wait on a plain load so that the cache line stays shared until the lock is released
+                while (pvt_lock.load<MemoryOrder::RELAXED>()) { __asm__ volatile("pause"); }
+            }
         }
 
         inline void unlock() noexcept {
-            pvt_lock.store(false);
+            pvt_lock.store<MemoryOrder::RELEASE>(false);
         }
 
         inline Lock& operator=(const Lock& m) {
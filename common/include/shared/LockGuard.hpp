@@ -14,14 +14,20 @@
 
 #pragma once
 
+#include <cstdint>
+
 #include <shared/Lock.hpp>
+#include <shared/MCSLock.hpp>
+#include <shared/RWLock.hpp>
+#include <shared/TicketLock.hpp>
 
 namespace Utils {
+    template<typename L = Lock>
     class LockGuard {
     private:
-        Lock& lock;
+        L& lock;
     public:
-        LockGuard(Lock& lock) : lock{lock} {
+        LockGuard(L& lock) : lock{lock} {
             lock.lock();
         }
 
@@ -29,4 +35,66 @@ namespace Utils {
             lock.unlock();
         }
     };
+
+    template<>
+    class LockGuard<MCSLock> {
+    private:
+        MCSLock& lock;
+        MCSLock::Node node{};
+    public:
+        LockGuard(MCSLock& lock) : lock{lock} {
+            lock.lock(node);
+        }
+
+        ~LockGuard() {
+            lock.unlock(node);
+        }
+    };
+
+    template<typename L = RWLock>
+    class SharedGuard {
+    private:
+        L& lock;
+    public:
+        SharedGuard(L& lock) : lock{lock} {
+            lock.lock_shared();
+        }
+
+        ~SharedGuard() {
+            lock.unlock_shared();
+        }
+    };
+
+    // Clears RFLAGS.IF for its lifetime and restores what was there before
+    class InterruptFlagGuard {
+    private:
+        static constexpr uint64_t RFLAGS_IF = 1 << 9;
+
+        uint64_t flags;
+    public:
+        InterruptFlagGuard() {
+            __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+        }
+
+        ~InterruptFlagGuard() {
+            if ((flags & RFLAGS_IF) != 0) {
+                __asm__ volatile("sti" ::: "memory");
+            }
+        }
+
+        InterruptFlagGuard(const InterruptFlagGuard&) = delete;
+        InterruptFlagGuard& operator=(const InterruptFlagGuard&) = delete;
+    };
+
+    // For locks also taken from interrupt handlers, the handler could otherwise spin on a lock
+    // held by the code it interrupted. Members are destroyed in reverse, so the lock is released
+    // before interrupts come back.
+    template<typename L = Lock>
+    class IRQLockGuard {
+    private:
+        InterruptFlagGuard irq{};
+        LockGuard<L> guard;
+    public:
+        IRQLockGuard(L& lock) : guard{lock} {}
+    };
 }
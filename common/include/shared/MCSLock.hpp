@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+
+#pragma once
+
+#include <cstdint>
+
+#include <shared/SimpleAtomic.hpp>
+
+namespace Utils {
+    // Queue lock for contended structures. Every waiter spins on its own node, so the lock
+    // word only changes hands once per acquisition instead of bouncing between processors.
+    // The node has to outlive the critical section and be mapped at the same address for every
+    // waiter. LockGuard keeps it on the stack, kernel task stacks are private to their address
+    // space, so kernel locks that can be contended across tasks use TicketLock instead.
+    class MCSLock {
+    public:
+        struct Node {
+            SimpleAtomic<uint64_t> next{0};     // Node* of the next waiter
+            SimpleAtomic<bool> waiting{false};
+        };
+
+        inline bool trylock(Node& node) noexcept {
+            node.next.store<MemoryOrder::RELAXED>(0);
+            node.waiting.store<MemoryOrder::RELAXED>(false);
+
+            uint64_t expected = 0;
+
+            return tail.compare_exchange<MemoryOrder::ACQUIRE>(expected, reinterpret_cast<uint64_t>(&node));
+        }
+
+        inline void lock(Node& node) noexcept {
+            node.next.store<MemoryOrder::RELAXED>(0);
+            node.waiting.store<MemoryOrder::RELAXED>(true);
+
+            const uint64_t previous = tail.exchange<MemoryOrder::ACQ_REL>(reinterpret_cast<uint64_t>(&node));
+
+            if (previous != 0) {
+                reinterpret_cast<Node*>(previous)->next.store<MemoryOrder::RELEASE>(reinterpret_cast<uint64_t>(&node));
+
+                while (node.waiting.load<MemoryOrder::ACQUIRE>()) { __asm__ volatile("pause"); }
+            }
+        }
+
+        inline void unlock(Node& node) noexcept {
+            uint64_t next = node.next.load<MemoryOrder::ACQUIRE>();
+
+            if (next == 0) {
+                uint64_t expected = reinterpret_cast<uint64_t>(&node);
+
+                if (tail.compare_exchange<MemoryOrder::RELEASE>(expected, 0)) {
+                    return;
+                }
+
+                // a waiter took the tail, but has not linked itself to this node yet
+                while ((next = node.next.load<MemoryOrder::ACQUIRE>()) == 0) { __asm__ volatile("pause"); }
+            }
+
+            reinterpret_cast<Node*>(next)->waiting.store<MemoryOrder::RELEASE>(false);
+        }
+
+    private:
+        SimpleAtomic<uint64_t> tail{0};         // Node* of the last waiter, 0 when free
+    };
+}
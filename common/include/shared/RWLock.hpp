@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+
+#pragma once
+
+#include <cstdint>
+
+#include <shared/SimpleAtomic.hpp>
+
+namespace Utils {
+    // Readers share the lock while writers get it alone. A waiting writer keeps new readers
+    // out, so that a steady flow of them cannot starve it.
+    class RWLock {
+    public:
+        inline bool trylock_shared() noexcept {
+            uint32_t current = state.load<MemoryOrder::RELAXED>();
+
+            return (current & (WRITER | WRITER_WAITING)) == 0
+                && state.compare_exchange<MemoryOrder::ACQUIRE>(current, current + READER);
+        }
+
+        inline void lock_shared() noexcept {
+            while (!trylock_shared()) { __asm__ volatile("pause"); }
+        }
+
+        inline void unlock_shared() noexcept {
+            state -= READER;
+        }
+
+        inline bool trylock() noexcept {
+            uint32_t current = state.load<MemoryOrder::RELAXED>();
+
+            return (current & ~WRITER_WAITING) == 0
+                && state.compare_exchange<MemoryOrder::ACQUIRE>(current, WRITER);
+        }
+
+        inline void lock() noexcept {
+            while (!trylock()) {
+                uint32_t current = state.load<MemoryOrder::RELAXED>();
+
+                if ((current & WRITER_WAITING) == 0) {
+                    state.compare_exchange<MemoryOrder::RELAXED>(current, current | WRITER_WAITING);
+                }
+
+                __asm__ volatile("pause");
+            }
+        }
+
+        // other waiting writers set their flag again, it stays set until they all got the lock
+        inline void unlock() noexcept {
+            state -= WRITER;
+        }
+
+    private:
+        static constexpr uint32_t WRITER            = 0x00000001;
+        static constexpr uint32_t WRITER_WAITING    = 0x00000002;
+        static constexpr uint32_t READER            = 0x00000004;
+
+        SimpleAtomic<uint32_t> state{0};
+    };
+}
@@ -14,6 +14,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <type_traits>
 
 #include <shared/MemoryOrdering.hpp>
@@ -51,6 +52,173 @@ extern "C" uint64_t __blatomic_sub_fetch_8(volatile uint64_t* ptr, uint64_t val,
 namespace Utils {
     template<typename T> concept atomic_t = std::is_integral_v<T> || std::is_pointer_v<T>;
 
+    namespace Atomic {
+        // Out-of-line implementation from AtomicImpl.asm, the order is checked at run time
+        namespace Assembly {
+            template<MemoryOrder Order, typename T>
+            inline T Load(const volatile T* ptr) {
+                if constexpr (sizeof(T) == 1) {
+                    return static_cast<T>(__blatomic_load_1(reinterpret_cast<const volatile uint8_t*>(ptr), Order));
+                }
+                else if constexpr (sizeof(T) == 2) {
+                    return static_cast<T>(__blatomic_load_2(reinterpret_cast<const volatile uint16_t*>(ptr), Order));
+                }
+                else if constexpr (sizeof(T) == 4) {
+                    return static_cast<T>(__blatomic_load_4(reinterpret_cast<const volatile uint32_t*>(ptr), Order));
+                }
+                else if constexpr (sizeof(T) == 8) {
+                    return static_cast<T>(__blatomic_load_8(reinterpret_cast<const volatile uint64_t*>(ptr), Order));
+                }
+            }
+
+            template<MemoryOrder Order, typename T>
+            inline void Store(volatile T* ptr, T value) {
+                if constexpr (sizeof(T) == 1) {
+                    __blatomic_store_1(reinterpret_cast<volatile uint8_t*>(ptr), static_cast<uint8_t>(value), Order);
+                }
+                else if constexpr (sizeof(T) == 2) {
+                    __blatomic_store_2(reinterpret_cast<volatile uint16_t*>(ptr), static_cast<uint16_t>(value), Order);
+                }
+                else if constexpr (sizeof(T) == 4) {
+                    __blatomic_store_4(reinterpret_cast<volatile uint32_t*>(ptr), static_cast<uint32_t>(value), Order);
+                }
+                else if constexpr (sizeof(T) == 8) {
+                    __blatomic_store_8(reinterpret_cast<volatile uint64_t*>(ptr), static_cast<uint64_t>(value), Order);
+                }
+            }
+
+            template<MemoryOrder Order, typename T>
+            inline T Exchange(volatile T* ptr, T value) {
+                if constexpr (sizeof(T) == 1) {
+                    return static_cast<T>(__blatomic_exchange_1(reinterpret_cast<volatile uint8_t*>(ptr), static_cast<uint8_t>(value), Order));
+                }
+                else if constexpr (sizeof(T) == 2) {
+                    return static_cast<T>(__blatomic_exchange_2(reinterpret_cast<volatile uint16_t*>(ptr), static_cast<uint16_t>(value), Order));
+                }
+                else if constexpr (sizeof(T) == 4) {
+                    return static_cast<T>(__blatomic_exchange_4(reinterpret_cast<volatile uint32_t*>(ptr), static_cast<uint32_t>(value), Order));
+                }
+                else if constexpr (sizeof(T) == 8) {
+                    return static_cast<T>(__blatomic_exchange_8(reinterpret_cast<volatile uint64_t*>(ptr), static_cast<uint64_t>(value), Order));
+                }
+            }
+
+            // always sequentially consistent, as lock cmpxchg is
+            template<MemoryOrder, typename T>
+            inline bool CompareExchange(volatile T* ptr, T& expected, T desired) {
+                if constexpr (sizeof(T) == 1) {
+                    return __blatomic_compare_exchange_1(reinterpret_cast<volatile uint8_t*>(ptr), reinterpret_cast<uint8_t*>(&expected), static_cast<uint8_t>(desired));
+                }
+                else if constexpr (sizeof(T) == 2) {
+                    return __blatomic_compare_exchange_2(reinterpret_cast<volatile uint16_t*>(ptr), reinterpret_cast<uint16_t*>(&expected), static_cast<uint16_t>(desired));
+                }
+                else if constexpr (sizeof(T) == 4) {
+                    return __blatomic_compare_exchange_4(reinterpret_cast<volatile uint32_t*>(ptr), reinterpret_cast<uint32_t*>(&expected), static_cast<uint32_t>(desired));
+                }
+                else if constexpr (sizeof(T) == 8) {
+                    return __blatomic_compare_exchange_8(reinterpret_cast<volatile uint64_t*>(ptr), reinterpret_cast<uint64_t*>(&expected), static_cast<uint64_t>(desired));
+                }
+            }
+
+            template<MemoryOrder Order, typename T>
+            inline T AddFetch(volatile T* ptr, T value) {
+                if constexpr (sizeof(T) == 1) {
+                    return static_cast<T>(__blatomic_add_fetch_1(reinterpret_cast<volatile uint8_t*>(ptr), static_cast<uint8_t>(value), Order));
+                }
+                else if constexpr (sizeof(T) == 2) {
+                    return static_cast<T>(__blatomic_add_fetch_2(reinterpret_cast<volatile uint16_t*>(ptr), static_cast<uint16_t>(value), Order));
+                }
+                else if constexpr (sizeof(T) == 4) {
+                    return static_cast<T>(__blatomic_add_fetch_4(reinterpret_cast<volatile uint32_t*>(ptr), static_cast<uint32_t>(value), Order));
+                }
+                else if constexpr (sizeof(T) == 8) {
+                    return static_cast<T>(__blatomic_add_fetch_8(reinterpret_cast<volatile uint64_t*>(ptr), static_cast<uint64_t>(value), Order));
+                }
+            }
+
+            template<MemoryOrder Order, typename T>
+            inline T SubFetch(volatile T* ptr, T value) {
+                if constexpr (sizeof(T) == 1) {
+                    return static_cast<T>(__blatomic_sub_fetch_1(reinterpret_cast<volatile uint8_t*>(ptr), static_cast<uint8_t>(value), Order));
+                }
+                else if constexpr (sizeof(T) == 2) {
+                    return static_cast<T>(__blatomic_sub_fetch_2(reinterpret_cast<volatile uint16_t*>(ptr), static_cast<uint16_t>(value), Order));
+                }
+                else if constexpr (sizeof(T) == 4) {
+                    return static_cast<T>(__blatomic_sub_fetch_4(reinterpret_cast<volatile uint32_t*>(ptr), static_cast<uint32_t>(value), Order));
+                }
+                else if constexpr (sizeof(T) == 8) {
+                    return static_cast<T>(__blatomic_sub_fetch_8(reinterpret_cast<volatile uint64_t*>(ptr), static_cast<uint64_t>(value), Order));
+                }
+            }
+        }
+
+        // Compiler builtins, inlined with the order known at compile time: relaxed, acquire and
+        // release accesses are plain moves, read-modify-writes a single locked instruction
+        namespace Builtin {
+            inline constexpr int ToBuiltin(MemoryOrder order) {
+                switch (order) {
+                    case MemoryOrder::RELAXED: return __ATOMIC_RELAXED;
+                    case MemoryOrder::CONSUME: return __ATOMIC_CONSUME;
+                    case MemoryOrder::ACQUIRE: return __ATOMIC_ACQUIRE;
+                    case MemoryOrder::RELEASE: return __ATOMIC_RELEASE;
+                    case MemoryOrder::ACQ_REL: return __ATOMIC_ACQ_REL;
+                    default: return __ATOMIC_SEQ_CST;
+                }
+            }
+
+            // loads cannot release and stores cannot acquire, those orders are strengthened
+            inline constexpr int ToLoadBuiltin(MemoryOrder order) {
+                return order == MemoryOrder::RELEASE || order == MemoryOrder::ACQ_REL ? __ATOMIC_ACQUIRE : ToBuiltin(order);
+            }
+
+            inline constexpr int ToStoreBuiltin(MemoryOrder order) {
+                return order == MemoryOrder::CONSUME || order == MemoryOrder::ACQUIRE || order == MemoryOrder::ACQ_REL ? __ATOMIC_RELEASE : ToBuiltin(order);
+            }
+
+            // a failed exchange only loads, and may not be ordered stronger than the success
+            inline constexpr int ToFailureBuiltin(MemoryOrder order) {
+                return order == MemoryOrder::RELEASE ? __ATOMIC_RELAXED : ToLoadBuiltin(order);
+            }
+
+            template<MemoryOrder Order, typename T>
+            inline T Load(const volatile T* ptr) {
+                return __atomic_load_n(ptr, ToLoadBuiltin(Order));
+            }
+
+            template<MemoryOrder Order, typename T>
+            inline void Store(volatile T* ptr, T value) {
+                __atomic_store_n(ptr, value, ToStoreBuiltin(Order));
+            }
+
+            template<MemoryOrder Order, typename T>
+            inline T Exchange(volatile T* ptr, T value) {
+                return __atomic_exchange_n(ptr, value, ToBuiltin(Order));
+            }
+
+            template<MemoryOrder Order, typename T>
+            inline bool CompareExchange(volatile T* ptr, T& expected, T desired) {
+                return __atomic_compare_exchange_n(ptr, &expected, desired, false, ToBuiltin(Order), ToFailureBuiltin(Order));
+            }
+
+            template<MemoryOrder Order, typename T>
+            inline T AddFetch(volatile T* ptr, T value) {
+                return __atomic_add_fetch(ptr, value, ToBuiltin(Order));
+            }
+
+            template<MemoryOrder Order, typename T>
+            inline T SubFetch(volatile T* ptr, T value) {
+                return __atomic_sub_fetch(ptr, value, ToBuiltin(Order));
+            }
+        }
+
+#ifdef __BLATOMIC_ASM__
+        namespace Backend = Assembly;
+#else
+        namespace Backend = Builtin;
+#endif
+    }
+
     template<atomic_t T, MemoryOrder Order = MemoryOrder::SEQ_CST>
     class SimpleAtomic {
     private:
@@ -65,62 +233,14 @@ namespace Utils {
         inline constexpr SimpleAtomic() : atomic_value{0} {}
         inline constexpr SimpleAtomic(T v) : atomic_value{v} {}
 
-        inline T load(MemoryOrder order = Order) const volatile {
-            if constexpr (sizeof(T) == 1) {
-                return static_cast<T>(__blatomic_load_1(
-                    reinterpret_cast<const volatile uint8_t*>(&atomic_value),
-                    order
-                ));
-            }
-            else if constexpr (sizeof(T) == 2) {
-                return static_cast<T>(__blatomic_load_2(
-                    reinterpret_cast<const volatile uint16_t*>(&atomic_value),
-                    order
-                ));
-            }
-            else if constexpr (sizeof(T) == 4) {
-                return static_cast<T>(__blatomic_load_4(
-                    reinterpret_cast<const volatile uint32_t*>(&atomic_value),
-                    order
-                ));
-            }
-            else if constexpr (sizeof(T) == 8) {
-                return static_cast<T>(__blatomic_load_8(
-                    reinterpret_cast<const volatile uint64_t*>(&atomic_value),
-                    order
-                ));
-            }
+        template<MemoryOrder O = Order>
+        inline T load() const volatile {
+            return Atomic::Backend::Load<O>(&atomic_value);
         }
 
-        inline void store(T v, MemoryOrder order = Order) volatile {
-            if constexpr (sizeof(T) == 1) {
-                __blatomic_store_1(
-                    reinterpret_cast<volatile uint8_t*>(&atomic_value),
-                    static_cast<uint8_t>(v),
-                    order
-                );
-            }
-            else if constexpr (sizeof(T) == 2) {
-                __blatomic_store_2(
-                    reinterpret_cast<volatile uint16_t*>(&atomic_value),
-                    static_cast<uint16_t>(v),
-                    order
-                );
-            }
-            else if constexpr (sizeof(T) == 4) {
-                __blatomic_store_4(
-                    reinterpret_cast<volatile uint32_t*>(&atomic_value),
-                    static_cast<uint32_t>(v),
-                    order
-                );
-            }
-            else if constexpr (sizeof(T) == 8) {
-                __blatomic_store_8(
-                    reinterpret_cast<volatile uint64_t*>(&atomic_value),
-                    static_cast<uint64_t>(v),
-                    order
-                );
-            }
+        template<MemoryOrder O = Order>
+        inline void store(T v) volatile {
+            Atomic::Backend::Store<O>(&atomic_value, v);
         }
 
         inline T operator=(T v) volatile {
@@ -133,189 +253,29 @@ namespace Utils {
         }
 
         inline T operator--() volatile {
-            if constexpr (sizeof(T) == 1) {
-                return static_cast<T>(__blatomic_sub_fetch_1(
-                    reinterpret_cast<volatile uint8_t*>(&atomic_value),
-                    1,
-                    Order
-                ));
-            }
-            else if constexpr (sizeof(T) == 2) {
-                return static_cast<T>(__blatomic_sub_fetch_2(
-                    reinterpret_cast<volatile uint16_t*>(&atomic_value),
-                    1,
-                    Order
-                ));
-            }
-            else if constexpr (sizeof(T) == 4) {
-                return static_cast<T>(__blatomic_sub_fetch_4(
-                    reinterpret_cast<volatile uint32_t*>(&atomic_value),
-                    1,
-                    Order
-                ));
-            }
-            else if constexpr (sizeof(T) == 8) {
-                return static_cast<T>(__blatomic_sub_fetch_8(
-                    reinterpret_cast<volatile uint64_t*>(&atomic_value),
-                    1,
-                    Order
-                ));
-            }
+            return Atomic::Backend::SubFetch<Order>(&atomic_value, static_cast<T>(1));
         }
 
-        inline constexpr operator++() volatile {
-            if constexpr (sizeof(T) == 1) {
-                return static_cast<T>(__blatomic_add_fetch_1(
-                    reinterpret_cast<volatile uint8_t*>(&atomic_value),
-                    1,
-                    Order
-                ));
-            }
-            else if constexpr (sizeof(T) == 2) {
-                return static_cast<T>(__blatomic_add_fetch_2(
-                    reinterpret_cast<volatile uint16_t*>(&atomic_value),
-                    1,
-                    Order
-                ));
-            }
-            else if constexpr (sizeof(T) == 4) {
-                return static_cast<T>(__blatomic_add_fetch_4(
-                    reinterpret_cast<volatile uint32_t*>(&atomic_value),
-                    1,
-                    Order
-                ));
-            }
-            else if constexpr (sizeof(T) == 8) {
-                return static_cast<T>(__blatomic_add_fetch_8(
-                    reinterpret_cast<volatile uint64_t*>(&atomic_value),
-                    1,
-                    Order
-                ));
-            }
+        inline T operator++() volatile {
+            return Atomic::Backend::AddFetch<Order>(&atomic_value, static_cast<T>(1));
         }
 
-        inline constexpr operator+=(const T& addend) {
-            if constexpr (sizeof(T) == 1) {
-                return static_cast<T>(__blatomic_add_fetch_1(
-                    reinterpret_cast<volatile uint8_t*>(&atomic_value),
-                    addend,
-                    Order
-                ));
-            }
-            else if constexpr (sizeof(T) == 2) {
-                return static_cast<T>(__blatomic_add_fetch_2(
-                    reinterpret_cast<volatile uint16_t*>(&atomic_value),
-                    addend,
-                    Order
-                ));
-            }
-            else if constexpr (sizeof(T) == 4) {
-                return static_cast<T>(__blatomic_add_fetch_4(
-                    reinterpret_cast<volatile uint32_t*>(&atomic_value),
-                    addend,
-                    Order
-                ));
-            }
-            else if constexpr (sizeof(T) == 8) {
-                return static_cast<T>(__blatomic_add_fetch_8(
-                    reinterpret_cast<volatile uint64_t*>(&atomic_value),
-                    addend,
-                    Order
-                ));
-            }
+        inline T operator+=(const T& addend) volatile {
+            return Atomic::Backend::AddFetch<Order>(&atomic_value, addend);
         }
 
-        inline constexpr operator-=(const T& subtrahend) {
-            if constexpr (sizeof(T) == 1) {
-                return static_cast<T>(__blatomic_sub_fetch_1(
-                    reinterpret_cast<volatile uint8_t*>(&atomic_value),
-                    subtrahend,
-                    Order
-                ));
-            }
-            else if constexpr (sizeof(T) == 2) {
-                return static_cast<T>(__blatomic_sub_fetch_2(
-                    reinterpret_cast<volatile uint16_t*>(&atomic_value),
-                    subtrahend,
-                    Order
-                ));
-            }
-            else if constexpr (sizeof(T) == 4) {
-                return static_cast<T>(__blatomic_sub_fetch_4(
-                    reinterpret_cast<volatile uint32_t*>(&atomic_value),
-                    subtrahend,
-                    Order
-                ));
-            }
-            else if constexpr (sizeof(T) == 8) {
-                return static_cast<T>(__blatomic_sub_fetch_8(
-                    reinterpret_cast<volatile uint64_t*>(&atomic_value),
-                    subtrahend,
-                    Order
-                ));
-            }
+        inline T operator-=(const T& subtrahend) volatile {
+            return Atomic::Backend::SubFetch<Order>(&atomic_value, subtrahend);
         }
 
-        inline bool compare_exchange(T& expected, T desired, [[maybe_unused]] MemoryOrder order = Order) volatile {
-            if constexpr (sizeof(T) == 1) {
-                return __blatomic_compare_exchange_1(
-                    reinterpret_cast<volatile uint8_t*>(&atomic_value),
-                    reinterpret_cast<uint8_t*>(&expected),
-                    static_cast<uint8_t>(desired)
-                );
-            }
-            else if constexpr (sizeof(T) == 2) {
-                return __blatomic_compare_exchange_2(
-                    reinterpret_cast<volatile uint16_t*>(&atomic_value),
-                    reinterpret_cast<uint16_t*>(&expected),
-                    static_cast<uint16_t>(desired)
-                );
-            }
-            else if constexpr (sizeof(T) == 4) {
-                return __blatomic_compare_exchange_4(
-                    reinterpret_cast<volatile uint32_t*>(&atomic_value),
-                    reinterpret_cast<uint32_t*>(&expected),
-                    static_cast<uint32_t>(desired)
-                );
-            }
-            else if constexpr (sizeof(T) == 8) {
-                return __blatomic_compare_exchange_8(
-                    reinterpret_cast<volatile uint64_t*>(&atomic_value),
-                    reinterpret_cast<uint64_t*>(&expected),
-                    static_cast<uint64_t>(desired)
-                );
-            }
+        template<MemoryOrder O = Order>
+        inline bool compare_exchange(T& expected, T desired) volatile {
+            return Atomic::Backend::CompareExchange<O>(&atomic_value, expected, desired);
         }
 
-        inline T exchange(T v, MemoryOrder order = Order) volatile {
-            if constexpr (sizeof(T) == 1) {
-                return static_cast<T>(__blatomic_exchange_1(
-                    reinterpret_cast<volatile uint8_t*>(&atomic_value),
-                    static_cast<uint8_t>(v),
-                    order
-                ));
-            }
-            else if constexpr (sizeof(T) == 2) {
-                return static_cast<T>(__blatomic_exchange_2(
-                    reinterpret_cast<volatile uint16_t*>(&atomic_value),
-                    static_cast<uint16_t>(v),
-                    order
-                ));
-            }
-            else if constexpr (sizeof(T) == 4) {
-                return static_cast<T>(__blatomic_exchange_4(
-                    reinterpret_cast<volatile uint32_t*>(&atomic_value),
-                    static_cast<uint32_t>(v),
-                    order
-                ));
-            }
-            else if constexpr (sizeof(T) == 8) {
-                return static_cast<T>(__blatomic_exchange_8(
-                    reinterpret_cast<volatile uint64_t*>(&atomic_value),
-                    static_cast<uint64_t>(v),
-                    order
-                ));
-            }
+        template<MemoryOrder O = Order>
+        inline T exchange(T v) volatile {
+            return Atomic::Backend::Exchange<O>(&atomic_value, v);
         }
     };
 }
@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+
+#pragma once
+
+#include <cstdint>
+
+#include <shared/SimpleAtomic.hpp>
+
+namespace Utils {
+    // Fair spinlock for short sections, waiters get the lock in the order they asked for it
+    class TicketLock {
+    public:
+        inline bool trylock() noexcept {
+            uint32_t ticket = serving.load<MemoryOrder::RELAXED>();
+
+            // free only while every ticket handed out has been served
+            return next.compare_exchange<MemoryOrder::ACQUIRE>(ticket, ticket + 1);
+        }
+
+        inline void lock() noexcept {
+            const uint32_t ticket = ++next - 1;
+
+            while (serving.load<MemoryOrder::ACQUIRE>() != ticket) { __asm__ volatile("pause"); }
+        }
+
+        inline void unlock() noexcept {
+            serving.store<MemoryOrder::RELEASE>(serving.load<MemoryOrder::RELAXED>() + 1);
+        }
+
+    private:
+        SimpleAtomic<uint32_t> next{0};
+        SimpleAtomic<uint32_t> serving{0};
+    };
+}
@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+
+#pragma once
+
+#include <cstdint>
+
+#include <acpi/header.hpp>
+
+namespace ACPI {
+#pragma pack(push)
+#pragma pack(1)
+    struct SRAT {
+        Header hdr;
+        uint32_t Reserved1;
+        uint64_t Reserved2;
+
+        struct ProcessorAffinity {
+            static constexpr uint8_t _Type = 0x00;
+            uint8_t Type;
+            uint8_t Length;
+            uint8_t ProximityDomainLow;
+            uint8_t APIC_ID;
+            uint32_t Flags;
+            uint8_t LocalSAPIC_EID;
+            uint8_t ProximityDomainHigh[3];
+            uint32_t ClockDomain;
+        };
+
+        struct MemoryAffinity {
+            static constexpr uint8_t _Type = 0x01;
+            uint8_t Type;
+            uint8_t Length;
+            uint32_t ProximityDomain;
+            uint16_t Reserved1;
+            uint64_t BaseAddress;
+            uint64_t RangeLength;
+            uint32_t Reserved2;
+            uint32_t Flags;
+            uint64_t Reserved3;
+        };
+
+        struct X2APICAffinity {
+            static constexpr uint8_t _Type = 0x02;
+            uint8_t Type;
+            uint8_t Length;
+            uint16_t Reserved1;
+            uint32_t ProximityDomain;
+            uint32_t X2APIC_ID;
+            uint32_t Flags;
+            uint32_t ClockDomain;
+            uint32_t Reserved2;
+        };
+
+        static constexpr uint32_t AFFINITY_ENABLED = 0x1;
+    };
+
+    struct SLIT {
+        Header hdr;
+        uint64_t LocalityCount;
+        // followed by a LocalityCount x LocalityCount matrix of relative distances
+    };
+#pragma pack(pop)
+
+    static_assert(sizeof(SRAT::ProcessorAffinity) == 16);
+    static_assert(sizeof(SRAT::MemoryAffinity) == 40);
+    static_assert(sizeof(SRAT::X2APICAffinity) == 24);
+}
@@ -17,4 +17,5 @@
 #include <acpi/header.hpp>
 #include <acpi/madt.hpp>
 #include <acpi/rsdp.hpp>
+#include <acpi/srat.hpp>
 #include <acpi/xsdt.hpp>
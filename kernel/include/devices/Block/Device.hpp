@@ -115,6 +115,9 @@ namespace Devices {
 
             bool IsValid() const { return valid; }
 
+            inline uint64_t GetBlockSize() const { return interface->GetBlockSize(); }
+            inline uint64_t GetSize() const { return blocksCount * interface->GetBlockSize(); }
+
             virtual FS::Response<size_t> Read(size_t offset, size_t count, uint8_t* buffer) final;
             virtual FS::Response<size_t> Write(size_t offset, size_t count, const uint8_t* buffer) final;
 
@@ -25,6 +25,7 @@
 #include <devices/USB/Driver.hpp>
 #include <devices/USB/MassStorage/Driver.hpp>
 #include <devices/USB/xHCI/Device.hpp>
+#include <sched/WaitQueue.hpp>
 
 namespace Devices {
     namespace USB {
@@ -97,7 +98,7 @@ namespace Devices {
                     void* const phys_io_buffer;
                     const xHCI::TRB* volatile last_sent_trb = nullptr;
                     xHCI::TransferEventTRB last_transfer_result{};
-                    Utils::SimpleAtomic<bool> transfer_complete{false};
+                    Scheduling::Completion transfer_completion;
                     Utils::Lock driver_lock;
 
                     Driver(
@@ -18,17 +18,20 @@
 #include <cstdint>
 
 #include <shared/Lock.hpp>
+#include <shared/RWLock.hpp>
 #include <shared/Response.hpp>
 
 #include <devices/USB/xHCI/Device.hpp>
 #include <devices/USB/xHCI/TRB.hpp>
-#include <interrupts/InterruptProvider.hpp>
+#include <interrupts/Deferred.hpp>
 #include <pci/Interface.hpp>
+#include <pci/MSI.hpp>
+#include <sched/WaitQueue.hpp>
 
 namespace Devices {
     namespace USB {
         namespace xHCI {
-            class Controller : public Interrupts::InterruptProvider {
+            class Controller : public Interrupts::Deferred::ThreadedProvider {
                 private:
                 struct CapabilityRegisters {
                     uint8_t     CAPLENGTH;
@@ -144,10 +147,12 @@ namespace Devices {
 
                 DCBAA* dcbaa = nullptr;
                 Device** devices = nullptr;
+                Utils::RWLock devices_lock;
 
                 Utils::Lock command_lock;
                 TRB* command_ring = nullptr;
                 CommandCompletionEventTRB command_completion;
+                Scheduling::WaitQueue command_waiters;
                 size_t command_index = 0;
                 bool command_cycle = true;
                 size_t command_capacity = 0;
@@ -162,16 +167,20 @@ namespace Devices {
                 uint16_t max_scratchpad_buffers = 0;
 
                 Port* ports = nullptr;
-                mutable bool port_update = false;
+                mutable volatile bool port_update = false;
+                Scheduling::WaitQueue port_waiters;
                 uint64_t port_updater_task_id = 0;
 
                 int interrupt_vector = -1;
+                PCI::MSIXTable msix_table;
 
                 mutable size_t context_size = 0;
 
                 Controller(const PCI::Interface& interface);
 
-                virtual void HandleIRQ(void* stack, uint64_t error_code) final;
+                // acknowledges the interrupt, the event ring is drained by the bottom half
+                bool HandleTopHalf(void* stack, uint64_t error_code) final;
+                void HandleBottomHalf() final;
 
                 void ReleaseResources();
 
@@ -180,6 +189,10 @@ namespace Devices {
 
                 void ConfigureMaxSlotsEnabled();
 
+                // route the primary interrupter to the processor, MSI-X is preferred over MSI
+                bool ConfigureMSIX(uint8_t apic_id);
+                bool ConfigureMSI(uint8_t apic_id) const;
+
                 void ConfigurePrimaryInterrupter() const;
                 RuntimeRegisters::IRS* GetPrimaryInterrupter() const;
                 void EnablePrimaryInterrupter() const;
@@ -219,6 +232,8 @@ namespace Devices {
 
                 int16_t EnableSlot(uint8_t slot_type);
                 void DisableSlot(uint8_t id);
+                void PublishDevice(uint8_t slot, Device* device);
+                Device* UnpublishDevice(uint8_t slot);
 
                 ExtendedCapability* FindExtendedCapability(uint8_t id) const;
                 ExtendedCapability* FindNextExtendedCapability(uint8_t id, ExtendedCapability* ptr) const;
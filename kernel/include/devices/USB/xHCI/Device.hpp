@@ -21,6 +21,7 @@
 #include <shared/SimpleAtomic.hpp>
 
 #include <devices/USB/xHCI/Specification.hpp>
+#include <sched/WaitQueue.hpp>
 
 namespace Devices {
     namespace USB {
@@ -223,7 +224,7 @@ namespace Devices {
                 TransferRing* control_transfer_ring = nullptr;
 
                 Utils::Lock transfer_lock;
-                Utils::SimpleAtomic<bool> transfer_complete{false};
+                Scheduling::Completion transfer_completion;
                 const TRB* volatile awaiting_transfer = nullptr;
                 TransferEventTRB transfer_result;
 
@@ -16,7 +16,7 @@
 
 #include <cstddef>
 
-#include <shared/Lock.hpp>
+#include <shared/RWLock.hpp>
 #include <shared/Response.hpp>
 
 #include <fs/IFNode.hpp>
@@ -46,7 +46,7 @@ protected:
         FS::Status                      CreateEntry(const DirectoryEntry* entry);
 
         void* container;
-        Utils::Lock mut;
+        Utils::RWLock mut;
     };
 
     class File final : public FS::File {
@@ -63,7 +63,7 @@ protected:
     
     private:
         void* container;
-        Utils::Lock mut;
+        Utils::RWLock mut;
     };
 
     Directory root;
@@ -86,6 +86,13 @@ namespace APIC {
 	uint8_t GetLAPICID();
 	void SendEOI();
 
+	// INIT-SIPI-SIPI sequence, page is the physical page (below 1MB) the processor starts from
+	void SendInitIPI(uint8_t apicID);
+	void SendStartupIPI(uint8_t apicID, uint8_t page);
+	void SendFixedIPI(uint8_t apicID, uint8_t vector);
+	// delivered even while the target has interrupts disabled
+	void SendNMI(uint8_t apicID);
+
 	void MaskIRQ(uint32_t irq);
 	void UnmaskIRQ(uint32_t irq);
 	void SetupIRQ(uint32_t irq, IRQDescriptor descriptor);
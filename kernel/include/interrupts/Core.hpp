@@ -18,6 +18,8 @@
 
 namespace Interrupts {
 	namespace Core {
+		extern InterruptTrampoline non_maskable_trampoline;
+		extern InterruptTrampoline device_not_available_trampoline;
 		extern InterruptTrampoline page_fault_trampoline;
 	}
 }
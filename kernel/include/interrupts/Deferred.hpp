@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+
+#pragma once
+
+#include <cstdint>
+
+#include <shared/Response.hpp>
+#include <shared/SimpleAtomic.hpp>
+
+#include <interrupts/InterruptProvider.hpp>
+
+// Bottom halves of interrupt handlers. The top half acknowledges the device and queues its
+// work on the processor it runs on, then a realtime kernel thread of that processor runs the
+// work with interrupts enabled, so that the time spent with them masked stays short.
+namespace Interrupts::Deferred {
+    class Work {
+    public:
+        Work(void (*handler)(void*), void* args);
+
+        // from any context, false when the work was already pending. Work scheduled while it
+        // runs runs once more afterwards, and never on two processors at the same time.
+        bool Schedule();
+
+    private:
+        static constexpr uint8_t STATE_PENDING = 0x01;
+        static constexpr uint8_t STATE_RUNNING = 0x02;
+
+        void (*const handler)(void*);
+        void* const args;
+        Utils::SimpleAtomic<uint8_t> state{0};
+        Work* next = nullptr;
+        uint64_t scheduled_at = 0;      // TSC
+
+        void Run();
+
+        friend class ProcessorQueue;
+    };
+
+    // per processor, pushed to by top halves and emptied by the bottom half thread
+    class ProcessorQueue {
+    public:
+        void Push(Work& work);
+        bool HasWork() const;
+        // runs the work in the order it was scheduled, until none is left
+        void RunPending();
+        void WaitForWork();
+
+    private:
+        Utils::SimpleAtomic<uint64_t> pending{0};   // Work*, last scheduled first
+        // the bottom half thread, unblocked by id since top halves run in whatever address
+        // space they interrupted, 0 until it first waits
+        Utils::SimpleAtomic<uint64_t> thread_id{0};
+    };
+
+    struct Statistics {
+        uint64_t topHalves;
+        uint64_t topHalfCycles;
+        uint64_t maxTopHalfCycles;
+        uint64_t bottomHalves;
+        uint64_t bottomHalfCycles;
+        uint64_t latencyCycles;         // from Schedule to the start of the bottom half
+        uint64_t maxLatencyCycles;
+    };
+
+    // starts the bottom half thread of the current processor
+    Success InitializeProcessor();
+    void QueryStatistics(Statistics& stats);
+
+    // Provider split in two halves. The top half runs in the interrupt, acknowledges the
+    // device, and returns whether the bottom half has work to do.
+    class ThreadedProvider : public InterruptProvider {
+    public:
+        ThreadedProvider();
+
+        void HandleIRQ(void* stack, uint64_t error_code) final;
+
+    protected:
+        virtual bool HandleTopHalf(void* stack, uint64_t error_code) = 0;
+        virtual void HandleBottomHalf() = 0;
+
+    private:
+        Work bottom_half;
+    };
+}
@@ -21,6 +21,8 @@
 
 namespace Interrupts {
 	void kernel_idt_setup(void);
+	// loads the IDT built by kernel_idt_setup on the current processor
+	void LoadIDT();
 	void ForceIRQHandler(unsigned int interruptVector, void* handler);
 	void ReleaseIRQ(unsigned int interruptVector);
 	void RegisterIRQ(unsigned int interruptVector, InterruptProvider* provider);
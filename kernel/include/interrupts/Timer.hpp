@@ -31,4 +31,9 @@ public:
     virtual void SetHandler(void (*handler)()) = 0;
     virtual uint64_t GetCountMicros() const = 0;
     virtual uint64_t GetCountMillis() const = 0;
+
+    // A tickless timer only fires at the deadline set last, given in GetCountMicros() time,
+    // 0 disarms it. Periodic timers ignore deadlines.
+    virtual bool IsTickless() const = 0;
+    virtual void SetDeadline(uint64_t micros) = 0;
 };
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <shared/Response.hpp>
+
+namespace CopyOnWrite {
+	// Set on a paging entry, at any level, whose table or page may be shared with another address
+	// space. The entry is read-only until a write fault gives the address space its own copy.
+	inline constexpr uint64_t ENTRY_COW = 0x0000000000000400;
+
+	struct Statistics {
+		uint64_t sharedFrames;
+		uint64_t copies;
+		uint64_t reuses;
+	};
+
+	// kernel writes must fault on read-only pages as well, called once per processor
+	void InitializeProcessor();
+
+	// References held by paging entries on frames and page tables, kept in the frame descriptors
+	// but taken under the sharing lock. Release returns true when the last reference is gone.
+	Success Share(uint64_t frame);
+	bool Release(uint64_t frame);
+	bool IsShared(uint64_t frame);
+
+	// Shares the mappings of size bytes at start from the current address space into the one
+	// behind the secondary recursive mapping, at the highest level the range covers. Both sides
+	// become read-only, so the cost does not depend on how much memory is mapped.
+	Success ShareRange(uint64_t start, uint64_t size);
+
+	// called on write faults on present pages, fails if the page is not copy-on-write
+	Success Resolve(const void* address);
+
+	void QueryStatistics(Statistics& stats);
+}
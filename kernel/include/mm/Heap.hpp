@@ -15,9 +15,31 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 
 namespace Heap {
+	// power-of-two classes from 16 to 2048 bytes, anything larger goes to the AVL heap
+	inline constexpr size_t SIZE_CLASSES = 8;
+
+	// allocations and frees count the Allocate and Free calls served by the class, refills
+	// the allocations that found the magazine of their processor empty
+	struct SizeClassStatistics {
+		size_t objectSize;
+		uint64_t allocations;
+		uint64_t frees;
+		uint64_t refills;
+		uint64_t pages;
+	};
+
+	struct Statistics {
+		SizeClassStatistics classes[SIZE_CLASSES];
+		uint64_t largeAllocations;
+		uint64_t largeFrees;
+	};
+
 	bool Create(); 
 	void* Allocate(size_t size);
 	void Free(void* ptr);
+
+	void QueryStatistics(Statistics& stats);
 }
@@ -19,7 +19,14 @@
 #include <shared/Response.hpp>
 
 namespace IOHeap {
+    // UNCACHEABLE suits memory shared with a device at a fine grain (rings, contexts),
+    // WRITE_BACK suits buffers the CPU parses or fills in bulk (descriptors, reports)
+    enum class Caching {
+        UNCACHEABLE,
+        WRITE_BACK
+    };
+
     Success Create(); 
-    void* Allocate(size_t size, size_t alignment = 8);
+    void* Allocate(size_t size, size_t alignment = 8, Caching caching = Caching::UNCACHEABLE);
     void Free(void* ptr);
 }
@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+
+#pragma once
+
+#include <cstddef>
+
+#include <mm/Heap.hpp>
+
+namespace Magazine {
+	// A magazine is a small LIFO of free objects owned by a single processor. It is only
+	// touched with interrupts disabled on its owner, so it needs no lock; the global
+	// allocators are visited once per BATCH objects to refill or drain it.
+	template<size_t ROUNDS>
+	struct Magazine {
+		static constexpr size_t CAPACITY = ROUNDS;
+		static constexpr size_t BATCH = ROUNDS / 2;
+
+		void* rounds[ROUNDS];
+		size_t count = 0;
+
+		bool IsEmpty() const {
+			return count == 0;
+		}
+
+		bool IsFull() const {
+			return count == ROUNDS;
+		}
+
+		void Push(void* object) {
+			rounds[count++] = object;
+		}
+
+		void* Pop() {
+			return rounds[--count];
+		}
+	};
+
+	using ObjectMagazine = Magazine<32>;
+	using FrameMagazine = Magazine<64>;
+	// frames cleared ahead of time by the idle task, handed out for page tables and faults
+	using ZeroedMagazine = Magazine<256>;
+
+	struct ProcessorCache {
+		ObjectMagazine objects[Heap::SIZE_CLASSES];
+		FrameMagazine frames;
+		ZeroedMagazine zeroed;
+
+		// Heap::Allocate and Heap::Free calls served through the object magazines
+		uint64_t allocations[Heap::SIZE_CLASSES] = {};
+		uint64_t frees[Heap::SIZE_CLASSES] = {};
+		uint64_t refills[Heap::SIZE_CLASSES] = {};
+	};
+}
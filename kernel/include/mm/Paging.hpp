@@ -14,6 +14,8 @@
 
 #pragma once
 
+#include <cstddef>
+
 #include <shared/Response.hpp>
 #include <shared/memory/defs.hpp>
 
@@ -108,6 +110,43 @@ namespace Paging {
 
     void InvalidatePage(const void* virtual_address);
     void InvalidateTLB();
+    // flushes every TLB entry of every PCID, global ones included
+    void InvalidateAllContexts();
+    // once the NMI handler is in place, mapping changes reach the other online processors
+    void EnableShootdown();
+    // InvalidateAllContexts on every online processor, returns once they all did it
+    void InvalidateAllProcessors();
+    // runs the invalidation another processor asked for with an NMI, false if it asked nothing
+    bool HandleShootdown();
+
+    // Gathers the invalidations of a batch of mapping changes. Commit issues one invlpg per
+    // recorded page, or a single flush of the whole TLB past FLUSH_THRESHOLD pages, which also
+    // drops global entries when a kernel page is involved. Every other online processor does
+    // the same before Commit returns. Frames that were unmapped can be handed over, they are
+    // only freed once no TLB can reach them anymore.
+    class MappingTransaction {
+    public:
+        static constexpr size_t FLUSH_THRESHOLD = 32;
+
+        MappingTransaction() = default;
+        ~MappingTransaction() { Commit(); }
+
+        MappingTransaction(const MappingTransaction&) = delete;
+        MappingTransaction& operator=(const MappingTransaction&) = delete;
+
+        void Invalidate(const void* virtual_address);
+        // frees the frame after the pages recorded so far are invalidated
+        void Release(void* frame);
+        void Commit();
+
+    private:
+        const void* pages[FLUSH_THRESHOLD];
+        void* frames[FLUSH_THRESHOLD];
+        size_t pageCount = 0;
+        size_t frameCount = 0;
+        bool flushAll = false;
+        bool global = false;
+    };
 
     bool IsMapped(const void* virtual_address, bool usePrimary = true);
 
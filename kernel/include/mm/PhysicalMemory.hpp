@@ -18,6 +18,7 @@
 #include <cstdint>
 
 #include <shared/Response.hpp>
+#include <shared/SimpleAtomic.hpp>
 
 namespace PhysicalMemory {
 	uint64_t FilterAddress(uint64_t address);
@@ -31,19 +32,63 @@ namespace PhysicalMemory {
 		ALLOCATED
 	};
 
+	enum class Fill {
+		ANY,	// the frame keeps whatever it contained
+		ZERO	// the frame is cleared, taken from the pre-zeroed pool when possible
+	};
+
+	// Metadata kept for every frame below the highest usable address, four descriptors to a
+	// cache line. The fields besides the counts belong to whoever owns the frame.
+	struct FrameDescriptor {
+		// references beyond the owner's one, so that fresh frames need no initialization
+		Utils::SimpleAtomic<uint32_t> references;
+		// a pinned frame keeps its physical address, device memory accesses may target it
+		Utils::SimpleAtomic<uint16_t> pins;
+		Utils::SimpleAtomic<uint8_t> flags;
+		uint8_t age;
+		// intrusive list link, as frame numbers (0 ends the list)
+		uint32_t next;
+		uint32_t prev;
+	};
+
+	static_assert(sizeof(FrameDescriptor) == 16);
+
 	Success Setup();
+	// splits memory into NUMA nodes from the ACPI SRAT/SLIT, needs ACPI to be initialized
+	Success SetupNodes();
+
+	size_t QueryNodeCount();
 
 	uint64_t QueryMemoryUsage();
 	StatusCode QueryDMAAddress(uint64_t address);
 
 	void* AllocateDMA(uint64_t pages);
-	void* Allocate();
+	void* Allocate(Fill fill = Fill::ANY);
+	size_t AllocateBatch(void** frames, size_t count, Fill fill = Fill::ANY);
 	void* Allocate2MB();
 	void* Allocate32MB();
 
 	Success FreeDMA(void* ptr, uint64_t pages);
 	Success Free(void* ptr);
+	Success FreeBatch(void* const* frames, size_t count);
 	Success Free2MB(void* ptr);
 	Success Free32MB(void* ptr);
 	Success Free1GB(void* ptr);
+
+	// nullptr for an address past the last usable frame
+	FrameDescriptor* GetDescriptor(uint64_t address);
+
+	// Get takes one more reference on a frame, Put drops one and returns true when the caller
+	// held the last one, the frame is then the caller's to free.
+	Success Get(uint64_t address);
+	bool Put(uint64_t address);
+	bool IsShared(uint64_t address);
+
+	Success Pin(uint64_t address);
+	void Unpin(uint64_t address);
+	bool IsPinned(uint64_t address);
+
+	// clears one frame ahead of time for the local pre-zeroed pool,
+	// returns false once the pool is full or memory runs out
+	bool PrepareZeroedFrame();
 }
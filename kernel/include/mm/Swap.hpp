@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <shared/Response.hpp>
+
+#include <sched/WaitQueue.hpp>
+
+namespace Devices::Block {
+	class Partition;
+}
+
+namespace Swap {
+	// Most pages written to the device by a single request
+	inline constexpr size_t BATCH_PAGES = 16;
+
+	struct Statistics {
+		uint64_t slots;
+		uint64_t usedSlots;
+		uint64_t pagesOut;
+		uint64_t pagesIn;
+	};
+
+	// attaches the partition as the swap area if its type is Linux swap and no area is attached yet
+	Success Probe(Devices::Block::Partition* partition);
+	bool IsAvailable();
+
+	// Slots are page sized and slot 0 is never handed out, which keeps the header of the area
+	// and ensures a swapped out entry is never 0. Returns the first slot of a run of free slots
+	// no longer than count, and sets count to its length (0 when the area is full).
+	uint64_t AllocateSlots(size_t& count);
+	// a slot shared by several address spaces is only freed along with its last reference
+	void ShareSlot(uint64_t slot);
+	void FreeSlot(uint64_t slot);
+
+	// Serializes the I/O below. An eviction holds it from the moment its pages are unmapped
+	// until they reach the device, so that a fault on one of them waits for the write. The
+	// transfers block, so the waiters sleep rather than spin.
+	Scheduling::Mutex& GetIOLock();
+
+	// the I/O lock must be held, and the device driver needs interrupts enabled
+	Success WriteFrames(uint64_t slot, void* const* frames, size_t count);
+	Success ReadFrame(uint64_t slot, void* frame);
+
+	void QueryStatistics(Statistics& stats);
+}
@@ -20,4 +20,6 @@ namespace Utils {
     int memcmp(const void* lhs, const void* rhs, size_t count);
     void* memcpy(void* dest, const void* src, size_t count);
     void* memset(void* dest, int ch, size_t count);
+    // zeroes memory with non-temporal stores, so the cleared lines do not evict the cache
+    void* memzero_nt(void* dest, size_t count);
 }
@@ -14,6 +14,9 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 #include <shared/Response.hpp>
 #include <shared/memory/defs.hpp>
 
@@ -41,22 +44,92 @@ namespace VirtualMemory {
 	// Set if the page is reserved for on-demand mapping
 	inline constexpr uint64_t NP_ON_DEMAND	= 0x0000000000000800;
 	// Index of the page in the swap file, this field is ignored if NP_ON_DEMAND is set
-	inline constexpr uint64_t NP_INDEX		= 0xFFFFFFFFFFFFE000;
+	inline constexpr uint64_t NP_INDEX		= 0xFFFFFFFFFFFFF000;
+	inline constexpr uint64_t NP_INDEX_SHIFT	= 12;
+
+	// How many pages a single fault populates in a fault-around region, the window is
+	// aligned on its size so that it never leaves the faulting page table
+	inline constexpr size_t FAULT_AROUND_PAGES = 16;
+
+	enum class FaultPolicy {
+		NONE,			// each page is populated by its own fault
+		FAULT_AROUND,	// a fault populates the on-demand pages around it as well
+		POPULATE		// pages are populated when the region is mapped
+	};
+
+	enum class Caching {
+		WRITE_BACK,
+		WRITE_THROUGH,
+		UNCACHEABLE
+	};
+
+	// Attributes shared by every page of a region, adjacent allocations with equal
+	// attributes are merged into a single region
+	struct RegionAttributes {
+		FaultPolicy policy;
+		Caching caching;
+		bool huge;			// parts of the region may be mapped with 2MB pages
+		uint32_t owner;		// tag left by whoever allocated the region, 0 if none
+
+		bool operator==(const RegionAttributes& other) const = default;
+	};
+
+	struct Region {
+		uint64_t start;
+		uint64_t pages;
+		RegionAttributes attributes;
+	};
+
+	struct FaultStatistics {
+		uint64_t faults;
+		uint64_t faultPopulatedPages;
+		uint64_t mapPopulatedPages;
+	};
+
+	// How often the promotion task looks for fully populated page tables in the kernel heap
+	inline constexpr uint64_t PROMOTION_INTERVAL_MS = 1000;
 
 	Success Setup();
 	void* DeriveNewFreshCR3();
+	// a new address space sharing the user memory of the current one, copied on write
+	void* CloneCR3();
 
 	void* AllocateDMA(uint64_t pages);
-	void* AllocateKernelHeap(uint64_t pages);
-	void* AllocateUserPages(uint64_t pages);
-	void* AllocateUserPagesAt(uint64_t pages, void* ptr);
+	void* AllocateKernelHeap(uint64_t pages, FaultPolicy policy = FaultPolicy::FAULT_AROUND);
+	void* ReserveKernelHeap(uint64_t pages);
+	void* AllocateUserPages(uint64_t pages, FaultPolicy policy = FaultPolicy::FAULT_AROUND);
+	void* AllocateUserPagesAt(uint64_t pages, void* ptr, FaultPolicy policy = FaultPolicy::FAULT_AROUND);
 
 	Success FreeDMA(void* ptr, uint64_t pages);
 	Success FreeKernelHeap(void* ptr, uint64_t pages);
 	Success FreeUserPages(void* ptr, uint64_t pages);
 
+	// maps a frame on the scratch page of the current processor, the page stays valid
+	// until the next call on the same processor so interrupts must be disabled while it is used
+	void* MapScratchFrame(void* frame);
+
+	// populates the on-demand page holding address, called by the page fault handler
+	Success PopulateOnDemand(const void* address);
+	Success SetFaultPolicy(void* ptr, uint64_t pages, FaultPolicy policy);
+	Success SetRegionOwner(void* ptr, uint64_t pages, uint32_t owner);
+	// finds the kernel heap or user region (of the current address space) holding address
+	Success QueryRegion(const void* address, Region& region);
+	void QueryFaultStatistics(FaultStatistics& stats);
+
+	// Swaps out up to Swap::BATCH_PAGES cold user pages of the current address space, and
+	// returns how many frames went back to the allocator. Needs interrupts enabled.
+	size_t ReclaimPages(size_t count);
+	// reads back a swapped out page, called by the page fault handler with interrupts enabled
+	Success SwapIn(const void* address);
+
 	Success ChangeMappingFlags(void* _ptr, uint64_t flags, uint64_t pages = 1);
 
 	void* MapGeneralPages(void* pageAddress, size_t pages, uint64_t flags = 0);
 	Success UnmapGeneralPages(void* vpage, size_t pages);
+
+	size_t PromoteHugePages();
+	// called by the page fault handler on a write to a read-only page, waits for a promotion
+	// of the range to end and is true when the write can be retried
+	bool AwaitPromotion(const void* address);
+	void PromotionTask();
 }
@@ -37,10 +37,16 @@ namespace VirtualMemoryLayout {
         .limit = 0x100000000
     };
 
-    inline constexpr MemoryZone GeneralMapping = {
+    // one page per processor, used to touch physical frames that are not mapped anywhere
+    inline constexpr MemoryZone ScratchMapping = {
         .start = PhysicalMemoryMap.end(),
+        .limit = Shared::Memory::PDE_COVERAGE
+    };
+
+    inline constexpr MemoryZone GeneralMapping = {
+        .start = ScratchMapping.end(),
         .limit = Shared::Memory::PML4E_COVERAGE
-            - (PhysicalMemoryMap.end() - Shared::Memory::Layout::KernelImage.start)
+            - (ScratchMapping.end() - Shared::Memory::Layout::KernelImage.start)
     };
 
     inline constexpr MemoryZone KernelHeapManagement = {
@@ -14,8 +14,14 @@
 
 #pragma once
 
+#include <cstddef>
+
 #define LEGACY_EXPORT extern "C"
 
 namespace VirtualMemory {
+    // room needed by kernel_gdt_setup_processor for a copy of the GDT, its TSS and pointer
+    inline constexpr size_t PROCESSOR_GDT_SIZE = 0x100;
+
     LEGACY_EXPORT void kernel_gdt_setup(void);
+    LEGACY_EXPORT void kernel_gdt_setup_processor(void* block);
 }
@@ -46,14 +46,14 @@ namespace PCI {
             static constexpr uint16_t BusMaster = 0x0004;
         };
 
+    protected:
         static constexpr uint32_t BAR_IO_FLAG       = 0x00000001;
         static constexpr uint32_t BAR_SIZE_MASK     = 0x00000006;
         static constexpr uint32_t BAR_32_FLAG       = 0x00000000;
         static constexpr uint32_t BAR_64_FLAG       = 0x00000004;
         static constexpr uint64_t BAR_MEM_ADDR_MASK = 0xFFFFFFFFFFFFFFF0;
         static constexpr uint64_t BAR_IO_ADDR_MASK  = 0xFFFFFFFFFFFFFFFC;
-    
-    protected:
+
         const uint8_t bus;
         const uint8_t device;
         const uint8_t function;
@@ -94,6 +94,7 @@ namespace PCI {
         
         void EnableMMIO() const;
         void DisableMMIO() const;
+        bool IsMMIOEnabled() const;
         
         void EnableBusMaster() const;
         void DisableBusMaster() const;
@@ -128,6 +129,8 @@ namespace PCI {
 
         uint32_t ReadBAR(uint8_t id) const;
         void WriteBAR(uint8_t id, uint32_t value) const;
+        // whether BAR id holds the lower half of a 64 bit memory BAR
+        bool IsMemoryXBAR(uint8_t id) const;
 
         uint64_t ReadXBAR(uint8_t id) const;
         void WriteXBAR(uint8_t id, uint64_t value) const;
@@ -16,6 +16,8 @@
 
 #include <cstdint>
 
+#include <shared/Response.hpp>
+
 #include <pci/Interface.hpp>
 
 namespace PCI {
@@ -72,4 +74,83 @@ namespace PCI {
     };
 
     MSI* GetMSI(const Interface& interface);
+
+    class MSIX : public Capability {
+    public:
+        static constexpr uint16_t TABLE_SIZE    = 0x07FF;
+        static constexpr uint16_t FUNCTION_MASK = 0x4000;
+        static constexpr uint16_t ENABLE        = 0x8000;
+
+        static constexpr uint32_t BIR_MASK      = 0x00000007;
+        static constexpr uint32_t OFFSET_MASK   = 0xFFFFFFF8;
+
+        mutable uint16_t MessageControl;
+        uint32_t Table;
+        uint32_t PBA;
+
+        uint16_t GetTableSize() const;
+    };
+
+    MSIX* GetMSIX(const Interface& interface);
+
+    struct MSIMessage {
+        uint64_t address;
+        uint32_t data;
+    };
+
+    // edge triggered, fixed delivery of vector to the LAPIC with the given physical id
+    MSIMessage ComposeMessage(uint8_t vector, uint8_t apic_id);
+
+    // hands out online processors in turn, so that devices do not all interrupt the BSP
+    uint8_t SelectInterruptTarget();
+
+    class MSIXTable {
+    private:
+        struct Entry {
+            uint32_t MessageAddress;
+            uint32_t MessageUpperAddress;
+            uint32_t MessageData;
+            uint32_t VectorControl;
+        };
+
+        static constexpr uint32_t ENTRY_MASKED        = 0x00000001;
+        static constexpr uint32_t MESSAGE_DATA_VECTOR = 0x000000FF;
+
+        const MSIX* capability = nullptr;
+        const IType0* interface = nullptr;
+
+        void* table_mapping = nullptr;
+        void* pba_mapping = nullptr;
+        volatile Entry* table = nullptr;
+        volatile uint64_t* pba = nullptr;
+
+        uint16_t size = 0;
+
+        static void* MapBIR(const IType0& interface, uint8_t bir);
+        static void UnmapBIR(const IType0& interface, uint8_t bir, void* ptr);
+
+    public:
+        // maps the table and the pending bit array, every entry starts masked
+        // the interface must outlive the mapping
+        Success Map(const IType0& interface);
+        void Unmap();
+        bool IsMapped() const;
+
+        uint16_t GetSize() const;
+
+        // reserves a vector and routes the entry to it, the entry is left masked
+        int AllocateVector(uint16_t entry, uint8_t apic_id);
+        void ReleaseVector(uint16_t entry);
+
+        Success Route(uint16_t entry, uint8_t vector, uint8_t apic_id) const;
+        // retargets an allocated entry at another processor
+        Success SetAffinity(uint16_t entry, uint8_t apic_id) const;
+
+        void Mask(uint16_t entry) const;
+        void Unmask(uint16_t entry) const;
+        bool IsPending(uint16_t entry) const;
+
+        void Enable() const;
+        void Disable() const;
+    };
 }
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+
+#pragma once
+
+#include <cstdint>
+
+#include <sched/TaskContext.hpp>
+
+class UnattachedSelf;
+
+namespace Scheduling::ContextID {
+    // PCID 0 stays with the boot address space, tasks are tagged with 1 to 4095
+    inline constexpr uint64_t PCID_COUNT = 4096;
+
+    struct Statistics {
+        uint64_t switches;
+        uint64_t flushingSwitches;
+        uint64_t generations;
+    };
+
+    // enables global pages, and PCIDs when the processor has them
+    void InitializeProcessor();
+
+    // returns the CR3 value that switches to the task, tagging it with a PCID first if needed
+    uint64_t PrepareSwitch(TaskContext& task, UnattachedSelf& self);
+
+    void QueryStatistics(Statistics& stats);
+}
@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+
+#pragma once
+
+#include <cstdint>
+
+#include <shared/Response.hpp>
+
+#include <interrupts/InterruptGuard.hpp>
+
+#include <sched/TaskContext.hpp>
+
+class UnattachedSelf;
+
+namespace Scheduling::ExtendedState {
+    // Per-processor view of the x87/SSE/AVX registers. A task gets its save area the first
+    // time it uses them, then CR0.TS is set whenever the registers hold another state, so
+    // tasks that never touch them pay nothing on switches.
+    struct ProcessorState {
+        TaskContext* current = nullptr;     // task running on the processor
+        TaskContext* owner = nullptr;       // task whose state the registers hold
+        bool trapping = true;               // CR0.TS is set
+        uint32_t kernel_depth = 0;          // nested SIMDGuard count
+    };
+
+    struct Statistics {
+        uint64_t switches;
+        uint64_t saves;
+        uint64_t restores;
+        uint64_t switchCycles;
+        uint64_t saveCycles;
+        uint64_t restoreCycles;
+    };
+
+    // enables FXSR/XSAVE with every user state component the processor has, and sets CR0.TS
+    void InitializeProcessor();
+
+    // saves the state of the running task if it used the registers, and traps the next
+    // use of them unless they still hold the state of the task switched to
+    void PrepareSwitch(TaskContext& task, UnattachedSelf& self);
+
+    // called on #NM, loads the state of the running task
+    Success LoadCurrent();
+
+    void Release(TaskContext& task);
+    void QueryStatistics(Statistics& stats);
+
+    // Lets kernel code use SIMD registers, interrupts stay disabled until the guard is
+    // destroyed. The code itself must be built for the instructions it uses, since the
+    // kernel is compiled for general purpose registers only.
+    class SIMDGuard {
+    private:
+        Interrupts::InterruptGuard irqGuard{};
+
+    public:
+        SIMDGuard();
+        ~SIMDGuard();
+
+        SIMDGuard(const SIMDGuard&) = delete;
+        SIMDGuard& operator=(const SIMDGuard&) = delete;
+    };
+}
@@ -17,8 +17,12 @@
 #include <cstddef>
 #include <cstdint>
 
+#include <interrupts/Deferred.hpp>
 #include <interrupts/Timer.hpp>
 
+#include <mm/Magazine.hpp>
+
+#include <sched/ExtendedState.hpp>
 #include <sched/TaskContext.hpp>
 #include <sched/TaskManager.hpp>
 
@@ -37,10 +41,19 @@ private:
 
         static constexpr uint8_t MILLIS_INTERVAL = 1;
 
+        // TSC value every processor counts time from, the TSC runs at the same rate on all
+        // of them when it is invariant
+        static inline uint64_t tsc_origin = 0;
+
         uint8_t vector = 0;
         bool enabled{false};
+        // one-shot or TSC deadline mode, time is read from the TSC instead of counting IRQs
+        bool tickless{false};
+        bool tsc_deadline{false};
         void (*handler)() = nullptr;
         uint64_t millis_counter = 0;
+        uint64_t ticks_per_ms = 0;
+        uint64_t tsc_per_us = 0;
         TimerProvider provider{this};
 
         void InternalHandler();
@@ -57,20 +70,36 @@ private:
         void SetHandler(void (*handler)()) final;
         uint64_t GetCountMicros() const final;
         uint64_t GetCountMillis() const final;
+        bool IsTickless() const final;
+        void SetDeadline(uint64_t micros) final;
+
+        uint8_t GetVector() const;
     };
 
     static inline UnattachedSelf* processors = nullptr;
     static inline size_t processor_count = 0;
     static inline size_t allocated_processors = 0;
 
+    // GS base of a processor that has not been bound yet, so that %gs:0 reads as nullptr
+    static inline UnattachedSelf* const unbound_reference = nullptr;
+
+    // GS base of a bound processor points here
+    UnattachedSelf* const self_reference{this};
+
     bool enabled{false};
     bool online_capable{false};
+    // set once the processor runs its own scheduler
+    volatile bool online{false};
 
     uint8_t apic_id{0xFF};
     uint8_t apic_uid{0xFF};
 
     APICTimerWrapper local_timer;
     Scheduling::TaskManager task_manager;
+    Magazine::ProcessorCache memory_cache;
+    uint64_t context_id_generation{0};
+    Scheduling::ExtendedState::ProcessorState extended_state;
+    Interrupts::Deferred::ProcessorQueue deferred_queue;
 
 public:
     UnattachedSelf(uint8_t apic_id, uint8_t apic_uid, bool enabled, bool online_capable);
@@ -78,10 +107,17 @@ public:
     static UnattachedSelf* AllocateProcessors(size_t count);
     static UnattachedSelf& AllocateRemote();
     static UnattachedSelf& AccessRemote(uint8_t id);
+    static UnattachedSelf& AccessProcessor(size_t index);
+    static size_t GetProcessorCount();
     static UnattachedSelf& Attach();
+    static UnattachedSelf* TryAttach();
+    static void PrepareBinding();
+    void Bind();
 
     bool IsEnabled() const;
     bool IsOnlineCapable() const;
+    bool IsOnline() const;
+    void SetOnline();
     uint8_t GetID() const;
     void Reset();
     void ForceHaltRemote();
@@ -91,11 +127,17 @@ public:
     bool SpinWaitMillsFor(uint64_t ms, bool (*predicate)(void*), void* args) const;
 
     void Yield();
+    // makes a tickless processor reschedule, from any processor
+    void Kick();
 
     static Timer& GetPIT();
     Timer& GetTimer();
 
     Scheduling::TaskManager& GetTaskManager();
+    Magazine::ProcessorCache& GetMemoryCache();
+    uint64_t& GetContextIDGeneration();
+    Scheduling::ExtendedState::ProcessorState& GetExtendedState();
+    Interrupts::Deferred::ProcessorQueue& GetDeferredQueue();
 };
 
 UnattachedSelf& Self();
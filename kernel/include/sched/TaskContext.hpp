@@ -14,13 +14,23 @@
 
 #pragma once
 
+#include <cstdint>
+
 #include <shared/Response.hpp>
 
 namespace Scheduling {
     struct TaskContext {
+        static constexpr uint16_t NO_PROCESSOR = 0xFFFF;
+
         void* CR3;
         void* InstructionPointer;
         void* StackPointer;
+        // PCID tag, handed out when the task is first scheduled
+        uint64_t PCID = 0;
+        uint16_t LastProcessor = NO_PROCESSOR;
+        // x87/SSE/AVX save area, allocated on the first use of the registers
+        void* ExtendedState = nullptr;
+        uint16_t ExtendedStateProcessor = NO_PROCESSOR;
 
         static TaskContext Create(void* InstructionPointer);
         void Destroy();
@@ -30,8 +40,11 @@ namespace Scheduling {
     private:
         static void* SetupTaskPages();
         static void* SetupTaskContext(void* InstructionPointer, uint64_t argument);
+        static Optional<KernelTaskContext> FromAddressSpace(void* CR3, void* InstructionPointer, uint64_t argument);
 
     public:
         static Optional<KernelTaskContext> Create(void* InstructionPointer, uint64_t argument = 0);
+        // the new task shares the user memory of the calling one until either writes to it
+        static Optional<KernelTaskContext> Clone(void* InstructionPointer, uint64_t argument = 0);
     };
 }
@@ -14,39 +14,170 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 #include <shared/Lock.hpp>
-#include <shared/LockGuard.hpp>
+#include <shared/Response.hpp>
+#include <shared/SimpleAtomic.hpp>
 
 #include <sched/TaskContext.hpp>
 
+class UnattachedSelf;
+
 namespace Scheduling {
+    enum class SchedulingClass : uint8_t {
+        REALTIME,   // by priority, then first in first out, until the task blocks or yields
+        FAIR,       // round robin, with time slices weighted by priority
+        IDLE        // only when no task of another class can run
+    };
+
+    // realtime priorities go up to REALTIME_PRIORITIES - 1, the highest, while fair ones
+    // scale the time slice of the task
+    inline constexpr uint8_t REALTIME_PRIORITIES = 4;
+    inline constexpr uint8_t FAIR_PRIORITIES = 8;
+    inline constexpr uint8_t DEFAULT_PRIORITY = 3;
+
     class TaskManager {
     private:
+        // one run queue per realtime priority, then the fair and idle classes, best first
+        static constexpr size_t LEVEL_COUNT = REALTIME_PRIORITIES + 2;
+
         struct Task {
             const bool blockable;
             bool blocked;
+            bool removed;
+            uint8_t state;
+            uint8_t level;
+            Utils::Lock lock;       // guards blocked, removed, state and level
+            uint32_t slice;         // in microseconds, 0 when the task is never preempted for time
             uint64_t id;
-            Task* prev;
-            Task* next;
+            // the only manager allowed to run the task, nullptr when any processor may
+            TaskManager* const pinned_to;
+            Task* next_pending;
             TaskContext context;
         };
 
-        mutable Utils::Lock modify_lock;
+        // unblocks a task once the timer passes the deadline, for waits with a timeout
+        struct Wakeup {
+            uint64_t deadline;
+            uint64_t task_id;
+        };
+
+        static constexpr size_t WAKEUP_CAPACITY = 32;
+
+        // id to task table shared by every processor, tasks move between them
+        struct Index;
+        static Index index;
+
+        // Bounded FIFO of runnable tasks, single producer and multiple consumers. Only the
+        // owning processor pushes, at the bottom, and every processor takes from the top with
+        // a compare and exchange, the owner included. Unlike a work stealing deque the owner
+        // does not pop its newest task, so that the tasks of a level run round robin.
+        class RunQueue {
+        private:
+            static constexpr uint64_t CAPACITY = 256;
+
+            Utils::SimpleAtomic<uint64_t> top{0};
+            Utils::SimpleAtomic<uint64_t> bottom{0};
+            Task* volatile slots[CAPACITY] = { nullptr };
+
+        public:
+            bool Push(Task* task);
+            // nullptr when empty, or when another processor took the task first
+            Task* Steal();
+            uint64_t Size() const;
+        };
+
+        RunQueue run_queues[LEVEL_COUNT];
+
+        // tasks added or woken up by any processor, moved into the run queues by the owner
+        Utils::SimpleAtomic<uint64_t> pending{0};
+
+        Task* current = nullptr;
+        // switched away from, published by FinishSwitch once this processor is off its stack
+        Task* outgoing = nullptr;
+        Task* idle = nullptr;
+
+        // end of the slice of the current task in timer microseconds, 0 when it has none
+        uint64_t slice_end = 0;
+        // set when a task better than the current one is woken up
+        volatile bool reschedule = false;
+
+        // taken from other processors to cancel wake-ups, always with interrupts disabled
+        Utils::Lock wakeup_lock;
+        Wakeup wakeups[WAKEUP_CAPACITY] = {};
+        size_t wakeup_count = 0;
+        // earliest deadline among the wake-ups, 0 when there are none
+        volatile uint64_t next_wakeup = 0;
 
         uint64_t switches = 0;
-        Task* head = nullptr;
-        uint64_t task_count = 0;
+        uint64_t steals = 0;
+        uint64_t interrupts = 0;
+        uint64_t timeouts = 0;
+
+        static Task* FindTask(uint64_t task_id);
+        static void DestroyTask(Task* task);
+        static bool IsRunnable(Task* task);
+        static bool Claim(Task* task);
+        // thief is nullptr when the manager takes from its own queues
+        static Task* TakeFrom(RunQueue& queue, TaskManager* thief);
+        static Task* TakeBest(TaskManager& manager, size_t limit, TaskManager* thief = nullptr);
+        static Success ResolveLevel(SchedulingClass scheduling_class, uint8_t priority, uint8_t& level, uint32_t& slice);
+
+        uint64_t GetQueuedCount() const;
+        bool IsSliceOver(uint64_t now) const;
+
+        void Enqueue(Task* task);
+        void DrainPending();
+        void Settle(Task* task);
+        void Wake(Task* task);
+        void RequestReschedule();
+        UnattachedSelf* FindIdleProcessor() const;
+        void KickIdleProcessor();
+        Task* StealFromBusiest(uint64_t load, size_t limit);
+        void UpdateNextWakeup();
+        void FireWakeups(uint64_t now);
 
-        Task* FindTask(uint64_t task_id) const;
-    
     public:
+        struct Statistics {
+            uint64_t switches;
+            uint64_t steals;
+            uint64_t queued;
+            uint64_t interrupts;
+            uint64_t timeouts;
+        };
+
         uint64_t GetTaskCount() const;
-        uint64_t AddTask(const TaskContext& context, bool blockable = true);
+        // the idle task belongs to this processor only, and runs when nothing else can
+        Success SetIdleTask(const TaskContext& context);
+        // a pinned task only ever runs on this processor, it is neither stolen nor handed to
+        // an idle processor when woken up
+        uint64_t AddTask(const TaskContext& context, bool blockable = true,
+            SchedulingClass scheduling_class = SchedulingClass::FAIR, uint8_t priority = DEFAULT_PRIORITY,
+            bool pinned = false);
         void RemoveTask(uint64_t task_id);
         void BlockTask(uint64_t task_id) const;
-        void UnblockTask(uint64_t task_id) const;
-        TaskContext* TaskSwitch(void* stack_context);
+        void UnblockTask(uint64_t task_id);
+        // 0 for the idle task, or before the first switch
+        uint64_t GetCurrentTaskID() const;
+        // the task is unblocked once the timer of this processor reaches the deadline, in
+        // microseconds, false when there is no room left. A task has one wake-up at most per
+        // processor, setting it again moves the deadline.
+        bool SetWakeup(uint64_t task_id, uint64_t deadline);
+        void CancelWakeup(uint64_t task_id);
+        // takes effect the next time the task is queued
+        Success SetScheduling(uint64_t task_id, SchedulingClass scheduling_class, uint8_t priority);
+
+        // called on every timer interrupt, true when the current task has to be switched
+        bool Tick(uint64_t now);
+        // yielding lets tasks of the same level run before the slice ends
+        TaskContext* TaskSwitch(void* stack_context, uint64_t now, bool yielding);
+        // called on the stack of the incoming task, so that other processors may run, or
+        // destroy, the outgoing one without waiting for the next switch here
+        void FinishSwitch();
+        // when the timer has to fire next, 0 for never, idle processors wait for an IPI
+        uint64_t GetDeadline() const;
+        void QueryStatistics(Statistics& stats) const;
     };
 }
\ No newline at end of file
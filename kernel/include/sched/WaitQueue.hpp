@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+
+#pragma once
+
+#include <cstdint>
+
+#include <shared/SimpleAtomic.hpp>
+#include <shared/TicketLock.hpp>
+
+namespace Scheduling {
+    // Tasks waiting for a condition that another task or an interrupt handler makes true.
+    // A waiting task is blocked until it is woken up or its timeout passes, and checks the
+    // condition again, so wake-ups may come before the condition holds. Outside of a task,
+    // or with interrupts disabled, waits poll the condition instead.
+    class WaitQueue {
+    public:
+        // true once the predicate holds, false when ms passed first
+        bool WaitFor(uint64_t ms, bool (*predicate)(void*), void* args);
+        void Wait(bool (*predicate)(void*), void* args);
+
+        // from any context, interrupt handlers included
+        void WakeAll();
+
+    private:
+        // on the heap for the duration of the wait, task stacks are only mapped in the address
+        // space of their own task, and wakers walk the list from any of them
+        struct Waiter {
+            uint64_t task_id;
+            Waiter* next;
+            Waiter* previous;
+        };
+
+        Utils::TicketLock lock;
+        Waiter* head = nullptr;
+
+        void Enlist(Waiter& waiter);
+        void Delist(Waiter& waiter);
+        // deadline in timer microseconds, 0 for none
+        bool Block(uint64_t task_id, uint64_t deadline, bool (*predicate)(void*), void* args);
+    };
+
+    // One-shot event, stays complete until reset
+    class Completion {
+    public:
+        void Complete();
+        void Reset();
+        bool IsComplete() const;
+
+        bool WaitFor(uint64_t ms);
+        void Wait();
+
+    private:
+        Utils::SimpleAtomic<bool> done{false};
+        WaitQueue waiters;
+    };
+
+    // Lock whose waiters sleep, for sections that block themselves, such as device I/O.
+    // Usable with Utils::LockGuard, never from interrupt handlers. The owner may unlock from
+    // another address space than the waiters, which the heap-resident wait list allows.
+    class Mutex {
+    public:
+        bool trylock();
+        void lock();
+        void unlock();
+
+    private:
+        Utils::SimpleAtomic<bool> locked{false};
+        WaitQueue waiters;
+    };
+}
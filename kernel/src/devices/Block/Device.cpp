@@ -27,6 +27,7 @@
 #include <kern/memory.hpp>
 
 #include <mm/Heap.hpp>
+#include <mm/Swap.hpp>
 #include <mm/Utils.hpp>
 
 #include <screen/Log.hpp>
@@ -636,6 +637,9 @@ namespace Devices::Block {
                         Log::putsSafe("[DEV] Failed to add block device partition to filesystem");
                         new (partition) Partition();
                     }
+                    else {
+                        Swap::Probe(partition);
+                    }
                 }
             }
         }
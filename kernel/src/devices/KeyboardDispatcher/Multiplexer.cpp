@@ -31,6 +31,8 @@
 #include <mm/Heap.hpp>
 #include <mm/Utils.hpp>
 
+#include <sched/WaitQueue.hpp>
+
 #include <screen/Log.hpp>
 
 namespace {
@@ -49,15 +51,25 @@ namespace {
 		Utils::Lock write_lock;
 		Utils::Lock read_lock;
 		Utils::SimpleAtomic<size_t> available_packets_count;
+		Scheduling::WaitQueue readers;
 
 	public:
 		GenericKeyboardBuffer(uint8_t* buffer) : FS::File(&keyboard_owner), buffer {buffer}, location{0}, available_packets_count{0} {
 			static_assert(BUFFER_SIZE % PACKET_SIZE == 0);
 		}
 
+		// blocks until at least one packet is available
 		virtual FS::Response<size_t> Read([[maybe_unused]] size_t offset, size_t count, uint8_t* buffer) final {
+			static constexpr auto AVAILABLE_PREDICATE = [](void* arg) {
+				return static_cast<GenericKeyboardBuffer*>(arg)->available_packets_count.load() > 0;
+			};
+
 			Utils::LockGuard _{read_lock};
-			
+
+			if (count > 0) {
+				readers.Wait(AVAILABLE_PREDICATE, this);
+			}
+
 			const size_t available_packets = available_packets_count;
 
 			if (available_packets == 0) {
@@ -95,13 +107,17 @@ namespace {
 			}
 
 			const size_t packets = count / PACKET_SIZE;
-			const size_t written_packets = packets > remaining_space ? remaining_space : packets;			
-			available_packets_count += written_packets;
+			const size_t written_packets = packets > remaining_space ? remaining_space : packets;
 
 			for (size_t i = 0; i < written_packets; ++i, buffer += PACKET_SIZE) {
 				Utils::memcpy(this->buffer + ((location + available_packets + i) % CAPACITY) * PACKET_SIZE, buffer, PACKET_SIZE);
 			}
 
+			// published once copied, a blocked reader may run as soon as it sees the count
+			available_packets_count += written_packets;
+
+			readers.WakeAll();
+
 			return FS::Response(written_packets * PACKET_SIZE);
 		}
 
@@ -600,7 +600,7 @@ namespace Devices::USB::HID {
 
         auto hid_descriptor = hid_descriptor_wrapper.GetValue();
 
-        uint8_t* buffer = reinterpret_cast<uint8_t*>(IOHeap::Allocate(hid_descriptor.reportDescriptorLength));
+        uint8_t* buffer = reinterpret_cast<uint8_t*>(IOHeap::Allocate(hid_descriptor.reportDescriptorLength, 8, IOHeap::Caching::WRITE_BACK));
 
         if (buffer == nullptr) {
             if constexpr (Debug::DEBUG_HID_ERRORS) {
@@ -690,7 +690,7 @@ namespace Devices::USB::HID {
         }
 
         /// Initialize IN endpoint by sending normal TRB with a buffer large enough to hold any report
-        uint8_t* reportBuffer = reinterpret_cast<uint8_t*>(IOHeap::Allocate(hierarchy.GetMaxReportSize()));
+        uint8_t* reportBuffer = reinterpret_cast<uint8_t*>(IOHeap::Allocate(hierarchy.GetMaxReportSize(), 8, IOHeap::Caching::WRITE_BACK));
 
         if (reportBuffer == nullptr) {
             if constexpr (Debug::DEBUG_HID_ERRORS) {
@@ -51,10 +51,6 @@ namespace Devices::USB::MassStorage::BBB {
 
     Success Driver::SendNormalBuffer(uint32_t length, uint8_t endpoint, bool is_input) {
         static constexpr uint64_t COMPLETION_TIMEOUT_MS = 1000;
-        static constexpr auto TRANSFER_STATUS_PREDICATE = [](void* arg) {
-            const Driver* const drv = reinterpret_cast<Driver*>(arg);
-            return drv->transfer_complete.load();
-        };
 
         auto* const endpoint_ring = GetEndpointTransferRing(endpoint, is_input);
 
@@ -81,11 +77,11 @@ namespace Devices::USB::MassStorage::BBB {
 
         RingDoorbell(endpoint * 2 + (is_input ? 1 : 0));
 
-        const bool result = Self().SpinWaitMillsFor(COMPLETION_TIMEOUT_MS, TRANSFER_STATUS_PREDICATE, this);   
+        const bool result = transfer_completion.WaitFor(COMPLETION_TIMEOUT_MS);
 
         last_sent_trb = nullptr;
 
-        transfer_complete.store(false);
+        transfer_completion.Reset();
 
         return Success(result);
     }
@@ -286,7 +282,7 @@ namespace Devices::USB::MassStorage::BBB {
 
     void Driver::HandleEvent(const xHCI::TransferEventTRB& trb) {
         last_transfer_result = trb;
-        transfer_complete.store(true);
+        transfer_completion.Complete();
     }
 
     Success Driver::PostInitialization() {
@@ -137,23 +137,31 @@ namespace Devices::USB::xHCI {
         return entry;
     }
 
-    Controller::Controller(const PCI::Interface& interface) : Interrupts::InterruptProvider(), interface{interface} { }
+    Controller::Controller(const PCI::Interface& interface) : Interrupts::Deferred::ThreadedProvider(), interface{interface} { }
 
-    void Controller::HandleIRQ([[maybe_unused]] void* sp, [[maybe_unused]] uint64_t error_code) {
+    bool Controller::HandleTopHalf([[maybe_unused]] void* sp, [[maybe_unused]] uint64_t error_code) {
         static constexpr uint32_t USBSTS_EINT_MASK = 0x00000008;
 
         opregs->USBSTS = USBSTS_EINT_MASK;
 
-        EventTRB* event = GetCurrentEvent();
-
         APIC::SendEOI();
 
+        // the controller holds back further interrupts until the bottom half clears EHB
+        return true;
+    }
+
+    void Controller::HandleBottomHalf() {
+        EventTRB* event = GetCurrentEvent();
+
         while (event->GetCycle() == event_cycle) {
             switch (event->GetType()) {
                 case EventTRB::Type::TransferEvent: {
                     const auto& transfer_event = *reinterpret_cast<TransferEventTRB*>(event);
                     const uint8_t slot_id = transfer_event.GetSlotID();
-                    
+
+                    // keeps the port updater from destroying the device under us
+                    Utils::SharedGuard _{devices_lock};
+
                     const auto& device = devices[slot_id - 1];
 
                     if (device != nullptr) {
@@ -167,12 +175,13 @@ namespace Devices::USB::xHCI {
                     command_completion.data[1] = event->data[1];
                     command_completion.data[0] = event->data[0];
                     __blatomic_store_4(&command_completion.data[2], event->data[2], Utils::MemoryOrder::SEQ_CST);
+                    command_waiters.WakeAll();
                     break;
                 }
                 case EventTRB::Type::PortStatusChangeEvent: {
-                    port_update = true;
                     ports[reinterpret_cast<PortStatusChangeEventTRB*>(event)->GetPortID() - 1].dirty = true;
-                    Self().GetTaskManager().UnblockTask(port_updater_task_id);
+                    port_update = true;
+                    port_waiters.WakeAll();
                     break;
                 }
                 default: {
@@ -191,6 +200,7 @@ namespace Devices::USB::xHCI {
     }
 
     void Controller::ReleaseResources() {
+        msix_table.Unmap();
         Interrupts::ReleaseInterrupt(interrupt_vector);
         
         if (MMIO_base != nullptr) {
@@ -261,6 +271,41 @@ namespace Devices::USB::xHCI {
         primary_interrupter->ERSTBA = reinterpret_cast<uint64_t>(event_ring) + GetEventRingSegmentTableOffset();
     }
 
+    bool Controller::ConfigureMSIX(uint8_t apic_id) {
+        static constexpr uint16_t PRIMARY_INTERRUPTER_ENTRY = 0;
+
+        if (!msix_table.Map(interface).IsSuccess()) {
+            return false;
+        }
+
+        // the primary interrupter signals through the first entry
+        msix_table.Route(PRIMARY_INTERRUPTER_ENTRY, static_cast<uint8_t>(interrupt_vector), apic_id);
+        msix_table.Unmask(PRIMARY_INTERRUPTER_ENTRY);
+        msix_table.Enable();
+
+        return true;
+    }
+
+    bool Controller::ConfigureMSI(uint8_t apic_id) const {
+        const auto* const msi_cap = PCI::GetMSI(interface);
+
+        if (msi_cap == nullptr) {
+            return false;
+        }
+
+        const PCI::MSIMessage message = PCI::ComposeMessage(static_cast<uint8_t>(interrupt_vector), apic_id);
+
+        msi_cap->ConfigureMSI(msi_cap, PCI::MSIConfiguration {
+            .address = message.address,
+            .data = static_cast<uint16_t>(message.data),
+            .implemented_vectors = 1
+        });
+
+        msi_cap->Enable();
+
+        return true;
+    }
+
     Controller::RuntimeRegisters::IRS* Controller::GetPrimaryInterrupter() const {
         return &primary_rtregs->InterrupterRegisterSets[0];
     }
@@ -502,30 +547,26 @@ namespace Devices::USB::xHCI {
 
         Utils::memset(scratchpad_buffer_array, 0, array_pages * Shared::Memory::PAGE_SIZE);
 
-        // allocate individual scratchpad buffers
-        for (uint16_t i = 0; i < max_scratchpad_buffers; ++i) {
-            void* buffer = PhysicalMemory::Allocate();
+        // allocate individual scratchpad buffers in one pass over the frame bitmap
+        const size_t allocated = PhysicalMemory::AllocateBatch(scratchpad_buffer_array, max_scratchpad_buffers);
 
-            if (buffer == nullptr) {
-                for (size_t j = 0; j < i; ++j) {
-                    PhysicalMemory::Free(scratchpad_buffer_array[j]);
-                }
-                VirtualMemory::FreeDMA(scratchpad_buffer_array, array_pages);
-                scratchpad_buffer_array = nullptr;
-                return false;
-            }
+        if (allocated != max_scratchpad_buffers) {
+            PhysicalMemory::FreeBatch(scratchpad_buffer_array, allocated);
+            VirtualMemory::FreeDMA(scratchpad_buffer_array, array_pages);
+            scratchpad_buffer_array = nullptr;
+            return false;
+        }
 
+        for (uint16_t i = 0; i < max_scratchpad_buffers; ++i) {
             // zero out the page
             auto* vbuffer = VirtualMemory::MapGeneralPages(
-                buffer,
+                scratchpad_buffer_array[i],
                 1,
                 Shared::Memory::PTE_PRESENT | Shared::Memory::PTE_READWRITE | Shared::Memory::PTE_UNCACHEABLE
             );
 
             if (vbuffer == nullptr) {
-                for (size_t j = 0; j <= i; ++j) {
-                    PhysicalMemory::Free(scratchpad_buffer_array[j]);
-                }
+                PhysicalMemory::FreeBatch(scratchpad_buffer_array, max_scratchpad_buffers);
                 VirtualMemory::FreeDMA(scratchpad_buffer_array, array_pages);
                 scratchpad_buffer_array = nullptr;
                 return false;
@@ -534,8 +575,6 @@ namespace Devices::USB::xHCI {
             Utils::memset(vbuffer, 0, Shared::Memory::PAGE_SIZE);
 
             VirtualMemory::UnmapGeneralPages(vbuffer, 1);
-
-            scratchpad_buffer_array[i] = buffer;
         }
 
         // update the scratchpad buffer array pointer in the DCBAA slot 0
@@ -618,6 +657,10 @@ namespace Devices::USB::xHCI {
     }
 
     void Controller::UpdatePorts() {
+        static constexpr auto PORT_UPDATE_PREDICATE = [](void* arg) {
+            return static_cast<const Controller*>(arg)->port_update;
+        };
+
         while (true) {
             for (size_t i = 0; i < GetMaxPorts(); ++i) {
                 if (ports[i].dirty) {
@@ -650,9 +693,9 @@ namespace Devices::USB::xHCI {
                         uint8_t& slot = ports[i].slot;
 
                         if (slot != 0) {
-                            if (devices[slot - 1] != nullptr) {
-                                auto* const device = devices[slot - 1];
-                                devices[slot - 1] = nullptr;
+                            auto* const device = UnpublishDevice(slot);
+
+                            if (device != nullptr) {
                                 device->Destroy();
                             }
 
@@ -743,27 +786,26 @@ namespace Devices::USB::xHCI {
                             .depth = 0
                         });
 
-                        auto& pdevice = devices[slot_id - 1];
-                        pdevice = device;
+                        PublishDevice(slot_id, device);
 
                         if (!device->Initialize().IsSuccess()) {
                             if constexpr (Debug::DEBUG_USB_SOFT_ERRORS) {
                                 Log::printfSafe("[xHCI] Failed to initialize device on port 0x%0.2hhx\n\r", i);
                             }
 
-                            Heap::Free(pdevice);
-                            pdevice = nullptr;
+                            UnpublishDevice(slot_id);
+                            Heap::Free(device);
                             DisableSlot(ports[i].slot);
                             ports[i].slot = 0;
                         }
-                        else if (!pdevice->PostInitialization().IsSuccess()) {
+                        else if (!device->PostInitialization().IsSuccess()) {
                             if constexpr (Debug::DEBUG_USB_SOFT_ERRORS) {
                                 Log::printfSafe("[xHCI] Post-initialization failed for device on port 0x%0.2hhx\n\r", i);
                             }
                             
-                            pdevice->Destroy();
-                            Heap::Free(pdevice);
-                            pdevice = nullptr;
+                            UnpublishDevice(slot_id);
+                            device->Destroy();
+                            Heap::Free(device);
                             DisableSlot(ports[i].slot);
                             ports[i].slot = 0;
                         }
@@ -771,12 +813,9 @@ namespace Devices::USB::xHCI {
                 }
             }
 
-            __asm__ volatile("cli");
-            if (!port_update) {
-                Self().GetTaskManager().BlockTask(port_updater_task_id);
-            }
+            // ports marked dirty after the flag is cleared are seen by the next pass
+            port_waiters.Wait(PORT_UPDATE_PREDICATE, this);
             port_update = false;
-            __asm__ volatile("sti");
         }
     }
 
@@ -810,6 +849,21 @@ namespace Devices::USB::xHCI {
         SendCommand(trb);
     }
 
+    // the interrupt handler reads the table, so writers keep interrupts off while holding the lock
+    void Controller::PublishDevice(uint8_t slot, Device* device) {
+        Utils::IRQLockGuard _{devices_lock};
+        devices[slot - 1] = device;
+    }
+
+    Device* Controller::UnpublishDevice(uint8_t slot) {
+        Utils::IRQLockGuard _{devices_lock};
+
+        Device* const device = devices[slot - 1];
+        devices[slot - 1] = nullptr;
+
+        return device;
+    }
+
     Controller::ExtendedCapability* Controller::FindExtendedCapability(uint8_t id) const {
         static constexpr uint32_t HCCPARAMS1_XECP_MASK = 0xFFFF0000;
         static constexpr uint8_t HCCPARAMS1_XECP_SHIFT = 16;
@@ -984,37 +1038,14 @@ namespace Devices::USB::xHCI {
         // set interrupt enable and interrupt pending on the primary interrupter
         controller->EnablePrimaryInterrupter();
 
-        // configure MSI for the controller
-        const uint8_t LID = APIC::GetLAPICLogicalID();
-
-        // // use current logical APIC as destination
-        const uint32_t MA =
-            (0x0FEE << 20)
-            | (LID << 12)
-            | (1 << 3)
-            | (1 << 2);
-        
-        // // Use edge, lowest priority
-        const uint16_t MD =
-            (0 << 15)
-            | (1 << 8)
-            | (static_cast<uint16_t>(vector));
-
-        auto msi_cap = PCI::GetMSI(controller->interface);
+        // spread the interrupt of each controller on a different processor
+        const uint8_t target = PCI::SelectInterruptTarget();
 
-        if (msi_cap == nullptr) {
+        if (!controller->ConfigureMSIX(target) && !controller->ConfigureMSI(target)) {
             Release(controller);
             return nullptr;
         }
 
-        msi_cap->ConfigureMSI(msi_cap, PCI::MSIConfiguration {
-            .address = MA,
-            .data = MD,
-            .implemented_vectors = 1
-        });
-
-        msi_cap->Enable();
-
         // register interrupt handler
         Interrupts::RegisterIRQ(controller->interrupt_vector, controller);
 
@@ -1136,7 +1167,7 @@ namespace Devices::USB::xHCI {
 
         SignalCommand();
 
-        if (!Self().SpinWaitMillsFor(COMPLETION_TIMEOUT_MS, COMMAND_STATUS_PREDICATE, this)) {
+        if (!command_waiters.WaitFor(COMPLETION_TIMEOUT_MS, COMMAND_STATUS_PREDICATE, this)) {
             return Optional<CommandCompletionEventTRB>();
         }
 
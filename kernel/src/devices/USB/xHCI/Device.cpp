@@ -296,20 +296,16 @@ namespace Devices::USB::xHCI {
 
     Success Device::InitiateTransfer(const TRB* trb, uint32_t reason) {
         static constexpr uint64_t COMPLETION_TIMEOUT_MS = 1000;
-        static constexpr auto TRANSFER_STATUS_PREDICATE = [](void* arg) {
-            const Device* const device = reinterpret_cast<Device*>(arg);
-            return device->transfer_complete.load();
-        };
 
-        transfer_complete.store(false);
+        transfer_completion.Reset();
         Utils::memset(&transfer_result.data, 0, sizeof(transfer_result.data));
 
         awaiting_transfer = trb;
         controller.RingDoorbell(*this, reason);
 
-        const bool result = Self().SpinWaitMillsFor(COMPLETION_TIMEOUT_MS, TRANSFER_STATUS_PREDICATE, this);
+        const bool result = transfer_completion.WaitFor(COMPLETION_TIMEOUT_MS);
         
-        transfer_complete.store(false);
+        transfer_completion.Reset();
 
         return Success(result);
     }
@@ -415,7 +411,7 @@ namespace Devices::USB::xHCI {
 
         const size_t descriptor_size = static_cast<size_t>(header.length);
 
-        uint8_t* descriptor_data = reinterpret_cast<uint8_t*>(IOHeap::Allocate(descriptor_size));
+        uint8_t* descriptor_data = reinterpret_cast<uint8_t*>(IOHeap::Allocate(descriptor_size, 8, IOHeap::Caching::WRITE_BACK));
 
         if (descriptor_data == nullptr) {
             return Optional<uint8_t*>();
@@ -764,7 +760,7 @@ namespace Devices::USB::xHCI {
 
         const size_t descriptor_size = static_cast<size_t>(pre_data[1]);
 
-        uint8_t* const data = reinterpret_cast<uint8_t*>(IOHeap::Allocate(descriptor_size));
+        uint8_t* const data = reinterpret_cast<uint8_t*>(IOHeap::Allocate(descriptor_size, 8, IOHeap::Caching::WRITE_BACK));
 
         if (data == nullptr) {
             return Optional<ConfigurationDescriptor>();
@@ -1740,7 +1736,7 @@ namespace Devices::USB::xHCI {
 
         if (awaiting_transfer_address_wrapper.HasValue() && trb.GetPointer() == awaiting_transfer_address_wrapper.GetValue()) {
             transfer_result = trb;
-            transfer_complete.store(true);
+            transfer_completion.Complete();
         }
         else {
             auto driver_wrapper = FindDriverEvent(trb);
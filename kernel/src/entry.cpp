@@ -47,6 +47,7 @@
 
 #include <sched/Dispatcher.hpp>
 #include <sched/Self.hpp>
+#include <sched/SMP.hpp>
 #include <sched/TaskContext.hpp>
 #include <sched/TaskManager.hpp>
 
@@ -156,6 +157,12 @@ void BootProcessorInit() {
 
     SetupPS2Keyboard(keyboardMultiplexer);
 
+    const auto promotionTask = Scheduling::KernelTaskContext::Create(reinterpret_cast<void*>(&VirtualMemory::PromotionTask));
+
+    if (!promotionTask.HasValue() || Self().GetTaskManager().AddTask(promotionTask.GetValue(), true, Scheduling::SchedulingClass::IDLE) == 0) {
+        Log::putsSafe("[ENTRY] Could not start the huge page promotion task\n\r");
+    }
+
     PCI::Enumerate();
 
     Services::Shell::Entry();
@@ -173,6 +180,9 @@ LEGACY_EXPORT void KernelEntry() {
     VirtualMemory::kernel_gdt_setup();
     Interrupts::kernel_idt_setup();
 
+    // loading the data segments above cleared the GS base, per-CPU data is unavailable until bound
+    UnattachedSelf::PrepareBinding();
+
     Log::Setup();
     Log::puts("Kernel Log Enabled\n\r");
 
@@ -225,22 +235,33 @@ LEGACY_EXPORT void KernelEntry() {
 
     ACPI::Initialize();
 
+    if (!PhysicalMemory::SetupNodes().IsSuccess()) {
+        Panic::PanicShutdown("PMM (COULD NOT MAP SRAT)\n\r");
+    }
+
+    Log::printf("[ENTRY] Physical memory split into %llu NUMA node(s)\n\r", PhysicalMemory::QueryNodeCount());
+
     APIC::Initialize();
 
     APIC::SetupLocalAPIC();
 
+    UnattachedSelf::Attach().Bind();
+
     PIT::Initialize();
 
     __asm__ volatile("sti");
 
     Self().GetTimer().Initialize();
 
+    Scheduling::SMP::StartProcessors();
+
     auto initTask = Scheduling::KernelTaskContext::Create(reinterpret_cast<void*>(&BootProcessorInit));
     if (!initTask.HasValue()) {
         Panic::PanicShutdown("COULD NOT CREATE INIT TASK\n\r");
     }
 
-    Self().GetTaskManager().AddTask(initTask.GetValue(), false);
+    // blockable so that the kernel shell sleeps while waiting for I/O
+    Self().GetTaskManager().AddTask(initTask.GetValue(), true);
 
     Scheduling::InitializeDispatcher();
 
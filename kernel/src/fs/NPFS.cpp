@@ -294,7 +294,7 @@ FS::Response<NPFS::Directory::DirectoryEntry*> NPFS::Directory::FindEntry(const
 NPFS::Directory::Directory(FS::Owner* owner) : FS::Directory(owner) {}
 
 FS::Response<FS::IFNode*> NPFS::Directory::Find(const FS::DirectoryEntry& fileref) {
-    Utils::LockGuard _{mut};
+    Utils::SharedGuard _{mut};
 
     auto result = FindEntry(fileref);
 
@@ -519,7 +519,7 @@ FS::Response<size_t> NPFS::Directory::List(FS::DirectoryEntry* list, size_t leng
     size_t remaining = length;
     uint8_t* blk = nullptr;
 
-    Utils::LockGuard _{mut};
+    Utils::SharedGuard _{mut};
 
     // name not deep copied within kernel memory;
     // is copied when required by user memory, however
@@ -597,7 +597,7 @@ FS::Response<size_t> NPFS::File::Read(size_t offset, size_t count, uint8_t* buff
     size_t effectiveCount = end - offset;
     uint8_t* const effectiveBufferEnd = buffer + effectiveCount;
 
-    Utils::LockGuard _{mut};
+    Utils::SharedGuard _{mut};
 
     if (firstBlock == lastBlock) {
         uint8_t* blk = data->GetWeakBlock(firstBlock);
@@ -26,6 +26,7 @@
 
 #include <interrupts/APIC.hpp>
 #include <interrupts/IDT.hpp>
+#include <interrupts/InterruptGuard.hpp>
 #include <interrupts/InterruptProvider.hpp>
 #include <interrupts/Panic.hpp>
 #include <interrupts/PIC.hpp>
@@ -102,6 +103,20 @@ namespace {
 			ESR = 0;
 		}
 
+		void SendIPI(uint8_t destination, uint32_t command) {
+			static constexpr uint32_t DELIVERY_PENDING = 0x1000;
+
+			// an IPI sent from an interrupt handler must not land between the two writes
+			Interrupts::InterruptGuard irqGuard{};
+
+			ICR[1].data = static_cast<uint32_t>(destination) << 24;
+			ICR[0].data = command;
+
+			while ((ICR[0].data & DELIVERY_PENDING) != 0) {
+				__asm__ volatile("pause");
+			}
+		}
+
 		void SetTimerLVT(uint8_t vector, APIC::Timer::Mode mode) {
 			const uint32_t timer_mode =
 				mode == APIC::Timer::Mode::ONE_SHOT ? 0 :
@@ -692,6 +707,33 @@ namespace APIC {
 		return LocalAPIC->GetID();
 	}
 
+	void SendInitIPI(uint8_t apicID) {
+		static constexpr uint32_t INIT = 0x500;
+		static constexpr uint32_t ASSERT = 0x4000;
+
+		LocalAPIC->SendIPI(apicID, INIT | ASSERT);
+	}
+
+	void SendStartupIPI(uint8_t apicID, uint8_t page) {
+		static constexpr uint32_t STARTUP = 0x600;
+		static constexpr uint32_t ASSERT = 0x4000;
+
+		LocalAPIC->SendIPI(apicID, STARTUP | ASSERT | page);
+	}
+
+	void SendFixedIPI(uint8_t apicID, uint8_t vector) {
+		static constexpr uint32_t ASSERT = 0x4000;
+
+		LocalAPIC->SendIPI(apicID, ASSERT | vector);
+	}
+
+	void SendNMI(uint8_t apicID) {
+		static constexpr uint32_t NMI = 0x400;
+		static constexpr uint32_t ASSERT = 0x4000;
+
+		LocalAPIC->SendIPI(apicID, NMI | ASSERT);
+	}
+
 	void SendEOI() {
 		LocalAPIC->SendEOI();
 	}
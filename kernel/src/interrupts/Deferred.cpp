@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+
+#include <cstdint>
+
+#include <shared/Response.hpp>
+#include <shared/SimpleAtomic.hpp>
+
+#include <interrupts/Deferred.hpp>
+#include <interrupts/InterruptGuard.hpp>
+
+#include <sched/Self.hpp>
+#include <sched/TaskContext.hpp>
+#include <sched/TaskManager.hpp>
+
+namespace Interrupts::Deferred {
+    namespace {
+        // bottom halves go before every other task
+        static constexpr uint8_t THREAD_PRIORITY = Scheduling::REALTIME_PRIORITIES - 1;
+
+        static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> top_halves{0};
+        static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> top_half_cycles{0};
+        static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> max_top_half_cycles{0};
+        static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> bottom_halves{0};
+        static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> bottom_half_cycles{0};
+        static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> latency_cycles{0};
+        static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> max_latency_cycles{0};
+
+        static inline uint64_t ReadTSC() {
+            uint32_t low, high;
+            __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+            return (static_cast<uint64_t>(high) << 32) | low;
+        }
+
+        static void RecordMax(Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED>& max, uint64_t value) {
+            uint64_t current = max.load();
+
+            while (value > current && !max.compare_exchange(current, value)) { }
+        }
+
+        static void BottomHalfThread(uint64_t queue_address) {
+            ProcessorQueue& queue = *reinterpret_cast<ProcessorQueue*>(queue_address);
+
+            while (true) {
+                queue.WaitForWork();
+                queue.RunPending();
+            }
+        }
+    }
+
+    Work::Work(void (*handler)(void*), void* args) : handler{handler}, args{args} { }
+
+    bool Work::Schedule() {
+        uint8_t current = state.load();
+
+        do {
+            if ((current & STATE_PENDING) != 0) {
+                return false;
+            }
+        } while (!state.compare_exchange(current, current | STATE_PENDING));
+
+        scheduled_at = ReadTSC();
+
+        // running work is not queued again, it goes on once the handler returns
+        if ((current & STATE_RUNNING) == 0) {
+            Interrupts::InterruptGuard irqGuard{};
+            Self().GetDeferredQueue().Push(*this);
+        }
+
+        return true;
+    }
+
+    void Work::Run() {
+        // only pending work is queued, and the state stays the same until it runs
+        state.store(STATE_RUNNING);
+
+        while (true) {
+            const uint64_t start = ReadTSC();
+            const uint64_t latency = start - scheduled_at;
+
+            latency_cycles += latency;
+            RecordMax(max_latency_cycles, latency);
+
+            handler(args);
+
+            ++bottom_halves;
+            bottom_half_cycles += ReadTSC() - start;
+
+            uint8_t expected = STATE_RUNNING;
+
+            if (state.compare_exchange(expected, 0)) {
+                return;
+            }
+
+            // scheduled again while the handler ran
+            state.store(STATE_RUNNING);
+        }
+    }
+
+    void ProcessorQueue::Push(Work& work) {
+        uint64_t head = pending.load();
+
+        do {
+            work.next = reinterpret_cast<Work*>(head);
+        } while (!pending.compare_exchange(head, reinterpret_cast<uint64_t>(&work)));
+
+        const uint64_t task_id = thread_id.load();
+
+        if (task_id != 0) {
+            Self().GetTaskManager().UnblockTask(task_id);
+        }
+    }
+
+    bool ProcessorQueue::HasWork() const {
+        return pending.load() != 0;
+    }
+
+    void ProcessorQueue::RunPending() {
+        Work* work = nullptr;
+
+        while ((work = reinterpret_cast<Work*>(pending.exchange(0))) != nullptr) {
+            Work* ordered = nullptr;
+
+            while (work != nullptr) {
+                Work* const next = work->next;
+                work->next = ordered;
+                ordered = work;
+                work = next;
+            }
+
+            // read before running, the work may be queued again as soon as it is done
+            while (ordered != nullptr) {
+                Work* const next = ordered->next;
+                ordered->Run();
+                ordered = next;
+            }
+        }
+    }
+
+    void ProcessorQueue::WaitForWork() {
+        // the thread is pinned, so the manager stays the same
+        Scheduling::TaskManager& manager = Self().GetTaskManager();
+        const uint64_t task_id = manager.GetCurrentTaskID();
+
+        thread_id.store(task_id);
+
+        while (true) {
+            // blocked before the check, so that work pushed in between unblocks it again
+            manager.BlockTask(task_id);
+
+            if (HasWork()) {
+                break;
+            }
+
+            Self().Yield();
+        }
+
+        manager.UnblockTask(task_id);
+    }
+
+    Success InitializeProcessor() {
+        ProcessorQueue& queue = Self().GetDeferredQueue();
+
+        auto context = Scheduling::KernelTaskContext::Create(
+            reinterpret_cast<void*>(&BottomHalfThread),
+            reinterpret_cast<uint64_t>(&queue)
+        );
+
+        if (!context.HasValue()) {
+            return Failure();
+        }
+
+        // pinned, so that the queue of each processor is served by that processor
+        if (Self().GetTaskManager().AddTask(context.GetValue(), true, Scheduling::SchedulingClass::REALTIME, THREAD_PRIORITY, true) == 0) {
+            context.GetValue().Destroy();
+            return Failure();
+        }
+
+        return Success();
+    }
+
+    void QueryStatistics(Statistics& stats) {
+        stats.topHalves = top_halves;
+        stats.topHalfCycles = top_half_cycles;
+        stats.maxTopHalfCycles = max_top_half_cycles;
+        stats.bottomHalves = bottom_halves;
+        stats.bottomHalfCycles = bottom_half_cycles;
+        stats.latencyCycles = latency_cycles;
+        stats.maxLatencyCycles = max_latency_cycles;
+    }
+
+    ThreadedProvider::ThreadedProvider() :
+        bottom_half{[](void* arg) { static_cast<ThreadedProvider*>(arg)->HandleBottomHalf(); }, this}
+    { }
+
+    void ThreadedProvider::HandleIRQ(void* stack, uint64_t error_code) {
+        const uint64_t start = ReadTSC();
+
+        if (HandleTopHalf(stack, error_code)) {
+            bottom_half.Schedule();
+        }
+
+        const uint64_t cycles = ReadTSC() - start;
+
+        ++top_halves;
+        top_half_cycles += cycles;
+        RecordMax(max_top_half_cycles, cycles);
+    }
+}
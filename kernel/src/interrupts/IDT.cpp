@@ -122,14 +122,14 @@ namespace {
 	}
 
 	static void ReserveKnownInterrupt(int i) {
-		if (i < 0x100) {
-			int_usage_map[i / 64] |= (1 << (i % 64));
+		if (i >= 0 && i < 0x100) {
+			int_usage_map[i / 64] |= (uint64_t{1} << (i % 64));
 		}
 	}
 
 	static int ReserveInterrupt() {
 		for (int i = 0; i < 0x100; ++i) {
-			if ((int_usage_map[i / 64] & (1 << (i % 64))) == 0) {
+			if ((int_usage_map[i / 64] & (uint64_t{1} << (i % 64))) == 0) {
 				ReserveKnownInterrupt(i);
 				return i;
 			}
@@ -139,8 +139,8 @@ namespace {
 	}
 
 	static void ReleaseInterrupt(int i) {
-		if (i < 0x100) {
-			int_usage_map[i / 64] &= ~(1 << (i % 64));
+		if (i >= 0 && i < 0x100) {
+			int_usage_map[i / 64] &= ~(uint64_t{1} << (i % 64));
 			providers[i] = nullptr;
 		}
 	}
@@ -150,12 +150,12 @@ void Interrupts::kernel_idt_setup() {
  	// set up each core exception handler
 // 	registerCoreInterrupt(0,  &Interrupts::Core::int_divide_error,				INTDPL::DPL0, INTTYPE::EXCEPTION);
 // 	registerCoreInterrupt(1,  &Interrupts::Core::int_debug_trap,				INTDPL::DPL0, INTTYPE::TRAP);
-// 	registerCoreInterrupt(2,  &Interrupts::Core::int_nmi_error,					INTDPL::DPL0, INTTYPE::EXCEPTION);
+registerProvider(2, &Interrupts::Core::non_maskable_trampoline);
 // 	registerCoreInterrupt(3,  &Interrupts::Core::int_breakpoint_trap,			INTDPL::DPL0, INTTYPE::TRAP);
 // 	registerCoreInterrupt(4,  &Interrupts::Core::int_overflow_trap,				INTDPL::DPL0, INTTYPE::TRAP);
 // 	registerCoreInterrupt(5,  &Interrupts::Core::int_bound_error,				INTDPL::DPL0, INTTYPE::EXCEPTION);
 // 	registerCoreInterrupt(6,  &Interrupts::Core::int_invalidop_error,			INTDPL::DPL0, INTTYPE::EXCEPTION);
-// 	registerCoreInterrupt(7,  &Interrupts::Core::int_device_error,				INTDPL::DPL0, INTTYPE::EXCEPTION);
+registerProvider(7, &Interrupts::Core::device_not_available_trampoline);
 // 	registerCoreInterrupt(8,  &Interrupts::Core::int_doublefault_error,			INTDPL::DPL0, INTTYPE::EXCEPTION);
 // 	registerCoreInterrupt(9,  &Interrupts::Core::int_coprocseg_error,			INTDPL::DPL0, INTTYPE::EXCEPTION);
 // 	registerCoreInterrupt(10, &Interrupts::Core::int_invalidtss_error,			INTDPL::DPL0, INTTYPE::EXCEPTION);
@@ -177,11 +177,7 @@ registerProvider(14, &Interrupts::Core::page_fault_trampoline);
 		registerCoreInterrupt(i, IDT_STUB_TABLE[i], INTDPL::DPL0, INTTYPE::EXCEPTION);
 	}
 
-	uint8_t IDTP[10];
-	*reinterpret_cast<uint16_t*>(IDTP) = sizeof(IDT) - 1;
-	*reinterpret_cast<IDTDescriptor**>(IDTP + sizeof(uint16_t)) = IDT;
-
-	__asm__ volatile("lidt (%0)" :: "memory"(IDTP));
+	LoadIDT();
 
 	for (int i = 0; i < 0x20; ++i) {
 		ReserveKnownInterrupt(i);
@@ -190,6 +186,14 @@ registerProvider(14, &Interrupts::Core::page_fault_trampoline);
 	ReserveKnownInterrupt(SOFTWARE_YIELD_IRQ);
 }
 
+void Interrupts::LoadIDT() {
+	uint8_t IDTP[10];
+	*reinterpret_cast<uint16_t*>(IDTP) = sizeof(IDT) - 1;
+	*reinterpret_cast<IDTDescriptor**>(IDTP + sizeof(uint16_t)) = IDT;
+
+	__asm__ volatile("lidt (%0)" :: "memory"(IDTP));
+}
+
 void Interrupts::ForceIRQHandler(unsigned int interruptVector, void* handler) {
 	registerCoreInterrupt(
 		interruptVector,
@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+
+#include <cstdint>
+
+#include <interrupts/InterruptProvider.hpp>
+#include <interrupts/Panic.hpp>
+
+#include <sched/ExtendedState.hpp>
+
+namespace {
+    // CR0.TS is set while the registers do not hold the state of the running task
+    static void DeviceNotAvailableHandler(void* sp, uint64_t errv) {
+        if (!Scheduling::ExtendedState::LoadCurrent().IsSuccess()) {
+            Panic::Panic(sp, "EXTENDED STATE UNAVAILABLE\n\r", errv);
+        }
+    }
+}
+
+namespace Interrupts::Core {
+    InterruptTrampoline device_not_available_trampoline(DeviceNotAvailableHandler);
+}
@@ -20,8 +20,9 @@
 #include <interrupts/InterruptProvider.hpp>
 #include <interrupts/Panic.hpp>
 
+#include <mm/CopyOnWrite.hpp>
 #include <mm/Paging.hpp>
-#include <mm/PhysicalMemory.hpp>
+#include <mm/Swap.hpp>
 #include <mm/VirtualMemory.hpp>
 
 namespace ShdMem = Shared::Memory;
@@ -37,6 +38,10 @@ namespace {
     static inline constexpr uint64_t PF_HLAT                        = 0x00000080;
     static inline constexpr uint64_t PF_SGX_VIOLATION               = 0x00008000;
 
+    // the handler stack holds the 15 saved registers, the vector and error code, then the CPU frame
+    static inline constexpr size_t FRAME_RFLAGS_INDEX               = 19;
+    static inline constexpr uint64_t RFLAGS_IF                      = 0x00000200;
+
     static void CheckUnmappedAccess(void* sp, const Shared::Memory::VirtualAddress& mapping, uint64_t errv) {
         const auto pml4e = Paging::GetPML4EAddress(mapping);
         const auto pdpte = Paging::GetPDPTEAddress(mapping);
@@ -69,7 +74,19 @@ namespace {
 
     static void PageFaultHandler(void* sp, uint64_t errv) {
         if ((errv & PF_PRESENT) == 1) {
-            Panic::Panic(sp, "PAGE FAULT VIOLATION\n\r", errv);
+            uint64_t CR2 = 0;
+            __asm__ volatile("mov %%cr2, %0" : "=r"(CR2));
+
+            // a plain write to a read-only page may only be a copy-on-write one, or one to a
+            // kernel heap range being promoted to a huge page
+            if ((errv & ~PF_USERMODE) != (PF_PRESENT | PF_WRITE)) {
+                Panic::Panic(sp, "PAGE FAULT VIOLATION\n\r", errv);
+            }
+            else if (!VirtualMemory::AwaitPromotion(reinterpret_cast<void*>(CR2))
+                && !CopyOnWrite::Resolve(reinterpret_cast<void*>(CR2)).IsSuccess()
+            ) {
+                Panic::Panic(sp, "PAGE FAULT VIOLATION\n\r", errv);
+            }
         }
         else {
             uint64_t CR2 = 0;
@@ -86,36 +103,38 @@ namespace {
                 Panic::Panic(sp, "HUGE PAGE ERROR\n\r", errv);
             }
             else {
-                const auto pte = Paging::GetPTEAddress(mapping);
-
-                const uint64_t PRESENT = ShdMem::PTE_PRESENT;
-                const uint64_t READWRITE = *pte & VirtualMemory::NP_READWRITE;
-                const uint64_t USERMODE = *pte & VirtualMemory::NP_USERMODE;
-                const uint64_t PWT = *pte & VirtualMemory::NP_PWT;
-                const uint64_t PCD = *pte & VirtualMemory::NP_PCD;
-                const uint64_t PAT = (*pte & VirtualMemory::NP_PAT) << 2;
-                const uint64_t GLOBAL = (*pte & VirtualMemory::NP_GLOBAL) << 2;
-                const uint64_t PK = (*pte & VirtualMemory::NP_PK) << 34;
-                
-                if ((*pte & VirtualMemory::NP_ON_DEMAND) == 0) {
-                    Panic::Panic(sp, "MEMORY SWAPPING UNSUPPORTED\n\r", errv);
+                const uint64_t entry = *Paging::GetPTEAddress(mapping);
+                const bool interruptible = (static_cast<const uint64_t*>(sp)[FRAME_RFLAGS_INDEX] & RFLAGS_IF) != 0;
+
+                // the entry may have been populated by another processor since the fault
+                if ((entry & ShdMem::PTE_PRESENT) == 0 && (entry & VirtualMemory::NP_ON_DEMAND) == 0) {
+                    // the swap device needs interrupts, which the faulting code may not allow
+                    if (!interruptible) {
+                        Panic::Panic(sp, "SWAPPED PAGE ACCESSED WITH INTERRUPTS DISABLED\n\r", errv);
+                    }
+
+                    __asm__ volatile("sti" ::: "memory");
+                    const bool swapped = VirtualMemory::SwapIn(reinterpret_cast<void*>(CR2)).IsSuccess();
+                    __asm__ volatile("cli" ::: "memory");
+
+                    if (!swapped) {
+                        Panic::Panic(sp, "SWAP IN FAILED\n\r", errv);
+                    }
                 }
-                else {
-                    void* page = PhysicalMemory::Allocate();
+                else if (!VirtualMemory::PopulateOnDemand(reinterpret_cast<void*>(CR2)).IsSuccess()) {
+                    bool populated = false;
+
+                    // under memory pressure, cold user pages make room before giving up
+                    if (interruptible) {
+                        __asm__ volatile("sti" ::: "memory");
+                        populated = VirtualMemory::ReclaimPages(Swap::BATCH_PAGES) != 0
+                            && VirtualMemory::PopulateOnDemand(reinterpret_cast<void*>(CR2)).IsSuccess();
+                        __asm__ volatile("cli" ::: "memory");
+                    }
 
-                    if (page == nullptr) {
+                    if (!populated) {
                         Panic::Panic(sp, "KERNEL OUT OF MEMORY\n\r", errv);
                     }
-
-                    *pte = PK
-                        | (PhysicalMemory::FilterAddress(page) & ShdMem::PTE_ADDRESS)
-                        | GLOBAL
-                        | PAT
-                        | PCD
-                        | PWT
-                        | USERMODE
-                        | READWRITE
-                        | PRESENT;
                 }
             }
         }
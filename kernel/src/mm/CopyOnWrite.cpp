@@ -0,0 +1,413 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+#include <cstddef>
+#include <cstdint>
+
+#include <shared/Lock.hpp>
+#include <shared/Response.hpp>
+#include <shared/SimpleAtomic.hpp>
+#include <shared/memory/defs.hpp>
+#include <shared/memory/layout.hpp>
+
+#include <interrupts/InterruptGuard.hpp>
+
+#include <mm/CopyOnWrite.hpp>
+#include <mm/Paging.hpp>
+#include <mm/PhysicalMemory.hpp>
+#include <mm/Swap.hpp>
+#include <mm/Utils.hpp>
+#include <mm/VirtualMemory.hpp>
+
+#include <sched/Self.hpp>
+
+namespace ShdMem = Shared::Memory;
+
+namespace {
+	static constexpr uint64_t CR0_WP = 1 << 16;
+
+	static constexpr size_t LEVELS = 4;
+	static constexpr uint64_t COVERAGE[LEVELS] = {
+		ShdMem::PML4E_COVERAGE,
+		ShdMem::PDPTE_COVERAGE,
+		ShdMem::PDE_COVERAGE,
+		ShdMem::PTE_COVERAGE
+	};
+
+	static constexpr uint16_t RECURSIVE_INDEX =
+		ShdMem::ParseVirtualAddress(ShdMem::Layout::RecursiveMemoryMapping.start).PML4_offset;
+
+	/// Reference counts
+
+	// frames with several references, they are counted in their descriptors
+	static uint64_t sharedCount = 0;
+	static uint64_t copyCount = 0;
+	static uint64_t reuseCount = 0;
+
+	static constexpr uint64_t NO_OWNER = ~0ULL;
+
+	static Utils::Lock sharingLock{};
+	static Utils::SimpleAtomic<uint64_t> owner{NO_OWNER};
+	static size_t depth = 0;
+
+	// Locked operations write to tables that may still be shared, through the recursive mapping,
+	// and the resulting fault takes the lock again. The lock thus belongs to a processor, which
+	// runs with interrupts disabled while it holds it.
+	class SharingGuard {
+	private:
+		Interrupts::InterruptGuard irqGuard{};
+
+	public:
+		SharingGuard() {
+			UnattachedSelf* const self = UnattachedSelf::TryAttach();
+			const uint64_t id = self != nullptr ? self->GetID() : 0;
+
+			if (owner.load() != id) {
+				sharingLock.lock();
+				owner.store(id);
+			}
+
+			++depth;
+		}
+
+		~SharingGuard() {
+			if (--depth == 0) {
+				owner.store(NO_OWNER);
+				sharingLock.unlock();
+			}
+		}
+
+		SharingGuard(const SharingGuard&) = delete;
+		SharingGuard& operator=(const SharingGuard&) = delete;
+	};
+
+	// the sharing lock must be held, so that a reference never goes away while a fault decides
+	// between copying and reusing
+	static void AddReference(uint64_t frame) {
+		const bool shared = PhysicalMemory::IsShared(frame);
+
+		if (PhysicalMemory::Get(frame).IsSuccess() && !shared) {
+			++sharedCount;
+		}
+	}
+
+	static bool DropReference(uint64_t frame) {
+		const bool last = PhysicalMemory::Put(frame);
+
+		if (!last && !PhysicalMemory::IsShared(frame)) {
+			--sharedCount;
+		}
+
+		return last;
+	}
+
+	/// Paging entries
+
+	static inline uint64_t* EntryAddress(const ShdMem::VirtualAddress& mapping, size_t level, bool usePrimary) {
+		switch (level) {
+		case 0:
+			return Paging::GetPML4EAddress(mapping, usePrimary);
+		case 1:
+			return Paging::GetPDPTEAddress(mapping, usePrimary);
+		case 2:
+			return Paging::GetPDEAddress(mapping, usePrimary);
+		default:
+			return Paging::GetPTEAddress(mapping, usePrimary);
+		}
+	}
+
+	static inline bool IsLeaf(uint64_t entry, size_t level) {
+		return level == LEVELS - 1 || (level != 0 && (entry & ShdMem::PDE_PAGE_SIZE) != 0);
+	}
+
+	static inline uint64_t AddressMask(size_t level, bool leaf) {
+		if (leaf && level == 1) {
+			return ShdMem::PDPTE_1GB_ADDRESS;
+		}
+		else if (leaf && level == 2) {
+			return ShdMem::PDE_2MB_ADDRESS;
+		}
+
+		return ShdMem::PTE_ADDRESS;
+	}
+
+	// Takes a reference on whatever a present entry points to, or on the swap slot of a swapped out
+	// page, and returns the entry as it must look from both sides of the sharing.
+	static uint64_t ShareEntry(uint64_t entry, size_t level) {
+		if ((entry & ShdMem::PTE_PRESENT) != 0) {
+			AddReference(entry & AddressMask(level, IsLeaf(entry, level)));
+
+			if ((entry & ShdMem::PTE_READWRITE) != 0) {
+				entry = (entry & ~ShdMem::PTE_READWRITE) | CopyOnWrite::ENTRY_COW;
+			}
+		}
+		else if (level == LEVELS - 1 && entry != 0 && (entry & VirtualMemory::NP_ON_DEMAND) == 0) {
+			Swap::ShareSlot((entry & VirtualMemory::NP_INDEX) >> VirtualMemory::NP_INDEX_SHIFT);
+		}
+
+		return entry;
+	}
+
+	// the entry at level now points to a table of ours, its own shared entries must be protected
+	static void ProtectChildren(const ShdMem::VirtualAddress& mapping, size_t level) {
+		uint64_t* const table = reinterpret_cast<uint64_t*>(
+			reinterpret_cast<uint64_t>(EntryAddress(mapping, level, true)) & ~(ShdMem::PAGE_SIZE - 1)
+		);
+
+		for (size_t i = 0; i < ShdMem::PT_ENTRIES; ++i) {
+			const uint64_t entry = table[i];
+
+			if ((entry & (ShdMem::PTE_PRESENT | ShdMem::PTE_READWRITE)) == (ShdMem::PTE_PRESENT | ShdMem::PTE_READWRITE)
+				&& PhysicalMemory::IsShared(entry & AddressMask(level, IsLeaf(entry, level)))
+			) {
+				table[i] = (entry & ~ShdMem::PTE_READWRITE) | CopyOnWrite::ENTRY_COW;
+			}
+		}
+	}
+
+	// gives the current address space its own copy of what the entry points to, or its exclusive
+	// use when the other address spaces already let go of it
+	static Success Unshare(uint64_t* entry, size_t level, uint64_t address) {
+		const auto mapping = ShdMem::ParseVirtualAddress(address);
+		const uint64_t value = *entry;
+		const bool leaf = IsLeaf(value, level);
+		const uint64_t mask = AddressMask(level, leaf);
+		const uint64_t frame = value & mask;
+
+		if (!PhysicalMemory::IsShared(frame)) {
+			*entry = (value | ShdMem::PTE_READWRITE) & ~CopyOnWrite::ENTRY_COW;
+			Paging::InvalidatePage(reinterpret_cast<const void*>(address));
+
+			if (!leaf) {
+				Paging::InvalidatePage(EntryAddress(mapping, level + 1, true));
+				ProtectChildren(mapping, level + 1);
+			}
+
+			++reuseCount;
+
+			return Success();
+		}
+
+		uint8_t* copy = nullptr;
+
+		if (leaf) {
+			const uint64_t size = COVERAGE[level];
+
+			if (size == ShdMem::PDPTE_COVERAGE) {
+				return Failure();
+			}
+
+			copy = static_cast<uint8_t*>(
+				size == ShdMem::PDE_COVERAGE ? PhysicalMemory::Allocate2MB() : PhysicalMemory::Allocate()
+			);
+
+			if (copy == nullptr) {
+				return Failure();
+			}
+
+			const uint8_t* const source = reinterpret_cast<const uint8_t*>(address & ~(size - 1));
+
+			for (uint64_t offset = 0; offset < size; offset += ShdMem::FRAME_SIZE) {
+				Utils::memcpy(VirtualMemory::MapScratchFrame(copy + offset), source + offset, ShdMem::FRAME_SIZE);
+			}
+		}
+		else {
+			const uint64_t* const source = reinterpret_cast<const uint64_t*>(
+				reinterpret_cast<uint64_t>(EntryAddress(mapping, level + 1, true)) & ~(ShdMem::PAGE_SIZE - 1)
+			);
+
+			copy = static_cast<uint8_t*>(PhysicalMemory::Allocate());
+
+			if (copy == nullptr) {
+				return Failure();
+			}
+
+			uint64_t* const destination = static_cast<uint64_t*>(VirtualMemory::MapScratchFrame(copy));
+
+			for (size_t i = 0; i < ShdMem::PT_ENTRIES; ++i) {
+				destination[i] = ShareEntry(source[i], level + 1);
+			}
+		}
+
+		*entry = (value & ~mask & ~CopyOnWrite::ENTRY_COW)
+			| (PhysicalMemory::FilterAddress(copy) & mask)
+			| ShdMem::PTE_READWRITE;
+
+		DropReference(frame);
+
+		Paging::InvalidatePage(reinterpret_cast<const void*>(address));
+
+		if (!leaf) {
+			Paging::InvalidatePage(EntryAddress(mapping, level + 1, true));
+		}
+
+		++copyCount;
+
+		return Success();
+	}
+}
+
+namespace CopyOnWrite {
+	void InitializeProcessor() {
+		uint64_t cr0 = 0;
+
+		__asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+		__asm__ volatile("mov %0, %%cr0" :: "r"(cr0 | CR0_WP) : "memory");
+	}
+
+	Success Share(uint64_t frame) {
+		SharingGuard _{};
+
+		if (PhysicalMemory::GetDescriptor(frame) == nullptr) {
+			return Failure();
+		}
+
+		AddReference(frame);
+
+		return Success();
+	}
+
+	bool Release(uint64_t frame) {
+		SharingGuard _{};
+
+		return DropReference(frame);
+	}
+
+	bool IsShared(uint64_t frame) {
+		SharingGuard _{};
+
+		return PhysicalMemory::IsShared(frame);
+	}
+
+	Success ShareRange(uint64_t start, uint64_t size) {
+		SharingGuard _{};
+
+		bool parentProtected = false;
+		uint64_t address = start;
+
+		// sizes rather than ends, a range may stop at the very top of the address space
+		while (address - start < size) {
+			const auto mapping = ShdMem::ParseVirtualAddress(address);
+
+			for (size_t level = 0; level < LEVELS; ++level) {
+				uint64_t* const parent = EntryAddress(mapping, level, true);
+				uint64_t* const child = EntryAddress(mapping, level, false);
+
+				const uint64_t value = *parent;
+				const bool present = (value & ShdMem::PTE_PRESENT) != 0;
+				const bool leaf = IsLeaf(value, level);
+				const uint64_t next = (address & ~(COVERAGE[level] - 1)) + COVERAGE[level];
+
+				// nothing to share, or both sides already use the same table
+				if (value == 0 || (!present && !leaf) || *child == value) {
+					address = next;
+					break;
+				}
+
+				if (*child == 0 && address % COVERAGE[level] == 0 && next - start <= size) {
+					const uint64_t shared = ShareEntry(value, level);
+
+					if (shared != value) {
+						*parent = shared;
+						parentProtected = true;
+					}
+
+					*child = shared;
+
+					address = next;
+					break;
+				}
+				else if (leaf || (*child != 0 && ((*child & ShdMem::PTE_PRESENT) == 0 || IsLeaf(*child, level)))) {
+					// the new address space has a mapping of its own there
+					address = next;
+					break;
+				}
+				else if (*child == 0) {
+					void* const table = PhysicalMemory::Allocate(PhysicalMemory::Fill::ZERO);
+
+					if (table == nullptr) {
+						return Failure();
+					}
+
+					*child = (PhysicalMemory::FilterAddress(table) & ShdMem::PTE_ADDRESS)
+						| (value & ShdMem::PTE_USERMODE)
+						| ShdMem::PTE_READWRITE
+						| ShdMem::PTE_PRESENT;
+
+					Paging::InvalidatePage(EntryAddress(mapping, level + 1, false));
+				}
+			}
+		}
+
+		// the pages of the current address space may still be cached as writable
+		if (parentProtected) {
+			Paging::InvalidateTLB();
+		}
+
+		return Success();
+	}
+
+	Success Resolve(const void* address) {
+		SharingGuard _{};
+
+		uint64_t target = reinterpret_cast<uint64_t>(address);
+		size_t levels = LEVELS;
+
+		// A write to a page table through the recursive mapping needs the path to that table,
+		// which is one level shorter for each recursive index at the top of the address.
+		while (levels != 0 && ShdMem::ParseVirtualAddress(target).PML4_offset == RECURSIVE_INDEX) {
+			target = static_cast<uint64_t>(static_cast<int64_t>(target << 25) >> 16);
+			--levels;
+		}
+
+		const auto mapping = ShdMem::ParseVirtualAddress(target);
+
+		if (levels == 0) {
+			return Failure();
+		}
+
+		for (size_t level = 0; level < levels; ++level) {
+			uint64_t* const entry = EntryAddress(mapping, level, true);
+			const uint64_t value = *entry;
+
+			if ((value & ShdMem::PTE_PRESENT) == 0) {
+				return Failure();
+			}
+			else if ((value & ENTRY_COW) != 0) {
+				if (!Unshare(entry, level, target).IsSuccess()) {
+					return Failure();
+				}
+			}
+			else if ((value & ShdMem::PTE_READWRITE) == 0) {
+				return Failure();
+			}
+
+			if (IsLeaf(value, level)) {
+				break;
+			}
+		}
+
+		// without anything to unshare, the fault came from a stale read-only translation
+		Paging::InvalidatePage(address);
+
+		return Success();
+	}
+
+	void QueryStatistics(Statistics& stats) {
+		SharingGuard _{};
+
+		stats.sharedFrames = sharedCount;
+		stats.copies = copyCount;
+		stats.reuses = reuseCount;
+	}
+}
@@ -12,18 +12,25 @@
 // You should have received a copy of the GNU General Public License along with this program.
 // If not, see <https://www.gnu.org/licenses/>. 
 
+#include <bit>
 #include <cstddef>
 #include <cstdint>
 
 #include <shared/Lock.hpp>
 #include <shared/LockGuard.hpp>
+#include <shared/TicketLock.hpp>
 #include <shared/memory/defs.hpp>
 
+#include <interrupts/InterruptGuard.hpp>
+
+#include <mm/Magazine.hpp>
 #include <mm/PhysicalMemory.hpp>
 #include <mm/VirtualMemory.hpp>
 #include <mm/Heap.hpp>
 #include <mm/Utils.hpp>
 
+#include <sched/Self.hpp>
+
 namespace ShdMem = Shared::Memory;
 
 namespace {
@@ -34,14 +41,48 @@ namespace {
 		return x > y ? x : y;
 	}
 
+	// Every block starts with a tag holding its size and state bits; free blocks
+	// additionally carry a tree node and a footer with their size, so that freeing
+	// can find and merge both neighbours in O(1). Each arena ends with a zero-sized
+	// allocated sentinel, which stops forward coalescing.
+	static constexpr uint64_t BLOCK_FREE 		= 1 << 0;
+	static constexpr uint64_t BLOCK_PREV_FREE 	= 1 << 1;
+	static constexpr uint64_t BLOCK_ARENA_START = 1 << 2;
+	static constexpr uint64_t BLOCK_FLAGS 		= ARENA_ALIGNMENT - 1;
+
 	struct AllocatedNode {
-		uint64_t size;
+		uint64_t tag;
+
+		uint64_t GetSize() const {
+			return tag & ~BLOCK_FLAGS;
+		}
+
+		AllocatedNode* GetNext() const {
+			return reinterpret_cast<AllocatedNode*>(reinterpret_cast<uintptr_t>(this) + GetSize());
+		}
+
+		AllocatedNode* GetPrevious() const {
+			const uint64_t* footer = reinterpret_cast<const uint64_t*>(this) - 1;
+			return reinterpret_cast<AllocatedNode*>(reinterpret_cast<uintptr_t>(this) - *footer);
+		}
+
+		void WriteFooter() {
+			*(reinterpret_cast<uint64_t*>(GetNext()) - 1) = GetSize();
+		}
+	};
+
+	struct Arena {
+		uint64_t pages;
+		bool bootstrap;
 	};
 
+	static_assert(sizeof(Arena) % ARENA_ALIGNMENT == 0);
+
 	class AVLHeap {
 	public:
 		AVLHeap();
-		AVLHeap(uint8_t* arena, size_t size);
+
+		bool AddArena(void* base, size_t pages, bool bootstrap);
 
 		void* Allocate(uint64_t size);
 		void Free(void* ptr);
@@ -49,20 +90,20 @@ namespace {
 		struct Node;
 
 	private:
-		Node* arenaRoot = nullptr;
+		Node* sizeRoot = nullptr;
 	};
 
-	struct AVLHeap::Node{
+	// free blocks are indexed by (size, address), which keeps keys unique and makes
+	// best fit a single root-to-leaf descent
+	struct AVLHeap::Node : AllocatedNode {
 	private:
 		static uint64_t GetHeight(const Node* n) {
 			return n == nullptr ? 0 : n->height;
 		}
 
 	public:
-		uint64_t size;
 		Node* left;
 		Node* right;
-		Node* parent;
 		uint64_t height;
 
 		void UpdateHeight() {
@@ -73,33 +114,16 @@ namespace {
 			return GetHeight(left) - GetHeight(right);
 		}
 
-		static Node* RotateLeft(Node* root) {
-			Node* newRoot;
+		bool IsOrderedBefore(const Node* other) const {
+			return GetSize() < other->GetSize() || (GetSize() == other->GetSize() && this < other);
+		}
 
-			if (root == nullptr || (newRoot = root->right) == nullptr) {
-				return root;
-			}
+		static Node* RotateLeft(Node* root) {
+			Node* newRoot = root->right;
 
 			root->right = newRoot->left;
 			newRoot->left = root;
 
-			if (root->right != nullptr) {
-				root->right->parent = root;
-			}
-
-			Node* parent = root->parent;
-			root->parent = newRoot;
-			newRoot->parent = parent;
-
-			if (parent != nullptr) {
-				if (root < parent) {
-					parent->left = newRoot;
-				}
-				else {
-					parent->right = newRoot;
-				}
-			}
-
 			root->UpdateHeight();
 			newRoot->UpdateHeight();
 
@@ -107,425 +131,672 @@ namespace {
 		}
 
 		static Node* RotateRight(Node* root) {
-			Node* newRoot;
-
-			if (root == nullptr || (newRoot = root->left) == nullptr) {
-				return root;
-			}
+			Node* newRoot = root->left;
 
 			root->left = newRoot->right;
 			newRoot->right = root;
 
-			if (root->left != nullptr) {
-				root->left->parent = root;
-			}
-
-			Node* parent = root->parent;
-			root->parent = newRoot;
-			newRoot->parent = parent;
-
-			if (parent != nullptr) {
-				if (root < parent) {
-					parent->left = newRoot;
-				}
-				else {
-					parent->right = newRoot;
-				}
-			}
-
 			root->UpdateHeight();
 			newRoot->UpdateHeight();
 
 			return newRoot;
 		}
-
-		static Node* RotateRightLeft(Node* root) {
-			Node* newSubRoot = RotateRight(root->right);
-			root->right = newSubRoot;
-			return RotateLeft(root);
-		}
-
-		static Node* RotateLeftRight(Node* root) {
-			Node* newSubRoot = RotateLeft(root->left);
-			root->left = newSubRoot;
-			return RotateRight(root);
-		}
 	};
 
 	using Node = AVLHeap::Node;
 	using Tree = Node;
 
-	static Tree* Rebalance(Tree* root, Tree* ptr) {
+	static constexpr size_t MIN_BLOCK_SIZE = sizeof(Node) + sizeof(uint64_t);
+
+	static_assert(MIN_BLOCK_SIZE % ARENA_ALIGNMENT == 0);
+
+	static Tree* Rebalance(Tree* root) {
 		root->UpdateHeight();
 
 		const int64_t balanceFactor = root->GetBalanceFactor();
 
-		if (balanceFactor < -1 || balanceFactor > 1) {
-			if (ptr > root && ptr > root->right) {
-				root = Node::RotateLeft(root);
-			}
-			else if (ptr < root && ptr < root->left) {
-				root = Node::RotateRight(root);
+		if (balanceFactor > 1) {
+			if (root->left->GetBalanceFactor() < 0) {
+				root->left = Node::RotateLeft(root->left);
 			}
-			else if (ptr > root && ptr < root->right) {
-				root = Node::RotateRightLeft(root);
-			}
-			else if (ptr < root && ptr > root->left) {
-				root = Node::RotateLeftRight(root);
+
+			return Node::RotateRight(root);
+		}
+		else if (balanceFactor < -1) {
+			if (root->right->GetBalanceFactor() > 0) {
+				root->right = Node::RotateRight(root->right);
 			}
+
+			return Node::RotateLeft(root);
 		}
 
 		return root;
 	}
 
-	static Tree* Insert(Tree* root, AllocatedNode* _n) {
-		Node* n = (Node*)_n;
-
+	static Tree* Insert(Tree* root, Node* n) {
 		if (root == nullptr) {
-			*n = Node{
-				.size = _n->size,
-				.left = nullptr,
-				.right = nullptr,
-				.parent = nullptr,
-				.height = 1
-			};
+			n->left = nullptr;
+			n->right = nullptr;
+			n->height = 1;
 			return n;
 		}
 
-		Node* prev = root;
-		Node* curr = root;
+		if (n->IsOrderedBefore(root)) {
+			root->left = Insert(root->left, n);
+		}
+		else {
+			root->right = Insert(root->right, n);
+		}
+
+		return Rebalance(root);
+	}
+
+	static Tree* DeleteMin(Tree* root, Node*& min) {
+		if (root->left == nullptr) {
+			min = root;
+			return root->right;
+		}
+
+		root->left = DeleteMin(root->left, min);
 
-		while (curr != nullptr) {
-			prev = curr;
+		return Rebalance(root);
+	}
 
-			if (n < curr) {
-				curr = curr->left;
+	static Tree* Delete(Tree* root, Node* node) {
+		if (root == nullptr) {
+			return nullptr;
+		}
+
+		if (root == node) {
+			if (root->left == nullptr) {
+				return root->right;
 			}
-			else if (n > curr) {
-				curr = curr->right;
+			else if (root->right == nullptr) {
+				return root->left;
+			}
+
+			Node* successor;
+			Node* right = DeleteMin(root->right, successor);
+
+			successor->left = root->left;
+			successor->right = right;
+
+			return Rebalance(successor);
+		}
+
+		if (node->IsOrderedBefore(root)) {
+			root->left = Delete(root->left, node);
+		}
+		else {
+			root->right = Delete(root->right, node);
+		}
+
+		return Rebalance(root);
+	}
+
+	static Node* BestFind(Tree* root, uint64_t size) {
+		Node* best = nullptr;
+
+		while (root != nullptr) {
+			if (root->GetSize() >= size) {
+				best = root;
+				root = root->left;
 			}
 			else {
-				return root;
+				root = root->right;
 			}
 		}
 
-		*n = {
-			.size = _n->size,
-			.left = nullptr,
-			.right = nullptr,
-			.parent = prev,
-			.height = 1
-		};
+		return best;
+	}
+
+	static void MarkFree(Tree*& root, AllocatedNode* block, uint64_t size, uint64_t flags) {
+		block->tag = size | BLOCK_FREE | flags;
+		block->WriteFooter();
+		block->GetNext()->tag |= BLOCK_PREV_FREE;
+
+		root = Insert(root, static_cast<Node*>(block));
+	}
+
+	static void* Allocate(Tree*& root, uint64_t size) {
+		size += sizeof(AllocatedNode);
 
-		if (n < prev) {
-			prev->left = n;
+		uint64_t misalignment = size % ARENA_ALIGNMENT;
+
+		if (misalignment != 0) {
+			size += ARENA_ALIGNMENT - misalignment;
 		}
-		else {
-			prev->right = n;
+
+		if (size < MIN_BLOCK_SIZE) {
+			size = MIN_BLOCK_SIZE;
+		}
+
+		Node* node = BestFind(root, size);
+
+		if (node == nullptr) {
+			return nullptr;
 		}
 
-		for (; prev != nullptr; curr = prev, prev = prev->parent) {
-			prev = Rebalance(prev, n);
+		root = Delete(root, node);
+
+		AllocatedNode* block = node;
+		const uint64_t available = block->GetSize();
+		const uint64_t flags = block->tag & BLOCK_ARENA_START;
+
+		if (available - size >= MIN_BLOCK_SIZE) {
+			block->tag = size | flags;
+			MarkFree(root, block->GetNext(), available - size, 0);
+		}
+		else {
+			block->tag = available | flags;
+			block->GetNext()->tag &= ~BLOCK_PREV_FREE;
 		}
 
-		return curr;
+		return reinterpret_cast<uint8_t*>(block) + sizeof(AllocatedNode);
 	}
 
-	static Tree* Delete(Tree* root, Node* node) {
-		if (root == nullptr || node == nullptr) {
-			return root;
-		}
+	// returns the arena if the freed block made it entirely free, in which case the block is not indexed
+	static Arena* Free(Tree*& root, void* pointer) {
+		AllocatedNode* block = reinterpret_cast<AllocatedNode*>(static_cast<uint8_t*>(pointer) - sizeof(AllocatedNode));
 
-		Node* prev = node->parent;
+		uint64_t size = block->GetSize();
+		uint64_t flags = block->tag & BLOCK_ARENA_START;
 
-		Node* left = node->left;
-		Node* right = node->right;
+		AllocatedNode* next = block->GetNext();
 
-		if (left == nullptr && right == nullptr) {
-			if (prev == nullptr) {
-				root = nullptr;
-			}
-			else if (node > prev) {
-				prev->right = nullptr;
-			}
-			else {
-				prev->left = nullptr;
-			}
+		if ((next->tag & BLOCK_FREE) != 0) {
+			root = Delete(root, static_cast<Node*>(next));
+			size += next->GetSize();
 		}
-		else if (right == nullptr) {
-			left->parent = prev;
 
-			if (prev == nullptr) {
-				root = left;
-			}
-			else if (node > prev) {
-				prev->right = left;
-			}
-			else {
-				prev->left = left;
-			}
+		if ((block->tag & BLOCK_PREV_FREE) != 0) {
+			AllocatedNode* prev = block->GetPrevious();
+
+			root = Delete(root, static_cast<Node*>(prev));
+			size += prev->GetSize();
+			flags = prev->tag & BLOCK_ARENA_START;
+			block = prev;
 		}
-		else if (left == nullptr) {
-			right->parent = prev;
 
-			if (prev == nullptr) {
-				root = right;
-			}
-			else if (node > prev) {
-				prev->right = right;
-			}
-			else {
-				prev->left = right;
+		const AllocatedNode* sentinel = reinterpret_cast<AllocatedNode*>(reinterpret_cast<uintptr_t>(block) + size);
+
+		if ((flags & BLOCK_ARENA_START) != 0 && sentinel->GetSize() == 0) {
+			Arena* arena = reinterpret_cast<Arena*>(block) - 1;
+
+			if (!arena->bootstrap) {
+				return arena;
 			}
 		}
-		else {
-			Node* ptr = right;
-			Node* successor = ptr;
 
-			while (ptr != nullptr) {
-				successor = ptr;
-				ptr = ptr->left;
-			}
+		MarkFree(root, block, size, flags);
 
-			Node* new_prev;
+		return nullptr;
+	}
 
-			if (successor->parent != node) {
-				successor->parent->left = successor->right;
+	AVLHeap::AVLHeap() {
+		sizeRoot = nullptr;
+	}
 
-				if (successor->right != nullptr) {
-					successor->right->parent = successor->parent;
-				}
+	bool AVLHeap::AddArena(void* base, size_t pages, bool bootstrap) {
+		const size_t arena_size = pages * ShdMem::PAGE_SIZE;
 
-				new_prev = successor->parent;
+		if (arena_size < sizeof(Arena) + MIN_BLOCK_SIZE + sizeof(AllocatedNode)) {
+			return false;
+		}
 
-				successor->right = right;
-				right->parent = successor;
-			}
-			else {
-				new_prev = successor;
-			}
+		Arena* arena = static_cast<Arena*>(base);
+		arena->pages = pages;
+		arena->bootstrap = bootstrap;
 
-			successor->left = left;
-			left->parent = successor;
-			successor->parent = prev;
+		AllocatedNode* block = reinterpret_cast<AllocatedNode*>(arena + 1);
+		AllocatedNode* sentinel = reinterpret_cast<AllocatedNode*>(
+			static_cast<uint8_t*>(base) + arena_size - sizeof(AllocatedNode)
+		);
 
-			successor->UpdateHeight();
+		sentinel->tag = 0;
 
-			if (prev == nullptr) {
-				root = successor;
-			}
-			else {
-				if (successor < prev) {
-					prev->left = successor;
-				}
-				else {
-					prev->right = successor;
-				}
-			}
+		MarkFree(
+			sizeRoot,
+			block,
+			reinterpret_cast<uintptr_t>(sentinel) - reinterpret_cast<uintptr_t>(block),
+			BLOCK_ARENA_START
+		);
+
+		return true;
+	}
+
+	static bool ExtendArena(AVLHeap& heap, size_t size) {
+		const size_t effective_size = 2 * (size + sizeof(AllocatedNode)) + sizeof(Arena) + MIN_BLOCK_SIZE;
+		const size_t allocated_pages = (effective_size + ShdMem::PAGE_SIZE - 1) / ShdMem::PAGE_SIZE;
+
+		void* ptr = VirtualMemory::AllocateKernelHeap(allocated_pages);
 
-			prev = new_prev;
+		if (ptr == nullptr) {
+			return false;
 		}
 
-		if (prev == nullptr) {
-			if (root == nullptr) {
-				return nullptr;
-			}
-			else {
-				return Rebalance(root, node);
-			}
+		return heap.AddArena(ptr, allocated_pages, false);
+	}
+
+	void* AVLHeap::Allocate(uint64_t size) {
+		void* ptr = ::Allocate(sizeRoot, size);
+
+		if (ptr == nullptr && ExtendArena(*this, size)) {
+			ptr = ::Allocate(sizeRoot, size);
 		}
-		else {
-			Node* subroot = nullptr;
 
-			for (; prev != nullptr; subroot = prev, prev = prev->parent) {
-				prev->UpdateHeight();
+		return ptr;
+	}
 
-				const int64_t balanceFactor = prev->GetBalanceFactor();
+	void AVLHeap::Free(void* ptr) {
+		Arena* arena = ::Free(sizeRoot, ptr);
 
-				if (balanceFactor > 1) {
-					if (prev->left->GetBalanceFactor() >= 0) {
-						prev = Node::RotateRight(prev);
-					}
-					else {
-						prev = Node::RotateLeftRight(prev);
-					}
-				}
-				else if (balanceFactor < -1) {
-					if (prev->right->GetBalanceFactor() > 0) {
-						prev = Node::RotateRightLeft(prev);
-					}
-					else {
-						prev = Node::RotateLeft(prev);
-					}
-				}
-			}
+		if (arena != nullptr) {
+			VirtualMemory::FreeKernelHeap(arena, arena->pages);
+		}
+	}
+
+	static bool CreateAVLHeap(AVLHeap& heap) {
+		const size_t allocated_pages = 16;
 
-			return subroot;
+		void* pages = VirtualMemory::AllocateKernelHeap(allocated_pages);
+
+		if (pages == nullptr) {
+			return false;
 		}
+
+		heap = AVLHeap();
+
+		return heap.AddArena(pages, allocated_pages, true);
 	}
 
-	static Node* BestFind(Tree* root, uint64_t size) {
-		if (root == nullptr) {
-			return nullptr;
+	// Small objects are served from fixed size classes carved out of 4 KiB pages.
+	// All slab pages live in one contiguous on-demand region reserved at boot, so
+	// telling a slab pointer apart from an AVL block is a range check, and finding
+	// its descriptor is an index computation.
+	class SlabHeap {
+	public:
+		static constexpr size_t MIN_OBJECT_SHIFT = 4;
+		static constexpr size_t CLASSES = Heap::SIZE_CLASSES;
+		static constexpr size_t MAX_OBJECT_SIZE = size_t(1) << (MIN_OBJECT_SHIFT + CLASSES - 1);
+		static constexpr size_t REGION_PAGES = 0x4000;
+
+		static_assert(MAX_OBJECT_SIZE <= ShdMem::PAGE_SIZE / 2);
+
+		static constexpr size_t ClassIndex(size_t size) {
+			return size <= (size_t(1) << MIN_OBJECT_SHIFT)
+				? 0
+				: std::bit_width(size - 1) - MIN_OBJECT_SHIFT;
 		}
 
-		if (root->size == size) {
-			return root;
+		static constexpr size_t ClassSize(size_t index) {
+			return size_t(1) << (MIN_OBJECT_SHIFT + index);
 		}
 
-		Node* left = BestFind(root->left, size);
+		bool Create();
+		bool Owns(const void* ptr) const;
+
+		void* Allocate(size_t index);
+		void Free(void* ptr);
+
+		size_t AllocateBatch(size_t index, void** objects, size_t count);
+		void FreeBatch(size_t index, void* const* objects, size_t count);
+
+		size_t ClassOf(const void* ptr) const;
+
+		void QueryStatistics(Heap::Statistics& stats);
+
+	private:
+		struct FreeObject {
+			FreeObject* next;
+		};
+
+		// out-of-line page descriptor, so that a 2 KiB class still fits two objects per page
+		struct Page {
+			FreeObject* freeList;
+			Page* next;
+			Page* prev;
+			uint16_t sizeClass;
+			uint16_t inUse;
+			uint16_t bumped;
+			uint16_t capacity;
+		};
 
-		if (left != nullptr && left->size == size) {
-			return left;
+		struct SizeClass {
+			Utils::Lock lock;
+			Page* partial = nullptr;
+			uint64_t allocations = 0;
+			uint64_t frees = 0;
+			uint64_t pages = 0;
+		};
+
+		static constexpr size_t DESCRIPTOR_PAGES =
+			(REGION_PAGES * sizeof(Page) + ShdMem::PAGE_SIZE - 1) / ShdMem::PAGE_SIZE;
+
+		Page* descriptors = nullptr;
+		uint8_t* pagesStart = nullptr;
+		uint8_t* pagesEnd = nullptr;
+
+		Utils::Lock pagesLock;
+		uint8_t* pagesCursor = nullptr;
+		Page* emptyPages = nullptr;
+
+		SizeClass classes[CLASSES];
+
+		uint8_t* PageAddress(const Page* page) const {
+			return pagesStart + (page - descriptors) * ShdMem::PAGE_SIZE;
+		}
+
+		Page* PageDescriptor(const void* ptr) const {
+			return descriptors + (static_cast<const uint8_t*>(ptr) - pagesStart) / ShdMem::PAGE_SIZE;
 		}
-			
-		Node* right = BestFind(root->right, size);
 
-		Node* nodes[3] = { root, left, right };
-		uint64_t sizes[3] = { root->size, left != nullptr ? left->size : 0, right != nullptr ? right->size : 0 };
+		static void Unlink(Page*& head, Page* page) {
+			if (page->prev != nullptr) {
+				page->prev->next = page->next;
+			}
+			else {
+				head = page->next;
+			}
 
-		for (size_t i = 0; i < 3; ++i) {
-			if (sizes[i] < size) {
-				sizes[i] = 0;
-				nodes[i] = nullptr;
+			if (page->next != nullptr) {
+				page->next->prev = page->prev;
 			}
+
+			page->next = nullptr;
+			page->prev = nullptr;
 		}
 
-		size_t best_fit = 0;
+		static void Push(Page*& head, Page* page) {
+			page->prev = nullptr;
+			page->next = head;
 
-		for (size_t i = 0; i < 3; ++i) {
-			if (sizes[i] > 0 && sizes[i] < sizes[best_fit] && sizes[i] >= size) {
-				best_fit = i;
+			if (head != nullptr) {
+				head->prev = page;
 			}
+
+			head = page;
 		}
 
-		return nodes[best_fit];
-	}
+		Page* AcquirePage(size_t index);
+		void ReleasePage(Page* page);
 
-	static AllocatedNode* ExtendArena(size_t size) {
-		const size_t effective_size = 2 * size;
-		const size_t allocated_pages = (effective_size + ShdMem::PAGE_SIZE - 1) / ShdMem::PAGE_SIZE;
-		const size_t allocated_size = allocated_pages * ShdMem::PAGE_SIZE;
+		void* AllocateLocked(SizeClass& sc, size_t index);
+		void FreeLocked(SizeClass& sc, void* ptr);
+	};
 
-		void* ptr = VirtualMemory::AllocateKernelHeap(allocated_pages);
+	bool SlabHeap::Create() {
+		uint8_t* region = static_cast<uint8_t*>(
+			VirtualMemory::ReserveKernelHeap(DESCRIPTOR_PAGES + REGION_PAGES)
+		);
 
-		if (ptr == nullptr) {
-			return nullptr;
+		if (region == nullptr) {
+			return false;
 		}
 
-		Utils::memset(ptr, 0, allocated_size);
+		// the region is mapped on demand, descriptors are only backed once their page is touched
+		descriptors = reinterpret_cast<Page*>(region);
+		pagesStart = region + DESCRIPTOR_PAGES * ShdMem::PAGE_SIZE;
+		pagesEnd = pagesStart + REGION_PAGES * ShdMem::PAGE_SIZE;
+		pagesCursor = pagesStart;
 
-		AllocatedNode* node = (AllocatedNode*)ptr;
-		node->size = allocated_size;
-		return node;
+		return true;
 	}
 
-	static void* Allocate(Tree*& root, uint64_t size) {
-		size += sizeof(AllocatedNode);
+	bool SlabHeap::Owns(const void* ptr) const {
+		return ptr >= pagesStart && ptr < pagesEnd;
+	}
 
-		if (size < sizeof(Node)) {
-			size = sizeof(Node);
-		}
+	SlabHeap::Page* SlabHeap::AcquirePage(size_t index) {
+		Page* page = nullptr;
 
-		uint64_t misalignment = size % ARENA_ALIGNMENT;
+		{
+			Utils::LockGuard _{pagesLock};
 
-		if (misalignment != 0) {
-			size += ARENA_ALIGNMENT - misalignment;
+			if (emptyPages != nullptr) {
+				page = emptyPages;
+				Unlink(emptyPages, page);
+			}
+			else if (pagesCursor < pagesEnd) {
+				page = PageDescriptor(pagesCursor);
+				pagesCursor += ShdMem::PAGE_SIZE;
+			}
 		}
 
-		Node* node = BestFind(root, size);
+		if (page != nullptr) {
+			*page = Page{
+				.freeList = nullptr,
+				.next = nullptr,
+				.prev = nullptr,
+				.sizeClass = static_cast<uint16_t>(index),
+				.inUse = 0,
+				.bumped = 0,
+				.capacity = static_cast<uint16_t>(ShdMem::PAGE_SIZE / ClassSize(index))
+			};
+		}
 
-		if (node == nullptr) {
-			AllocatedNode* node = ExtendArena(size);
+		return page;
+	}
 
-			if (node == nullptr) {
+	void SlabHeap::ReleasePage(Page* page) {
+		Utils::LockGuard _{pagesLock};
+		Push(emptyPages, page);
+	}
+
+	void* SlabHeap::AllocateLocked(SizeClass& sc, size_t index) {
+		Page* page = sc.partial;
+
+		if (page == nullptr) {
+			page = AcquirePage(index);
+
+			if (page == nullptr) {
 				return nullptr;
 			}
 
-			uint8_t* pointer = (uint8_t*)node + node->size - size;
-			node->size -= size;
-			((AllocatedNode*)pointer)->size = size;
-
-			root = Insert(root, node);
-			return pointer + sizeof(AllocatedNode);
+			Push(sc.partial, page);
+			++sc.pages;
 		}
 
-		if (node->size > size && node->size - size >= sizeof(Node)) {
-			uint8_t* pointer = (uint8_t*)node + node->size - size;
-			((AllocatedNode*)pointer)->size = size;
-
-			node->size -= size;
+		void* object;
 
-			return pointer + sizeof(AllocatedNode);
+		if (page->freeList != nullptr) {
+			object = page->freeList;
+			page->freeList = page->freeList->next;
 		}
 		else {
-			root = Delete(root, node);
+			object = PageAddress(page) + page->bumped++ * ClassSize(index);
+		}
 
-			((AllocatedNode*)node)->size = node->size;
-			return ((uint8_t*)node) + sizeof(AllocatedNode);
+		if (++page->inUse == page->capacity) {
+			Unlink(sc.partial, page);
 		}
+
+		return object;
 	}
 
-	static void Free(Tree*& root, void* pointer) {
-		AllocatedNode* allocatedNode = (AllocatedNode*)((uint8_t*)pointer - sizeof(AllocatedNode));
+	void SlabHeap::FreeLocked(SizeClass& sc, void* ptr) {
+		Page* page = PageDescriptor(ptr);
 
-		root = Insert(root, allocatedNode);
-	}
+		FreeObject* object = static_cast<FreeObject*>(ptr);
+		object->next = page->freeList;
+		page->freeList = object;
 
-	AVLHeap::AVLHeap() {
-		arenaRoot = nullptr;
+		if (page->inUse-- == page->capacity) {
+			Push(sc.partial, page);
+		}
+
+		// keep one partial page per class around to avoid bouncing on alloc/free pairs
+		if (page->inUse == 0 && (page->next != nullptr || page->prev != nullptr)) {
+			Unlink(sc.partial, page);
+			--sc.pages;
+			ReleasePage(page);
+		}
 	}
 
-	AVLHeap::AVLHeap(uint8_t* arena, size_t size) {
-		arenaRoot = (Node*)arena;
-		*arenaRoot = Node{
-			.size = size,
-			.left = nullptr,
-			.right = nullptr,
-			.parent = nullptr,
-			.height = 1
-		};
+	void* SlabHeap::Allocate(size_t index) {
+		SizeClass& sc = classes[index];
+
+		Utils::LockGuard _{sc.lock};
+		void* const object = AllocateLocked(sc, index);
+
+		if (object != nullptr) {
+			++sc.allocations;
+		}
+
+		return object;
 	}
 
-	void* AVLHeap::Allocate(uint64_t size) {
-		return ::Allocate(arenaRoot, size);
+	void SlabHeap::Free(void* ptr) {
+		SizeClass& sc = classes[ClassOf(ptr)];
+
+		Utils::LockGuard _{sc.lock};
+		++sc.frees;
+		FreeLocked(sc, ptr);
 	}
 
-	void AVLHeap::Free(void* ptr) {
-		return ::Free(arenaRoot, ptr);
+	size_t SlabHeap::AllocateBatch(size_t index, void** objects, size_t count) {
+		SizeClass& sc = classes[index];
+
+		Utils::LockGuard _{sc.lock};
+
+		for (size_t i = 0; i < count; ++i) {
+			objects[i] = AllocateLocked(sc, index);
+
+			if (objects[i] == nullptr) {
+				return i;
+			}
+		}
+
+		return count;
 	}
 
-	static bool CreateAVLHeap(AVLHeap& heap) {
-		const size_t allocated_pages = 16;
-		const size_t allocated_memory = allocated_pages * ShdMem::PAGE_SIZE;
+	void SlabHeap::FreeBatch(size_t index, void* const* objects, size_t count) {
+		SizeClass& sc = classes[index];
 
-		void* pages = VirtualMemory::AllocateKernelHeap(allocated_pages);
+		Utils::LockGuard _{sc.lock};
 
-		if (pages == nullptr) {
-			return false;
+		for (size_t i = 0; i < count; ++i) {
+			FreeLocked(sc, objects[i]);
 		}
+	}
 
-		Utils::memset(pages, 0, allocated_memory);
+	size_t SlabHeap::ClassOf(const void* ptr) const {
+		return PageDescriptor(ptr)->sizeClass;
+	}
 
-		heap = AVLHeap((uint8_t*)pages, allocated_memory);
+	void SlabHeap::QueryStatistics(Heap::Statistics& stats) {
+		for (size_t i = 0; i < CLASSES; ++i) {
+			Utils::LockGuard _{classes[i].lock};
 
-		return true;
+			stats.classes[i] = Heap::SizeClassStatistics{
+				.objectSize = ClassSize(i),
+				.allocations = classes[i].allocations,
+				.frees = classes[i].frees,
+				.refills = 0,
+				.pages = classes[i].pages
+			};
+		}
 	}
 
-	static Utils::Lock heapLock;
+	static Utils::TicketLock heapLock;
 	static AVLHeap heap;
+	static SlabHeap slabs;
+
+	static uint64_t largeAllocations = 0;
+	static uint64_t largeFrees = 0;
 }
 
 bool Heap::Create() {
-	return CreateAVLHeap(heap);
+	return CreateAVLHeap(heap) && slabs.Create();
 }
 
 void* Heap::Allocate(size_t size) {
+	if (size <= SlabHeap::MAX_OBJECT_SIZE) {
+		const size_t index = SlabHeap::ClassIndex(size);
+
+		Interrupts::InterruptGuard irqGuard{};
+
+		UnattachedSelf* self = UnattachedSelf::TryAttach();
+
+		if (self != nullptr) {
+			auto& cache = self->GetMemoryCache();
+			auto& magazine = cache.objects[index];
+
+			if (magazine.IsEmpty()) {
+				magazine.count = slabs.AllocateBatch(index, magazine.rounds, magazine.BATCH);
+
+				// an empty batch falls through to the large heap, and refilled nothing
+				if (magazine.count != 0) {
+					++cache.refills[index];
+				}
+			}
+
+			if (!magazine.IsEmpty()) {
+				++cache.allocations[index];
+				return magazine.Pop();
+			}
+		}
+		else {
+			void* ptr = slabs.Allocate(index);
+
+			if (ptr != nullptr) {
+				return ptr;
+			}
+		}
+	}
+
 	Utils::LockGuard _{heapLock};
+	++largeAllocations;
 	return heap.Allocate(size);
 }
 
 void Heap::Free(void* ptr) {
+	if (ptr == nullptr) {
+		return;
+	}
+	else if (slabs.Owns(ptr)) {
+		Interrupts::InterruptGuard irqGuard{};
+
+		UnattachedSelf* self = UnattachedSelf::TryAttach();
+
+		if (self == nullptr) {
+			return slabs.Free(ptr);
+		}
+
+		const size_t index = slabs.ClassOf(ptr);
+		auto& cache = self->GetMemoryCache();
+		auto& magazine = cache.objects[index];
+
+		++cache.frees[index];
+
+		if (magazine.IsFull()) {
+			magazine.count -= magazine.BATCH;
+			slabs.FreeBatch(index, magazine.rounds + magazine.count, magazine.BATCH);
+		}
+
+		return magazine.Push(ptr);
+	}
+
 	Utils::LockGuard _{heapLock};
+	++largeFrees;
 	return heap.Free(ptr);
 }
+
+void Heap::QueryStatistics(Statistics& stats) {
+	// calls made before a processor was attached went to the slab layer directly
+	slabs.QueryStatistics(stats);
+
+	for (size_t i = 0; i < UnattachedSelf::GetProcessorCount(); ++i) {
+		const auto& cache = UnattachedSelf::AccessProcessor(i).GetMemoryCache();
+
+		for (size_t j = 0; j < SIZE_CLASSES; ++j) {
+			stats.classes[j].allocations += cache.allocations[j];
+			stats.classes[j].frees += cache.frees[j];
+			stats.classes[j].refills += cache.refills[j];
+		}
+	}
+
+	Utils::LockGuard _{heapLock};
+	stats.largeAllocations = largeAllocations;
+	stats.largeFrees = largeFrees;
+}
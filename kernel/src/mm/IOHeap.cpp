@@ -15,8 +15,10 @@
 #include <cstddef>
 #include <cstdint>
 
-#include <shared/Lock.hpp>
+#include <bit>
+
 #include <shared/LockGuard.hpp>
+#include <shared/TicketLock.hpp>
 #include <shared/Response.hpp>
 #include <shared/memory/defs.hpp>
 
@@ -34,180 +36,332 @@ namespace IOHeap {
     static constexpr size_t DEFAULT_HUGE_PAGES = (DEFAULT_PAGES) / PAGES_IN_HUGE_PAGE;
 
     static_assert(DEFAULT_PAGES % PAGES_IN_HUGE_PAGE == 0);
-    
-    struct Metadata {
-        uint32_t padding;
-        uint32_t size;
-        Metadata* next;
+
+    // Every block starts with a boundary tag. The size of the previous block is always
+    // kept up to date, so both neighbours of a freed block are found in O(1).
+    struct Block {
+        uint64_t prevSize;
+        uint64_t tag;
+
+        // only valid while the block is free
+        Block* nextFree;
+        Block* prevFree;
     };
 
-    static Metadata* head = nullptr;
+    static constexpr uint64_t BLOCK_FREE        = 0x1;
+    static constexpr uint64_t BLOCK_CACHEABLE   = 0x2;
+    static constexpr uint64_t BLOCK_FLAGS       = 0xF;
 
-    static Utils::Lock heapLock;
+    static constexpr size_t GRANULARITY     = 16;
+    static constexpr size_t HEADER_SIZE     = 2 * sizeof(uint64_t);
+    static constexpr size_t MIN_BLOCK_SIZE  = sizeof(Block);
 
-    Success Create() {
-        if (head == nullptr) {
-            void* const physical_region = PhysicalMemory::Allocate32MB();
+    static_assert(MIN_BLOCK_SIZE % GRANULARITY == 0 && HEADER_SIZE % GRANULARITY == 0);
+
+    // arenas are linked together and end with a zero-size used block
+    struct Arena {
+        Arena* next;
+        uint64_t size;
+    };
+
+    static_assert(sizeof(Arena) % GRANULARITY == 0);
+
+    // Two level segregated fit: the first level splits sizes by power of two, the second
+    // level splits each power of two in SL_COUNT linear ranges. Sizes below SMALL_LIMIT
+    // all share the first level, in GRANULARITY steps.
+    static constexpr size_t SL_SHIFT        = 3;
+    static constexpr size_t SL_COUNT        = 1 << SL_SHIFT;
+    static constexpr size_t FL_SHIFT        = SL_SHIFT + std::countr_zero(GRANULARITY) + 1;
+    static constexpr size_t SMALL_LIMIT     = 1 << (FL_SHIFT - 1);
+    static constexpr size_t FL_COUNT        = std::bit_width(DEFAULT_ARENA_SIZE) - FL_SHIFT + 1;
+
+    struct Pool {
+        Utils::TicketLock lock{};
+
+        const uint64_t mappingFlags;
+        const uint64_t blockFlags;
+
+        Arena* arenas = nullptr;
+
+        uint32_t flBitmap = 0;
+        uint32_t slBitmap[FL_COUNT] = {};
+        Block* heads[FL_COUNT][SL_COUNT] = {};
+    };
+
+    static Pool uncacheablePool{
+        .mappingFlags = ShdMem::PDE_PAGE_SIZE | ShdMem::PDE_UNCACHEABLE | ShdMem::PDE_READWRITE | ShdMem::PDE_PRESENT,
+        .blockFlags = 0
+    };
+
+    static Pool cacheablePool{
+        .mappingFlags = ShdMem::PDE_PAGE_SIZE | ShdMem::PDE_READWRITE | ShdMem::PDE_PRESENT,
+        .blockFlags = BLOCK_CACHEABLE
+    };
+
+    static inline Pool& GetPool(Caching caching) {
+        return caching == Caching::WRITE_BACK ? cacheablePool : uncacheablePool;
+    }
+
+    static inline size_t GetSize(const Block* block) {
+        return block->tag & ~BLOCK_FLAGS;
+    }
+
+    static inline Block* GetNext(Block* block) {
+        return reinterpret_cast<Block*>(reinterpret_cast<uint8_t*>(block) + GetSize(block));
+    }
+
+    static inline Block* GetPrev(Block* block) {
+        return block->prevSize == 0
+            ? nullptr
+            : reinterpret_cast<Block*>(reinterpret_cast<uint8_t*>(block) - block->prevSize);
+    }
+
+    static inline void MapIndex(size_t size, size_t& fl, size_t& sl) {
+        if (size < SMALL_LIMIT) {
+            fl = 0;
+            sl = size / GRANULARITY;
+        }
+        else {
+            const size_t width = std::bit_width(size);
 
-            if (physical_region == nullptr) {
-                return Failure();
+            fl = width - FL_SHIFT + 1;
+            sl = (size >> (width - 1 - SL_SHIFT)) & (SL_COUNT - 1);
+        }
+    }
+
+    static void Insert(Pool& pool, Block* block) {
+        size_t fl = 0, sl = 0;
+        MapIndex(GetSize(block), fl, sl);
+
+        Block*& head = pool.heads[fl][sl];
+
+        block->prevFree = nullptr;
+        block->nextFree = head;
+
+        if (head != nullptr) {
+            head->prevFree = block;
+        }
+
+        head = block;
+
+        pool.flBitmap |= 1u << fl;
+        pool.slBitmap[fl] |= 1u << sl;
+    }
+
+    static void Remove(Pool& pool, Block* block) {
+        size_t fl = 0, sl = 0;
+        MapIndex(GetSize(block), fl, sl);
+
+        if (block->prevFree != nullptr) {
+            block->prevFree->nextFree = block->nextFree;
+        }
+        else {
+            pool.heads[fl][sl] = block->nextFree;
+
+            if (block->nextFree == nullptr) {
+                pool.slBitmap[fl] &= ~(1u << sl);
+
+                if (pool.slBitmap[fl] == 0) {
+                    pool.flBitmap &= ~(1u << fl);
+                }
             }
+        }
+
+        if (block->nextFree != nullptr) {
+            block->nextFree->prevFree = block->prevFree;
+        }
+    }
+
+    // first block of a list guaranteed to hold size bytes, two bit scans at most
+    static Block* Find(Pool& pool, size_t size) {
+        if (size >= SMALL_LIMIT) {
+            size += (size_t(1) << (std::bit_width(size) - 1 - SL_SHIFT)) - 1;
+        }
+
+        size_t fl = 0, sl = 0;
+        MapIndex(size, fl, sl);
+
+        if (fl >= FL_COUNT) {
+            return nullptr;
+        }
 
-            head = reinterpret_cast<Metadata*>(
-                VirtualMemory::MapGeneralPages(
-                    physical_region,
-                    DEFAULT_HUGE_PAGES,
-                    ShdMem::PDE_PAGE_SIZE | ShdMem::PDE_UNCACHEABLE | ShdMem::PDE_READWRITE | ShdMem::PDE_PRESENT
-                )
-            );
-
-            if (head == nullptr) {
-                PhysicalMemory::Free32MB(physical_region);
-                return Failure();
+        uint32_t slMap = pool.slBitmap[fl] & (~0u << sl);
+
+        if (slMap == 0) {
+            const uint32_t flMap = pool.flBitmap & (~0u << (fl + 1));
+
+            if (flMap == 0) {
+                return nullptr;
             }
 
-            head->padding = 0;
-            head->size = DEFAULT_ARENA_SIZE - sizeof(Metadata);
-            head->next = nullptr;
+            fl = std::countr_zero(flMap);
+            slMap = pool.slBitmap[fl];
+        }
+
+        return pool.heads[fl][std::countr_zero(slMap)];
+    }
+
+    // shrinks a free block that is not in any list to size bytes, the remainder goes back to the pool
+    static void Split(Pool& pool, Block* block, size_t size) {
+        const size_t remaining = GetSize(block) - size;
+
+        if (remaining < MIN_BLOCK_SIZE) {
+            return;
+        }
+
+        block->tag = size | (block->tag & BLOCK_FLAGS);
+
+        Block* const rest = GetNext(block);
+        rest->prevSize = size;
+        rest->tag = remaining | BLOCK_FREE | pool.blockFlags;
+
+        GetNext(rest)->prevSize = remaining;
+
+        Insert(pool, rest);
+    }
+
+    static void AddArena(Pool& pool, void* base, size_t size) {
+        Arena* const arena = static_cast<Arena*>(base);
+        arena->next = pool.arenas;
+        arena->size = size;
+        pool.arenas = arena;
+
+        const size_t block_size = size - sizeof(Arena) - HEADER_SIZE;
+
+        Block* const block = reinterpret_cast<Block*>(arena + 1);
+        block->prevSize = 0;
+        block->tag = block_size | BLOCK_FREE | pool.blockFlags;
+
+        Block* const sentinel = GetNext(block);
+        sentinel->prevSize = block_size;
+        sentinel->tag = pool.blockFlags;
+
+        Insert(pool, block);
+    }
+
+    static bool Grow(Pool& pool, size_t size) {
+        if (size + sizeof(Arena) + HEADER_SIZE > DEFAULT_ARENA_SIZE) {
+            return false;
+        }
+
+        void* const physical_region = PhysicalMemory::Allocate32MB();
+
+        if (physical_region == nullptr) {
+            return false;
+        }
+
+        void* const arena = VirtualMemory::MapGeneralPages(physical_region, DEFAULT_HUGE_PAGES, pool.mappingFlags);
+
+        if (arena == nullptr) {
+            PhysicalMemory::Free32MB(physical_region);
+            return false;
+        }
+
+        AddArena(pool, arena, DEFAULT_ARENA_SIZE);
+
+        return true;
+    }
+
+    Success Create() {
+        Utils::LockGuard _{uncacheablePool.lock};
+
+        if (uncacheablePool.arenas == nullptr && !Grow(uncacheablePool, 0)) {
+            return Failure();
         }
 
         return Success();
     }
 
-    void* Allocate(const size_t size, const size_t alignment) {
+    void* Allocate(const size_t size, const size_t alignment, Caching caching) {
         if ((alignment > ShdMem::PAGE_SIZE) || (alignment % 8 != 0)) {
             return nullptr;
         }
-        
-        Utils::LockGuard _{heapLock};
 
-        Metadata* prev = nullptr;
-        Metadata* best_fit_prev = nullptr;
-        Metadata* best_fit = nullptr;
+        Pool& pool = GetPool(caching);
 
-        for (Metadata* current = head; current != nullptr; prev = current, current = current->next) {
-            size_t total_size = current->size;
-            size_t padding = 0;
+        const size_t payload = size < MIN_BLOCK_SIZE - HEADER_SIZE ? MIN_BLOCK_SIZE - HEADER_SIZE : size;
+        const size_t needed = HEADER_SIZE + (payload + GRANULARITY - 1) / GRANULARITY * GRANULARITY;
 
-            uintptr_t address = reinterpret_cast<uintptr_t>(current) + sizeof(Metadata);
+        // room for the padding in front of an aligned block, once split off as a free block
+        const size_t search = alignment > GRANULARITY ? needed + alignment + MIN_BLOCK_SIZE : needed;
 
-            if (address % alignment != 0) {
-                padding = alignment - (address % alignment);
+        Utils::LockGuard _{pool.lock};
+
+        Block* block = Find(pool, search);
+
+        if (block == nullptr) {
+            if (!Grow(pool, search)) {
+                return nullptr;
             }
 
-            if (padding + size <= total_size) {
-                if (best_fit == nullptr || current->size < best_fit->size) {
-                    best_fit_prev = prev;
-                    best_fit = current;
-                    best_fit->padding = static_cast<uint32_t>(padding);
-                }
+            block = Find(pool, search);
+
+            if (block == nullptr) {
+                return nullptr;
             }
         }
-        
-        if (best_fit != nullptr) {
-            size_t allocated_size = size + best_fit->padding;
 
-            if (allocated_size < best_fit->size - sizeof(Metadata)) {
-                Metadata* new_metadata = reinterpret_cast<Metadata*>(
-                    reinterpret_cast<uint8_t*>(best_fit) + sizeof(Metadata) + allocated_size
-                );
+        Remove(pool, block);
 
-                new_metadata->size = best_fit->size - allocated_size - sizeof(Metadata);
-                new_metadata->padding = 0;
-                new_metadata->next = best_fit->next;
+        if (alignment > GRANULARITY) {
+            const uintptr_t start = reinterpret_cast<uintptr_t>(block) + HEADER_SIZE;
 
-                best_fit->size = static_cast<uint32_t>(allocated_size);
-                best_fit->next = new_metadata;
-            }
-            else {
-                allocated_size = best_fit->size;
-            }
+            size_t padding = (alignment - start % alignment) % alignment;
 
-            if (best_fit_prev == nullptr) {
-                head = best_fit->next;
-            }
-            else {
-                best_fit_prev->next = best_fit->next;
+            if (padding != 0 && padding < MIN_BLOCK_SIZE) {
+                padding += alignment;
             }
 
-            best_fit->next = nullptr;
+            if (padding != 0) {
+                Block* const aligned = reinterpret_cast<Block*>(reinterpret_cast<uint8_t*>(block) + padding);
 
-            Metadata* user_metadata = reinterpret_cast<Metadata*>(
-                reinterpret_cast<uintptr_t>(best_fit) + best_fit->padding
-            );
+                aligned->prevSize = padding;
+                aligned->tag = (GetSize(block) - padding) | BLOCK_FREE | pool.blockFlags;
+                GetNext(aligned)->prevSize = GetSize(aligned);
 
-            *user_metadata = *best_fit;
+                block->tag = padding | BLOCK_FREE | pool.blockFlags;
+                Insert(pool, block);
 
-            return user_metadata + 1;
+                block = aligned;
+            }
         }
 
-        return nullptr;
-    }
-
-    static void Coalesce(Metadata* current) {
-        Metadata* const next = current->next;
+        Split(pool, block, needed);
 
-        if (next != nullptr) {
-            const uintptr_t current_end = reinterpret_cast<uintptr_t>(current) + sizeof(Metadata) + current->size;
-            const uintptr_t next_address = reinterpret_cast<uintptr_t>(next);
+        block->tag &= ~BLOCK_FREE;
 
-            if (current_end == next_address) {
-                current->size += sizeof(Metadata) + next->size;
-                current->next = next->next;
-            }
-        }
+        return reinterpret_cast<uint8_t*>(block) + HEADER_SIZE;
     }
 
     void Free(void* ptr) {
         if (ptr != nullptr) {
-            Utils::LockGuard _{heapLock};
+            Block* block = reinterpret_cast<Block*>(static_cast<uint8_t*>(ptr) - HEADER_SIZE);
+
+            Pool& pool = (block->tag & BLOCK_CACHEABLE) != 0 ? cacheablePool : uncacheablePool;
 
-            Metadata* user_metadata = reinterpret_cast<Metadata*>(ptr) - 1;
+            Utils::LockGuard _{pool.lock};
 
-            Metadata* metadata = reinterpret_cast<Metadata*>(
-                reinterpret_cast<uint8_t*>(user_metadata) - user_metadata->padding
-            );
+            size_t size = GetSize(block);
 
-            if (head == nullptr) {
-                head = metadata;
-                metadata->next = nullptr;
+            Block* const next = GetNext(block);
+
+            if ((next->tag & BLOCK_FREE) != 0) {
+                Remove(pool, next);
+                size += GetSize(next);
             }
-            else {
-                bool inserted = false;
 
-                if (metadata < head) {
-                    metadata->next = head;
-                    head = metadata;
-                    inserted = true;
-                }
+            Block* const prev = GetPrev(block);
 
-                for (Metadata* current = head; current != nullptr; current = current->next) {
-                    const uintptr_t current_address = reinterpret_cast<uintptr_t>(current);
-                    const uintptr_t current_end = current_address + sizeof(Metadata) + current->size;
-                    const uintptr_t metadata_address = reinterpret_cast<uintptr_t>(metadata);
-
-                    Metadata* next = current->next;
-
-                    if (!inserted) {
-                        if (next == nullptr) {
-                            current->next = metadata;
-                            inserted = true;
-                        }
-                        else {
-                            const uintptr_t next_address = reinterpret_cast<uintptr_t>(next);
-
-                            if (metadata_address >= current_end && metadata_address < next_address) {
-                                metadata->next = next;
-                                current->next = metadata;
-                                inserted = true;
-                            }
-                        }
-                    }
-
-                    Coalesce(current);
-                }
+            if (prev != nullptr && (prev->tag & BLOCK_FREE) != 0) {
+                Remove(pool, prev);
+                size += GetSize(prev);
+                block = prev;
             }
+
+            block->tag = size | BLOCK_FREE | pool.blockFlags;
+            GetNext(block)->prevSize = size;
+
+            Insert(pool, block);
         }
     }
 }
-
@@ -15,15 +15,24 @@
 #include <cstddef>
 #include <cstdint>
 
+#include <shared/LockGuard.hpp>
 #include <shared/Response.hpp>
+#include <shared/SimpleAtomic.hpp>
+#include <shared/TicketLock.hpp>
 #include <shared/memory/defs.hpp>
 #include <shared/memory/layout.hpp>
 
+#include <interrupts/APIC.hpp>
+#include <interrupts/InterruptGuard.hpp>
+
+#include <mm/CopyOnWrite.hpp>
 #include <mm/Paging.hpp>
 #include <mm/PhysicalMemory.hpp>
 #include <mm/VirtualMemory.hpp>
 #include <mm/VirtualMemoryLayout.hpp>
 
+#include <sched/Self.hpp>
+
 namespace ShdMem = Shared::Memory;
 
 namespace Paging {
@@ -72,7 +81,7 @@ namespace Paging {
             const auto dma_pml4e    = GetPML4EAddress(dma_mapping, false);
             const auto dma_pdpte    = GetPDPTEAddress(dma_mapping, false);
 
-            void* phys_first_pml4e = PhysicalMemory::Allocate();
+            void* phys_first_pml4e = PhysicalMemory::Allocate(PhysicalMemory::Fill::ZERO);
 
             if (phys_first_pml4e == nullptr) {
                 return Failure();
@@ -86,7 +95,7 @@ namespace Paging {
 
             InvalidatePage(dma_pdpte);
 
-            void* phys_first_pdpte = PhysicalMemory::Allocate();
+            void* phys_first_pdpte = PhysicalMemory::Allocate(PhysicalMemory::Fill::ZERO);
 
             if (phys_first_pdpte == nullptr) {
                 PhysicalMemory::Free(phys_first_pml4e);
@@ -112,8 +121,13 @@ namespace Paging {
             return Success();
         }
 
-        // Frees a PDE/PT and all its children
+        // Frees a PDE/PT and all its children, a table shared with another address space
+        // only loses a reference
         static Success FreePDE(const ShdMem::VirtualAddress& mapping, PDE* pde) {
+            if (!CopyOnWrite::Release(GetPDEInfo(pde).address)) {
+                return Success();
+            }
+
             for (size_t i = 0; i < ShdMem::PD_ENTRIES; ++i) {
                 auto map = mapping;
                 map.PT_offset = i;
@@ -124,7 +138,7 @@ namespace Paging {
                 if (pte_info.present) {
                     const auto address = pte_info.address;
                     
-                    if (!PhysicalMemory::Free(reinterpret_cast<void*>(address)).IsSuccess()) {
+                    if (CopyOnWrite::Release(address) && !PhysicalMemory::Free(reinterpret_cast<void*>(address)).IsSuccess()) {
                         return Failure();
                     }
                 }
@@ -138,6 +152,10 @@ namespace Paging {
 
         // Frees a PDPTE/PD and all its children
         static Success FreePDPTE(const ShdMem::VirtualAddress& mapping, PDPTE* pdpte) {
+            if (!CopyOnWrite::Release(GetPDPTEInfo(pdpte).address)) {
+                return Success();
+            }
+
             for (size_t i = 0; i < ShdMem::PD_ENTRIES; ++i) {
                 auto map = mapping;
                 map.PD_offset = i;
@@ -149,7 +167,7 @@ namespace Paging {
                     if (pde_info.pageSize) {
                         const auto address = pde_info.address;
                         
-                        if (!PhysicalMemory::Free2MB(reinterpret_cast<void*>(address)).IsSuccess()) {
+                        if (CopyOnWrite::Release(address) && !PhysicalMemory::Free2MB(reinterpret_cast<void*>(address)).IsSuccess()) {
                             return Failure();
                         }
                     }
@@ -168,6 +186,10 @@ namespace Paging {
 
         // Frees a PML4E/PDPT and all its children
         static Success FreePML4E(const ShdMem::VirtualAddress& mapping, PML4E* pml4e) {
+            if (!CopyOnWrite::Release(GetPML4EInfo(pml4e).address)) {
+                return Success();
+            }
+
             for (size_t i = 0; i < ShdMem::PDPT_ENTRIES; ++i) {
                 auto map = mapping;
                 map.PDPT_offset = i;
@@ -179,7 +201,7 @@ namespace Paging {
                     if (pdpte_info.pageSize) {
                         const auto address = pdpte_info.address;
                         
-                        if (!PhysicalMemory::Free1GB(reinterpret_cast<void*>(address)).IsSuccess()) {
+                        if (CopyOnWrite::Release(address) && !PhysicalMemory::Free1GB(reinterpret_cast<void*>(address)).IsSuccess()) {
                             return Failure();
                         }
                     }
@@ -545,6 +567,153 @@ namespace Paging {
         );
     }
 
+    void InvalidateAllContexts() {
+        static constexpr uint64_t CR4_PGE = 0x80;
+
+        uint64_t cr4 = 0;
+        __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+
+        // any write that changes CR4.PGE flushes the whole TLB
+        __asm__ volatile(
+            "mov %0, %%cr4\n"
+            "mov %1, %%cr4\n"
+            :: "r"(cr4 ^ CR4_PGE), "r"(cr4) : "memory"
+        );
+    }
+
+    namespace {
+        // One shootdown at a time. Targets are sent an NMI rather than a fixed IPI, so that a
+        // processor spinning on a lock with interrupts disabled, possibly held by the sender,
+        // still answers.
+        struct Shootdown {
+            // set before the application processors start
+            volatile bool enabled;
+            Utils::TicketLock lock;
+            const void* pages[MappingTransaction::FLUSH_THRESHOLD];
+            size_t pageCount;
+            bool flushAll;
+            bool global;
+            volatile bool targets[0x100];
+            Utils::SimpleAtomic<uint64_t> remaining;
+        };
+
+        static Shootdown shootdown{};
+
+        static void InvalidateLocal(const void* const* pages, size_t pageCount, bool flushAll, bool global) {
+            if (flushAll && global) {
+                InvalidateAllContexts();
+            }
+            else if (flushAll) {
+                InvalidateTLB();
+            }
+            else {
+                for (size_t i = 0; i < pageCount; ++i) {
+                    InvalidatePage(pages[i]);
+                }
+            }
+        }
+
+        static void ShootdownRemote(const void* const* pages, size_t pageCount, bool flushAll, bool global) {
+            if (!shootdown.enabled) {
+                return;
+            }
+
+            const size_t processors = UnattachedSelf::GetProcessorCount();
+
+            // the sender must not move to another processor halfway
+            Interrupts::InterruptGuard irqGuard{};
+            Utils::LockGuard _{shootdown.lock};
+
+            for (size_t i = 0; i < pageCount; ++i) {
+                shootdown.pages[i] = pages[i];
+            }
+
+            shootdown.pageCount = pageCount;
+            shootdown.flushAll = flushAll;
+            shootdown.global = global;
+
+            const uint8_t self = APIC::GetLAPICID();
+
+            for (size_t i = 0; i < processors; ++i) {
+                const UnattachedSelf& processor = UnattachedSelf::AccessProcessor(i);
+
+                // a processor coming online flushes everything on its own
+                if (processor.IsOnline() && processor.GetID() != self) {
+                    ++shootdown.remaining;
+                    shootdown.targets[processor.GetID()] = true;
+                    APIC::SendNMI(processor.GetID());
+                }
+            }
+
+            while (shootdown.remaining.load() != 0) {
+                __asm__ volatile("pause");
+            }
+        }
+    }
+
+    void EnableShootdown() {
+        shootdown.enabled = true;
+    }
+
+    void InvalidateAllProcessors() {
+        InvalidateAllContexts();
+        ShootdownRemote(nullptr, 0, true, true);
+    }
+
+    bool HandleShootdown() {
+        const uint8_t self = APIC::GetLAPICID();
+
+        if (!shootdown.targets[self]) {
+            return false;
+        }
+
+        shootdown.targets[self] = false;
+
+        InvalidateLocal(shootdown.pages, shootdown.pageCount, shootdown.flushAll, shootdown.global);
+
+        --shootdown.remaining;
+
+        return true;
+    }
+
+    void MappingTransaction::Invalidate(const void* virtual_address) {
+        // only kernel pages may be global, and those survive a CR3 reload
+        if (reinterpret_cast<uint64_t>(virtual_address) >= ShdMem::Layout::KernelImage.start) {
+            global = true;
+        }
+
+        if (pageCount < FLUSH_THRESHOLD) {
+            pages[pageCount++] = virtual_address;
+        }
+        else {
+            flushAll = true;
+        }
+    }
+
+    void MappingTransaction::Release(void* frame) {
+        if (frameCount == FLUSH_THRESHOLD) {
+            Commit();
+        }
+
+        frames[frameCount++] = frame;
+    }
+
+    void MappingTransaction::Commit() {
+        if (flushAll || pageCount != 0) {
+            InvalidateLocal(pages, pageCount, flushAll, global);
+            ShootdownRemote(pages, pageCount, flushAll, global);
+        }
+
+        if (frameCount != 0) {
+            PhysicalMemory::FreeBatch(frames, frameCount);
+        }
+
+        pageCount = 0;
+        frameCount = 0;
+        flushAll = false;
+        global = false;
+    }
+
     bool IsMapped(const void* virtual_address, bool usePrimary) {
         const auto mapping = ShdMem::ParseVirtualAddress(reinterpret_cast<uint64_t>(virtual_address));
 
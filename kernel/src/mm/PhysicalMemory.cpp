@@ -17,15 +17,27 @@
 
 #include <bit>
 
+#include <shared/LockGuard.hpp>
+#include <shared/TicketLock.hpp>
+#include <shared/SimpleAtomic.hpp>
 #include <shared/efi/efi.h>
 #include <shared/memory/defs.hpp>
 #include <shared/memory/layout.hpp>
 
+#include <acpi/Interface.hpp>
+#include <acpi/tables.hpp>
+
+#include <interrupts/InterruptGuard.hpp>
+
+#include <mm/Magazine.hpp>
 #include <mm/Paging.hpp>
 #include <mm/PhysicalMemory.hpp>
+#include <mm/Utils.hpp>
 #include <mm/VirtualMemory.hpp>
 #include <mm/VirtualMemoryLayout.hpp>
 
+#include <sched/Self.hpp>
+
 namespace ShdMem = Shared::Memory;
 namespace VML = ShdMem::Layout;
 
@@ -84,10 +96,11 @@ namespace {
 	//   - Set bit indicates the 4KB page is currently in use
 	//   - Clear bit indicates the 4KB page is free
 	// 
-	// Cache Structures:
-	// - Cached32MB: Stack of free 32MB regions for fast allocation
-	// - Cached2MB: Stack of free 2MB regions for fast allocation
-	// - Cached4KB: Single cached 4KB region for fast allocation
+	// Node Structures (one per NUMA node):
+	// - Regions32MB: 32MB regions owned by the node, allocations are masked with it
+	// - Cache32MB: Stack of free 32MB regions for fast allocation
+	// - Cache2MB: Stack of free 2MB regions for fast allocation
+	// - Hint32MB/Hint2MB: Where the last 4KB allocation was found, scans resume from there
 
 	static LargeMemoryRegionStatus* const BitMap32MB
 		= reinterpret_cast<LargeMemoryRegionStatus*>(VirtualMemoryLayout::PhysicalMemoryMap.start);
@@ -99,8 +112,23 @@ namespace {
 	static constexpr uint64_t TOTAL_METADATA_SIZE 	= 2 * BITMAP_SIZE_32MB + 2 * BITMAP_SIZE_2MB + BITMAP_SIZE_4KB;
 	static constexpr uint64_t TOTAL_METADATA_PAGES 	= (TOTAL_METADATA_SIZE + ShdMem::FRAME_SIZE - 1) / ShdMem::FRAME_SIZE;
 
+	// The frame descriptors follow the bitmaps, sized from the highest usable address at setup
+	static constexpr uint64_t DESCRIPTORS_OFFSET = TOTAL_METADATA_PAGES * ShdMem::FRAME_SIZE;
+
+	static_assert(DESCRIPTORS_OFFSET + BITMAP_ENTRIES_4KB * sizeof(PhysicalMemory::FrameDescriptor)
+		<= VirtualMemoryLayout::PhysicalMemoryMap.limit);
+
+	static PhysicalMemory::FrameDescriptor* const FrameDescriptors
+		= reinterpret_cast<PhysicalMemory::FrameDescriptor*>(VirtualMemoryLayout::PhysicalMemoryMap.start + DESCRIPTORS_OFFSET);
+	static uint64_t FrameDescriptorCount = 0;
+
 	static constexpr uint64_t UNIT = 1;
 
+	static constexpr bool IsUsableMemory(uint32_t type) {
+		return type == EfiConventionalMemory || type == EfiLoaderCode || type == EfiLoaderData
+			|| type == EfiBootServicesCode || type == EfiBootServicesData;
+	}
+
 	class LargeMemoryCache {
 	private:
 		static constexpr size_t CACHE_SIZE = 64;
@@ -141,9 +169,42 @@ namespace {
 		}
 	};
 
-	static LargeMemoryCache 		Cache32MB{};
-	static LargeMemoryCache 		Cache2MB{};
-	static Optional<uint64_t> 		Cached4KB{};
+	// serializes the large region caches and the DMA bitmap, 4 KiB frames are claimed lock-free
+	static Utils::TicketLock 			BitMapLock{};
+
+	static constexpr size_t MAX_NODES = 8;
+	static constexpr size_t MAX_PROCESSORS = 256;
+
+	// SLIT distances used when the firmware does not provide them
+	static constexpr uint8_t LOCAL_DISTANCE = 10;
+	static constexpr uint8_t REMOTE_DISTANCE = 20;
+
+	// A node owns the 32MB regions whose base address lies in one of its SRAT memory ranges.
+	// Until SetupNodes runs, or without an SRAT, node 0 owns all of them.
+	struct Node {
+		uint64_t Regions32MB[BITMAP_WORDS_32MB];
+
+		LargeMemoryCache Cache32MB{};
+		LargeMemoryCache Cache2MB{};
+
+		// scan cursors, they are only ever used as starting points so relaxed accesses are enough
+		Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> Hint32MB{0};
+		Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> Hint2MB{0};
+	};
+
+	static Node 	Nodes[MAX_NODES];
+	static size_t 	NodeCount = 1;
+
+	// fallback order of every node, nearest first
+	static uint8_t 	NodeOrder[MAX_NODES][MAX_NODES] = {};
+	// indexed by local APIC ID
+	static uint8_t 	ProcessorNode[MAX_PROCESSORS] = {};
+
+	static constexpr uint64_t FULL_WORD 		= ~0ULL;
+	static constexpr uint64_t WORDS_PER_2MB 	= ShdMem::PT_ENTRIES / 64;
+	static constexpr uint64_t WORDS_PER_BLOCK 	= 4;
+
+	static_assert(WORDS_PER_2MB % WORDS_PER_BLOCK == 0);
 
 	static constexpr bool IsAddressable(uint64_t address) {
 		return address < MAX_ADDRESSABLE_MEMORY;
@@ -169,165 +230,400 @@ namespace {
 		return Get2MBParent32MB(Get4KBParent2MB(region_4kb));
 	}
 
-	static constexpr Optional<uint64_t> Try4KBCache() {
-		if (Cached4KB.HasValue()) {
-			const auto region = Cached4KB.GetValueAndClear();
+	static inline uint64_t ReadWord(const uint64_t& word) {
+		return *const_cast<const volatile uint64_t*>(&word);
+	}
 
-			// Check parent 2MB page still has free pages, i.e., has not been allocated since caching
-			const size_t parent_2mb = Get4KBParent2MB(region);
-			const size_t word_2mb 	= parent_2mb / 64;
-			const size_t bit_2mb 	= parent_2mb % 64;
+	// through the configured atomic backend, so that the builtin one inlines the lock cmpxchg
+	static inline bool CompareExchangeWord(uint64_t& word, uint64_t& expected, uint64_t desired) {
+		return Utils::Atomic::Backend::CompareExchange<Utils::MemoryOrder::SEQ_CST>(&word, expected, desired);
+	}
 
-			if ((BitMap2MB[word_2mb].AnyFree & (UNIT << bit_2mb)) != 0) {
-				return Optional(region);
+	static inline bool NodeOwns32MB(const Node& node, uint64_t region_32mb) {
+		return (node.Regions32MB[region_32mb / 64] & (UNIT << (region_32mb % 64))) != 0;
+	}
+
+	static inline Node& GetNodeOf32MB(uint64_t region_32mb) {
+		for (size_t i = 1; i < NodeCount; ++i) {
+			if (NodeOwns32MB(Nodes[i], region_32mb)) {
+				return Nodes[i];
 			}
 		}
 
-		return Optional<uint64_t>();
+		return Nodes[0];
+	}
+
+	static inline const uint8_t* GetLocalNodeOrder() {
+		UnattachedSelf* self = UnattachedSelf::TryAttach();
+
+		return NodeOrder[self != nullptr ? ProcessorNode[self->GetID()] : 0];
 	}
 
-	static void Mark32MBRegionUsed(uint64_t region) {
-		const size_t word_idx = region / 64;
-		const size_t bit = region % 64;
+	static inline void AtomicSetBits(uint64_t& word, uint64_t mask) {
+		uint64_t expected = ReadWord(word);
 
-		BitMap32MB[word_idx].AnyUsed |= (UNIT << bit);
+		while ((expected & mask) != mask && !CompareExchangeWord(word, expected, expected | mask)) {}
+	}
 
-		const size_t first_2mb = region * 16;
-		bool all_used = true;
+	static inline void AtomicClearBits(uint64_t& word, uint64_t mask) {
+		uint64_t expected = ReadWord(word);
 
-		for (size_t i = 0; i < 16; i++) {
-			const size_t check_region 	= first_2mb + i;
-			const size_t check_word 	= check_region / 64;
-			const size_t check_bit 		= check_region % 64;
+		while ((expected & mask) != 0 && !CompareExchangeWord(word, expected, expected & ~mask)) {}
+	}
 
-			if ((BitMap2MB[check_word].AnyUsed & (UNIT << check_bit)) == 0) {
-				all_used = false;
-				break;
+	// the 16 children of a 32MB region always sit in the same 2MB status word
+	static inline uint64_t Get32MBChildren(uint64_t LargeMemoryRegionStatus::* field, uint64_t region_32mb) {
+		const uint64_t first_2mb = region_32mb * 16;
+		return (ReadWord(BitMap2MB[first_2mb / 64].*field) >> (first_2mb % 64)) & 0xFFFF;
+	}
+
+	// 256 bits at a time: a block is full iff the AND of its words is all ones
+	static bool Region2MBIsFull(uint64_t region_2mb) {
+		const uint64_t* words = BitMap4KB + region_2mb * WORDS_PER_2MB;
+
+		for (size_t i = 0; i < WORDS_PER_2MB; i += WORDS_PER_BLOCK) {
+			const uint64_t reduced = ReadWord(words[i]) & ReadWord(words[i + 1])
+				& ReadWord(words[i + 2]) & ReadWord(words[i + 3]);
+
+			if (reduced != FULL_WORD) {
+				return false;
 			}
 		}
 
-		if (all_used) {
-			BitMap32MB[word_idx].AnyFree &= ~(UNIT << bit);
+		return true;
+	}
+
+	static bool Region2MBHasUsed(uint64_t region_2mb) {
+		const uint64_t* words = BitMap4KB + region_2mb * WORDS_PER_2MB;
+
+		for (size_t i = 0; i < WORDS_PER_2MB; i += WORDS_PER_BLOCK) {
+			const uint64_t reduced = ReadWord(words[i]) | ReadWord(words[i + 1])
+				| ReadWord(words[i + 2]) | ReadWord(words[i + 3]);
+
+			if (reduced != 0) {
+				return true;
+			}
 		}
+
+		return false;
 	}
 
-	static void Mark2MBRegionUsed(uint64_t region) {
-		const size_t word_idx = region / 64;
-		const size_t bit = region % 64;
+	// The 4KB bitmap is the only source of truth, the 2MB and 32MB summaries are hints
+	// kept up to date with atomic bit operations. A summary bit is cleared first and the
+	// condition checked again afterwards, so a racing update can only leave a stale set
+	// bit behind (which costs a wasted scan), never hide free or used memory.
+
+	static void NoteRegion2MBFull(uint64_t region_2mb) {
+		const uint64_t mask_2mb = UNIT << (region_2mb % 64);
+		auto& status_2mb = BitMap2MB[region_2mb / 64];
 
-		BitMap2MB[word_idx].AnyUsed |= (UNIT << bit);
+		AtomicClearBits(status_2mb.AnyFree, mask_2mb);
 
-		const size_t parent_32mb = Get2MBParent32MB(region);
-		Mark32MBRegionUsed(parent_32mb);
+		if (!Region2MBIsFull(region_2mb)) {
+			AtomicSetBits(status_2mb.AnyFree, mask_2mb);
+			return;
+		}
 
-		// check if there is still a free 4KB page in this 2MB region
-		const size_t first_4kb = region * ShdMem::PT_ENTRIES;
-		bool all_used = true;
+		const uint64_t region_32mb = Get2MBParent32MB(region_2mb);
+		const uint64_t mask_32mb = UNIT << (region_32mb % 64);
+		auto& status_32mb = BitMap32MB[region_32mb / 64];
 
-		for (size_t i = 0; i < ShdMem::PT_ENTRIES; i++) {
-			const size_t check_region 	= first_4kb + i;
-			const size_t check_word 	= check_region / 64;
-			const size_t check_bit 		= check_region % 64;
+		if (Get32MBChildren(&LargeMemoryRegionStatus::AnyFree, region_32mb) == 0) {
+			AtomicClearBits(status_32mb.AnyFree, mask_32mb);
 
-			if ((BitMap4KB[check_word] & (UNIT << check_bit)) == 0) {
-				all_used = false;
-				break;
+			if (Get32MBChildren(&LargeMemoryRegionStatus::AnyFree, region_32mb) != 0) {
+				AtomicSetBits(status_32mb.AnyFree, mask_32mb);
 			}
 		}
+	}
+
+	static void NoteRegion2MBUsed(uint64_t region_2mb) {
+		const uint64_t region_32mb = Get2MBParent32MB(region_2mb);
+
+		AtomicSetBits(BitMap2MB[region_2mb / 64].AnyUsed, UNIT << (region_2mb % 64));
+		AtomicSetBits(BitMap32MB[region_32mb / 64].AnyUsed, UNIT << (region_32mb % 64));
+	}
 
-		if (all_used) {
-			BitMap2MB[word_idx].AnyFree &= ~(UNIT << bit);
+	static void NoteRegion2MBReleased(uint64_t region_2mb) {
+		const uint64_t mask_2mb = UNIT << (region_2mb % 64);
+		auto& status_2mb = BitMap2MB[region_2mb / 64];
+
+		const uint64_t region_32mb = Get2MBParent32MB(region_2mb);
+		const uint64_t mask_32mb = UNIT << (region_32mb % 64);
+		auto& status_32mb = BitMap32MB[region_32mb / 64];
+
+		AtomicSetBits(status_2mb.AnyFree, mask_2mb);
+		AtomicSetBits(status_32mb.AnyFree, mask_32mb);
+
+		if (Region2MBHasUsed(region_2mb)) {
+			return;
+		}
+
+		AtomicClearBits(status_2mb.AnyUsed, mask_2mb);
+
+		if (Region2MBHasUsed(region_2mb)) {
+			AtomicSetBits(status_2mb.AnyUsed, mask_2mb);
+			return;
+		}
+
+		if (Get32MBChildren(&LargeMemoryRegionStatus::AnyUsed, region_32mb) == 0) {
+			AtomicClearBits(status_32mb.AnyUsed, mask_32mb);
+
+			if (Get32MBChildren(&LargeMemoryRegionStatus::AnyUsed, region_32mb) != 0) {
+				AtomicSetBits(status_32mb.AnyUsed, mask_32mb);
+			}
 		}
 	}
 
-	static bool Update32MBFlags(uint64_t region_32mb) {
-		const size_t word_idx = region_32mb / 64;
-		const size_t bit = region_32mb % 64;
+	// Claims up to count frames in a single pass over the region. The lowest free bits of a
+	// word are taken with one compare-exchange, so frames come out in ascending order and
+	// are physically adjacent whenever the word is sparsely used.
+	static size_t ClaimFramesIn2MB(uint64_t region_2mb, void** frames, size_t count) {
+		uint64_t* words = BitMap4KB + region_2mb * WORDS_PER_2MB;
 
-		bool any_used = false;
-		bool any_free = false;
+		size_t claimed = 0;
+		bool filled_word = false;
 
-		const size_t first_2mb = region_32mb * 16;
+		for (size_t block = 0; block < WORDS_PER_2MB && claimed < count; block += WORDS_PER_BLOCK) {
+			uint64_t* const w = words + block;
 
-		for (size_t i = 0; i < 16; ++i) {
-			const size_t child 	= first_2mb + i;
-			const size_t w 		= child / 64;
-			const size_t b 		= child % 64;
+			if ((ReadWord(w[0]) & ReadWord(w[1]) & ReadWord(w[2]) & ReadWord(w[3])) == FULL_WORD) {
+				continue;
+			}
+
+			for (size_t i = 0; i < WORDS_PER_BLOCK && claimed < count; ++i) {
+				uint64_t expected = ReadWord(w[i]);
+
+				while (expected != FULL_WORD) {
+					uint64_t available = ~expected;
+					uint64_t mask = 0;
+
+					for (size_t n = claimed; n < count && available != 0; ++n) {
+						mask |= available & -available;
+						available &= available - 1;
+					}
 
-			if ((BitMap2MB[w].AnyUsed & (UNIT << b)) != 0) {
-				any_used = true;
+					if (CompareExchangeWord(w[i], expected, expected | mask)) {
+						const uint64_t base = (w + i - BitMap4KB) * 64;
+
+						filled_word |= (expected | mask) == FULL_WORD;
+
+						for (; mask != 0; mask &= mask - 1) {
+							frames[claimed++] = reinterpret_cast<void*>((base + std::countr_zero(mask)) * ShdMem::FRAME_SIZE);
+						}
+
+						break;
+					}
+				}
 			}
-			if ((BitMap2MB[w].AnyFree & (UNIT << b)) != 0) {
-				any_free = true;
+		}
+
+		if (claimed > 0) {
+			NoteRegion2MBUsed(region_2mb);
+		}
+
+		// a short claim means the region is exhausted, which also fixes a stale summary
+		if (claimed < count || (filled_word && Region2MBIsFull(region_2mb))) {
+			NoteRegion2MBFull(region_2mb);
+		}
+
+		return claimed;
+	}
+
+	static size_t ClaimFramesIn32MB(Node& node, uint64_t region_32mb, void** frames, size_t count) {
+		uint64_t children = Get32MBChildren(&LargeMemoryRegionStatus::AnyFree, region_32mb);
+
+		size_t claimed = 0;
+
+		while (children != 0 && claimed < count) {
+			const uint64_t region_2mb = region_32mb * 16 + std::countr_zero(children);
+			children &= children - 1;
+
+			const size_t n = ClaimFramesIn2MB(region_2mb, frames + claimed, count - claimed);
+
+			if (n > 0) {
+				node.Hint2MB.store(region_2mb);
+				claimed += n;
 			}
 		}
 
-		auto& any_used_word = BitMap32MB[word_idx].AnyUsed;
-		auto& any_free_word = BitMap32MB[word_idx].AnyFree;
+		return claimed;
+	}
 
-		if (any_used) {
-			any_used_word |= (UNIT << bit);
-		} else {
-			any_used_word &= ~(UNIT << bit);
+	static size_t AllocateFramesIn(Node& node, void** frames, size_t count) {
+		size_t claimed = 0;
+
+		// resume in the region the last allocation came from
+		const uint64_t hint_2mb = node.Hint2MB.load();
+
+		if (NodeOwns32MB(node, Get2MBParent32MB(hint_2mb))
+			&& (ReadWord(BitMap2MB[hint_2mb / 64].AnyFree) & (UNIT << (hint_2mb % 64))) != 0
+		) {
+			claimed = ClaimFramesIn2MB(hint_2mb, frames, count);
 		}
 
-		if (any_free) {
-			any_free_word |= (UNIT << bit);
-		} else {
-			any_free_word &= ~(UNIT << bit);
+		const uint64_t start = node.Hint32MB.load();
+
+		for (size_t n = 0; n < BITMAP_WORDS_32MB && claimed < count; ++n) {
+			const size_t i = (start + n) % BITMAP_WORDS_32MB;
+
+			const uint64_t has_free = ReadWord(BitMap32MB[i].AnyFree) & node.Regions32MB[i];
+
+			if (has_free == 0) {
+				continue;
+			}
+
+			// prefer partial regions (already have some pages used), then untouched ones
+			const uint64_t partial = ReadWord(BitMap32MB[i].AnyUsed) & has_free;
+			const uint64_t passes[2] = { partial, has_free & ~partial };
+
+			for (uint64_t candidates : passes) {
+				while (candidates != 0 && claimed < count) {
+					const uint64_t region_32mb = i * 64 + std::countr_zero(candidates);
+					candidates &= candidates - 1;
+
+					const size_t found = ClaimFramesIn32MB(node, region_32mb, frames + claimed, count - claimed);
+
+					if (found > 0) {
+						node.Hint32MB.store(i);
+						claimed += found;
+					}
+				}
+			}
 		}
 
-		return !any_used;
+		return claimed;
 	}
 
-	static void Mark2MBRegionFreed(uint64_t region) {
-		const size_t word_idx 	= region / 64;
-		const size_t bit 		= region % 64;
+	// the local node first, then the others by increasing distance
+	static size_t AllocateFrames(void** frames, size_t count) {
+		const uint8_t* const order = GetLocalNodeOrder();
+
+		size_t claimed = 0;
+
+		for (size_t i = 0; i < NodeCount && claimed < count; ++i) {
+			claimed += AllocateFramesIn(Nodes[order[i]], frames + claimed, count - claimed);
+		}
+
+		return claimed;
+	}
 
-		// Clear 4KB usage inside this 2MB region
-		const size_t start_word_4kb = (region * ShdMem::PT_ENTRIES) / 64;
-		const size_t end_word_4kb 	= ((region + 1) * ShdMem::PT_ENTRIES) / 64;
+	static void* AllocateFrame() {
+		void* frame = nullptr;
+		AllocateFrames(&frame, 1);
+		return frame;
+	}
 
-		for (size_t w = start_word_4kb; w < end_word_4kb; ++w) {
-			BitMap4KB[w] = 0;
+	// takes a frame from the processor magazine, must be called with interrupts disabled
+	static void* AllocateCachedFrame(UnattachedSelf* self) {
+		if (self == nullptr) {
+			return AllocateFrame();
 		}
 
-		BitMap2MB[word_idx].AnyUsed &= ~(UNIT << bit);
-		BitMap2MB[word_idx].AnyFree |= (UNIT << bit);
+		auto& magazine = self->GetMemoryCache().frames;
 
-		const uint64_t parent_32mb = Get2MBParent32MB(region);		
-		const bool parent_free = Update32MBFlags(parent_32mb);
+		if (magazine.IsEmpty()) {
+			magazine.count = AllocateFrames(magazine.rounds, magazine.BATCH);
 
-		if (parent_free) {
-			Cache32MB.Push(parent_32mb);
+			// frames come out in ascending order, hand them out in that order too
+			for (size_t i = 0; i < magazine.count / 2; ++i) {
+				void* frame = magazine.rounds[i];
+				magazine.rounds[i] = magazine.rounds[magazine.count - 1 - i];
+				magazine.rounds[magazine.count - 1 - i] = frame;
+			}
 		}
-		
-		Cache2MB.Push(region);
+
+		return magazine.IsEmpty() ? nullptr : magazine.Pop();
 	}
 
-	static bool Region2MBHasUsed(uint64_t region) {
-		const size_t start_word_4kb = (region * ShdMem::PT_ENTRIES) / 64;
-		const size_t end_word_4kb = ((region + 1) * ShdMem::PT_ENTRIES) / 64;
+	static void FreeFrame(uint64_t address) {
+		const uint64_t region 	= address / ShdMem::FRAME_SIZE;
+		const uint64_t bit 		= UNIT << (region % 64);
 
-		for (size_t w = start_word_4kb; w < end_word_4kb; ++w) {
-			if (BitMap4KB[w] != 0) {
-				return true;
+		uint64_t& word = BitMap4KB[region / 64];
+		uint64_t expected = ReadWord(word);
+
+		do {
+			if ((expected & bit) == 0) {
+				return;
+			}
+		} while (!CompareExchangeWord(word, expected, expected & ~bit));
+
+		NoteRegion2MBReleased(Get4KBParent2MB(region));
+	}
+
+	// frames sharing a bitmap word are released with a single atomic update
+	static void FreeFrames(void* const* frames, size_t count) {
+		for (size_t i = 0; i < count;) {
+			const uint64_t word_idx = reinterpret_cast<uint64_t>(frames[i]) / ShdMem::FRAME_SIZE / 64;
+			uint64_t mask = 0;
+
+			for (; i < count && reinterpret_cast<uint64_t>(frames[i]) / ShdMem::FRAME_SIZE / 64 == word_idx; ++i) {
+				mask |= UNIT << ((reinterpret_cast<uint64_t>(frames[i]) / ShdMem::FRAME_SIZE) % 64);
+			}
+
+			AtomicClearBits(BitMap4KB[word_idx], mask);
+			NoteRegion2MBReleased(word_idx / WORDS_PER_2MB);
+		}
+	}
+
+	// a large region is claimed by taking every 4KB word from empty to full, so that it
+	// can never overlap with frames claimed concurrently
+	static bool ClaimWords(uint64_t* words, size_t count) {
+		for (size_t i = 0; i < count; ++i) {
+			uint64_t expected = 0;
+
+			if (!CompareExchangeWord(words[i], expected, FULL_WORD)) {
+				while (i-- > 0) {
+					AtomicClearBits(words[i], FULL_WORD);
+				}
+
+				return false;
 			}
 		}
 
-		return false;
+		return true;
+	}
+
+	static bool Claim2MBRegion(uint64_t region_2mb) {
+		if (!ClaimWords(BitMap4KB + region_2mb * WORDS_PER_2MB, WORDS_PER_2MB)) {
+			return false;
+		}
+
+		NoteRegion2MBUsed(region_2mb);
+		NoteRegion2MBFull(region_2mb);
+
+		return true;
+	}
+
+	static bool Claim32MBRegion(uint64_t region_32mb) {
+		if (!ClaimWords(BitMap4KB + region_32mb * 16 * WORDS_PER_2MB, 16 * WORDS_PER_2MB)) {
+			return false;
+		}
+
+		for (size_t i = 0; i < 16; ++i) {
+			NoteRegion2MBUsed(region_32mb * 16 + i);
+			NoteRegion2MBFull(region_32mb * 16 + i);
+		}
+
+		return true;
 	}
 
-	static void* AllocateCached32MBPage() {
-		const auto region_wrapper = Cache32MB.Pop();
+	static void Release2MBRegion(uint64_t region_2mb) {
+		uint64_t* words = BitMap4KB + region_2mb * WORDS_PER_2MB;
+
+		for (size_t i = 0; i < WORDS_PER_2MB; ++i) {
+			AtomicClearBits(words[i], FULL_WORD);
+		}
+
+		NoteRegion2MBReleased(region_2mb);
+	}
 
-		if (region_wrapper.HasValue()) {
-			const uint64_t region = region_wrapper.GetValue();
-			const size_t word_idx = region / 64;
-			const size_t bit = region % 64;
+	static void* AllocateCached32MBPage(Node& node) {
+		while (!node.Cache32MB.IsEmpty()) {
+			const uint64_t region = node.Cache32MB.Pop().GetValue();
 
-			if ((BitMap32MB[word_idx].AnyUsed & (UNIT << bit)) == 0) {
-				Mark32MBRegionUsed(region);
+			if (Claim32MBRegion(region)) {
 				return reinterpret_cast<void*>(region * 16 * ShdMem::PDE_COVERAGE);
 			}
 		}
@@ -335,31 +631,144 @@ namespace {
 		return nullptr;
 	}
 
-	static void* AllocateCached2MBPage() {
-		const auto region_wrapper = Cache2MB.Pop();
+	static void* AllocateCached2MBPage(Node& node) {
+		while (!node.Cache2MB.IsEmpty()) {
+			const uint64_t region = node.Cache2MB.Pop().GetValue();
 
-		if (region_wrapper.HasValue()) {
-			const uint32_t 	region 		= region_wrapper.GetValue();        
-			const size_t 	word_idx 	= region / 64;
-			const size_t 	bit 		= region % 64;
+			if (Claim2MBRegion(region)) {
+				return reinterpret_cast<void*>(region * ShdMem::PDE_COVERAGE);
+			}
+		}
 
-			const size_t	parent_32mb = Get2MBParent32MB(region);
+		return nullptr;
+	}
 
-			auto& any_used = BitMap2MB[word_idx].AnyUsed;
-			auto& any_free = BitMap2MB[word_idx].AnyFree;
+	static void* Allocate2MBIn(Node& node) {
+		const auto cached_page = AllocateCached2MBPage(node);
 
-			if ((any_used & (UNIT << bit)) == 0) {        
-				any_used |= (UNIT << bit);
-				any_free &= ~(UNIT << bit);
-				
-				Mark32MBRegionUsed(parent_32mb);
-				
-				return (void*)(region * ShdMem::PDE_COVERAGE);
+		if (cached_page != nullptr) {
+			return cached_page;
+		}
+
+		for (size_t i = 0; i < BITMAP_WORDS_32MB; i++) {
+			const uint64_t has_free = ReadWord(BitMap32MB[i].AnyFree) & node.Regions32MB[i];
+
+			// prefer splitting partial 32MB regions before breaking up an untouched one
+			const uint64_t partial = ReadWord(BitMap32MB[i].AnyUsed) & has_free;
+			const uint64_t passes[2] = { partial, has_free & ~partial };
+
+			for (uint64_t candidates : passes) {
+				while (candidates != 0) {
+					const uint64_t region_32mb = i * 64 + std::countr_zero(candidates);
+					candidates &= candidates - 1;
+
+					uint64_t children = ~Get32MBChildren(&LargeMemoryRegionStatus::AnyUsed, region_32mb) & 0xFFFF;
+
+					while (children != 0) {
+						const uint64_t region_2mb = region_32mb * 16 + std::countr_zero(children);
+						children &= children - 1;
+
+						if (Claim2MBRegion(region_2mb)) {
+							return reinterpret_cast<void*>(region_2mb * ShdMem::PDE_COVERAGE);
+						}
+					}
+				}
 			}
 		}
 
 		return nullptr;
 	}
+
+	static void* Allocate32MBIn(Node& node) {
+		const auto cached_page = AllocateCached32MBPage(node);
+
+		if (cached_page != nullptr) {
+			return cached_page;
+		}
+
+		for (size_t i = 0; i < BITMAP_WORDS_32MB; i++) {
+			uint64_t free_regions = ~ReadWord(BitMap32MB[i].AnyUsed) & node.Regions32MB[i];
+
+			while (free_regions != 0) {
+				const uint64_t region = i * 64 + std::countr_zero(free_regions);
+				free_regions &= free_regions - 1;
+
+				if (Claim32MBRegion(region)) {
+					return reinterpret_cast<void*>(region * 16 * ShdMem::PDE_COVERAGE);
+				}
+			}
+		}
+
+		return nullptr;
+	}
+
+	// proximity domains are sparse 32-bit values, nodes are numbered densely in order of appearance
+	static size_t GetDomainNode(uint32_t* domains, size_t& domain_count, uint32_t domain) {
+		for (size_t i = 0; i < domain_count; ++i) {
+			if (domains[i] == domain) {
+				return i;
+			}
+		}
+
+		if (domain_count == MAX_NODES) {
+			return MAX_NODES;
+		}
+
+		domains[domain_count] = domain;
+		return domain_count++;
+	}
+
+	static void AssignMemoryRange(size_t node, uint64_t base, uint64_t length) {
+		constexpr uint64_t REGION_SIZE = 16 * ShdMem::PDE_COVERAGE;
+
+		const uint64_t end = (base + length > MAX_ADDRESSABLE_MEMORY) ? MAX_ADDRESSABLE_MEMORY : base + length;
+
+		for (uint64_t region = (base + REGION_SIZE - 1) / REGION_SIZE; region * REGION_SIZE < end; ++region) {
+			for (size_t i = 0; i < MAX_NODES; ++i) {
+				Nodes[i].Regions32MB[region / 64] &= ~(UNIT << (region % 64));
+			}
+
+			Nodes[node].Regions32MB[region / 64] |= UNIT << (region % 64);
+		}
+	}
+
+	static void SortNodesByDistance(const uint8_t* distances, size_t locality_count, const uint32_t* domains) {
+		const auto distance = [&](size_t from, size_t to) -> uint8_t {
+			if (domains[from] < locality_count && domains[to] < locality_count) {
+				return distances[domains[from] * locality_count + domains[to]];
+			}
+
+			return from == to ? LOCAL_DISTANCE : REMOTE_DISTANCE;
+		};
+
+		for (size_t node = 0; node < NodeCount; ++node) {
+			uint8_t* const order = NodeOrder[node];
+
+			for (size_t i = 0; i < NodeCount; ++i) {
+				order[i] = static_cast<uint8_t>(i);
+			}
+
+			// insertion sort, stable so that equally distant nodes keep their numbering
+			for (size_t i = 1; i < NodeCount; ++i) {
+				const uint8_t candidate = order[i];
+				size_t j = i;
+
+				for (; j > 0 && distance(node, order[j - 1]) > distance(node, candidate); --j) {
+					order[j] = order[j - 1];
+				}
+
+				order[j] = candidate;
+			}
+
+			// the local node always comes first, even if the SLIT claims otherwise
+			for (size_t i = 0; order[0] != node; ++i) {
+				if (order[i] == node) {
+					order[i] = order[0];
+					order[0] = static_cast<uint8_t>(node);
+				}
+			}
+		}
+	}
 }
 
 uint64_t PhysicalMemory::FilterAddress(uint64_t address) {
@@ -379,10 +788,31 @@ Success PhysicalMemory::Setup() {
 	DMA_bitmap = reinterpret_cast<uint8_t*>(VML::OsLoaderData.start + VML::OsLoaderDataOffsets.DMABitMap);
 	DMA_bitmap[0] |= 1; // reserve the first DMA page to make NULL pointers invalid
 
+	for (size_t i = 0; i < BITMAP_WORDS_32MB; ++i) {
+		Nodes[0].Regions32MB[i] = FULL_WORD;
+	}
+
+	// descriptors cover every frame up to the end of the highest usable region
+	uint64_t highest_address = 0;
+
+	for (size_t i = 0; i < descriptorCount; ++i) {
+		EFI_MEMORY_DESCRIPTOR* descriptor = reinterpret_cast<EFI_MEMORY_DESCRIPTOR*>(mmap + i * descriptorSize);
+
+		if (IsUsableMemory(descriptor->Type)) {
+			const uint64_t end = descriptor->PhysicalStart + descriptor->NumberOfPages * ShdMem::FRAME_SIZE;
+
+			if (end > highest_address) {
+				highest_address = end;
+			}
+		}
+	}
+
+	FrameDescriptorCount = (IsAddressable(highest_address) ? highest_address : MAX_ADDRESSABLE_MEMORY) / ShdMem::FRAME_SIZE;
+
 	uint64_t bitmap_virt_addr = VirtualMemoryLayout::PhysicalMemoryMap.start;
 
 	uint64_t bytes_mapped = 0;
-	const uint64_t bytes_needed = TOTAL_METADATA_SIZE;
+	const uint64_t bytes_needed = DESCRIPTORS_OFFSET + FrameDescriptorCount * sizeof(FrameDescriptor);
 
 	bool bitmaps_mapped = false;
 	bool bitmaps_initialized = false;
@@ -390,9 +820,7 @@ Success PhysicalMemory::Setup() {
 	for (size_t i = 0; i < descriptorCount; ++i) {
 		EFI_MEMORY_DESCRIPTOR* descriptor = reinterpret_cast<EFI_MEMORY_DESCRIPTOR*>(mmap + i * descriptorSize);
 
-		if (descriptor->Type == EfiConventionalMemory || descriptor->Type == EfiLoaderCode || descriptor->Type == EfiLoaderData
-			|| descriptor->Type == EfiBootServicesCode || descriptor->Type == EfiBootServicesData
-		) {
+		if (IsUsableMemory(descriptor->Type)) {
 			uint64_t phys_addr = descriptor->PhysicalStart;
 			uint64_t num_pages = descriptor->NumberOfPages;
 
@@ -578,6 +1006,9 @@ Success PhysicalMemory::Setup() {
 						BitMap4KB[i] = ~0ULL;
 					}
 
+					// large pages are not cleared when they are mapped
+					Utils::memset(FrameDescriptors, 0, FrameDescriptorCount * sizeof(FrameDescriptor));
+
 					bitmaps_initialized = true;
 				}
 				
@@ -673,6 +1104,104 @@ Success PhysicalMemory::Setup() {
 	return Success();
 }
 
+Success PhysicalMemory::SetupNodes() {
+	void* const physical_srat = ACPI::FindTable("SRAT");
+
+	// without an SRAT the machine is treated as a single node
+	if (physical_srat == nullptr) {
+		return Success();
+	}
+
+	auto* const srat = static_cast<ACPI::SRAT*>(ACPI::MapTable(physical_srat));
+
+	if (srat == nullptr) {
+		return Failure();
+	}
+
+	using SRAT = ACPI::SRAT;
+
+	uint32_t domains[MAX_NODES] = {};
+	size_t domain_count = 0;
+
+	Interrupts::InterruptGuard irqGuard{};
+	Utils::LockGuard _{BitMapLock};
+
+	const uint8_t* type = reinterpret_cast<const uint8_t*>(srat + 1);
+	const uint8_t* const end = reinterpret_cast<const uint8_t*>(srat) + srat->hdr.Length;
+
+	for (; type < end && *(type + 1) != 0; type += *(type + 1)) {
+		switch (*type) {
+			case SRAT::ProcessorAffinity::_Type: {
+				const auto* ptr = reinterpret_cast<const SRAT::ProcessorAffinity*>(type);
+
+				if ((ptr->Flags & SRAT::AFFINITY_ENABLED) != 0) {
+					const uint32_t domain = ptr->ProximityDomainLow
+						| (static_cast<uint32_t>(ptr->ProximityDomainHigh[0]) << 8)
+						| (static_cast<uint32_t>(ptr->ProximityDomainHigh[1]) << 16)
+						| (static_cast<uint32_t>(ptr->ProximityDomainHigh[2]) << 24);
+
+					const size_t node = GetDomainNode(domains, domain_count, domain);
+
+					if (node < MAX_NODES) {
+						ProcessorNode[ptr->APIC_ID] = static_cast<uint8_t>(node);
+					}
+				}
+
+				break;
+			}
+			case SRAT::X2APICAffinity::_Type: {
+				const auto* ptr = reinterpret_cast<const SRAT::X2APICAffinity*>(type);
+
+				if ((ptr->Flags & SRAT::AFFINITY_ENABLED) != 0 && ptr->X2APIC_ID < MAX_PROCESSORS) {
+					const size_t node = GetDomainNode(domains, domain_count, ptr->ProximityDomain);
+
+					if (node < MAX_NODES) {
+						ProcessorNode[ptr->X2APIC_ID] = static_cast<uint8_t>(node);
+					}
+				}
+
+				break;
+			}
+			case SRAT::MemoryAffinity::_Type: {
+				const auto* ptr = reinterpret_cast<const SRAT::MemoryAffinity*>(type);
+
+				if ((ptr->Flags & SRAT::AFFINITY_ENABLED) != 0) {
+					const size_t node = GetDomainNode(domains, domain_count, ptr->ProximityDomain);
+
+					if (node < MAX_NODES) {
+						AssignMemoryRange(node, ptr->BaseAddress, ptr->RangeLength);
+					}
+				}
+
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	ACPI::UnmapTable(srat);
+
+	NodeCount = domain_count > 0 ? domain_count : 1;
+
+	void* const physical_slit = ACPI::FindTable("SLIT");
+	auto* const slit = physical_slit != nullptr ? static_cast<ACPI::SLIT*>(ACPI::MapTable(physical_slit)) : nullptr;
+
+	if (slit != nullptr) {
+		SortNodesByDistance(reinterpret_cast<const uint8_t*>(slit + 1), slit->LocalityCount, domains);
+		ACPI::UnmapTable(slit);
+	}
+	else {
+		SortNodesByDistance(nullptr, 0, domains);
+	}
+
+	return Success();
+}
+
+size_t PhysicalMemory::QueryNodeCount() {
+	return NodeCount;
+}
+
 PhysicalMemory::StatusCode PhysicalMemory::QueryDMAAddress(uint64_t address) {
 	if (address >= VML::DMAZone.limit) {
 		return StatusCode::INVALID_PARAMETER;
@@ -683,6 +1212,9 @@ PhysicalMemory::StatusCode PhysicalMemory::QueryDMAAddress(uint64_t address) {
 }
 
 void* PhysicalMemory::AllocateDMA(uint64_t pages) {
+	Interrupts::InterruptGuard irqGuard{};
+	Utils::LockGuard _{BitMapLock};
+
 	if (pages == 0) {
 		return nullptr;
 	}
@@ -719,168 +1251,44 @@ void* PhysicalMemory::AllocateDMA(uint64_t pages) {
 	return nullptr;
 }
 
-void* PhysicalMemory::Allocate() {
-    const auto cached = Try4KBCache();
-
-	if (cached.HasValue()) {
-		const auto region = cached.GetValue();
-
-		const size_t word_idx = region / 64;
-		const size_t bit = region % 64;
-
-		BitMap4KB[word_idx] |= (UNIT << bit);
-
-		const size_t parent_2mb = Get4KBParent2MB(region);
-		Mark2MBRegionUsed(parent_2mb);
-		
-		return reinterpret_cast<void*>(region * ShdMem::FRAME_SIZE);
-	}
-	
-	for (size_t i = 0; i < BITMAP_WORDS_32MB; i++) {
-		const auto word_32mb = BitMap32MB[i];
-		
-		// Look for regions with free pages
-		const uint64_t has_free = word_32mb.AnyFree;
-		
-		if (has_free != 0) {
-			// Prefer partial regions (already have some pages used)
-			const uint64_t partial = word_32mb.AnyUsed & word_32mb.AnyFree;
-			const uint64_t target = (partial != 0) ? partial : has_free;
-			
-			const int bit = std::countr_zero(target);
-			const size_t region_32mb = i * 64 + bit;
-			const size_t first_2mb = region_32mb * 16;
-			
-			// Search 2MB children
-			for (int j = 0; j < 16; j++) {
-				const size_t region_2mb = first_2mb + j;
-				const size_t word_idx_2mb = region_2mb / 64;
-				const int bit_2mb = region_2mb % 64;
-				
-				const auto word_2mb = BitMap2MB[word_idx_2mb];
-				
-				// Check 2MB region has available pages
-				if ((word_2mb.AnyFree & (UNIT << bit_2mb)) != 0) {
-					Mark2MBRegionUsed(region_2mb);
-					
-					// Search 4KB pages within this 2MB region
-					const size_t start_4kb = (region_2mb * ShdMem::PT_ENTRIES) / 64;
-					const size_t end_4kb = ((region_2mb + 1) * ShdMem::PT_ENTRIES) / 64;
-					
-					for (size_t kb4_idx = start_4kb; kb4_idx < end_4kb; kb4_idx++) {
-						const uint64_t word = BitMap4KB[kb4_idx];
-						
-						if (word != ~0ULL) {
-							const int page_bit = std::countr_zero(~word);
-							const size_t page_region = kb4_idx * 64 + page_bit;
-							
-							BitMap4KB[kb4_idx] |= (UNIT << page_bit);
-							
-							// Cache the next potential free page in this word
-							if (BitMap4KB[kb4_idx] != ~0ULL) {
-								const int next_bit = std::countr_zero(~BitMap4KB[kb4_idx]);
-								Cached4KB = Optional<uint64_t>(kb4_idx * 64 + next_bit);
-							}
-							
-							return reinterpret_cast<void*>(page_region * ShdMem::FRAME_SIZE);
-						}
-					}
-				}
-			}
+void* PhysicalMemory::Allocate2MB() {
+	Interrupts::InterruptGuard irqGuard{};
+	Utils::LockGuard _{BitMapLock};
+
+	const uint8_t* const order = GetLocalNodeOrder();
+
+	for (size_t i = 0; i < NodeCount; ++i) {
+		void* const page = Allocate2MBIn(Nodes[order[i]]);
+
+		if (page != nullptr) {
+			return page;
 		}
 	}
-    
-	return nullptr;
-}
 
-void* PhysicalMemory::Allocate2MB() {
-	const auto cached_page = AllocateCached2MBPage();
-
-	if (cached_page != nullptr) {
-		return cached_page;
-	}
-    
-    for (size_t i = 0; i < BITMAP_WORDS_32MB; i++) {
-        const auto word_mb32 = BitMap32MB[i];
-        
-        uint64_t partial_mask = word_mb32.AnyUsed & word_mb32.AnyFree;
-        
-        if (partial_mask != 0) {
-            while (partial_mask != 0 && !Cache2MB.IsFull()) {
-                const int bit = std::countr_zero(partial_mask);
-                partial_mask &= ~(UNIT << bit);
-                
-                const size_t region_32mb 	= i * 64 + bit;
-                const size_t first_2mb 		= region_32mb * 16;
-                
-                for (int j = 0; j < 16; j++) {
-                    const size_t region_2mb 	= first_2mb + j;
-                    const size_t word_idx_2mb 	= region_2mb / 64;
-                    const size_t bit_2mb 		= region_2mb % 64;
-                    
-                    if ((BitMap2MB[word_idx_2mb].AnyUsed & (UNIT << bit_2mb)) == 0) {
-						Cache2MB.Push(region_2mb);
-						           
-                        if (Cache2MB.IsFull()) {
-							break;
-						}
-                    }
-                }
-            }
-            
-            if (!Cache2MB.IsEmpty()) {
-                return AllocateCached2MBPage();
-            }
-        }
-    }
-    
-    for (size_t i = 0; i < BITMAP_WORDS_32MB; i++) {
-        const auto 		word 			= BitMap32MB[i];
-        const uint64_t 	free_regions 	= ~word.AnyUsed;
-        
-        if (free_regions != 0) {
-            const size_t bit 			= std::countr_zero(free_regions);
-            const size_t region_32mb 	= i * 64 + bit;
-            const size_t first_2mb 		= region_32mb * 16;
-
-			Cache2MB.Push(first_2mb);
-            
-            return AllocateCached2MBPage();
-        }
-    }
-    
-    return nullptr;
+	return nullptr;
 }
 
 void* PhysicalMemory::Allocate32MB() {
-	const auto cached_page = AllocateCached32MBPage();
+	Interrupts::InterruptGuard irqGuard{};
+	Utils::LockGuard _{BitMapLock};
 
-	if (cached_page != nullptr) {
-		return cached_page;
-	}
-	
-	for (size_t i = 0; i < BITMAP_WORDS_32MB && !Cache32MB.IsFull(); i++) {
-		const auto word = BitMap32MB[i];
-		uint64_t free_regions = ~word.AnyUsed;
+	const uint8_t* const order = GetLocalNodeOrder();
 
-		while (free_regions != 0 && !Cache32MB.IsFull()) {
-			const int bit = std::countr_zero(free_regions);
-			free_regions &= ~(UNIT << bit);
+	for (size_t i = 0; i < NodeCount; ++i) {
+		void* const page = Allocate32MBIn(Nodes[order[i]]);
 
-			const uint64_t region = i * 64 + bit;
-
-			if (region >= BITMAP_ENTRIES_32MB) {
-				break;
-			}
-
-			Cache32MB.Push(region);
+		if (page != nullptr) {
+			return page;
 		}
 	}
 
-	return AllocateCached32MBPage();
+	return nullptr;
 }
 
 Success PhysicalMemory::FreeDMA(void* ptr, uint64_t pages) {
+	Interrupts::InterruptGuard irqGuard{};
+	Utils::LockGuard _{BitMapLock};
+
 	const uint64_t address = reinterpret_cast<uint64_t>(ptr);
 	const uint64_t end = address + ShdMem::FRAME_SIZE * (pages - 1);
 
@@ -900,6 +1308,77 @@ Success PhysicalMemory::FreeDMA(void* ptr, uint64_t pages) {
 	return Success();
 }
 
+void* PhysicalMemory::Allocate(Fill fill) {
+	Interrupts::InterruptGuard irqGuard{};
+
+	UnattachedSelf* self = UnattachedSelf::TryAttach();
+
+	if (fill == Fill::ZERO && self != nullptr) {
+		auto& zeroed = self->GetMemoryCache().zeroed;
+
+		if (!zeroed.IsEmpty()) {
+			return zeroed.Pop();
+		}
+	}
+
+	void* frame = AllocateCachedFrame(self);
+
+	// the pool ran dry, clear the frame on the spot
+	if (frame != nullptr && fill == Fill::ZERO) {
+		Utils::memset(VirtualMemory::MapScratchFrame(frame), 0, ShdMem::FRAME_SIZE);
+	}
+
+	return frame;
+}
+
+bool PhysicalMemory::PrepareZeroedFrame() {
+	Interrupts::InterruptGuard irqGuard{};
+
+	UnattachedSelf* self = UnattachedSelf::TryAttach();
+
+	if (self == nullptr || self->GetMemoryCache().zeroed.IsFull()) {
+		return false;
+	}
+
+	void* frame = AllocateCachedFrame(self);
+
+	if (frame == nullptr) {
+		return false;
+	}
+
+	Utils::memzero_nt(VirtualMemory::MapScratchFrame(frame), ShdMem::FRAME_SIZE);
+	self->GetMemoryCache().zeroed.Push(frame);
+
+	return true;
+}
+
+size_t PhysicalMemory::AllocateBatch(void** frames, size_t count, Fill fill) {
+	if (fill == Fill::ANY) {
+		return AllocateFrames(frames, count);
+	}
+
+	Interrupts::InterruptGuard irqGuard{};
+
+	UnattachedSelf* self = UnattachedSelf::TryAttach();
+	size_t claimed = 0;
+
+	if (self != nullptr) {
+		auto& zeroed = self->GetMemoryCache().zeroed;
+
+		for (; claimed < count && !zeroed.IsEmpty(); ++claimed) {
+			frames[claimed] = zeroed.Pop();
+		}
+	}
+
+	const size_t fresh = AllocateFrames(frames + claimed, count - claimed);
+
+	for (size_t i = claimed; i < claimed + fresh; ++i) {
+		Utils::memset(VirtualMemory::MapScratchFrame(frames[i]), 0, ShdMem::FRAME_SIZE);
+	}
+
+	return claimed + fresh;
+}
+
 Success PhysicalMemory::Free(void* ptr) {
 	if (ptr == nullptr) {
 		return Failure();
@@ -914,35 +1393,37 @@ Success PhysicalMemory::Free(void* ptr) {
 		address = address - (address % ShdMem::FRAME_SIZE);
 	}
 
-	const uint64_t region 	= address / ShdMem::FRAME_SIZE;
-	const size_t word_idx 	= region / 64;
-	const size_t bit 		= region % 64;
+	Interrupts::InterruptGuard irqGuard{};
+
+	UnattachedSelf* self = UnattachedSelf::TryAttach();
 
-	if ((BitMap4KB[word_idx] & (UNIT << bit)) == 0) {
+	if (self == nullptr) {
+		FreeFrame(address);
 		return Success();
 	}
 
-	BitMap4KB[word_idx] &= ~(UNIT << bit);
+	auto& magazine = self->GetMemoryCache().frames;
 
-	const uint64_t parent_2mb 	= Get4KBParent2MB(region);
-	const size_t word_2mb 		= parent_2mb / 64;
-	const size_t bit_2mb 		= parent_2mb % 64;
+	if (magazine.IsFull()) {
+		magazine.count -= magazine.BATCH;
+		FreeFrames(magazine.rounds + magazine.count, magazine.BATCH);
+	}
 
-	BitMap2MB[word_2mb].AnyFree |= (UNIT << bit_2mb);
+	magazine.Push(reinterpret_cast<void*>(address));
 
-	if (!Region2MBHasUsed(parent_2mb)) {
-		BitMap2MB[word_2mb].AnyUsed &= ~(UNIT << bit_2mb);
-		Cache2MB.Push(parent_2mb);
-	}
+	return Success();
+}
 
-	const uint64_t parent_32mb = Get2MBParent32MB(parent_2mb);
-	const bool fully_free = Update32MBFlags(parent_32mb);
+Success PhysicalMemory::FreeBatch(void* const* frames, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		const uint64_t address = reinterpret_cast<uint64_t>(frames[i]);
 
-	if (fully_free) {
-		Cache32MB.Push(parent_32mb);
+		if (frames[i] == nullptr || !IsAddressable(address) || IsDMAAddress(address)) {
+			return Failure();
+		}
 	}
 
-	Cached4KB = Optional<uint64_t>(region);
+	FreeFrames(frames, count);
 
 	return Success();
 }
@@ -961,22 +1442,24 @@ Success PhysicalMemory::Free2MB(void* ptr) {
 		address = address - (address % ShdMem::PDE_COVERAGE);
 	}
 
-	const uint64_t region 	= address / ShdMem::PDE_COVERAGE;
-	const size_t word_idx 	= region / 64;
-	const size_t bit 		= region % 64;
+	Interrupts::InterruptGuard irqGuard{};
+	Utils::LockGuard _{BitMapLock};
 
-	if ((BitMap2MB[word_idx].AnyUsed & (UNIT << bit)) == 0) {
+	const uint64_t region = address / ShdMem::PDE_COVERAGE;
+
+	if (!Region2MBHasUsed(region)) {
 		return Failure();
 	}
 
-	Mark2MBRegionFreed(region);
+	Release2MBRegion(region);
+	GetNodeOf32MB(Get2MBParent32MB(region)).Cache2MB.Push(region);
 
 	return Success();
 }
 
 Success PhysicalMemory::Free32MB(void* ptr) {
 	if (ptr == nullptr) {
-		Failure();
+		return Failure();
 	}
 
 	uint64_t address = reinterpret_cast<uint64_t>(ptr);
@@ -988,42 +1471,20 @@ Success PhysicalMemory::Free32MB(void* ptr) {
 		address = address - (address % (16 * ShdMem::PDE_COVERAGE));
 	}
 
-	const uint64_t region 	= address / (16 * ShdMem::PDE_COVERAGE);
-	const size_t word_idx 	= region / 64;
-	const size_t bit 		= region % 64;
+	Interrupts::InterruptGuard irqGuard{};
+	Utils::LockGuard _{BitMapLock};
 
-	if ((BitMap32MB[word_idx].AnyUsed & (UNIT << bit)) == 0) {
+	const uint64_t region = address / (16 * ShdMem::PDE_COVERAGE);
+
+	if (Get32MBChildren(&LargeMemoryRegionStatus::AnyUsed, region) == 0) {
 		return Failure();
 	}
 
-	// Free all 2MB children
-	const size_t first_2mb = region * 16;
-
 	for (size_t i = 0; i < 16; ++i) {
-		const uint64_t child_2mb = first_2mb + i;
-		const size_t word_2mb = child_2mb / 64;
-		const size_t bit_2mb = child_2mb % 64;
-
-		// Clear all 4KB pages within this 2MB region
-		const size_t start_word_4kb = (child_2mb * ShdMem::PT_ENTRIES) / 64;
-		const size_t end_word_4kb = ((child_2mb + 1) * ShdMem::PT_ENTRIES) / 64;
-
-		for (size_t w = start_word_4kb; w < end_word_4kb; ++w) {
-			BitMap4KB[w] = 0;
-		}
-
-		BitMap2MB[word_2mb].AnyUsed &= ~(UNIT << bit_2mb);
-		BitMap2MB[word_2mb].AnyFree |= (UNIT << bit_2mb);
-
-		Cache2MB.Push(child_2mb);
+		Release2MBRegion(region * 16 + i);
 	}
 
-	// Update parent 32MB flags
-	BitMap32MB[word_idx].AnyUsed &= ~(UNIT << bit);
-	BitMap32MB[word_idx].AnyFree |= (UNIT << bit);
-
-	// Add to cache if space available
-	Cache32MB.Push(region);
+	GetNodeOf32MB(region).Cache32MB.Push(region);
 
 	return Success();
 }
@@ -1043,3 +1504,68 @@ Success PhysicalMemory::Free1GB(void* ptr) {
 
 	return Success();
 }
+
+PhysicalMemory::FrameDescriptor* PhysicalMemory::GetDescriptor(uint64_t address) {
+	const uint64_t frame = address / ShdMem::FRAME_SIZE;
+
+	return frame < FrameDescriptorCount ? &FrameDescriptors[frame] : nullptr;
+}
+
+Success PhysicalMemory::Get(uint64_t address) {
+	FrameDescriptor* const descriptor = GetDescriptor(address);
+
+	if (descriptor == nullptr) {
+		return Failure();
+	}
+
+	++descriptor->references;
+
+	return Success();
+}
+
+bool PhysicalMemory::Put(uint64_t address) {
+	FrameDescriptor* const descriptor = GetDescriptor(address);
+
+	if (descriptor == nullptr) {
+		return true;
+	}
+
+	uint32_t expected = descriptor->references.load();
+
+	// expected only changes when the exchange fails
+	while (expected != 0 && !descriptor->references.compare_exchange(expected, expected - 1)) {}
+
+	return expected == 0;
+}
+
+bool PhysicalMemory::IsShared(uint64_t address) {
+	const FrameDescriptor* const descriptor = GetDescriptor(address);
+
+	return descriptor != nullptr && descriptor->references.load() != 0;
+}
+
+Success PhysicalMemory::Pin(uint64_t address) {
+	FrameDescriptor* const descriptor = GetDescriptor(address);
+
+	if (descriptor == nullptr) {
+		return Failure();
+	}
+
+	++descriptor->pins;
+
+	return Success();
+}
+
+void PhysicalMemory::Unpin(uint64_t address) {
+	FrameDescriptor* const descriptor = GetDescriptor(address);
+
+	if (descriptor != nullptr) {
+		--descriptor->pins;
+	}
+}
+
+bool PhysicalMemory::IsPinned(uint64_t address) {
+	const FrameDescriptor* const descriptor = GetDescriptor(address);
+
+	return descriptor != nullptr && descriptor->pins.load() != 0;
+}
@@ -0,0 +1,276 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+#include <cstddef>
+#include <cstdint>
+
+#include <shared/Lock.hpp>
+#include <shared/LockGuard.hpp>
+#include <shared/Response.hpp>
+#include <shared/memory/defs.hpp>
+
+#include <devices/Block/Device.hpp>
+
+#include <interrupts/InterruptGuard.hpp>
+
+#include <mm/Heap.hpp>
+#include <mm/Swap.hpp>
+#include <mm/Utils.hpp>
+#include <mm/VirtualMemory.hpp>
+
+#include <sched/WaitQueue.hpp>
+
+#include <screen/Log.hpp>
+
+namespace ShdMem = Shared::Memory;
+
+namespace {
+	// 0657FD6D-A4AB-43C4-84E5-0933C84B4F4F, in its on-disk byte order
+	static constexpr uint8_t LINUX_SWAP_GUID[16] = {
+		0x6D, 0xFD, 0x57, 0x06, 0xAB, 0xA4, 0xC4, 0x43,
+		0x84, 0xE5, 0x09, 0x33, 0xC8, 0x4B, 0x4F, 0x4F
+	};
+
+	static constexpr uint64_t BITS_PER_WORD = 64;
+
+	static Devices::Block::Partition* area = nullptr;
+
+	// one bit per slot, set when the slot is in use
+	static uint64_t* slotBitmap = nullptr;
+	static uint64_t slotCount = 0;
+	static uint64_t usedSlots = 0;
+	static uint64_t nextSlot = 1;
+	// references beyond the first one, for slots shared through copy-on-write
+	static uint16_t* slotShares = nullptr;
+
+	// pages go through this buffer, the device may not be able to reach every frame
+	static uint8_t* batchBuffer = nullptr;
+
+	static uint64_t pagesOut = 0;
+	static uint64_t pagesIn = 0;
+
+	static Utils::Lock slotLock{};
+	static Scheduling::Mutex ioLock{};
+
+	static inline bool IsSlotUsed(uint64_t slot) {
+		return (slotBitmap[slot / BITS_PER_WORD] & (1ULL << (slot % BITS_PER_WORD))) != 0;
+	}
+}
+
+namespace Swap {
+	Success Probe(Devices::Block::Partition* partition) {
+		Devices::Block::GUID type{};
+
+		if (partition == nullptr || !partition->IsValid()) {
+			return Failure();
+		}
+
+		const FS::Status status = partition->Query(FS::QueryInfo{
+			.queryId = Devices::Block::Partition::Queries::GET_PARTITION_TYPE_GUID,
+			.queryDataSize = 0,
+			.queryResultSize = sizeof(type),
+			.queryData = nullptr,
+			.queryResult = &type
+		});
+
+		if (status != FS::Status::SUCCESS || Utils::memcmp(type.data, LINUX_SWAP_GUID, sizeof(type.data)) != 0) {
+			return Failure();
+		}
+		else if (ShdMem::FRAME_SIZE % partition->GetBlockSize() != 0) {
+			Log::putsSafe("[SWAP] Swap partition block size is not supported\n\r");
+			return Failure();
+		}
+
+		Utils::LockGuard _{slotLock};
+
+		const uint64_t slots = partition->GetSize() / ShdMem::FRAME_SIZE;
+		const uint64_t words = (slots + BITS_PER_WORD - 1) / BITS_PER_WORD;
+
+		if (area != nullptr || slots < 2) {
+			return Failure();
+		}
+
+		uint64_t* const bitmap = static_cast<uint64_t*>(Heap::Allocate(words * sizeof(uint64_t)));
+
+		uint16_t* const shares = static_cast<uint16_t*>(Heap::Allocate(slots * sizeof(uint16_t)));
+
+		if (bitmap == nullptr || shares == nullptr) {
+			Heap::Free(bitmap);
+			Heap::Free(shares);
+			return Failure();
+		}
+
+		uint8_t* const buffer = static_cast<uint8_t*>(
+			VirtualMemory::AllocateKernelHeap(BATCH_PAGES, VirtualMemory::FaultPolicy::POPULATE)
+		);
+
+		if (buffer == nullptr) {
+			Heap::Free(bitmap);
+			Heap::Free(shares);
+			return Failure();
+		}
+
+		Utils::memset(bitmap, 0, words * sizeof(uint64_t));
+		Utils::memset(shares, 0, slots * sizeof(uint16_t));
+
+		// slot 0 and the bits past the end of the area are never free
+		bitmap[0] = 1;
+
+		if (slots % BITS_PER_WORD != 0) {
+			bitmap[words - 1] |= ~0ULL << (slots % BITS_PER_WORD);
+		}
+
+		slotBitmap = bitmap;
+		slotShares = shares;
+		slotCount = slots;
+		usedSlots = 0;
+		batchBuffer = buffer;
+		area = partition;
+
+		Log::printfSafe("[SWAP] Swap partition attached, %llu pages\n\r", slots - 1);
+
+		return Success();
+	}
+
+	bool IsAvailable() {
+		return area != nullptr;
+	}
+
+	uint64_t AllocateSlots(size_t& count) {
+		Utils::LockGuard _{slotLock};
+
+		if (area == nullptr || count == 0) {
+			count = 0;
+			return 0;
+		}
+
+		uint64_t slot = nextSlot;
+
+		for (uint64_t scanned = 0; scanned < slotCount; ++scanned) {
+			if (slot >= slotCount) {
+				slot = 1;
+			}
+
+			if (slotBitmap[slot / BITS_PER_WORD] == ~0ULL) {
+				const uint64_t skipped = BITS_PER_WORD - slot % BITS_PER_WORD;
+
+				scanned += skipped - 1;
+				slot += skipped;
+				continue;
+			}
+			else if (IsSlotUsed(slot)) {
+				++slot;
+				continue;
+			}
+
+			size_t run = 1;
+
+			while (run < count && slot + run < slotCount && !IsSlotUsed(slot + run)) {
+				++run;
+			}
+
+			for (uint64_t i = slot; i < slot + run; ++i) {
+				slotBitmap[i / BITS_PER_WORD] |= 1ULL << (i % BITS_PER_WORD);
+			}
+
+			usedSlots += run;
+			nextSlot = slot + run;
+			count = run;
+
+			return slot;
+		}
+
+		count = 0;
+		return 0;
+	}
+
+	void ShareSlot(uint64_t slot) {
+		Utils::LockGuard _{slotLock};
+
+		if (slot != 0 && slot < slotCount && IsSlotUsed(slot)) {
+			++slotShares[slot];
+		}
+	}
+
+	void FreeSlot(uint64_t slot) {
+		Utils::LockGuard _{slotLock};
+
+		if (slot == 0 || slot >= slotCount || !IsSlotUsed(slot)) {
+			return;
+		}
+		else if (slotShares[slot] != 0) {
+			--slotShares[slot];
+			return;
+		}
+
+		slotBitmap[slot / BITS_PER_WORD] &= ~(1ULL << (slot % BITS_PER_WORD));
+		--usedSlots;
+	}
+
+	Scheduling::Mutex& GetIOLock() {
+		return ioLock;
+	}
+
+	Success WriteFrames(uint64_t slot, void* const* frames, size_t count) {
+		if (area == nullptr || count > BATCH_PAGES) {
+			return Failure();
+		}
+
+		for (size_t i = 0; i < count; ++i) {
+			Interrupts::InterruptGuard irqGuard{};
+
+			Utils::memcpy(batchBuffer + i * ShdMem::FRAME_SIZE, VirtualMemory::MapScratchFrame(frames[i]), ShdMem::FRAME_SIZE);
+		}
+
+		const auto response = area->Write(slot * ShdMem::FRAME_SIZE, count * ShdMem::FRAME_SIZE, batchBuffer);
+
+		if (response.CheckError()) {
+			Log::printfSafe("[SWAP] Failed to write %llu pages at slot %llu\n\r", count, slot);
+			return Failure();
+		}
+
+		pagesOut += count;
+
+		return Success();
+	}
+
+	Success ReadFrame(uint64_t slot, void* frame) {
+		if (area == nullptr) {
+			return Failure();
+		}
+
+		const auto response = area->Read(slot * ShdMem::FRAME_SIZE, ShdMem::FRAME_SIZE, batchBuffer);
+
+		if (response.CheckError()) {
+			Log::printfSafe("[SWAP] Failed to read slot %llu\n\r", slot);
+			return Failure();
+		}
+
+		Interrupts::InterruptGuard irqGuard{};
+
+		Utils::memcpy(VirtualMemory::MapScratchFrame(frame), batchBuffer, ShdMem::FRAME_SIZE);
+
+		++pagesIn;
+
+		return Success();
+	}
+
+	void QueryStatistics(Statistics& stats) {
+		Utils::LockGuard _{slotLock};
+
+		stats.slots = slotCount == 0 ? 0 : slotCount - 1;
+		stats.usedSlots = usedSlots;
+		stats.pagesOut = pagesOut;
+		stats.pagesIn = pagesIn;
+	}
+}
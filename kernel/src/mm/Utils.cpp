@@ -99,3 +99,28 @@ void* Utils::memset(void* dest, int ch, size_t count) {
 
     return dest;
 }
+
+void* Utils::memzero_nt(void* dest, size_t count) {
+    if ((reinterpret_cast<uintptr_t>(dest) % 8) != 0 || (count % 32) != 0) {
+        return Utils::memset(dest, 0, count);
+    }
+
+    uint64_t* dest64 = static_cast<uint64_t*>(dest);
+
+    for (size_t i = 0; i < count / 8; i += 4) {
+        __asm__ volatile(
+            "movnti %1, 0(%0)\n\t"
+            "movnti %1, 8(%0)\n\t"
+            "movnti %1, 16(%0)\n\t"
+            "movnti %1, 24(%0)"
+            :
+            : "r"(dest64 + i), "r"(static_cast<uint64_t>(0))
+            : "memory"
+        );
+    }
+
+    // non-temporal stores are weakly ordered, make them visible before the memory is handed out
+    __asm__ volatile("sfence" ::: "memory");
+
+    return dest;
+}
@@ -15,25 +15,57 @@
 #include <cstddef>
 #include <cstdint>
 
+#include <shared/Lock.hpp>
+#include <shared/LockGuard.hpp>
 #include <shared/Response.hpp>
+#include <shared/SimpleAtomic.hpp>
 #include <shared/memory/defs.hpp>
 
+#include <interrupts/InterruptGuard.hpp>
+
+#include <mm/CopyOnWrite.hpp>
 #include <mm/Paging.hpp>
 #include <mm/PhysicalMemory.hpp>
+#include <mm/Swap.hpp>
+#include <mm/Utils.hpp>
 #include <mm/VirtualMemory.hpp>
 #include <mm/VirtualMemoryLayout.hpp>
 
+#include <sched/Self.hpp>
+#include <sched/WaitQueue.hpp>
+
 namespace ShdMem = Shared::Memory;
 
-struct VMemMapBlock {
-	uint64_t virtualStart;
-	uint64_t availablePages;
+// An allocated range of virtual memory. Areas are kept in an AVL tree ordered by address,
+// each one counts the free pages separating it from the previous area, and each node holds
+// the largest of these gaps in its subtree, so finding room for an allocation is a single descent.
+struct Area {
+	uint64_t start;
+	uint64_t pages;
+	uint64_t gap;
+	uint64_t maxGap;
+	Area* left;
+	Area* right;
+	uint64_t height;
+	VirtualMemory::RegionAttributes attributes;
+
+	uint64_t end() const {
+		return start + pages * Shared::Memory::FRAME_SIZE;
+	}
+
+	uint64_t gapStart() const {
+		return start - gap * Shared::Memory::FRAME_SIZE;
+	}
 };
 
+// Areas come from a pool at the start of the management zone, which grows a page at a time.
+// The managed zone ends with an empty area, so that every gap comes before some area.
 struct MemoryContext {
-	uint64_t availableMemory;
-	uint64_t availableBlockMemory;
-	uint64_t storedBlocks;
+	Utils::Lock lock;
+	Area* root;
+	Area* freeAreas;		// released areas, linked through their right child
+	uint64_t poolCursor;	// first area never handed out
+	uint64_t poolEnd;		// end of the mapped part of the pool
 };
 
 enum class AccessPrivilege {
@@ -46,33 +78,51 @@ enum class AccessPrivilege {
 namespace VirtualMemory {
     namespace {
         static MemoryContext kernelContext {
-			.availableMemory = VirtualMemoryLayout::KernelHeap.limit,
-			.availableBlockMemory = 0,
-			.storedBlocks = 0
+			.lock = {},
+			.root = nullptr,
+			.freeAreas = nullptr,
+			.poolCursor = VirtualMemoryLayout::KernelHeapManagement.start,
+			.poolEnd = VirtualMemoryLayout::KernelHeapManagement.start
 		};
 
 		static MemoryContext* const userContext = reinterpret_cast<MemoryContext*>(
 			VirtualMemoryLayout::UserVMemManagement.start
 		);
 
+		// 2MB range whose page table is being copied into a huge page, 0 when there is none
+		static volatile uint64_t promotingRange = 0;
+
+		// The DMA zone and the kernel half up to the heap are the same in every address
+		// space, so their kernel mappings are global and survive switches between PCIDs.
+		static inline bool IsSharedMapping(uint64_t address, AccessPrivilege privilege) {
+			if (privilege == AccessPrivilege::LOW) {
+				return false;
+			}
+
+			return (address >= ShdMem::Layout::DMAZone.start && address < ShdMem::Layout::DMAZone.end())
+				|| (address >= ShdMem::Layout::KernelImage.start && address < VirtualMemoryLayout::KernelHeap.end());
+		}
+
         template<bool usePrimary = true>
         static inline Success MapPage(
 			uint64_t _physicalAddress,
 			uint64_t _virtualAddress,
 			AccessPrivilege privilege,
-			bool huge = false
+			bool huge = false,
+			Paging::MappingTransaction* transaction = nullptr
 		) {
             if (_physicalAddress % ShdMem::FRAME_SIZE != 0 || _virtualAddress % ShdMem::FRAME_SIZE != 0) {
                 return Failure();
             }
 
             const auto mapping = ShdMem::ParseVirtualAddress(_virtualAddress);
+			const bool global = usePrimary && IsSharedMapping(_virtualAddress, privilege);
 
             const auto pml4e = Paging::GetPML4EAddress(mapping, usePrimary);
 			const auto pml4e_info = Paging::GetPML4EInfo(pml4e);
 
             if (!pml4e_info.present) {
-                void* page = PhysicalMemory::Allocate();
+                void* page = PhysicalMemory::Allocate(PhysicalMemory::Fill::ZERO);
 
                 if (page == nullptr) {
                     return Failure();
@@ -87,14 +137,13 @@ namespace VirtualMemory {
 
                 const auto pdpt = Paging::GetPDPTAddress(mapping, usePrimary);
                 Paging::InvalidatePage(pdpt);
-                ShdMem::ZeroPage(pdpt);
             }
 
             const auto pdpte = Paging::GetPDPTEAddress(mapping, usePrimary);
 			const auto pdpte_info = Paging::GetPDPTEInfo(pdpte);
 
             if (!pdpte_info.present) {
-                void* page = PhysicalMemory::Allocate();
+                void* page = PhysicalMemory::Allocate(PhysicalMemory::Fill::ZERO);
 
                 if (page == nullptr) {
                     return Failure();
@@ -109,7 +158,6 @@ namespace VirtualMemory {
 
                 const auto pd = Paging::GetPDAddress(mapping, usePrimary);
                 Paging::InvalidatePage(pd);
-                ShdMem::ZeroPage(pd);
             }
 
             const auto pde = Paging::GetPDEAddress(mapping, usePrimary);
@@ -118,6 +166,7 @@ namespace VirtualMemory {
 			if (huge) {
 				*pde = (PhysicalMemory::FilterAddress(_physicalAddress) & ShdMem::PDE_ADDRESS)
 					| (privilege == AccessPrivilege::LOW ? ShdMem::PDE_USERMODE : 0)
+					| (global ? ShdMem::PDE_GLOBAL : 0)
 					| ShdMem::PDE_PAGE_SIZE
 					| ShdMem::PDE_READWRITE
 					| ShdMem::PDE_PRESENT;
@@ -127,14 +176,13 @@ namespace VirtualMemory {
 					.readWrite = 1,
 					.userMode = privilege == AccessPrivilege::LOW,
 					.pageSize = 1,
+					.global = global,
 					.address = PhysicalMemory::FilterAddress(_physicalAddress)
 				});
-				
-				Paging::InvalidatePage(reinterpret_cast<void*>(_virtualAddress));
 			}
 			else {
 				if (!pde_info.present) {
-					void* page = PhysicalMemory::Allocate();
+					void* page = PhysicalMemory::Allocate(PhysicalMemory::Fill::ZERO);
 
 					if (page == nullptr) {
 						return Failure();
@@ -148,13 +196,13 @@ namespace VirtualMemory {
 					});
 					const auto pt = Paging::GetPTAddress(mapping, usePrimary);
 					Paging::InvalidatePage(pt);
-					ShdMem::ZeroPage(pt);
 				}
 
 				const auto pte = Paging::GetPTEAddress(mapping, usePrimary);
 
 				*pte = (PhysicalMemory::FilterAddress(_physicalAddress) & ShdMem::PTE_ADDRESS)
 					| (privilege == AccessPrivilege::LOW ? ShdMem::PTE_USERMODE : 0)
+					| (global ? ShdMem::PTE_GLOBAL : 0)
 					| ShdMem::PTE_READWRITE
 					| ShdMem::PTE_PRESENT;
 
@@ -162,9 +210,16 @@ namespace VirtualMemory {
 					.present = 1,
 					.readWrite = 1,
 					.userMode = privilege == AccessPrivilege::LOW,
+					.global = global,
 					.address = PhysicalMemory::FilterAddress(_physicalAddress)
 				});
+			}
 
+			// the tables created above are used right away, only the page itself can wait
+			if (transaction != nullptr) {
+				transaction->Invalidate(reinterpret_cast<void*>(_virtualAddress));
+			}
+			else {
 				Paging::InvalidatePage(reinterpret_cast<void*>(_virtualAddress));
 			}
 
@@ -172,8 +227,18 @@ namespace VirtualMemory {
         }
 
         template<bool usePrimary = true>
-		static inline Success MapOnDemand(const void* _address, uint64_t pages, AccessPrivilege privilege) {
+		static inline Success MapOnDemand(
+			const void* _address,
+			uint64_t pages,
+			AccessPrivilege privilege,
+			Caching caching = Caching::WRITE_BACK
+		) {
 			const uint8_t* address = static_cast<const uint8_t*>(_address);
+			Paging::MappingTransaction transaction{};
+
+			const uint64_t cachingFlags = caching == Caching::UNCACHEABLE ? NP_PCD | NP_PWT
+				: caching == Caching::WRITE_THROUGH ? NP_PWT
+				: 0;
 
 			for (size_t i = 0; i < pages; ++i) {
 				const auto mapping = ShdMem::ParseVirtualAddress(address);
@@ -182,7 +247,7 @@ namespace VirtualMemory {
 				const auto pml4e_info = Paging::GetPML4EInfo(pml4e);
 
 				if (!pml4e_info.present) {
-					void* page = PhysicalMemory::Allocate();
+					void* page = PhysicalMemory::Allocate(PhysicalMemory::Fill::ZERO);
 
 					if (page == nullptr) {
 						return Failure();
@@ -197,14 +262,13 @@ namespace VirtualMemory {
 
 					const auto pdpt = Paging::GetPDPTAddress(mapping, usePrimary);
 					Paging::InvalidatePage(pdpt);
-					ShdMem::ZeroPage(pdpt);
 				}
 
 				const auto pdpte = Paging::GetPDPTEAddress(mapping, usePrimary);
 				const auto pdpte_info = Paging::GetPDPTEInfo(pdpte);
 
 				if (!pdpte_info.present) {
-					void* page = PhysicalMemory::Allocate();
+					void* page = PhysicalMemory::Allocate(PhysicalMemory::Fill::ZERO);
 
 					if (page == nullptr) {
 						return Failure();
@@ -219,14 +283,13 @@ namespace VirtualMemory {
 
 					const auto pd = Paging::GetPDAddress(mapping, usePrimary);
 					Paging::InvalidatePage(pd);
-					ShdMem::ZeroPage(pd);
 				}
 
 				const auto pde = Paging::GetPDEAddress(mapping, usePrimary);
 				const auto pde_info = Paging::GetPDEInfo(pde);
 
 				if (!pde_info.present) {
-					void* page = PhysicalMemory::Allocate();
+					void* page = PhysicalMemory::Allocate(PhysicalMemory::Fill::ZERO);
 
 					if (page == nullptr) {
 						return Failure();
@@ -241,16 +304,20 @@ namespace VirtualMemory {
 
 					const auto pt = Paging::GetPTAddress(mapping, usePrimary);
 					Paging::InvalidatePage(pt);
-					ShdMem::ZeroPage(pt);
 				}
 
 				const auto pte = Paging::GetPTEAddress(mapping, usePrimary);
 
 				*pte = NP_ON_DEMAND
+					| cachingFlags
+					| (usePrimary && IsSharedMapping(reinterpret_cast<uint64_t>(address), privilege) ? NP_GLOBAL : 0)
 					| (privilege == AccessPrivilege::LOW ? NP_USERMODE : 0)
 					| NP_READWRITE;
 
-				Paging::InvalidatePage(reinterpret_cast<const void*>(address));
+				// the secondary address space is not loaded, nothing of it can be cached
+				if constexpr (usePrimary) {
+					transaction.Invalidate(address);
+				}
 
 				address += ShdMem::FRAME_SIZE;
 			}
@@ -258,500 +325,1229 @@ namespace VirtualMemory {
 			return Success();
 		}
 
-        static inline Success ExpandVirtualMemoryMap(uint64_t start, uint64_t blocks) {
-			void* page = PhysicalMemory::Allocate();
-			if (page == nullptr) {
-				return Failure();
-			}
+		static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> faultCount{0};
+		static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> faultPopulatedCount{0};
+		static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> mapPopulatedCount{0};
 
-			return MapPage(reinterpret_cast<uint64_t>(page), start + blocks * sizeof(VMemMapBlock), AccessPrivilege::HIGH);
+		static inline bool IsOnDemand(uint64_t entry) {
+			return (entry & NP_PRESENT) == 0 && (entry & NP_ON_DEMAND) != 0;
 		}
 
-		// sorts (to the right) by descending number of available pages
-		static inline void SortVirtualMemoryMap(VMemMapBlock* start, size_t n) {
-			if (n > 2) {
-				VMemMapBlock temp;
-				for (size_t i = 0; i < n - 1 && (start + 1)->availablePages > start->availablePages; ++i) {
-					temp = *start;
-					*start = *(start + 1);
-					*++start = temp;
-				}
-			}
+		// builds the present entry of an on-demand page, the attributes keep their meaning
+		// but some of them sit lower in the non-present encoding
+		static inline uint64_t PopulatedEntry(uint64_t entry, void* frame) {
+			return ((entry & NP_PK) << 52)
+				| (PhysicalMemory::FilterAddress(frame) & ShdMem::PTE_ADDRESS)
+				| ((entry & NP_GLOBAL) << 2)
+				| ((entry & NP_PAT) << 2)
+				| (entry & (NP_PCD | NP_PWT | NP_USERMODE | NP_READWRITE))
+				| ShdMem::PTE_PRESENT;
 		}
-		
-		// reverse sorts (to the left) by ascending number of available pages
-		static inline void RSortVirtualMemoryMap(VMemMapBlock* start, size_t n) {
-			if (n > 2) {
-				VMemMapBlock temp;
-				for (size_t i = 0; i < n - 1 && (start - 1)->availablePages < start->availablePages; ++i) {
-					temp = *start;
-					*start = *(start - 1);
-					*--start = temp;
-				}
-			}
+
+		// the reverse of PopulatedEntry, for a present entry whose page went to the given swap slot
+		static inline uint64_t SwappedEntry(uint64_t entry, uint64_t slot) {
+			return ((slot << NP_INDEX_SHIFT) & NP_INDEX)
+				| ((entry & ShdMem::PTE_PK) >> 52)
+				| ((entry & ShdMem::PTE_GLOBAL) >> 2)
+				| ((entry & ShdMem::PTE_PAT) >> 2)
+				| (entry & (ShdMem::PTE_PCD | ShdMem::PTE_PWT | ShdMem::PTE_USERMODE | ShdMem::PTE_READWRITE));
 		}
 
-        template<AccessPrivilege privilege>
-		static inline void* AllocateHintCore(VMemMapBlock* block, uint64_t offset, uint64_t pages) {
-			MemoryContext* ctx = privilege == AccessPrivilege::HIGH ? &kernelContext : userContext;
+		// Backs up to FAULT_AROUND_PAGES on-demand entries with zeroed frames, in order, and
+		// returns how many of them are present afterwards. An entry populated by another
+		// processor in the meantime keeps its frame, and ours goes back to the allocator.
+		static inline size_t PopulateEntries(ShdMem::PTE* const* entries, size_t count) {
+			void* frames[FAULT_AROUND_PAGES];
+			void* unused[FAULT_AROUND_PAGES];
+			size_t unusedCount = 0;
 
-			void* pagesStart = reinterpret_cast<void*>(block->virtualStart);
+			const size_t allocated = PhysicalMemory::AllocateBatch(frames, count, PhysicalMemory::Fill::ZERO);
 
-			if (!MapOnDemand(pagesStart, pages, AccessPrivilege::LOW).IsSuccess()) {
-				return nullptr;
-			}
+			for (size_t i = 0; i < allocated; ++i) {
+				uint64_t expected = *entries[i];
 
-			block->availablePages -= pages;
-			block->virtualStart += pages * ShdMem::FRAME_SIZE;
+				// expected only changes when the exchange fails
+				while (IsOnDemand(expected)
+					&& !Utils::Atomic::Backend::CompareExchange<Utils::MemoryOrder::SEQ_CST>(entries[i], expected, PopulatedEntry(expected, frames[i]))
+				) {}
 
-			SortVirtualMemoryMap(block, ctx->storedBlocks - offset);
+				if (!IsOnDemand(expected)) {
+					unused[unusedCount++] = frames[i];
+				}
+			}
 
-			ctx->availableMemory -= pages * ShdMem::FRAME_SIZE;
-			return pagesStart;
+			if (unusedCount != 0) {
+				PhysicalMemory::FreeBatch(unused, unusedCount);
+			}
+
+			return allocated;
 		}
 
-        template<AccessPrivilege privilege, bool useHint = false>
-		static inline void* AllocateCore(uint64_t pages, [[maybe_unused]] void* hintPtr) {			
-			constexpr uint64_t managementBase = privilege == AccessPrivilege::HIGH
-				? VirtualMemoryLayout::KernelHeapManagement.start
-				: (VirtualMemoryLayout::UserVMemManagement.start
-					+ (sizeof(*userContext) + sizeof(VMemMapBlock) - 1) / sizeof(VMemMapBlock));
-			
-			MemoryContext* ctx = privilege == AccessPrivilege::HIGH ? &kernelContext : userContext;
+		// populates every on-demand page of a range, pages already backed (including huge
+		// pages) are skipped, and whatever cannot be allocated stays on demand
+		static inline void PopulateRange(uint64_t address, uint64_t pages) {
+			ShdMem::PTE* entries[FAULT_AROUND_PAGES];
+			size_t count = 0;
 
-			VMemMapBlock* vmmb = reinterpret_cast<VMemMapBlock*>(managementBase);
-			
-			if (ctx->availableMemory < pages * ShdMem::FRAME_SIZE || vmmb->availablePages < pages) {
-				return nullptr;
-			}
+			const uint64_t end = address + pages * ShdMem::FRAME_SIZE;
 
-			size_t index = 0;
+			for (; address < end; address += ShdMem::FRAME_SIZE) {
+				const auto mapping = ShdMem::ParseVirtualAddress(address);
 
-			if (pages == 0) {
-				return nullptr;
-			}
-			else if (pages == 1) {
-				index = ctx->storedBlocks - 1;
-				vmmb += index;
-			}
-			else {
-				for (++index, ++vmmb;; ++index, ++vmmb) {
-					if (index >= ctx->storedBlocks || vmmb->availablePages < pages) {
-						--index;
-						--vmmb;
-						break;
-					}
+				if ((*Paging::GetPDEAddress(mapping) & ShdMem::PDE_PAGE_SIZE) != 0) {
+					address = (address & ~(ShdMem::PDE_COVERAGE - 1)) + ShdMem::PDE_COVERAGE - ShdMem::FRAME_SIZE;
+					continue;
 				}
-			}
 
-			if constexpr (useHint) {
-				if (hintPtr != nullptr && (reinterpret_cast<uint64_t>(hintPtr) % ShdMem::FRAME_SIZE) == 0) {
-					const uint64_t hint = reinterpret_cast<uint64_t>(hintPtr);
-					size_t indexOffset = 0;
-					unsigned int fitFound = 0;
+				ShdMem::PTE* const pte = Paging::GetPTEAddress(mapping);
 
-					for (size_t i = 0; i <= index; ++i) {
-						VMemMapBlock* newBlock = vmmb - i;
+				if (!IsOnDemand(*pte)) {
+					continue;
+				}
 
-						if (newBlock->virtualStart <= hint
-							&& hint + pages * ShdMem::FRAME_SIZE
-							<= newBlock->virtualStart + newBlock->availablePages * ShdMem::FRAME_SIZE
-						) {
-							indexOffset = i;
-							fitFound = 1;
-							break;
-						}
-						else if (newBlock->virtualStart < vmmb->virtualStart && newBlock->virtualStart >= hint) {
-							if (hint + pages * ShdMem::FRAME_SIZE
-								<= newBlock->virtualStart + newBlock->availablePages * ShdMem::FRAME_SIZE
-							) {
-								indexOffset = i;
-								fitFound = 1;
-								continue;
-							}
-						}
-					}
+				entries[count++] = pte;
 
-					if (fitFound && vmmb->availablePages > pages) {
-						vmmb -= indexOffset;
-						index -= indexOffset;
-
-						if (vmmb->virtualStart <= hint) {
-							VMemMapBlock prevBlock = {
-								.virtualStart = vmmb->virtualStart,
-								.availablePages = (hint - vmmb->virtualStart) / ShdMem::FRAME_SIZE
-							};
-							VMemMapBlock nextBlock = {
-								.virtualStart = hint + pages * ShdMem::FRAME_SIZE,
-								.availablePages = (
-									vmmb->virtualStart
-									+ vmmb->availablePages * ShdMem::FRAME_SIZE
-									- (hint + pages * ShdMem::FRAME_SIZE)) / ShdMem::FRAME_SIZE
-							};
-
-							if (prevBlock.availablePages == 0) {
-								return AllocateHintCore<privilege>(vmmb, index, pages);
-							}
-							else if (nextBlock.availablePages == 0) {
-								if (!MapOnDemand(hintPtr, pages, privilege).IsSuccess()) {
-									return nullptr;
-								}
-
-								*vmmb = prevBlock;
-								SortVirtualMemoryMap(vmmb, ctx->storedBlocks - index);
-								ctx->availableMemory -= pages * ShdMem::FRAME_SIZE;
-								
-								return hintPtr;
-							}
-							else {
-								if (ctx->availableBlockMemory == 0) {
-									if (!ExpandVirtualMemoryMap(managementBase, ctx->storedBlocks).IsSuccess()) {
-										return nullptr;
-									}
-									ctx->availableBlockMemory += ShdMem::FRAME_SIZE;
-								}
-
-								if (!MapOnDemand(hintPtr, pages, privilege).IsSuccess()) {
-									return nullptr;
-								}
-
-								VMemMapBlock* splitResidue = reinterpret_cast<VMemMapBlock*>(managementBase) + ctx->storedBlocks++;
-
-								if (prevBlock.availablePages > nextBlock.availablePages) {
-									*vmmb = prevBlock;
-									*splitResidue = nextBlock;
-								}
-								else {
-									*vmmb = nextBlock;
-									*splitResidue = prevBlock;
-								}
-
-								SortVirtualMemoryMap(vmmb, ctx->storedBlocks - index);
-								RSortVirtualMemoryMap(splitResidue, ctx->storedBlocks);
-								ctx->availableMemory -= pages * ShdMem::FRAME_SIZE;
-								ctx->availableBlockMemory -= sizeof(VMemMapBlock);
-
-								return hintPtr;
-							}
-						}
-						else {
-							return AllocateHintCore<privilege>(vmmb, index, pages);
-						}
+				if (count == FAULT_AROUND_PAGES) {
+					const size_t populated = PopulateEntries(entries, count);
+					mapPopulatedCount += populated;
+
+					if (populated != count) {
+						return;
 					}
+
+					count = 0;
 				}
 			}
 
-			void* pagesStart = reinterpret_cast<void*>(
-				vmmb->virtualStart + (vmmb->availablePages -= pages) * ShdMem::FRAME_SIZE
-			);
-			const bool remove = vmmb->availablePages == 0;
+			mapPopulatedCount += PopulateEntries(entries, count);
+		}
+
+		// the clock hand sweeps the user memory of whichever address space is current, it only
+		// moves with the swap I/O lock held
+		static uint64_t clockHand = VirtualMemoryLayout::UserMemory.start;
 
-			if (!MapOnDemand(pagesStart, pages, privilege).IsSuccess()) {
-				vmmb->availablePages += pages;
-				return nullptr;
-			}
+		// Second chance selection: a present user page accessed since the last pass loses its
+		// accessed bit and is spared, the others become victims. The hand stops after two laps.
+		// Pages shared with another address space stay, their frame is not ours to release, and
+		// so do pinned ones.
+		static inline size_t SelectVictims(ShdMem::PTE** victims, uint64_t* addresses, size_t count) {
+			constexpr uint64_t start = VirtualMemoryLayout::UserMemory.start;
+			constexpr uint64_t end = VirtualMemoryLayout::UserVMemManagement.start;
+			constexpr uint64_t candidate = ShdMem::PTE_PRESENT | ShdMem::PTE_USERMODE;
+
+			uint64_t address = clockHand;
+			size_t found = 0;
+			size_t laps = 0;
+
+			Paging::MappingTransaction transaction{};
+
+			while (found < count && laps < 2) {
+				if (address >= end || address < start) {
+					address = start;
+					++laps;
+					continue;
+				}
 
-			SortVirtualMemoryMap(vmmb, ctx->storedBlocks - index);
+				const auto mapping = ShdMem::ParseVirtualAddress(address);
+
+				const uint64_t pml4e = *Paging::GetPML4EAddress(mapping);
+
+				if ((pml4e & ShdMem::PML4E_PRESENT) == 0 || (pml4e & CopyOnWrite::ENTRY_COW) != 0) {
+					address = (address & ~(ShdMem::PML4E_COVERAGE - 1)) + ShdMem::PML4E_COVERAGE;
+					continue;
+				}
 
-			if (remove) {
-				--ctx->storedBlocks;
-				ctx->availableBlockMemory += sizeof(VMemMapBlock);
+				const uint64_t pdpte = *Paging::GetPDPTEAddress(mapping);
 
-				if (ctx->availableBlockMemory % ShdMem::FRAME_SIZE == 0 && ctx->availableBlockMemory > ShdMem::FRAME_SIZE) {
-					ctx->availableBlockMemory -= ShdMem::FRAME_SIZE;
+				if ((pdpte & ShdMem::PDPTE_PRESENT) == 0 || (pdpte & (ShdMem::PDPTE_PAGE_SIZE | CopyOnWrite::ENTRY_COW)) != 0) {
+					address = (address & ~(ShdMem::PDPTE_COVERAGE - 1)) + ShdMem::PDPTE_COVERAGE;
+					continue;
+				}
+
+				const uint64_t pde = *Paging::GetPDEAddress(mapping);
+
+				if ((pde & ShdMem::PDE_PRESENT) == 0 || (pde & (ShdMem::PDE_PAGE_SIZE | CopyOnWrite::ENTRY_COW)) != 0) {
+					address = (address & ~(ShdMem::PDE_COVERAGE - 1)) + ShdMem::PDE_COVERAGE;
+					continue;
+				}
 
-					const uint64_t linearAddress = managementBase + ctx->availableBlockMemory;
-					const auto blockMemoryAddress = ShdMem::ParseVirtualAddress(linearAddress);
+				ShdMem::PTE* const pte = Paging::GetPTEAddress(mapping);
+				const uint64_t page = address;
+				uint64_t entry = *pte;
 
-					const auto blockMemoryPTE = Paging::GetPTEAddress(blockMemoryAddress);
+				address += ShdMem::FRAME_SIZE;
 
-					PhysicalMemory::Free(reinterpret_cast<void*>(Paging::GetPTEInfo(blockMemoryPTE).address));
-					Paging::UnmapPTE(blockMemoryPTE);
-					Paging::InvalidatePage(reinterpret_cast<void*>(linearAddress));
+				if ((entry & candidate) != candidate || (entry & (PTE_LOCK | CopyOnWrite::ENTRY_COW)) != 0
+					|| CopyOnWrite::IsShared(entry & ShdMem::PTE_ADDRESS)
+					|| PhysicalMemory::IsPinned(entry & ShdMem::PTE_ADDRESS)
+				) {
+					continue;
 				}
+				else if ((entry & ShdMem::PTE_ACCESSED) != 0) {
+					// an entry changed in the meantime is simply looked at again on the next lap
+					Utils::Atomic::Backend::CompareExchange<Utils::MemoryOrder::SEQ_CST>(pte, entry, entry & ~ShdMem::PTE_ACCESSED);
+					transaction.Invalidate(reinterpret_cast<const void*>(page));
+					continue;
+				}
+
+				victims[found] = pte;
+				addresses[found] = page;
+				++found;
 			}
 
-			ctx->availableMemory -= pages * ShdMem::FRAME_SIZE;
-			return pagesStart;
-		}
+			clockHand = address;
 
-		template<AccessPrivilege privilege> static inline Success FreeCore(void* ptr, uint64_t pages) {
-			constexpr uint64_t managementBase = privilege == AccessPrivilege::HIGH
-				? VirtualMemoryLayout::KernelHeapManagement.start
-				: (VirtualMemoryLayout::UserVMemManagement.start
-					+ (sizeof(*userContext) + sizeof(VMemMapBlock) - 1) / sizeof(VMemMapBlock));
+			return found;
+		}
 
-			MemoryContext* ctx = privilege == AccessPrivilege::HIGH ? &kernelContext : userContext;
+		// A new address space with its kernel stack, left behind the secondary recursive mapping.
+		/// FIXME: a failure after the recursive mapping is created will cause a memory leak
+		/// How to fix: create a method to completely free an entire page table
+		static void* CreateTaskAddressSpace() {
+			void* const CR3 = PhysicalMemory::Allocate();
 
-			if (pages == 0) {
-				return Success();
+			if (CR3 == nullptr) {
+				return nullptr;
 			}
 			
-			uint64_t address = reinterpret_cast<uint64_t>(ptr);
+			if (!Paging::CreateSecondaryRecursiveMapping(CR3).IsSuccess()) {
+				PhysicalMemory::Free(CR3);
+				return nullptr;
+			}
 
-			if constexpr (privilege == AccessPrivilege::LOW) {
-				if (address > VirtualMemoryLayout::UserMemory.start + VirtualMemoryLayout::UserMemory.limit
-					|| address < VirtualMemoryLayout::UserMemory.start
-					|| address + pages * ShdMem::FRAME_SIZE < address
-				) {
-					return Failure();
-				}
+			// setup kernel stack and kernel stack guard
+			if (!MapOnDemand<false>(
+				reinterpret_cast<void*>(VirtualMemoryLayout::KernelStack.start),
+				(VirtualMemoryLayout::KernelStack.limit - ShdMem::PAGE_SIZE) / ShdMem::PAGE_SIZE,
+				AccessPrivilege::HIGH
+			).IsSuccess()) {
+				Paging::FreeSecondaryRecursiveMapping();
+				return nullptr;
 			}
 
-			for (size_t i = 0; i < pages; ++i, address += ShdMem::FRAME_SIZE) {
-				const auto mapping = ShdMem::ParseVirtualAddress(address);
+			const auto stack_guard_address = reinterpret_cast<void*>(VirtualMemoryLayout::KernelStackGuard.start);
+			const auto stack_guard_mapping = ShdMem::ParseVirtualAddress(stack_guard_address);
+			const auto stack_guard_pte = Paging::GetPTEAddress(stack_guard_mapping, false);
+			Paging::UnmapPTE(stack_guard_pte);
+			Paging::InvalidatePage(stack_guard_address);
 
-				const auto pml4e = Paging::GetPML4EAddress(mapping);
-				const auto pdpte = Paging::GetPDPTEAddress(mapping);
-				const auto pde 	 = Paging::GetPDEAddress(mapping);
-				const auto pte 	 = Paging::GetPTEAddress(mapping);
+			// stack top and stack reserve
+			void* frames[2] = {};
 
-				const auto pml4e_info = Paging::GetPML4EInfo(pml4e);
-				const auto pdpte_info = Paging::GetPDPTEInfo(pdpte);
-				const auto pde_info   = Paging::GetPDEInfo(pde);
-				const auto pte_info   = Paging::GetPTEInfo(pte);
+			const size_t allocated = PhysicalMemory::AllocateBatch(frames, 2);
 
-				if constexpr (privilege == AccessPrivilege::LOW) {
-					if (!pml4e_info.present || !pdpte_info.present || !pde_info.present || *pte == 0) {
-						return Failure();
-					}
-				}
+			if (allocated != 2) {
+				PhysicalMemory::FreeBatch(frames, allocated);
+				Paging::FreeSecondaryRecursiveMapping();
+				return nullptr;
+			}
 
-				if (pde_info.present) {
-					if (pde_info.pageSize) {
-						constexpr uint64_t pagesPerHugePage = ShdMem::PDE_COVERAGE / ShdMem::FRAME_SIZE;
+			void* const stack_top = frames[0];
+			void* const stack_reserve = frames[1];
 
-						void* const pageAddress = reinterpret_cast<void*>(pde_info.address);
+			if (!MapPage<false>(
+				reinterpret_cast<uint64_t>(stack_top),
+				VirtualMemoryLayout::KernelStackReserve.start - ShdMem::PAGE_SIZE,
+				AccessPrivilege::HIGH
+			).IsSuccess()) {
+				PhysicalMemory::FreeBatch(frames, 2);
+				Paging::FreeSecondaryRecursiveMapping();
+				return nullptr;
+			}
 
-						if (!PhysicalMemory::Free2MB(pageAddress).IsSuccess()) {
-							return Failure();
-						}
+			if (!MapPage<false>(
+				reinterpret_cast<uint64_t>(stack_reserve),
+				VirtualMemoryLayout::KernelStackReserve.start,
+				AccessPrivilege::HIGH
+			).IsSuccess()) {
+				PhysicalMemory::Free(stack_reserve);
+				Paging::FreeSecondaryRecursiveMapping();
+				return nullptr;
+			}
 
-						Paging::UnmapPDE(pde);
-						Paging::InvalidatePage(reinterpret_cast<void*>(address));
+			return CR3;
+		}
 
-						i += pagesPerHugePage - 1;
-						address += (pagesPerHugePage - 1) * ShdMem::FRAME_SIZE;
-					}
-					else {
-						if (pte_info.present) {
-							void* pageAddress = reinterpret_cast<void*>(pte_info.address);
+		static constexpr uint64_t PAGES_PER_HUGE_PAGE = ShdMem::PDE_COVERAGE / ShdMem::FRAME_SIZE;
 
-							if (!PhysicalMemory::Free(pageAddress).IsSuccess()) {
-								return Failure();
-							}
+		// attributes encoded at the same position in a PTE and in a 2MB PDE (PAT moves from bit 7 to bit 12)
+		static constexpr uint64_t SHARED_ENTRY_FLAGS = ShdMem::PTE_READWRITE
+			| ShdMem::PTE_USERMODE
+			| ShdMem::PTE_PWT
+			| ShdMem::PTE_PCD
+			| ShdMem::PTE_GLOBAL
+			| ShdMem::PTE_PK
+			| ShdMem::PTE_XD;
 
-							Paging::UnmapPTE(pte);
-							Paging::InvalidatePage(reinterpret_cast<void*>(address));
-						}
-						else if ((*pte & VirtualMemory::NP_ON_DEMAND) != 0) {
-							/// TODO: do stuff with the swap file
-						}
-						
-					}
-				}
+		static inline void InvalidateHugeRange(uint64_t address) {
+			Paging::MappingTransaction transaction{};
+
+			for (size_t i = 0; i < PAGES_PER_HUGE_PAGE; ++i, address += ShdMem::FRAME_SIZE) {
+				transaction.Invalidate(reinterpret_cast<void*>(address));
 			}
+		}
 
-			VMemMapBlock vmmb = {
-				.virtualStart = reinterpret_cast<uint64_t>(ptr),
-				.availablePages = pages
-			};
+		// Backs a 2MB aligned kernel heap range with a single huge page. The page table
+		// it replaces only held on-demand entries of the same allocation.
+		static inline bool BackHugePage(uint64_t address) {
+			void* const frame = PhysicalMemory::Allocate2MB();
 
-			if (ctx->availableBlockMemory == 0) {
-				auto status = ExpandVirtualMemoryMap(managementBase, ctx->storedBlocks);
+			if (frame == nullptr) {
+				return false;
+			}
 
-				if (!status.IsSuccess()) {
-					return Failure();
-				}
+			const auto mapping = ShdMem::ParseVirtualAddress(address);
+			const auto pde_info = Paging::GetPDEInfo(Paging::GetPDEAddress(mapping));
 
-				ctx->availableBlockMemory += ShdMem::FRAME_SIZE;
+			if (!MapPage(reinterpret_cast<uint64_t>(frame), address, AccessPrivilege::HIGH, true).IsSuccess()) {
+				PhysicalMemory::Free2MB(frame);
+				return false;
 			}
 
-			VMemMapBlock* blockPtr = reinterpret_cast<VMemMapBlock*>(managementBase) + ctx->storedBlocks++;
-			*blockPtr = vmmb;
-			ctx->availableBlockMemory -= sizeof(VMemMapBlock);
-			ctx->availableMemory += pages * ShdMem::FRAME_SIZE;
-			RSortVirtualMemoryMap(blockPtr, ctx->storedBlocks);
+			// the old table may still be cached under another PCID, drop it everywhere first
+			if (pde_info.present && !pde_info.pageSize) {
+				Paging::InvalidateAllProcessors();
+				PhysicalMemory::Free(reinterpret_cast<void*>(pde_info.address));
+			}
 
-			return Success();
+			return true;
 		}
-    }
 
-	Success Setup() {
-		// make the NULL memory page reserved and unusable, and allocate the DMA PML4E and PDPTE
-		if (PhysicalMemory::QueryDMAAddress(0) == PhysicalMemory::StatusCode::FREE) {
-			if (VirtualMemory::AllocateDMA(1) == nullptr) {
+		// Splits a 2MB mapping back into 4KB pages so that part of it can be released.
+		// The frames stay allocated, the physical allocator tracks them per 4KB page.
+		static inline Success DemoteHugePage(uint64_t address) {
+			address &= ~(ShdMem::PDE_COVERAGE - 1);
+
+			const auto mapping = ShdMem::ParseVirtualAddress(address);
+			const auto pde = Paging::GetPDEAddress(mapping);
+			const uint64_t entry = *pde;
+
+			void* page = PhysicalMemory::Allocate();
+
+			if (page == nullptr) {
 				return Failure();
 			}
-		}
-		else {
-			MapPage(0, 0, AccessPrivilege::MEDIUM);
+
+			// fill the table through a temporary mapping before it becomes visible
+			auto* const pt = static_cast<ShdMem::PTE*>(MapGeneralPages(page, 1, ShdMem::PTE_READWRITE));
+
+			if (pt == nullptr) {
+				PhysicalMemory::Free(page);
+				return Failure();
+			}
+
+			const uint64_t flags = (entry & SHARED_ENTRY_FLAGS)
+				| ((entry & ShdMem::PDE_PAT) != 0 ? ShdMem::PTE_PAT : 0)
+				| ShdMem::PTE_PRESENT;
+
+			const uint64_t physical = entry & ShdMem::PDE_2MB_ADDRESS;
+
+			for (size_t i = 0; i < PAGES_PER_HUGE_PAGE; ++i) {
+				pt[i] = ((physical + i * ShdMem::FRAME_SIZE) & ShdMem::PTE_ADDRESS) | flags;
+			}
+
+			UnmapGeneralPages(pt, 1);
+
+			*pde = (PhysicalMemory::FilterAddress(page) & ShdMem::PDE_ADDRESS)
+				| (entry & (ShdMem::PDE_READWRITE | ShdMem::PDE_USERMODE))
+				| ShdMem::PDE_PRESENT;
+
+			InvalidateHugeRange(address);
+			Paging::InvalidatePage(Paging::GetPTAddress(mapping));
+
+			return Success();
 		}
 
-		static constexpr auto nullMapping = ShdMem::ParseVirtualAddress(static_cast<uint64_t>(0));
+		// Replaces a page table whose entries are all present with identical attributes by a
+		// single 2MB mapping. Frames that already form an aligned physical run are kept,
+		// otherwise the contents are copied into a fresh 2MB frame. Other processors may write
+		// through their own 4KB entries meanwhile, so the range is made read-only on all of
+		// them before the copy, and their writes wait in AwaitPromotion until the PDE changes.
+		static inline bool PromoteHugePage(uint64_t address) {
+			const auto mapping = ShdMem::ParseVirtualAddress(address);
+			const auto pde = Paging::GetPDEAddress(mapping);
+			const auto pt = Paging::GetPTAddress(mapping);
 
-		Paging::UnmapPTE(Paging::GetPTEAddress(nullMapping));
-		
-		// set up identity paging for the DMA zone, and allocate all necessary pages table it needs
-		// even if they are not mapping to anything yet
+			Interrupts::InterruptGuard irqGuard{};
 
-		static constexpr auto dmaStart = ShdMem::Layout::DMAZone.start;
-		static constexpr auto dmaEnd = ShdMem::Layout::DMAZone.start + ShdMem::Layout::DMAZone.limit;
+			const uint64_t pde_entry = *pde;
 
-		for (size_t i = dmaStart; i < dmaEnd; i += ShdMem::FRAME_SIZE) {
-			if (PhysicalMemory::QueryDMAAddress(i) == PhysicalMemory::StatusCode::ALLOCATED) {
-				MapPage(i, i, AccessPrivilege::MEDIUM);
+			if ((pde_entry & ShdMem::PDE_PRESENT) == 0 || (pde_entry & ShdMem::PDE_PAGE_SIZE) != 0) {
+				return false;
 			}
-			else {
-				const auto mapping = ShdMem::ParseVirtualAddress(i);
 
-				const auto pdpte 		= Paging::GetPDPTEAddress(mapping);
-				const auto pdpte_info 	= Paging::GetPDPTEInfo(pdpte);
+			constexpr uint64_t IGNORED_FLAGS = ShdMem::PTE_ADDRESS | ShdMem::PTE_ACCESSED | ShdMem::PTE_DIRTY;
 
-				const auto pd 			= Paging::GetPDAddress(mapping);
-				const auto pde 			= Paging::GetPDEAddress(mapping);
+			const uint64_t base = pt[0] & ShdMem::PTE_ADDRESS;
+			const uint64_t flags = pt[0] & ~IGNORED_FLAGS;
 
-				const auto pt 			= Paging::GetPTAddress(mapping);
+			if ((flags & ShdMem::PTE_PRESENT) == 0 || (flags & PTE_LOCK) != 0) {
+				return false;
+			}
 
-				if (!pdpte_info.present) {
-					void* page = PhysicalMemory::Allocate();
-					
-					if (page == nullptr) {
-						return Failure();
-					}
+			bool contiguous = base % ShdMem::PDE_COVERAGE == 0;
 
-					Paging::SetPDPTEInfo(pdpte, {
-						.present = 1,
-						.readWrite = 1,
-						.userMode = 1,
-						.address = PhysicalMemory::FilterAddress(page)
-					});
+			for (size_t i = 1; i < PAGES_PER_HUGE_PAGE; ++i) {
+				if ((pt[i] & ~IGNORED_FLAGS) != flags) {
+					return false;
+				}
 
-					Paging::InvalidatePage(pd);
-					ShdMem::ZeroPage(pd);
+				contiguous = contiguous && (pt[i] & ShdMem::PTE_ADDRESS) == base + i * ShdMem::FRAME_SIZE;
+			}
+
+			void* frames[PAGES_PER_HUGE_PAGE];
+			void* vhuge = nullptr;
+			uint64_t physical = base;
+
+			if (!contiguous) {
+				void* const huge = PhysicalMemory::Allocate2MB();
+
+				if (huge == nullptr) {
+					return false;
 				}
 
-				const auto pde_info = Paging::GetPDEInfo(pde);
+				vhuge = MapGeneralPages(
+					huge,
+					1,
+					ShdMem::PDE_PAGE_SIZE | ShdMem::PDE_READWRITE | ShdMem::PDE_PRESENT
+				);
 
-				if (!pde_info.present) {
-					void* page = PhysicalMemory::Allocate();
+				if (vhuge == nullptr) {
+					PhysicalMemory::Free2MB(huge);
+					return false;
+				}
 
-					if (page == nullptr) {
-						return Failure();
+				promotingRange = address;
+
+				{
+					Paging::MappingTransaction transaction{};
+
+					for (size_t i = 0; i < PAGES_PER_HUGE_PAGE; ++i) {
+						pt[i] &= ~ShdMem::PTE_READWRITE;
+						transaction.Invalidate(reinterpret_cast<void*>(address + i * ShdMem::FRAME_SIZE));
 					}
-					
-					Paging::SetPDEInfo(pde, {
-						.present = 1,
-						.readWrite = 1,
-						.userMode = 1,
-						.address = PhysicalMemory::FilterAddress(page)
-					});
+				}
 
-					Paging::InvalidatePage(pt);
-					ShdMem::ZeroPage(pt);
+				Utils::memcpy(vhuge, reinterpret_cast<void*>(address), ShdMem::PDE_COVERAGE);
+
+				// the table is only reachable through the recursive mapping until the PDE changes
+				for (size_t i = 0; i < PAGES_PER_HUGE_PAGE; ++i) {
+					frames[i] = reinterpret_cast<void*>(pt[i] & ShdMem::PTE_ADDRESS);
 				}
+
+				physical = reinterpret_cast<uint64_t>(huge);
 			}
-		}
 
-		// set up kernel heap
-		void* basePage = PhysicalMemory::Allocate();
-		if (basePage == nullptr) {
-			return Failure();
-		}
+			*pde = (physical & ShdMem::PDE_2MB_ADDRESS)
+				| (flags & SHARED_ENTRY_FLAGS)
+				| ((flags & ShdMem::PTE_PAT) != 0 ? ShdMem::PDE_PAT : 0)
+				| ShdMem::PDE_PAGE_SIZE
+				| ShdMem::PDE_PRESENT;
 
-		if (!MapPage(
-			reinterpret_cast<uint64_t>(basePage),
-			VirtualMemoryLayout::KernelHeapManagement.start,
-			AccessPrivilege::HIGH
-		).IsSuccess()) {
-			return Failure();
-		}
+			// the table is about to be freed, and other PCIDs or processors may still cache it
+			Paging::InvalidateAllProcessors();
 
-		kernelContext.availableBlockMemory = ShdMem::FRAME_SIZE - sizeof(VMemMapBlock);
-		kernelContext.storedBlocks = 1;
+			// the waiting writers may hold locks that the releases below need
+			promotingRange = 0;
 
-		VMemMapBlock* kernelHeapBlockPtr = reinterpret_cast<VMemMapBlock*>(VirtualMemoryLayout::KernelHeapManagement.start);
-		kernelHeapBlockPtr->virtualStart = VirtualMemoryLayout::KernelHeap.start;
-		kernelHeapBlockPtr->availablePages = kernelContext.availableMemory / ShdMem::FRAME_SIZE;
-		
-		return Success();
-	}
+			if (!contiguous) {
+				UnmapGeneralPages(vhuge, 1);
+				PhysicalMemory::FreeBatch(frames, PAGES_PER_HUGE_PAGE);
+			}
 
-	void* DeriveNewFreshCR3() {
-		void* const CR3 = PhysicalMemory::Allocate();
+			PhysicalMemory::Free(reinterpret_cast<void*>(pde_entry & ShdMem::PDE_ADDRESS));
 
-		if (CR3 == nullptr) {
-			return nullptr;
-		}
-		
-		if (!Paging::CreateSecondaryRecursiveMapping(CR3).IsSuccess()) {
-			PhysicalMemory::Free(CR3);
-			return nullptr;
+			return true;
 		}
 
-		/// FIXME: starting from here, a failure will cause a memory leak
-		/// How to fix: create a method to completely free an entire page table
+		static inline uint64_t GetHeight(const Area* area) {
+			return area == nullptr ? 0 : area->height;
+		}
 
-		// setup kernel stack and kernel stack guard
-		if (!MapOnDemand<false>(
-			reinterpret_cast<void*>(VirtualMemoryLayout::KernelStack.start),
-			(VirtualMemoryLayout::KernelStack.limit - ShdMem::PAGE_SIZE) / ShdMem::PAGE_SIZE,
-			AccessPrivilege::HIGH
-		).IsSuccess()) {
-			Paging::FreeSecondaryRecursiveMapping();
-			return nullptr;
+		static inline uint64_t GetMaxGap(const Area* area) {
+			return area == nullptr ? 0 : area->maxGap;
 		}
 
-		const auto stack_guard_address = reinterpret_cast<void*>(VirtualMemoryLayout::KernelStackGuard.start);
-		const auto stack_guard_mapping = ShdMem::ParseVirtualAddress(stack_guard_address);
-		const auto stack_guard_pte = Paging::GetPTEAddress(stack_guard_mapping, false);
-		Paging::UnmapPTE(stack_guard_pte);
-		Paging::InvalidatePage(stack_guard_address);
+		static inline void UpdateArea(Area* area) {
+			const uint64_t leftHeight = GetHeight(area->left);
+			const uint64_t rightHeight = GetHeight(area->right);
+			const uint64_t leftGap = GetMaxGap(area->left);
+			const uint64_t rightGap = GetMaxGap(area->right);
 
-		void* stack_top = PhysicalMemory::Allocate();
+			area->height = (leftHeight > rightHeight ? leftHeight : rightHeight) + 1;
+			area->maxGap = area->gap;
+
+			if (leftGap > area->maxGap) {
+				area->maxGap = leftGap;
+			}
+
+			if (rightGap > area->maxGap) {
+				area->maxGap = rightGap;
+			}
+		}
+
+		static inline int64_t GetBalanceFactor(const Area* area) {
+			return static_cast<int64_t>(GetHeight(area->left)) - static_cast<int64_t>(GetHeight(area->right));
+		}
+
+		static Area* RotateLeft(Area* root) {
+			Area* newRoot = root->right;
+
+			root->right = newRoot->left;
+			newRoot->left = root;
+
+			UpdateArea(root);
+			UpdateArea(newRoot);
+
+			return newRoot;
+		}
+
+		static Area* RotateRight(Area* root) {
+			Area* newRoot = root->left;
+
+			root->left = newRoot->right;
+			newRoot->right = root;
+
+			UpdateArea(root);
+			UpdateArea(newRoot);
+
+			return newRoot;
+		}
+
+		static Area* Rebalance(Area* root) {
+			UpdateArea(root);
+
+			const int64_t balanceFactor = GetBalanceFactor(root);
+
+			if (balanceFactor > 1) {
+				if (GetBalanceFactor(root->left) < 0) {
+					root->left = RotateLeft(root->left);
+				}
+
+				return RotateRight(root);
+			}
+			else if (balanceFactor < -1) {
+				if (GetBalanceFactor(root->right) > 0) {
+					root->right = RotateRight(root->right);
+				}
+
+				return RotateLeft(root);
+			}
+
+			return root;
+		}
+
+		static Area* InsertArea(Area* root, Area* area) {
+			if (root == nullptr) {
+				area->left = nullptr;
+				area->right = nullptr;
+				UpdateArea(area);
+				return area;
+			}
+
+			if (area->start < root->start) {
+				root->left = InsertArea(root->left, area);
+			}
+			else {
+				root->right = InsertArea(root->right, area);
+			}
+
+			return Rebalance(root);
+		}
+
+		static Area* DeleteMinArea(Area* root, Area*& min) {
+			if (root->left == nullptr) {
+				min = root;
+				return root->right;
+			}
+
+			root->left = DeleteMinArea(root->left, min);
+
+			return Rebalance(root);
+		}
+
+		static Area* DeleteArea(Area* root, uint64_t start) {
+			if (root == nullptr) {
+				return nullptr;
+			}
+
+			if (root->start == start) {
+				if (root->left == nullptr) {
+					return root->right;
+				}
+				else if (root->right == nullptr) {
+					return root->left;
+				}
+
+				Area* successor;
+				Area* right = DeleteMinArea(root->right, successor);
+
+				successor->left = root->left;
+				successor->right = right;
+
+				return Rebalance(successor);
+			}
+
+			if (start < root->start) {
+				root->left = DeleteArea(root->left, start);
+			}
+			else {
+				root->right = DeleteArea(root->right, start);
+			}
+
+			return Rebalance(root);
+		}
+
+		// recomputes the largest gaps on the path to an area whose own gap changed
+		static void RefreshArea(Area* root, uint64_t start) {
+			if (root == nullptr) {
+				return;
+			}
+
+			if (start < root->start) {
+				RefreshArea(root->left, start);
+			}
+			else if (start > root->start) {
+				RefreshArea(root->right, start);
+			}
+
+			UpdateArea(root);
+		}
+
+		static Area* FindArea(Area* root, uint64_t address) {
+			while (root != nullptr) {
+				if (address < root->start) {
+					root = root->left;
+				}
+				else if (address >= root->end()) {
+					root = root->right;
+				}
+				else {
+					return root;
+				}
+			}
+
+			return nullptr;
+		}
+
+		// the first area starting at or after address
+		static Area* FindNextArea(Area* root, uint64_t address) {
+			Area* next = nullptr;
+
+			while (root != nullptr) {
+				if (root->start >= address) {
+					next = root;
+					root = root->left;
+				}
+				else {
+					root = root->right;
+				}
+			}
+
+			return next;
+		}
+
+		// the lowest area preceded by a gap of at least the given number of pages
+		static Area* FindGap(Area* root, uint64_t pages) {
+			while (root != nullptr && root->maxGap >= pages) {
+				if (GetMaxGap(root->left) >= pages) {
+					root = root->left;
+				}
+				else if (root->gap >= pages) {
+					return root;
+				}
+				else {
+					root = root->right;
+				}
+			}
 
-		if (stack_top == nullptr) {
-			Paging::FreeSecondaryRecursiveMapping();
 			return nullptr;
 		}
 
-		void* stack_reserve = PhysicalMemory::Allocate();
+		// every page of the range belongs to some area
+		static bool IsReserved(Area* root, uint64_t start, uint64_t end) {
+			if (end <= start) {
+				return false;
+			}
+
+			while (start < end) {
+				const Area* area = FindArea(root, start);
+
+				if (area == nullptr) {
+					return false;
+				}
+
+				start = area->end();
+			}
+
+			return true;
+		}
+
+		static inline Area* NewArea(MemoryContext* ctx) {
+			if (ctx->freeAreas != nullptr) {
+				Area* const area = ctx->freeAreas;
+				ctx->freeAreas = area->right;
+				return area;
+			}
+
+			if (ctx->poolCursor + sizeof(Area) > ctx->poolEnd) {
+				void* page = PhysicalMemory::Allocate();
+
+				if (page == nullptr) {
+					return nullptr;
+				}
+
+				if (!MapPage(reinterpret_cast<uint64_t>(page), ctx->poolEnd, AccessPrivilege::HIGH).IsSuccess()) {
+					PhysicalMemory::Free(page);
+					return nullptr;
+				}
+
+				ctx->poolEnd += ShdMem::FRAME_SIZE;
+			}
+
+			Area* const area = reinterpret_cast<Area*>(ctx->poolCursor);
+			ctx->poolCursor += sizeof(Area);
+
+			return area;
+		}
+
+		static inline void FreeArea(MemoryContext* ctx, Area* area) {
+			area->right = ctx->freeAreas;
+			ctx->freeAreas = area;
+		}
+
+		// the context managing an address, the user one belongs to the current address space
+		static inline MemoryContext* GetContext(uint64_t address) {
+			if (address >= VirtualMemoryLayout::KernelHeap.start && address < VirtualMemoryLayout::KernelHeap.end()) {
+				return &kernelContext;
+			}
+			else if (address >= VirtualMemoryLayout::UserMemory.start && address < VirtualMemoryLayout::UserMemory.end()) {
+				return userContext;
+			}
+
+			return nullptr;
+		}
+
+		// Records an allocation at the hint if that range is free, and otherwise at the top of
+		// the lowest gap large enough for it, which keeps allocations away from the bottom of
+		// the user zone where the DMA zone lies. It joins the next area when nothing separates
+		// them and their attributes match.
+		static Optional<uint64_t> ReserveArea(MemoryContext* ctx, uint64_t pages, uint64_t hint, const RegionAttributes& attributes) {
+			Interrupts::InterruptGuard irqGuard{};
+			Utils::LockGuard _{ctx->lock};
+
+			Area* next = nullptr;
+			uint64_t start = hint;
+
+			if (hint != 0 && hint + pages * ShdMem::FRAME_SIZE > hint) {
+				next = FindNextArea(ctx->root, hint + pages * ShdMem::FRAME_SIZE);
+
+				if (next != nullptr && next->gapStart() > hint) {
+					next = nullptr;
+				}
+			}
+
+			if (next == nullptr) {
+				next = FindGap(ctx->root, pages);
+
+				if (next == nullptr) {
+					return Optional<uint64_t>();
+				}
+
+				start = next->start - pages * ShdMem::FRAME_SIZE;
+			}
+
+			const uint64_t end = start + pages * ShdMem::FRAME_SIZE;
+			const uint64_t gap = (start - next->gapStart()) / ShdMem::FRAME_SIZE;
+
+			if (end == next->start && next->pages != 0 && next->attributes == attributes) {
+				next->start = start;
+				next->pages += pages;
+				next->gap = gap;
+				RefreshArea(ctx->root, start);
+
+				return Optional<uint64_t>(start);
+			}
+
+			Area* const area = NewArea(ctx);
+
+			if (area == nullptr) {
+				return Optional<uint64_t>();
+			}
+
+			area->start = start;
+			area->pages = pages;
+			area->gap = gap;
+			area->attributes = attributes;
+
+			next->gap = (next->start - end) / ShdMem::FRAME_SIZE;
+			RefreshArea(ctx->root, next->start);
+
+			ctx->root = InsertArea(ctx->root, area);
+
+			return Optional<uint64_t>(start);
+		}
+
+		// Gives a reserved range back to the gaps around it, an area is split in two if the
+		// range only covers its middle.
+		static Success ReleaseArea(MemoryContext* ctx, uint64_t start, uint64_t pages) {
+			Interrupts::InterruptGuard irqGuard{};
+			Utils::LockGuard _{ctx->lock};
+
+			const uint64_t end = start + pages * ShdMem::FRAME_SIZE;
+
+			if (!IsReserved(ctx->root, start, end)) {
+				return Failure();
+			}
+
+			while (start < end) {
+				Area* const area = FindArea(ctx->root, start);
+				const uint64_t areaEnd = area->end();
+				const uint64_t cutEnd = end < areaEnd ? end : areaEnd;
+				const uint64_t cut = (cutEnd - start) / ShdMem::FRAME_SIZE;
+
+				if (area->start < start && cutEnd < areaEnd) {
+					// only happens with a range inside a single area, so nothing changed yet
+					Area* const tail = NewArea(ctx);
+
+					if (tail == nullptr) {
+						return Failure();
+					}
+
+					tail->start = cutEnd;
+					tail->pages = (areaEnd - cutEnd) / ShdMem::FRAME_SIZE;
+					tail->gap = cut;
+					tail->attributes = area->attributes;
+
+					area->pages = (start - area->start) / ShdMem::FRAME_SIZE;
+					ctx->root = InsertArea(ctx->root, tail);
+				}
+				else if (area->start < start) {
+					Area* const next = FindNextArea(ctx->root, areaEnd);
+
+					area->pages -= cut;
+					next->gap += cut;
+					RefreshArea(ctx->root, next->start);
+				}
+				else if (cutEnd < areaEnd) {
+					area->start = cutEnd;
+					area->pages -= cut;
+					area->gap += cut;
+					RefreshArea(ctx->root, cutEnd);
+				}
+				else {
+					Area* const next = FindNextArea(ctx->root, areaEnd);
+
+					next->gap += area->gap + area->pages;
+					RefreshArea(ctx->root, next->start);
+
+					ctx->root = DeleteArea(ctx->root, area->start);
+					FreeArea(ctx, area);
+				}
+
+				start = cutEnd;
+			}
+
+			return Success();
+		}
+
+		// makes address the start of an area if it falls inside one
+		static Success SplitArea(MemoryContext* ctx, uint64_t address) {
+			Area* const area = FindArea(ctx->root, address);
+
+			if (area == nullptr || area->start == address) {
+				return Success();
+			}
+
+			Area* const tail = NewArea(ctx);
+
+			if (tail == nullptr) {
+				return Failure();
+			}
+
+			tail->start = address;
+			tail->pages = (area->end() - address) / ShdMem::FRAME_SIZE;
+			tail->gap = 0;
+			tail->attributes = area->attributes;
+
+			area->pages -= tail->pages;
+			ctx->root = InsertArea(ctx->root, tail);
+
+			return Success();
+		}
+
+		// applies a change to the attributes of a reserved range, splitting the areas it cuts through
+		template<class F>
+		static Success UpdateRegions(void* ptr, uint64_t pages, F update) {
+			const uint64_t start = reinterpret_cast<uint64_t>(ptr);
+			const uint64_t end = start + pages * ShdMem::FRAME_SIZE;
+
+			MemoryContext* const ctx = GetContext(start);
+
+			if (ctx == nullptr || start % ShdMem::FRAME_SIZE != 0) {
+				return Failure();
+			}
+
+			Interrupts::InterruptGuard irqGuard{};
+			Utils::LockGuard _{ctx->lock};
+
+			if (!IsReserved(ctx->root, start, end)
+				|| !SplitArea(ctx, start).IsSuccess()
+				|| !SplitArea(ctx, end).IsSuccess()
+			) {
+				return Failure();
+			}
+
+			for (uint64_t address = start; address < end;) {
+				Area* const area = FindArea(ctx->root, address);
+
+				update(area->attributes);
+				address = area->end();
+			}
+
+			return Success();
+		}
+
+		// A fault may interrupt code holding the context lock on the same processor, for instance
+		// while a frame magazine is first touched, so the fault handler does not wait for it.
+		static Success FindRegion(uint64_t address, Region& region, bool wait) {
+			MemoryContext* const ctx = GetContext(address);
+
+			if (ctx == nullptr) {
+				return Failure();
+			}
+
+			Interrupts::InterruptGuard irqGuard{};
+
+			if (wait) {
+				ctx->lock.lock();
+			}
+			else if (!ctx->lock.trylock()) {
+				return Failure();
+			}
+
+			const Area* area = FindArea(ctx->root, address);
+
+			if (area != nullptr) {
+				region = {
+					.start = area->start,
+					.pages = area->pages,
+					.attributes = area->attributes
+				};
+			}
+
+			ctx->lock.unlock();
+
+			return Success(area != nullptr);
+		}
+
+        template<AccessPrivilege privilege>
+		static inline void* AllocateCore(uint64_t pages, void* hintPtr, const RegionAttributes& attributes) {
+			MemoryContext* ctx = privilege == AccessPrivilege::HIGH ? &kernelContext : userContext;
+
+			if (pages == 0) {
+				return nullptr;
+			}
+
+			const uint64_t hint = reinterpret_cast<uint64_t>(hintPtr) % ShdMem::FRAME_SIZE == 0
+				? reinterpret_cast<uint64_t>(hintPtr)
+				: 0;
+
+			const auto start = ReserveArea(ctx, pages, hint, attributes);
+
+			if (!start.HasValue()) {
+				return nullptr;
+			}
+
+			void* pagesStart = reinterpret_cast<void*>(start.GetValue());
+
+			if (!MapOnDemand(pagesStart, pages, privilege, attributes.caching).IsSuccess()) {
+				ReleaseArea(ctx, start.GetValue(), pages);
+				return nullptr;
+			}
+
+			return pagesStart;
+		}
+
+		template<AccessPrivilege privilege> static inline Success FreeCore(void* ptr, uint64_t pages) {
+			MemoryContext* ctx = privilege == AccessPrivilege::HIGH ? &kernelContext : userContext;
+
+			if (pages == 0) {
+				return Success();
+			}
+			
+			uint64_t address = reinterpret_cast<uint64_t>(ptr);
+
+			if constexpr (privilege == AccessPrivilege::LOW) {
+				if (address > VirtualMemoryLayout::UserMemory.start + VirtualMemoryLayout::UserMemory.limit
+					|| address < VirtualMemoryLayout::UserMemory.start
+					|| address + pages * ShdMem::FRAME_SIZE < address
+				) {
+					return Failure();
+				}
+			}
+
+			{
+				Interrupts::InterruptGuard irqGuard{};
+				Utils::LockGuard _{ctx->lock};
+
+				if (!IsReserved(ctx->root, address, address + pages * ShdMem::FRAME_SIZE)) {
+					return Failure();
+				}
+			}
+
+			// frames are handed back once the whole batch of unmapped pages is invalidated
+			Paging::MappingTransaction transaction{};
+
+			for (size_t i = 0; i < pages; ++i, address += ShdMem::FRAME_SIZE) {
+				const auto mapping = ShdMem::ParseVirtualAddress(address);
+
+				const auto pml4e = Paging::GetPML4EAddress(mapping);
+				const auto pdpte = Paging::GetPDPTEAddress(mapping);
+				const auto pde 	 = Paging::GetPDEAddress(mapping);
+				const auto pte 	 = Paging::GetPTEAddress(mapping);
+
+				const auto pml4e_info = Paging::GetPML4EInfo(pml4e);
+				const auto pdpte_info = Paging::GetPDPTEInfo(pdpte);
+				auto pde_info   = Paging::GetPDEInfo(pde);
+				auto pte_info   = Paging::GetPTEInfo(pte);
+
+				if constexpr (privilege == AccessPrivilege::LOW) {
+					if (!pml4e_info.present || !pdpte_info.present || !pde_info.present || *pte == 0) {
+						return Failure();
+					}
+				}
+
+				// a huge page only partially covered by the range is split before releasing it
+				if (pde_info.present && pde_info.pageSize
+					&& (address % ShdMem::PDE_COVERAGE != 0 || pages - i < PAGES_PER_HUGE_PAGE)
+				) {
+					if (!DemoteHugePage(address).IsSuccess()) {
+						return Failure();
+					}
+
+					pde_info = Paging::GetPDEInfo(pde);
+					pte_info = Paging::GetPTEInfo(pte);
+				}
+
+				if (pde_info.present) {
+					if (pde_info.pageSize) {
+						void* const pageAddress = reinterpret_cast<void*>(pde_info.address);
+
+						Paging::UnmapPDE(pde);
+						transaction.Invalidate(reinterpret_cast<void*>(address));
+
+						if (CopyOnWrite::Release(pde_info.address)) {
+							transaction.Commit();
+
+							if (!PhysicalMemory::Free2MB(pageAddress).IsSuccess()) {
+								return Failure();
+							}
+						}
+
+						i += PAGES_PER_HUGE_PAGE - 1;
+						address += (PAGES_PER_HUGE_PAGE - 1) * ShdMem::FRAME_SIZE;
+					}
+					else {
+						// References are dropped once the entry is gone: clearing an entry of a shared
+						// table first gives this address space its own copy, which takes new ones.
+						if (pte_info.present) {
+							void* pageAddress = reinterpret_cast<void*>(pte_info.address);
+
+							Paging::UnmapPTE(pte);
+							transaction.Invalidate(reinterpret_cast<void*>(address));
+
+							if (CopyOnWrite::Release(pte_info.address)) {
+								transaction.Release(pageAddress);
+							}
+						}
+						else if (*pte != 0 && (*pte & VirtualMemory::NP_ON_DEMAND) == 0) {
+							// the page is in the swap area, its slot is all that is left of it
+							const uint64_t slot = (*pte & NP_INDEX) >> NP_INDEX_SHIFT;
+
+							Paging::UnmapPTE(pte);
+							Swap::FreeSlot(slot);
+						}
+						
+					}
+				}
+			}
+
+			// the range only becomes free once nothing of it is mapped anymore
+			transaction.Commit();
+
+			return ReleaseArea(ctx, reinterpret_cast<uint64_t>(ptr), pages);
+		}
+    }
+
+	Success Setup() {
+		// the scratch page table is built first, since zeroed frames for every other
+		// page table go through it
+		static constexpr auto scratchMapping = ShdMem::ParseVirtualAddress(VirtualMemoryLayout::ScratchMapping.start);
+
+		const auto scratchPDPTE = Paging::GetPDPTEAddress(scratchMapping);
+
+		if (!Paging::GetPDPTEInfo(scratchPDPTE).present) {
+			void* page = PhysicalMemory::Allocate();
+
+			if (page == nullptr) {
+				return Failure();
+			}
+
+			Paging::SetPDPTEInfo(scratchPDPTE, {
+				.present = 1,
+				.readWrite = 1,
+				.address = PhysicalMemory::FilterAddress(page)
+			});
+
+			const auto pd = Paging::GetPDAddress(scratchMapping);
+			Paging::InvalidatePage(pd);
+			ShdMem::ZeroPage(pd);
+		}
+
+		const auto scratchPDE = Paging::GetPDEAddress(scratchMapping);
+
+		if (!Paging::GetPDEInfo(scratchPDE).present) {
+			void* page = PhysicalMemory::Allocate();
+
+			if (page == nullptr) {
+				return Failure();
+			}
+
+			Paging::SetPDEInfo(scratchPDE, {
+				.present = 1,
+				.readWrite = 1,
+				.address = PhysicalMemory::FilterAddress(page)
+			});
+
+			const auto pt = Paging::GetPTAddress(scratchMapping);
+			Paging::InvalidatePage(pt);
+			ShdMem::ZeroPage(pt);
+		}
+
+		// make the NULL memory page reserved and unusable, and allocate the DMA PML4E and PDPTE
+		if (PhysicalMemory::QueryDMAAddress(0) == PhysicalMemory::StatusCode::FREE) {
+			if (VirtualMemory::AllocateDMA(1) == nullptr) {
+				return Failure();
+			}
+		}
+		else {
+			MapPage(0, 0, AccessPrivilege::MEDIUM);
+		}
+
+		static constexpr auto nullMapping = ShdMem::ParseVirtualAddress(static_cast<uint64_t>(0));
+
+		Paging::UnmapPTE(Paging::GetPTEAddress(nullMapping));
+		
+		// set up identity paging for the DMA zone, and allocate all necessary pages table it needs
+		// even if they are not mapping to anything yet
+
+		static constexpr auto dmaStart = ShdMem::Layout::DMAZone.start;
+		static constexpr auto dmaEnd = ShdMem::Layout::DMAZone.start + ShdMem::Layout::DMAZone.limit;
+
+		for (size_t i = dmaStart; i < dmaEnd; i += ShdMem::FRAME_SIZE) {
+			if (PhysicalMemory::QueryDMAAddress(i) == PhysicalMemory::StatusCode::ALLOCATED) {
+				MapPage(i, i, AccessPrivilege::MEDIUM);
+			}
+			else {
+				const auto mapping = ShdMem::ParseVirtualAddress(i);
+
+				const auto pdpte 		= Paging::GetPDPTEAddress(mapping);
+				const auto pdpte_info 	= Paging::GetPDPTEInfo(pdpte);
+
+				const auto pd 			= Paging::GetPDAddress(mapping);
+				const auto pde 			= Paging::GetPDEAddress(mapping);
+
+				const auto pt 			= Paging::GetPTAddress(mapping);
+
+				if (!pdpte_info.present) {
+					void* page = PhysicalMemory::Allocate(PhysicalMemory::Fill::ZERO);
+					
+					if (page == nullptr) {
+						return Failure();
+					}
+
+					Paging::SetPDPTEInfo(pdpte, {
+						.present = 1,
+						.readWrite = 1,
+						.userMode = 1,
+						.address = PhysicalMemory::FilterAddress(page)
+					});
+
+					Paging::InvalidatePage(pd);
+				}
+
+				const auto pde_info = Paging::GetPDEInfo(pde);
+
+				if (!pde_info.present) {
+					void* page = PhysicalMemory::Allocate(PhysicalMemory::Fill::ZERO);
+
+					if (page == nullptr) {
+						return Failure();
+					}
+					
+					Paging::SetPDEInfo(pde, {
+						.present = 1,
+						.readWrite = 1,
+						.userMode = 1,
+						.address = PhysicalMemory::FilterAddress(page)
+					});
 
-		if (stack_reserve == nullptr) {
-			PhysicalMemory::Free(stack_top);
-			Paging::FreeSecondaryRecursiveMapping();
-			return nullptr;
+					Paging::InvalidatePage(pt);
+				}
+			}
 		}
 
-		if (!MapPage<false>(
-			reinterpret_cast<uint64_t>(stack_top),
-			VirtualMemoryLayout::KernelStackReserve.start - ShdMem::PAGE_SIZE,
-			AccessPrivilege::HIGH
-		).IsSuccess()) {
-			PhysicalMemory::Free(stack_reserve);
-			PhysicalMemory::Free(stack_top);
-			Paging::FreeSecondaryRecursiveMapping();
-			return nullptr;
+		// set up kernel heap, the first area closes it and maps the first page of the pool
+		Area* const heapEnd = NewArea(&kernelContext);
+
+		if (heapEnd == nullptr) {
+			return Failure();
 		}
 
-		if (!MapPage<false>(
-			reinterpret_cast<uint64_t>(stack_reserve),
-			VirtualMemoryLayout::KernelStackReserve.start,
-			AccessPrivilege::HIGH
-		).IsSuccess()) {
-			PhysicalMemory::Free(stack_reserve);
-			Paging::FreeSecondaryRecursiveMapping();
+		heapEnd->start = VirtualMemoryLayout::KernelHeap.end();
+		heapEnd->pages = 0;
+		heapEnd->gap = VirtualMemoryLayout::KernelHeap.limit / ShdMem::FRAME_SIZE;
+		heapEnd->attributes = {};
+
+		kernelContext.root = InsertArea(nullptr, heapEnd);
+		
+		return Success();
+	}
+
+	void* MapScratchFrame(void* frame) {
+		UnattachedSelf* self = UnattachedSelf::TryAttach();
+		const uint64_t slot = VirtualMemoryLayout::ScratchMapping.start
+			+ (self != nullptr ? self->GetID() : 0) * ShdMem::PAGE_SIZE;
+
+		const auto pte = Paging::GetPTEAddress(ShdMem::ParseVirtualAddress(slot));
+		*pte = (PhysicalMemory::FilterAddress(frame) & ShdMem::PTE_ADDRESS)
+			| ShdMem::PTE_GLOBAL
+			| ShdMem::PTE_READWRITE
+			| ShdMem::PTE_PRESENT;
+
+		void* page = reinterpret_cast<void*>(slot);
+		Paging::InvalidatePage(page);
+
+		return page;
+	}
+
+	void* DeriveNewFreshCR3() {
+		void* const CR3 = CreateTaskAddressSpace();
+
+		if (CR3 == nullptr) {
 			return nullptr;
 		}
 
-		// set up user memory management structures
-		void* base_page = PhysicalMemory::Allocate();
-		
+		void* const base_page = PhysicalMemory::Allocate();
+
 		if (base_page == nullptr) {
 			Paging::FreeSecondaryRecursiveMapping();
 			return nullptr;
 		}
 
+		// set up user memory management structures
+
 		if (!MapPage<false>(
 			reinterpret_cast<uint64_t>(base_page),
 			reinterpret_cast<uint64_t>(userContext),
@@ -771,24 +1567,48 @@ namespace VirtualMemory {
 
 		MemoryContext* newUserContext = static_cast<MemoryContext*>(vbase_page);
 
-		newUserContext->availableMemory = VirtualMemoryLayout::UserMemory.limit - VirtualMemoryLayout::UserStack.limit;
-		newUserContext->availableBlockMemory =
-			ShdMem::PAGE_SIZE
-			- sizeof(VMemMapBlock)
-			- (VirtualMemoryLayout::UserVMemManagement.start - reinterpret_cast<uint64_t>(newUserContext));
-		newUserContext->storedBlocks = 1;
-		
-		VMemMapBlock* userMemBlockPtr = reinterpret_cast<VMemMapBlock*>(
-			reinterpret_cast<uint64_t>(newUserContext) + sizeof(MemoryContext)
-		);
-		userMemBlockPtr->virtualStart = VirtualMemoryLayout::UserMemory.start;
-		userMemBlockPtr->availablePages = newUserContext->availableMemory / ShdMem::FRAME_SIZE;
+		// the pool starts right after the context, its first area closes the user zone below the stack
+		constexpr uint64_t poolStart = VirtualMemoryLayout::UserVMemManagement.start + sizeof(MemoryContext);
+
+		Area* const userEnd = reinterpret_cast<Area*>(newUserContext + 1);
+
+		userEnd->start = VirtualMemoryLayout::UserStack.start;
+		userEnd->pages = 0;
+		userEnd->gap = (VirtualMemoryLayout::UserStack.start - VirtualMemoryLayout::UserMemory.start) / ShdMem::FRAME_SIZE;
+		userEnd->attributes = {};
+		InsertArea(nullptr, userEnd);
+
+		*newUserContext = {
+			.lock = {},
+			.root = reinterpret_cast<Area*>(poolStart),
+			.freeAreas = nullptr,
+			.poolCursor = poolStart + sizeof(Area),
+			.poolEnd = VirtualMemoryLayout::UserVMemManagement.start + ShdMem::PAGE_SIZE
+		};
 
 		UnmapGeneralPages(vbase_page, 1);
 
 		return CR3;
 	}
 
+	void* CloneCR3() {
+		void* const CR3 = CreateTaskAddressSpace();
+
+		if (CR3 == nullptr) {
+			return nullptr;
+		}
+
+		// user memory and the structures managing it stay shared until either side writes to them
+		if (!CopyOnWrite::ShareRange(VirtualMemoryLayout::UserMemory.start, VirtualMemoryLayout::UserMemory.limit).IsSuccess()
+			|| !CopyOnWrite::ShareRange(VirtualMemoryLayout::UserVMemManagement.start, VirtualMemoryLayout::UserVMemManagement.limit).IsSuccess()
+		) {
+			Paging::FreeSecondaryRecursiveMapping();
+			return nullptr;
+		}
+
+		return CR3;
+	}
+
 	void* AllocateDMA(uint64_t pages) {
 		void* const allocated = PhysicalMemory::AllocateDMA(pages);
 		if (allocated == nullptr) {
@@ -796,9 +1616,10 @@ namespace VirtualMemory {
 		}
 		
 		uint64_t address = reinterpret_cast<uint64_t>(allocated);
+		Paging::MappingTransaction transaction{};
 
 		for (size_t i = 0; i < pages; ++i, address += ShdMem::FRAME_SIZE) {
-			if (!MapPage(address, address, AccessPrivilege::MEDIUM).IsSuccess()) {
+			if (!MapPage(address, address, AccessPrivilege::MEDIUM, false, &transaction).IsSuccess()) {
 				return nullptr;
 			}
 		}
@@ -806,16 +1627,82 @@ namespace VirtualMemory {
 		return allocated;
 	}
 
-	void* AllocateKernelHeap(uint64_t pages) {
-		return AllocateCore<AccessPrivilege::HIGH>(pages, nullptr);
+	void* AllocateKernelHeap(uint64_t pages, FaultPolicy policy) {
+		void* const ptr = AllocateCore<AccessPrivilege::HIGH>(pages, nullptr, {
+			.policy = policy,
+			.caching = Caching::WRITE_BACK,
+			.huge = pages >= PAGES_PER_HUGE_PAGE,
+			.owner = 0
+		});
+
+		if (ptr == nullptr) {
+			return nullptr;
+		}
+		else if (pages < PAGES_PER_HUGE_PAGE) {
+			if (policy == FaultPolicy::POPULATE) {
+				PopulateRange(reinterpret_cast<uint64_t>(ptr), pages);
+			}
+
+			return ptr;
+		}
+
+		// back the 2MB aligned part of large allocations with huge pages up front,
+		// whatever is left over (or cannot be backed) stays mapped on demand
+		const uint64_t end = reinterpret_cast<uint64_t>(ptr) + pages * ShdMem::FRAME_SIZE;
+
+		uint64_t address = (reinterpret_cast<uint64_t>(ptr) + ShdMem::PDE_COVERAGE - 1) & ~(ShdMem::PDE_COVERAGE - 1);
+
+		for (; address + ShdMem::PDE_COVERAGE <= end; address += ShdMem::PDE_COVERAGE) {
+			if (!BackHugePage(address)) {
+				break;
+			}
+		}
+
+		// the huge pages are skipped, only the edges of the range are left to populate
+		if (policy == FaultPolicy::POPULATE) {
+			PopulateRange(reinterpret_cast<uint64_t>(ptr), pages);
+		}
+
+		return ptr;
+	}
+
+	void* ReserveKernelHeap(uint64_t pages) {
+		return AllocateCore<AccessPrivilege::HIGH>(pages, nullptr, {
+			.policy = FaultPolicy::NONE,
+			.caching = Caching::WRITE_BACK,
+			.huge = false,
+			.owner = 0
+		});
 	}
 
-	void* AllocateUserPages(uint64_t pages) {
-		return AllocateCore<AccessPrivilege::LOW>(pages, nullptr);
+	void* AllocateUserPages(uint64_t pages, FaultPolicy policy) {
+		void* const ptr = AllocateCore<AccessPrivilege::LOW>(pages, nullptr, {
+			.policy = policy,
+			.caching = Caching::WRITE_BACK,
+			.huge = false,
+			.owner = 0
+		});
+
+		if (ptr != nullptr && policy == FaultPolicy::POPULATE) {
+			PopulateRange(reinterpret_cast<uint64_t>(ptr), pages);
+		}
+
+		return ptr;
 	}
 
-	void* AllocateUserPagesAt(uint64_t pages, void* ptr) {
-		return AllocateCore<AccessPrivilege::LOW, true>(pages, ptr);
+	void* AllocateUserPagesAt(uint64_t pages, void* ptr, FaultPolicy policy) {
+		void* const allocated = AllocateCore<AccessPrivilege::LOW>(pages, ptr, {
+			.policy = policy,
+			.caching = Caching::WRITE_BACK,
+			.huge = false,
+			.owner = 0
+		});
+
+		if (allocated != nullptr && policy == FaultPolicy::POPULATE) {
+			PopulateRange(reinterpret_cast<uint64_t>(allocated), pages);
+		}
+
+		return allocated;
 	}
 
 	Success FreeDMA(void* ptr, uint64_t pages) {
@@ -824,12 +1711,13 @@ namespace VirtualMemory {
 		}
 
 		uint64_t address = reinterpret_cast<uint64_t>(ptr);
+		Paging::MappingTransaction transaction{};
 
 		for (size_t i = 0; i < pages; ++i, address += ShdMem::FRAME_SIZE) {
 			const auto mapping = ShdMem::ParseVirtualAddress(address);
 			const auto pte = Paging::GetPTEAddress(mapping);
 			Paging::UnmapPTE(pte);
-			Paging::InvalidatePage(reinterpret_cast<void*>(address));
+			transaction.Invalidate(reinterpret_cast<void*>(address));
 		}
 
 		return Success();
@@ -843,8 +1731,198 @@ namespace VirtualMemory {
 		return FreeCore<AccessPrivilege::LOW>(ptr, pages);
 	}
 
+	Success PopulateOnDemand(const void* address) {
+		const auto mapping = ShdMem::ParseVirtualAddress(address);
+		ShdMem::PTE* const pte = Paging::GetPTEAddress(mapping);
+
+		++faultCount;
+
+		const uint64_t entry = *pte;
+
+		if (!IsOnDemand(entry)) {
+			// another processor populated it first
+			return (entry & ShdMem::PTE_PRESENT) != 0 ? Success() : Failure();
+		}
+
+		// the faulting page goes first, so that it is the one served if memory runs short
+		ShdMem::PTE* entries[FAULT_AROUND_PAGES] = { pte };
+		size_t count = 1;
+
+		Region region;
+
+		// the policy belongs to the region, and so do the neighbours populated along, a region
+		// that cannot be looked up right away is served one page at a time
+		if (FindRegion(reinterpret_cast<uint64_t>(address), region, false).IsSuccess()
+			&& region.attributes.policy != FaultPolicy::NONE
+		) {
+			const size_t offset = mapping.PT_offset % FAULT_AROUND_PAGES;
+			const uint64_t regionEnd = region.start + region.pages * ShdMem::FRAME_SIZE;
+
+			ShdMem::PTE* const window = pte - offset;
+			const uint64_t windowStart = (reinterpret_cast<uint64_t>(address) & ~(ShdMem::FRAME_SIZE - 1))
+				- offset * ShdMem::FRAME_SIZE;
+
+			for (size_t i = 0; i < FAULT_AROUND_PAGES; ++i) {
+				const uint64_t page = windowStart + i * ShdMem::FRAME_SIZE;
+
+				if (window + i != pte && page >= region.start && page < regionEnd && IsOnDemand(window[i])) {
+					entries[count++] = window + i;
+				}
+			}
+		}
+
+		const size_t populated = PopulateEntries(entries, count);
+
+		if (populated == 0) {
+			return Failure();
+		}
+
+		faultPopulatedCount += populated;
+
+		return Success();
+	}
+
+	Success SetFaultPolicy(void* ptr, uint64_t pages, FaultPolicy policy) {
+		if (!UpdateRegions(ptr, pages, [policy](RegionAttributes& attributes) {
+			attributes.policy = policy;
+		}).IsSuccess()) {
+			return Failure();
+		}
+
+		if (policy == FaultPolicy::POPULATE) {
+			PopulateRange(reinterpret_cast<uint64_t>(ptr), pages);
+		}
+
+		return Success();
+	}
+
+	Success SetRegionOwner(void* ptr, uint64_t pages, uint32_t owner) {
+		return UpdateRegions(ptr, pages, [owner](RegionAttributes& attributes) {
+			attributes.owner = owner;
+		});
+	}
+
+	Success QueryRegion(const void* address, Region& region) {
+		return FindRegion(reinterpret_cast<uint64_t>(address), region, true);
+	}
+
+	void QueryFaultStatistics(FaultStatistics& stats) {
+		stats.faults = faultCount;
+		stats.faultPopulatedPages = faultPopulatedCount;
+		stats.mapPopulatedPages = mapPopulatedCount;
+	}
+
+	size_t ReclaimPages(size_t count) {
+		ShdMem::PTE* victims[Swap::BATCH_PAGES];
+		ShdMem::PTE* entries[Swap::BATCH_PAGES];
+		uint64_t addresses[Swap::BATCH_PAGES];
+		uint64_t previous[Swap::BATCH_PAGES];
+		void* frames[Swap::BATCH_PAGES];
+
+		if (!Swap::IsAvailable()) {
+			return 0;
+		}
+		else if (count > Swap::BATCH_PAGES) {
+			count = Swap::BATCH_PAGES;
+		}
+
+		Scheduling::Mutex& ioLock = Swap::GetIOLock();
+
+		// the device may be busy with an eviction that ended up here through an allocation
+		if (!ioLock.trylock()) {
+			return 0;
+		}
+
+		const size_t found = SelectVictims(victims, addresses, count);
+		size_t slots = found;
+		const uint64_t slot = found == 0 ? 0 : Swap::AllocateSlots(slots);
+		size_t evicted = 0;
+
+		Paging::MappingTransaction transaction{};
+
+		for (size_t i = 0; i < slots; ++i) {
+			uint64_t expected = *victims[i];
+
+			// a page touched since it was selected gets its second chance after all
+			if ((expected & ShdMem::PTE_ACCESSED) != 0
+				|| !Utils::Atomic::Backend::CompareExchange<Utils::MemoryOrder::SEQ_CST>(victims[i], expected, SwappedEntry(expected, slot + evicted))
+			) {
+				continue;
+			}
+
+			transaction.Invalidate(reinterpret_cast<const void*>(addresses[i]));
+
+			entries[evicted] = victims[i];
+			previous[evicted] = expected;
+			frames[evicted] = reinterpret_cast<void*>(expected & ShdMem::PTE_ADDRESS);
+			++evicted;
+		}
+
+		for (uint64_t unused = slot + evicted; unused < slot + slots; ++unused) {
+			Swap::FreeSlot(unused);
+		}
+
+		// nothing may write to the pages through a stale translation while they are copied out
+		transaction.Commit();
+
+		if (evicted != 0 && !Swap::WriteFrames(slot, frames, evicted).IsSuccess()) {
+			// nothing was lost, the pages are simply mapped back
+			for (size_t i = 0; i < evicted; ++i) {
+				*entries[i] = previous[i];
+				Swap::FreeSlot(slot + i);
+			}
+
+			evicted = 0;
+		}
+		else if (evicted != 0) {
+			PhysicalMemory::FreeBatch(frames, evicted);
+		}
+
+		ioLock.unlock();
+
+		return evicted;
+	}
+
+	Success SwapIn(const void* address) {
+		const auto mapping = ShdMem::ParseVirtualAddress(address);
+		ShdMem::PTE* const pte = Paging::GetPTEAddress(mapping);
+
+		void* frame = PhysicalMemory::Allocate();
+
+		if (frame == nullptr && ReclaimPages(Swap::BATCH_PAGES) != 0) {
+			frame = PhysicalMemory::Allocate();
+		}
+
+		if (frame == nullptr) {
+			return Failure();
+		}
+
+		Utils::LockGuard _{Swap::GetIOLock()};
+
+		const uint64_t entry = *pte;
+
+		// another fault on the same page may have read it back while we waited
+		if ((entry & ShdMem::PTE_PRESENT) != 0 || (entry & NP_ON_DEMAND) != 0 || entry == 0) {
+			PhysicalMemory::Free(frame);
+			return (entry & ShdMem::PTE_PRESENT) != 0 ? Success() : Failure();
+		}
+
+		const uint64_t slot = (entry & NP_INDEX) >> NP_INDEX_SHIFT;
+
+		if (!Swap::ReadFrame(slot, frame).IsSuccess()) {
+			PhysicalMemory::Free(frame);
+			return Failure();
+		}
+
+		*pte = PopulatedEntry(entry, frame);
+		Swap::FreeSlot(slot);
+
+		return Success();
+	}
+
 	Success ChangeMappingFlags(void* _ptr, uint64_t flags, uint64_t pages) {		
 		uint64_t ptr = reinterpret_cast<uint64_t>(_ptr);
+		Paging::MappingTransaction transaction{};
 
 		for (size_t i = 0; i < pages; ++i, ptr += ShdMem::PTE_COVERAGE) {
 			const ShdMem::VirtualAddress mapping = ShdMem::ParseVirtualAddress(ptr);
@@ -868,18 +1946,93 @@ namespace VirtualMemory {
 				*pte = (*pte & (ShdMem::PTE_ADDRESS)) | (flags & ~ShdMem::PTE_ADDRESS);
 			}
 
-			Paging::InvalidatePage(reinterpret_cast<void*>(ptr));
+			transaction.Invalidate(reinterpret_cast<void*>(ptr));
 		}
 
 		return Success();
 	}
 
+	// pages are counted in 2MB units, each one takes a whole PDE of the general mapping zone
+	static void* MapGeneralHugePages(void* pageAddress, size_t pages, uint64_t flags) {
+		constexpr uint64_t GP_START = (VirtualMemoryLayout::GeneralMapping.start + ShdMem::PDE_COVERAGE - 1)
+			& ~(ShdMem::PDE_COVERAGE - 1);
+		constexpr uint64_t GP_HUGE_PAGES = (VirtualMemoryLayout::GeneralMapping.end() - GP_START) / ShdMem::PDE_COVERAGE;
+
+		if (reinterpret_cast<uint64_t>(pageAddress) % ShdMem::PDE_COVERAGE != 0) {
+			return nullptr;
+		}
+
+		uint64_t address = GP_START;
+
+		size_t found = 0;
+		uint64_t start = 0;
+
+		for (size_t i = 0; i < GP_HUGE_PAGES; ++i, address += ShdMem::PDE_COVERAGE) {
+			auto mapping = ShdMem::ParseVirtualAddress(address);
+
+			const auto pdpte = Paging::GetPDPTEAddress(mapping);
+			const auto pdpte_info = Paging::GetPDPTEInfo(pdpte);
+
+			if (!pdpte_info.present) {
+				void* page = PhysicalMemory::Allocate(PhysicalMemory::Fill::ZERO);
+
+				if (page == nullptr) {
+					return nullptr;
+				}
+
+				*pdpte = (PhysicalMemory::FilterAddress(page) & ShdMem::PDPTE_ADDRESS)
+					| ShdMem::PDPTE_READWRITE
+					| ShdMem::PDPTE_PRESENT;
+
+				const auto pd = Paging::GetPDAddress(mapping);
+				Paging::InvalidatePage(pd);
+			}
+
+			const auto pde_info = Paging::GetPDEInfo(Paging::GetPDEAddress(mapping));
+
+			if (pde_info.present) {
+				found = 0;
+				start = 0;
+				continue;
+			}
+
+			if (found++ == 0) {
+				start = address;
+			}
+
+			if (found == pages) {
+				address = start;
+
+				uint64_t physical_address = reinterpret_cast<uint64_t>(pageAddress);
+				Paging::MappingTransaction transaction{};
+
+				for (size_t j = 0; j < pages; ++j, address += ShdMem::PDE_COVERAGE, physical_address += ShdMem::PDE_COVERAGE) {
+					const auto pde = Paging::GetPDEAddress(ShdMem::ParseVirtualAddress(address));
+
+					*pde = (PhysicalMemory::FilterAddress(physical_address) & ShdMem::PDE_2MB_ADDRESS)
+						| flags
+						| ShdMem::PDE_GLOBAL
+						| ShdMem::PDE_PRESENT;
+
+					transaction.Invalidate(reinterpret_cast<void*>(address));
+				}
+
+				return reinterpret_cast<void*>(start);
+			}
+		}
+
+		return nullptr;
+	}
+
 	void* MapGeneralPages(void* pageAddress, size_t pages, uint64_t flags) {
 		constexpr uint64_t GP_PAGES = VirtualMemoryLayout::GeneralMapping.limit / ShdMem::PAGE_SIZE;
 
 		if (pages == 0) {
 			return nullptr;
 		}
+		else if ((flags & ShdMem::PDE_PAGE_SIZE) != 0) {
+			return MapGeneralHugePages(pageAddress, pages, flags);
+		}
 
 		uint64_t address = VirtualMemoryLayout::GeneralMapping.start;
 
@@ -893,7 +2046,7 @@ namespace VirtualMemory {
 			const auto pdpte_info = Paging::GetPDPTEInfo(pdpte);
 
 			if (!pdpte_info.present) {
-				void* page = PhysicalMemory::Allocate();
+				void* page = PhysicalMemory::Allocate(PhysicalMemory::Fill::ZERO);
 
 				if (page == nullptr) {
 					return nullptr;
@@ -904,14 +2057,14 @@ namespace VirtualMemory {
 					| ShdMem::PDPTE_PRESENT;
 
 				const auto pd = Paging::GetPDAddress(mapping);
-				ShdMem::ZeroPage(pd);
+				Paging::InvalidatePage(pd);
 			}
 
 			const auto pde = Paging::GetPDEAddress(mapping);
 			const auto pde_info = Paging::GetPDEInfo(pde);
 
 			if (!pde_info.present) {
-				void* page = PhysicalMemory::Allocate();
+				void* page = PhysicalMemory::Allocate(PhysicalMemory::Fill::ZERO);
 				
 				if (page == nullptr) {
 					return nullptr;
@@ -922,7 +2075,7 @@ namespace VirtualMemory {
 					| ShdMem::PDE_PRESENT;
 
 				const auto pt = Paging::GetPTAddress(mapping);
-				ShdMem::ZeroPage(pt);
+				Paging::InvalidatePage(pt);
 			}
 
 			auto pte = Paging::GetPTEAddress(mapping);
@@ -937,6 +2090,7 @@ namespace VirtualMemory {
 					address = start;
 
 					uint64_t physical_address = reinterpret_cast<uint64_t>(pageAddress);
+					Paging::MappingTransaction transaction{};
 
 					for (size_t j = 0; j < pages; ++j, address += ShdMem::PAGE_SIZE, physical_address += ShdMem::PAGE_SIZE) {
 						mapping = ShdMem::ParseVirtualAddress(address);
@@ -944,9 +2098,10 @@ namespace VirtualMemory {
 
 						*pte = (PhysicalMemory::FilterAddress(physical_address) & ShdMem::PTE_ADDRESS)
 							| flags
+							| ShdMem::PTE_GLOBAL
 							| ShdMem::PTE_PRESENT;
 
-						Paging::InvalidatePage(reinterpret_cast<void*>(address));
+						transaction.Invalidate(reinterpret_cast<void*>(address));
 					}
 
 					return reinterpret_cast<void*>(start + (reinterpret_cast<uint64_t>(pageAddress) % ShdMem::PAGE_SIZE));
@@ -967,8 +2122,9 @@ namespace VirtualMemory {
 		}
 
 		uint64_t address = reinterpret_cast<uint64_t>(vpage);
+		Paging::MappingTransaction transaction{};
 
-		for (size_t i = 0; i < pages; ++i, address += ShdMem::PAGE_SIZE) {
+		for (size_t i = 0; i < pages; ++i) {
 			auto mapping = ShdMem::ParseVirtualAddress(address);
 
 			const auto pml4e	= Paging::GetPML4EAddress(mapping);
@@ -984,10 +2140,95 @@ namespace VirtualMemory {
 				return Failure();
 			}
 
-			Paging::UnmapPTE(pte);
-			Paging::InvalidatePage(reinterpret_cast<void*>(address));
+			if (pde_info.pageSize) {
+				Paging::UnmapPDE(pde);
+				transaction.Invalidate(reinterpret_cast<void*>(address));
+
+				address += ShdMem::PDE_COVERAGE;
+			}
+			else {
+				Paging::UnmapPTE(pte);
+				transaction.Invalidate(reinterpret_cast<void*>(address));
+
+				address += ShdMem::PAGE_SIZE;
+			}
 		}
 
 		return Success();
 	}
+
+	size_t PromoteHugePages() {
+		constexpr uint64_t HEAP_START = (VirtualMemoryLayout::KernelHeap.start + ShdMem::PDE_COVERAGE - 1)
+			& ~(ShdMem::PDE_COVERAGE - 1);
+		constexpr uint64_t HEAP_END = VirtualMemoryLayout::KernelHeap.end();
+
+		size_t promoted = 0;
+
+		for (uint64_t address = HEAP_START; address < HEAP_END;) {
+			const auto mapping = ShdMem::ParseVirtualAddress(address);
+
+			// skip whole unpopulated subtrees
+			if (!Paging::GetPML4EInfo(Paging::GetPML4EAddress(mapping)).present) {
+				address = (address + ShdMem::PML4E_COVERAGE) & ~(ShdMem::PML4E_COVERAGE - 1);
+			}
+			else if (!Paging::GetPDPTEInfo(Paging::GetPDPTEAddress(mapping)).present) {
+				address = (address + ShdMem::PDPTE_COVERAGE) & ~(ShdMem::PDPTE_COVERAGE - 1);
+			}
+			else {
+				Interrupts::InterruptGuard irqGuard{};
+				Utils::LockGuard _{kernelContext.lock};
+
+				// the region records that it holds huge pages, so one may not straddle two regions
+				Area* const area = FindArea(kernelContext.root, address);
+
+				if (area != nullptr && area->end() - address >= ShdMem::PDE_COVERAGE && PromoteHugePage(address)) {
+					area->attributes.huge = true;
+					++promoted;
+				}
+
+				address += ShdMem::PDE_COVERAGE;
+			}
+		}
+
+		return promoted;
+	}
+
+	bool AwaitPromotion(const void* _address) {
+		const uint64_t address = reinterpret_cast<uint64_t>(_address);
+		const uint64_t range = address & ~(ShdMem::PDE_COVERAGE - 1);
+
+		if (address < VirtualMemoryLayout::KernelHeap.start || address >= VirtualMemoryLayout::KernelHeap.end()) {
+			return false;
+		}
+
+		while (promotingRange == range) {
+			__asm__ volatile("pause" ::: "memory");
+		}
+
+		// the promotion may also have ended between the fault and the check above
+		const auto mapping = ShdMem::ParseVirtualAddress(address);
+		const uint64_t pde = *Paging::GetPDEAddress(mapping);
+
+		if ((pde & ShdMem::PDE_PAGE_SIZE) != 0) {
+			return (pde & ShdMem::PDE_READWRITE) != 0;
+		}
+
+		return (*Paging::GetPTEAddress(mapping) & ShdMem::PTE_READWRITE) != 0;
+	}
+
+	void PromotionTask() {
+		// nothing ever wakes the queue, the task sleeps for the whole interval
+		static constexpr auto NEVER_PREDICATE = []([[maybe_unused]] void* arg) {
+			return false;
+		};
+
+		static Scheduling::WaitQueue sleepers;
+
+		while (true) {
+			PromoteHugePages();
+
+			// blocked rather than yielding, so that the processor can go idle meanwhile
+			sleepers.WaitFor(PROMOTION_INTERVAL_MS, NEVER_PREDICATE, nullptr);
+		}
+	}
 }
@@ -14,6 +14,7 @@
 
 BITS 64
 global kernel_gdt_setup
+global kernel_gdt_setup_processor
 
 %define CODE_SEGMENT	0x0008
 %define DATA_SEGMENT	0x0010
@@ -84,6 +85,8 @@ kernel_gdt_setup:
     mov [rel TSS_GDT_ENTRY + 8], eax
 
     lgdt [rel GDTP]
+
+load_segments:
     mov eax, TSS_SEGMENT
     ltr ax
 
@@ -99,4 +102,39 @@ kernel_gdt_setup:
     push rax
     push rdx
 
-    retfq
\ No newline at end of file
+    retfq
+
+; rcx = PROCESSOR_GDT_SIZE bytes receiving a copy of the GDT and TSS, every processor
+; needs its own TSS since loading one marks its descriptor busy
+kernel_gdt_setup_processor:
+    push rsi
+    push rdi
+
+    mov rdx, rcx
+    lea rsi, [rel TSS]
+    mov rdi, rcx
+    mov ecx, GDT_END - TSS
+    rep movsb
+
+    pop rdi
+    pop rsi
+
+    mov rax, rdx
+    mov [rdx + TSS_GDT_ENTRY - TSS + 2], ax
+    shr rax, 16
+    mov [rdx + TSS_GDT_ENTRY - TSS + 4], al
+    shr rax, 8
+    mov [rdx + TSS_GDT_ENTRY - TSS + 7], al
+    shr rax, 8
+    mov [rdx + TSS_GDT_ENTRY - TSS + 8], eax
+
+    ; the copied descriptor is busy if the bootstrap processor already loaded its TSS
+    mov byte [rdx + TSS_GDT_ENTRY - TSS + 5], 0x89
+
+    ; GDT pointer right after the copy
+    lea rax, [rdx + GDT - TSS]
+    mov word [rdx + GDT_END - TSS], GDT_END - GDT - 1
+    mov [rdx + GDT_END - TSS + 2], rax
+
+    lgdt [rdx + GDT_END - TSS]
+    jmp load_segments
@@ -59,6 +59,10 @@ namespace PCI {
         *Command &= ~CommandsMasks::MMIO;
     }
 
+    bool Interface::IsMMIOEnabled() const {
+        return *Command & CommandsMasks::MMIO;
+    }
+
     void Interface::EnableBusMaster() const {
         *Command |= CommandsMasks::BusMaster;
     }
@@ -155,7 +159,7 @@ namespace PCI {
 
                 size_t pages = (size + Shared::Memory::PAGE_SIZE - 1) / Shared::Memory::PAGE_SIZE;
 
-                VirtualMemory::MapGeneralPages(ptr, pages);
+                VirtualMemory::UnmapGeneralPages(ptr, pages);
             }
         }
     }
@@ -179,6 +183,12 @@ namespace PCI {
         return 0xFFFFFFFF;
     }
 
+    bool IType0::IsMemoryXBAR(uint8_t id) const {
+        const uint32_t bar_value = ReadBAR(id);
+
+        return (bar_value & BAR_IO_FLAG) == 0 && (bar_value & BAR_SIZE_MASK) == BAR_64_FLAG;
+    }
+
     void IType0::WriteBAR(uint8_t id, uint32_t value) const {
         if (id < 6) {
             bar_base[id] = value;
@@ -14,8 +14,17 @@
 
 #include <cstdint>
 
+#include <shared/memory/defs.hpp>
+#include <shared/Response.hpp>
+#include <shared/SimpleAtomic.hpp>
+
+#include <interrupts/APIC.hpp>
+#include <interrupts/IDT.hpp>
+
 #include <pci/MSI.hpp>
 
+#include <sched/Self.hpp>
+
 namespace PCI {
     bool MSI::IsEnabled() const {
         return MessageControl & ENABLE;
@@ -125,4 +134,245 @@ namespace PCI {
         static constexpr uint8_t MSI_CAPABILITY_ID = 5;
         return reinterpret_cast<MSI*>(interface.FindCapability(MSI_CAPABILITY_ID));
     }
+
+    uint16_t MSIX::GetTableSize() const {
+        return (MessageControl & TABLE_SIZE) + 1;
+    }
+
+    MSIX* GetMSIX(const Interface& interface) {
+        static constexpr uint8_t MSIX_CAPABILITY_ID = 0x11;
+        return reinterpret_cast<MSIX*>(interface.FindCapability(MSIX_CAPABILITY_ID));
+    }
+
+    MSIMessage ComposeMessage(uint8_t vector, uint8_t apic_id) {
+        static constexpr uint32_t MESSAGE_ADDRESS_BASE = 0xFEE00000;
+        static constexpr uint8_t DESTINATION_SHIFT = 12;
+
+        // physical destination mode, no redirection hint, fixed delivery and edge trigger
+        return MSIMessage {
+            .address = MESSAGE_ADDRESS_BASE | (static_cast<uint32_t>(apic_id) << DESTINATION_SHIFT),
+            .data = vector
+        };
+    }
+
+    uint8_t SelectInterruptTarget() {
+        static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> next_target{0};
+
+        const size_t count = UnattachedSelf::GetProcessorCount();
+        const uint64_t start = ++next_target;
+
+        for (size_t i = 0; i < count; ++i) {
+            const UnattachedSelf& processor = UnattachedSelf::AccessProcessor((start + i) % count);
+
+            if (processor.IsOnline()) {
+                return processor.GetID();
+            }
+        }
+
+        // the other processors are not up yet
+        return APIC::GetLAPICID();
+    }
+
+    void* MSIXTable::MapBIR(const IType0& interface, uint8_t bir) {
+        static constexpr uint64_t TABLE_MAPPING_FLAGS =
+            Shared::Memory::PTE_PRESENT
+            | Shared::Memory::PTE_READWRITE
+            | Shared::Memory::PTE_UNCACHEABLE;
+
+        if (interface.IsMemoryXBAR(bir)) {
+            // the 64 bit BARs are indexed in pairs, the table cannot sit in the upper half
+            return (bir % 2 == 0) ? interface.MapMemoryXBAR(bir / 2, TABLE_MAPPING_FLAGS) : nullptr;
+        }
+
+        return interface.MapMemoryBAR(bir, TABLE_MAPPING_FLAGS);
+    }
+
+    void MSIXTable::UnmapBIR(const IType0& interface, uint8_t bir, void* ptr) {
+        if (interface.IsMemoryXBAR(bir)) {
+            interface.UnmapMemoryXBAR(bir / 2, ptr);
+        }
+        else {
+            interface.UnmapMemoryBAR(bir, ptr);
+        }
+    }
+
+    Success MSIXTable::Map(const IType0& interface) {
+        const MSIX* const msix = GetMSIX(interface);
+
+        if (msix == nullptr || IsMapped()) {
+            return Failure();
+        }
+
+        const uint8_t table_bir = msix->Table & MSIX::BIR_MASK;
+        const uint8_t pba_bir = msix->PBA & MSIX::BIR_MASK;
+
+        // the BARs are sized by writing to them, keep the decoder off meanwhile
+        const bool mmio_enabled = interface.IsMMIOEnabled();
+
+        interface.DisableMMIO();
+
+        void* const table_base = MapBIR(interface, table_bir);
+        void* const pba_base = (pba_bir == table_bir || table_base == nullptr) ? table_base : MapBIR(interface, pba_bir);
+
+        if (mmio_enabled) {
+            interface.EnableMMIO();
+        }
+
+        if (table_base == nullptr || pba_base == nullptr) {
+            if (table_base != nullptr) {
+                UnmapBIR(interface, table_bir, table_base);
+            }
+
+            return Failure();
+        }
+
+        this->capability = msix;
+        this->interface = &interface;
+        table_mapping = table_base;
+        pba_mapping = pba_base;
+        table = reinterpret_cast<volatile Entry*>(static_cast<uint8_t*>(table_base) + (msix->Table & MSIX::OFFSET_MASK));
+        pba = reinterpret_cast<volatile uint64_t*>(static_cast<uint8_t*>(pba_base) + (msix->PBA & MSIX::OFFSET_MASK));
+        size = msix->GetTableSize();
+
+        for (uint16_t entry = 0; entry < size; ++entry) {
+            table[entry].VectorControl = ENTRY_MASKED;
+            table[entry].MessageData = 0;
+        }
+
+        return Success();
+    }
+
+    void MSIXTable::Unmap() {
+        if (!IsMapped()) {
+            return;
+        }
+
+        Disable();
+
+        const uint8_t table_bir = capability->Table & MSIX::BIR_MASK;
+        const uint8_t pba_bir = capability->PBA & MSIX::BIR_MASK;
+
+        if (pba_mapping != table_mapping) {
+            UnmapBIR(*interface, pba_bir, pba_mapping);
+        }
+
+        UnmapBIR(*interface, table_bir, table_mapping);
+
+        capability = nullptr;
+        interface = nullptr;
+        table_mapping = nullptr;
+        pba_mapping = nullptr;
+        table = nullptr;
+        pba = nullptr;
+        size = 0;
+    }
+
+    bool MSIXTable::IsMapped() const {
+        return table != nullptr;
+    }
+
+    uint16_t MSIXTable::GetSize() const {
+        return size;
+    }
+
+    int MSIXTable::AllocateVector(uint16_t entry, uint8_t apic_id) {
+        if (entry >= size) {
+            return -1;
+        }
+
+        const int vector = Interrupts::ReserveInterrupt();
+
+        if (vector < 0) {
+            return -1;
+        }
+
+        Route(entry, static_cast<uint8_t>(vector), apic_id);
+
+        return vector;
+    }
+
+    void MSIXTable::ReleaseVector(uint16_t entry) {
+        if (entry < size) {
+            Mask(entry);
+
+            const int vector = table[entry].MessageData & MESSAGE_DATA_VECTOR;
+
+            table[entry].MessageData = 0;
+
+            // vector 0 is an exception, never handed out
+            if (vector != 0) {
+                Interrupts::ReleaseInterrupt(vector);
+            }
+        }
+    }
+
+    Success MSIXTable::Route(uint16_t entry, uint8_t vector, uint8_t apic_id) const {
+        if (entry >= size) {
+            return Failure();
+        }
+
+        const MSIMessage message = ComposeMessage(vector, apic_id);
+        const bool masked = table[entry].VectorControl & ENTRY_MASKED;
+
+        // a half written message must never be delivered
+        table[entry].VectorControl = table[entry].VectorControl | ENTRY_MASKED;
+
+        table[entry].MessageAddress = static_cast<uint32_t>(message.address);
+        table[entry].MessageUpperAddress = static_cast<uint32_t>(message.address >> 32);
+        table[entry].MessageData = message.data;
+
+        if (!masked) {
+            table[entry].VectorControl = table[entry].VectorControl & ~ENTRY_MASKED;
+        }
+
+        return Success();
+    }
+
+    Success MSIXTable::SetAffinity(uint16_t entry, uint8_t apic_id) const {
+        if (entry >= size) {
+            return Failure();
+        }
+
+        const uint8_t vector = table[entry].MessageData & MESSAGE_DATA_VECTOR;
+
+        // an interrupt raised while masked is kept pending and delivered to the new target
+        return vector != 0 ? Route(entry, vector, apic_id) : Failure();
+    }
+
+    void MSIXTable::Mask(uint16_t entry) const {
+        if (entry < size) {
+            table[entry].VectorControl = table[entry].VectorControl | ENTRY_MASKED;
+        }
+    }
+
+    void MSIXTable::Unmask(uint16_t entry) const {
+        if (entry < size) {
+            table[entry].VectorControl = table[entry].VectorControl & ~ENTRY_MASKED;
+        }
+    }
+
+    bool MSIXTable::IsPending(uint16_t entry) const {
+        if (entry < size) {
+            return (pba[entry / 64] >> (entry % 64)) & 1;
+        }
+
+        return false;
+    }
+
+    void MSIXTable::Enable() const {
+        if (capability != nullptr) {
+            // MSI and MSI-X must not be enabled together
+            if (const MSI* const msi = GetMSI(*interface); msi != nullptr) {
+                msi->Disable();
+            }
+
+            capability->MessageControl = (capability->MessageControl & ~MSIX::FUNCTION_MASK) | MSIX::ENABLE;
+        }
+    }
+
+    void MSIXTable::Disable() const {
+        if (capability != nullptr) {
+            capability->MessageControl &= ~(MSIX::ENABLE | MSIX::FUNCTION_MASK);
+        }
+    }
 }
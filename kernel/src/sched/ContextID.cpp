@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+
+#include <cpuid.h>
+#include <cstdint>
+
+#include <shared/Lock.hpp>
+#include <shared/LockGuard.hpp>
+#include <shared/SimpleAtomic.hpp>
+
+#include <mm/Paging.hpp>
+
+#include <sched/ContextID.hpp>
+#include <sched/Self.hpp>
+
+namespace Scheduling::ContextID {
+    namespace {
+        static constexpr uint64_t PCID_MASK         = PCID_COUNT - 1;
+        static constexpr uint64_t GENERATION_SHIFT  = 12;
+
+        static constexpr uint64_t CR3_NO_FLUSH      = 0x8000000000000000;
+        static constexpr uint64_t CR4_PGE           = 0x0000000000000080;
+        static constexpr uint64_t CR4_PCIDE         = 0x0000000000020000;
+
+        static constexpr uint32_t CPUID_ECX_PCID    = 0x00020000;
+
+        static bool enabled = false;
+
+        // A tag is the PCID in its low 12 bits and the generation it was handed out in above.
+        // Once the 4095 PCIDs of a generation are used up a new generation starts, and every
+        // task is given a new PCID the next time it is scheduled.
+        static Utils::Lock allocation_lock{};
+        static Utils::SimpleAtomic<uint64_t> generation{1};
+        static uint64_t next_pcid = 1;
+
+        static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> switches{0};
+        static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> flushing_switches{0};
+
+        static void AssignTag(TaskContext& task) {
+            Utils::LockGuard _{allocation_lock};
+
+            uint64_t current = generation;
+
+            if (next_pcid == PCID_COUNT) {
+                generation.store(++current);
+                next_pcid = 1;
+            }
+
+            task.PCID = (current << GENERATION_SHIFT) | next_pcid++;
+        }
+    }
+
+    void InitializeProcessor() {
+        uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+        __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+
+        uint64_t cr4 = 0;
+        __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+
+        cr4 |= CR4_PGE;
+
+        // CR3 still holds PCID 0 here, which is required to turn PCIDs on
+        if ((ecx & CPUID_ECX_PCID) != 0) {
+            cr4 |= CR4_PCIDE;
+            enabled = true;
+        }
+
+        __asm__ volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
+    }
+
+    uint64_t PrepareSwitch(TaskContext& task, UnattachedSelf& self) {
+        const uint64_t root = reinterpret_cast<uint64_t>(task.CR3);
+
+        if (!enabled) {
+            return root;
+        }
+
+        uint64_t current = generation;
+        bool flush = false;
+
+        if ((task.PCID >> GENERATION_SHIFT) != current) {
+            AssignTag(task);
+            current = task.PCID >> GENERATION_SHIFT;
+
+            // the PCID may still hold entries of its previous owner
+            flush = true;
+        }
+
+        // every generation reuses the same PCIDs, a processor catching up on one
+        // drops everything it cached under the previous one
+        uint64_t& seen = self.GetContextIDGeneration();
+
+        if (seen != current) {
+            Paging::InvalidateAllContexts();
+            seen = current;
+        }
+
+        // entries cached on this processor during an earlier stay may be outdated
+        if (task.LastProcessor != self.GetID()) {
+            task.LastProcessor = self.GetID();
+            flush = true;
+        }
+
+        ++switches;
+
+        if (flush) {
+            ++flushing_switches;
+        }
+
+        return root | (task.PCID & PCID_MASK) | (flush ? 0 : CR3_NO_FLUSH);
+    }
+
+    void QueryStatistics(Statistics& stats) {
+        stats.switches = switches;
+        stats.flushingSwitches = flushing_switches;
+        stats.generations = generation;
+    }
+}
@@ -12,9 +12,14 @@
 // You should have received a copy of the GNU General Public License along with this program.
 // If not, see <https://www.gnu.org/licenses/>. 
 
+#include <interrupts/Deferred.hpp>
 #include <interrupts/IDT.hpp>
 #include <interrupts/Panic.hpp>
 
+#include <mm/CopyOnWrite.hpp>
+
+#include <sched/ContextID.hpp>
+#include <sched/ExtendedState.hpp>
 #include <sched/Self.hpp>
 #include <sched/Dispatcher.hpp>
 
@@ -32,22 +37,43 @@ namespace Scheduling {
     void InitializeDispatcher() {
         __asm__ volatile("cli");
 
+        ContextID::InitializeProcessor();
+        CopyOnWrite::InitializeProcessor();
+        ExtendedState::InitializeProcessor();
+
+        if (!Interrupts::Deferred::InitializeProcessor().IsSuccess()) {
+            Panic::Panic("COULD NOT START THE BOTTOM HALF THREAD\n\r");
+        }
+
         // Setup timer IRQ handler for scheduling
         Self().GetTimer().ReattachIRQ(&SCHEDULER_IRQ_HANDLER);
         Interrupts::ForceIRQHandler(Interrupts::SOFTWARE_YIELD_IRQ, reinterpret_cast<void*>(&SCHEDULER_SOFT_IRQ_HANDLER));
 
+        // a tickless timer is only armed by the scheduler, starting with the first switch
+        Self().GetTimer().SetDeadline(1);
+
         Log::printfSafe("[CPU %llu] Scheduler Initialized\n\r", Self().GetID());
         
         __asm__ volatile("sti");
     }
 
-    static void Reschedule(SwitchResult* result, void* stack_context, UnattachedSelf& self) {
-        auto* task = self.GetTaskManager().TaskSwitch(stack_context);
+    static void Reschedule(SwitchResult* result, void* stack_context, UnattachedSelf& self, bool yielding) {
+        auto& timer = self.GetTimer();
+        auto& manager = self.GetTaskManager();
+        auto* task = manager.TaskSwitch(stack_context, timer.GetCountMicros(), yielding);
 
-        if (task != nullptr) {
-            result->CR3 = task->CR3;
+        if (task != nullptr && task->CR3 != nullptr) {
+            ExtendedState::PrepareSwitch(*task, self);
+            result->CR3 = reinterpret_cast<void*>(ContextID::PrepareSwitch(*task, self));
             result->RSP = task->StackPointer;
         }
+
+        // a tickless timer next fires when the slice ends, and not at all on idle
+        timer.SetDeadline(manager.GetDeadline());
+    }
+
+    extern "C" void SCHEDULER_SWITCH_COMPLETE() {
+        Self().GetTaskManager().FinishSwitch();
     }
 
     extern "C" void SCHEDULER_IRQ_DISPATCHER(SwitchResult* result, void* stack_context, bool is_timer_irq) {
@@ -62,12 +88,13 @@ namespace Scheduling {
                 timer.SignalIRQ();
                 timer.SendEOI();
 
-                if (timer.GetCountMillis() % 10 == 0) {
-                    Reschedule(result, stack_context, self);
+                // tickless interrupts only come at the end of a slice, or from another processor
+                if (self.GetTaskManager().Tick(timer.GetCountMicros()) || timer.IsTickless()) {
+                    Reschedule(result, stack_context, self, false);
                 }
             }
             else {
-                Reschedule(result, stack_context, self);
+                Reschedule(result, stack_context, self, true);
             }
         }
     }
@@ -0,0 +1,281 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+
+#include <cpuid.h>
+#include <cstddef>
+#include <cstdint>
+
+#include <shared/SimpleAtomic.hpp>
+#include <shared/memory/defs.hpp>
+
+#include <mm/Utils.hpp>
+#include <mm/VirtualMemory.hpp>
+
+#include <sched/ExtendedState.hpp>
+#include <sched/Self.hpp>
+
+namespace Scheduling::ExtendedState {
+    namespace {
+        static constexpr uint64_t CR0_MP            = 0x0000000000000002;
+        static constexpr uint64_t CR0_EM            = 0x0000000000000004;
+        static constexpr uint64_t CR0_TS            = 0x0000000000000008;
+        static constexpr uint64_t CR4_OSFXSR        = 0x0000000000000200;
+        static constexpr uint64_t CR4_OSXMMEXCPT    = 0x0000000000000400;
+        static constexpr uint64_t CR4_OSXSAVE       = 0x0000000000040000;
+
+        static constexpr uint32_t CPUID_ECX_XSAVE   = 0x04000000;
+        static constexpr uint32_t CPUID_XSAVEOPT    = 0x00000001;
+
+        // x87, SSE, AVX, then the AVX-512 opmask and upper ZMM registers
+        static constexpr uint64_t XCR0_COMPONENTS   = 0x00000000000000E7;
+
+        static constexpr size_t FXSAVE_AREA_SIZE    = 512;
+        static constexpr size_t FCW_OFFSET          = 0;
+        static constexpr size_t MXCSR_OFFSET        = 24;
+        static constexpr uint16_t FCW_DEFAULT       = 0x037F;
+        static constexpr uint32_t MXCSR_DEFAULT     = 0x00001F80;
+
+        enum class Mode : uint8_t {
+            FXSAVE,
+            XSAVE,
+            XSAVEOPT    // skips the components left unmodified since the last restore
+        };
+
+        static Mode mode = Mode::FXSAVE;
+        static uint64_t components = 0;
+        static size_t area_size = FXSAVE_AREA_SIZE;
+
+        static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> switches{0};
+        static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> saves{0};
+        static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> restores{0};
+        static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> switch_cycles{0};
+        static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> save_cycles{0};
+        static Utils::SimpleAtomic<uint64_t, Utils::MemoryOrder::RELAXED> restore_cycles{0};
+
+        static inline uint64_t ReadTSC() {
+            uint32_t low, high;
+            __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+            return (static_cast<uint64_t>(high) << 32) | low;
+        }
+
+        static inline void SetTrap(ProcessorState& state, bool trapping) {
+            if (state.trapping == trapping) {
+                return;
+            }
+
+            if (trapping) {
+                uint64_t cr0 = 0;
+                __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+                __asm__ volatile("mov %0, %%cr0" :: "r"(cr0 | CR0_TS) : "memory");
+            }
+            else {
+                __asm__ volatile("clts" ::: "memory");
+            }
+
+            state.trapping = trapping;
+        }
+
+        static void Save(void* area) {
+            const uint64_t start = ReadTSC();
+            const uint32_t low = static_cast<uint32_t>(components);
+            const uint32_t high = static_cast<uint32_t>(components >> 32);
+
+            switch (mode) {
+                case Mode::XSAVEOPT:
+                    __asm__ volatile("xsaveopt64 (%0)" :: "r"(area), "a"(low), "d"(high) : "memory");
+                    break;
+                case Mode::XSAVE:
+                    __asm__ volatile("xsave64 (%0)" :: "r"(area), "a"(low), "d"(high) : "memory");
+                    break;
+                case Mode::FXSAVE:
+                    __asm__ volatile("fxsave64 (%0)" :: "r"(area) : "memory");
+                    break;
+            }
+
+            ++saves;
+            save_cycles += ReadTSC() - start;
+        }
+
+        static void Restore(const void* area) {
+            const uint64_t start = ReadTSC();
+            const uint32_t low = static_cast<uint32_t>(components);
+            const uint32_t high = static_cast<uint32_t>(components >> 32);
+
+            if (mode == Mode::FXSAVE) {
+                __asm__ volatile("fxrstor64 (%0)" :: "r"(area) : "memory");
+            }
+            else {
+                __asm__ volatile("xrstor64 (%0)" :: "r"(area), "a"(low), "d"(high) : "memory");
+            }
+
+            ++restores;
+            restore_cycles += ReadTSC() - start;
+        }
+
+        static inline uint64_t AreaPages() {
+            return (area_size + Shared::Memory::PAGE_SIZE - 1) / Shared::Memory::PAGE_SIZE;
+        }
+
+        static Success Allocate(TaskContext& task) {
+            // page aligned, as XSAVE needs 64 bytes
+            uint8_t* const area = static_cast<uint8_t*>(
+                VirtualMemory::AllocateKernelHeap(AreaPages(), VirtualMemory::FaultPolicy::POPULATE)
+            );
+
+            if (area == nullptr) {
+                return Failure();
+            }
+
+            // an empty XSAVE header restores every component to its initial state, only the
+            // control words of the legacy area are always loaded
+            Utils::memset(area, 0, area_size);
+            *reinterpret_cast<uint16_t*>(area + FCW_OFFSET) = FCW_DEFAULT;
+            *reinterpret_cast<uint32_t*>(area + MXCSR_OFFSET) = MXCSR_DEFAULT;
+
+            task.ExtendedState = area;
+
+            return Success();
+        }
+    }
+
+    void InitializeProcessor() {
+        uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+        __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+
+        const bool xsave = (ecx & CPUID_ECX_XSAVE) != 0;
+
+        uint64_t cr4 = 0;
+        __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+
+        cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+
+        if (xsave) {
+            cr4 |= CR4_OSXSAVE;
+        }
+
+        __asm__ volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
+
+        if (xsave) {
+            __cpuid_count(0xD, 0, eax, ebx, ecx, edx);
+            components = ((static_cast<uint64_t>(edx) << 32) | eax) & XCR0_COMPONENTS;
+
+            __asm__ volatile("xsetbv" :: "c"(0), "a"(static_cast<uint32_t>(components)), "d"(static_cast<uint32_t>(components >> 32)) : "memory");
+
+            // EBX now reports the area size for the components enabled above
+            __cpuid_count(0xD, 0, eax, ebx, ecx, edx);
+            area_size = ebx;
+
+            __cpuid_count(0xD, 1, eax, ebx, ecx, edx);
+            mode = (eax & CPUID_XSAVEOPT) != 0 ? Mode::XSAVEOPT : Mode::XSAVE;
+        }
+
+        uint64_t cr0 = 0;
+        __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+        __asm__ volatile("mov %0, %%cr0" :: "r"((cr0 & ~CR0_EM) | CR0_MP | CR0_TS) : "memory");
+
+        ProcessorState& state = Self().GetExtendedState();
+        state.owner = nullptr;
+        state.trapping = true;
+    }
+
+    void PrepareSwitch(TaskContext& task, UnattachedSelf& self) {
+        const uint64_t start = ReadTSC();
+        ProcessorState& state = self.GetExtendedState();
+
+        // another processor may run the task next, so its state cannot stay in the registers only
+        if (!state.trapping && state.owner != nullptr && state.owner == state.current) {
+            Save(state.owner->ExtendedState);
+        }
+
+        state.current = &task;
+
+        // the registers still hold the state of the task if nothing was loaded since it left,
+        // and it did not run elsewhere in the meantime
+        SetTrap(state, state.owner != &task || task.ExtendedStateProcessor != self.GetID());
+
+        ++switches;
+        switch_cycles += ReadTSC() - start;
+    }
+
+    Success LoadCurrent() {
+        UnattachedSelf& self = Self();
+        ProcessorState& state = self.GetExtendedState();
+        TaskContext* const task = state.current;
+
+        if (task == nullptr || state.kernel_depth != 0) {
+            return Failure();
+        }
+
+        if (task->ExtendedState == nullptr && !Allocate(*task).IsSuccess()) {
+            return Failure();
+        }
+
+        SetTrap(state, false);
+        Restore(task->ExtendedState);
+
+        task->ExtendedStateProcessor = self.GetID();
+        state.owner = task;
+
+        return Success();
+    }
+
+    void Release(TaskContext& task) {
+        ProcessorState& state = Self().GetExtendedState();
+
+        if (state.owner == &task) {
+            state.owner = nullptr;
+        }
+
+        if (task.ExtendedState != nullptr) {
+            VirtualMemory::FreeKernelHeap(task.ExtendedState, AreaPages());
+            task.ExtendedState = nullptr;
+        }
+
+        task.ExtendedStateProcessor = TaskContext::NO_PROCESSOR;
+    }
+
+    void QueryStatistics(Statistics& stats) {
+        stats.switches = switches;
+        stats.saves = saves;
+        stats.restores = restores;
+        stats.switchCycles = switch_cycles;
+        stats.saveCycles = save_cycles;
+        stats.restoreCycles = restore_cycles;
+    }
+
+    SIMDGuard::SIMDGuard() {
+        ProcessorState& state = Self().GetExtendedState();
+
+        if (state.kernel_depth++ == 0) {
+            // the registers are about to be clobbered, the running task keeps its state first
+            if (!state.trapping && state.owner != nullptr) {
+                Save(state.owner->ExtendedState);
+            }
+
+            state.owner = nullptr;
+            SetTrap(state, false);
+
+            __asm__ volatile("fninit\n\tldmxcsr %0" :: "m"(MXCSR_DEFAULT));
+        }
+    }
+
+    SIMDGuard::~SIMDGuard() {
+        ProcessorState& state = Self().GetExtendedState();
+
+        // the next use by the task loads its state back
+        if (--state.kernel_depth == 0) {
+            SetTrap(state, true);
+        }
+    }
+}
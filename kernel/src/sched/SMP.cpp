@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+
+#include <cstddef>
+#include <cstdint>
+
+#include <shared/memory/defs.hpp>
+
+#include <interrupts/APIC.hpp>
+#include <interrupts/IDT.hpp>
+
+#include <mm/gdt.hpp>
+#include <mm/Paging.hpp>
+#include <mm/Utils.hpp>
+#include <mm/VirtualMemory.hpp>
+
+#include <sched/Dispatcher.hpp>
+#include <sched/Self.hpp>
+#include <sched/SMP.hpp>
+
+#include <screen/Log.hpp>
+
+extern "C" uint8_t AP_TRAMPOLINE_START[];
+extern "C" uint8_t AP_TRAMPOLINE_PARAMETERS[];
+extern "C" uint8_t AP_TRAMPOLINE_END[];
+
+namespace ShdMem = Shared::Memory;
+
+namespace Scheduling::SMP {
+    namespace {
+        // must match the layout in Trampoline.asm
+        struct TrampolineParameters {
+            uint64_t bootCR3;
+            uint64_t CR0;
+            uint64_t CR3;
+            uint64_t CR4;
+            uint64_t EFER;
+            uint64_t stack;
+            uint64_t entry;
+            uint64_t argument;
+            volatile uint64_t started;
+        };
+
+        // the trampoline page, followed by the PML4 it enables paging with
+        static constexpr size_t TRAMPOLINE_PAGES = 2;
+        // startup IPIs can only point to the first 1MB
+        static constexpr uint64_t TRAMPOLINE_LIMIT = 0x100000;
+
+        static constexpr size_t BOOT_STACK_PAGES = 4;
+
+        static constexpr uint64_t INIT_DELAY_MS = 10;
+        static constexpr uint64_t STARTUP_DELAY_MS = 1;
+        // covers the calibration of the local timer against the PIT
+        static constexpr uint64_t ONLINE_TIMEOUT_MS = 1000;
+
+        static constexpr uint32_t IA32_EFER = 0xC0000080;
+        static constexpr uint64_t EFER_LMA = 0x400;
+
+        static uint64_t ReadEFER() {
+            uint32_t low, high;
+            __asm__ volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(IA32_EFER));
+            return (static_cast<uint64_t>(high) << 32) | low;
+        }
+
+        [[noreturn]] static void ProcessorEntry(void* gdt) {
+            VirtualMemory::kernel_gdt_setup_processor(gdt);
+            Interrupts::LoadIDT();
+
+            // loading the data segments above cleared the GS base, per-CPU data is unavailable until bound
+            UnattachedSelf::PrepareBinding();
+
+            APIC::SetupLocalAPIC();
+
+            auto& self = UnattachedSelf::Attach();
+            self.Bind();
+
+            self.GetTimer().Initialize();
+            self.SetOnline();
+
+            Scheduling::InitializeDispatcher();
+
+            while (1) {
+                __asm__ volatile("hlt");
+            }
+        }
+
+        static bool HasStarted(void* parameters) {
+            return static_cast<TrampolineParameters*>(parameters)->started != 0;
+        }
+
+        static bool IsOnline(void* processor) {
+            return static_cast<UnattachedSelf*>(processor)->IsOnline();
+        }
+
+        // signalled is set once the startup IPIs went out, the processor may then still run the
+        // trampoline after a failure
+        static Success StartProcessor(UnattachedSelf& processor, TrampolineParameters& parameters, uint8_t page, bool& signalled) {
+            void* const stack = VirtualMemory::AllocateKernelHeap(BOOT_STACK_PAGES, VirtualMemory::FaultPolicy::POPULATE);
+            void* const gdt = VirtualMemory::AllocateKernelHeap(1, VirtualMemory::FaultPolicy::POPULATE);
+
+            static_assert(VirtualMemory::PROCESSOR_GDT_SIZE <= ShdMem::PAGE_SIZE);
+
+            if (stack == nullptr || gdt == nullptr) {
+                if (stack != nullptr) {
+                    VirtualMemory::FreeKernelHeap(stack, BOOT_STACK_PAGES);
+                }
+
+                if (gdt != nullptr) {
+                    VirtualMemory::FreeKernelHeap(gdt, 1);
+                }
+
+                return Failure();
+            }
+
+            parameters.stack = reinterpret_cast<uint64_t>(stack) + BOOT_STACK_PAGES * ShdMem::PAGE_SIZE;
+            parameters.argument = reinterpret_cast<uint64_t>(gdt);
+            parameters.started = 0;
+
+            auto& self = Self();
+
+            signalled = true;
+            APIC::SendInitIPI(processor.GetID());
+            self.SpinWaitMillis(INIT_DELAY_MS);
+
+            // the second startup IPI is only needed if the processor missed the first one
+            for (int i = 0; i < 2 && parameters.started == 0; ++i) {
+                APIC::SendStartupIPI(processor.GetID(), page);
+                self.SpinWaitMillsFor(STARTUP_DELAY_MS, &HasStarted, &parameters);
+            }
+
+            if (!self.SpinWaitMillsFor(ONLINE_TIMEOUT_MS, &IsOnline, &processor)) {
+                return Failure();
+            }
+
+            return Success();
+        }
+    }
+
+    void StartProcessors() {
+        auto& bootstrap = Self();
+        bootstrap.SetOnline();
+
+        const size_t count = UnattachedSelf::GetProcessorCount();
+
+        if (count <= 1) {
+            return;
+        }
+
+        // from now on, mapping changes have to reach the other processors
+        Paging::EnableShootdown();
+
+        uint8_t* const trampoline = static_cast<uint8_t*>(VirtualMemory::AllocateDMA(TRAMPOLINE_PAGES));
+
+        if (trampoline == nullptr || reinterpret_cast<uint64_t>(trampoline) >= TRAMPOLINE_LIMIT) {
+            if (trampoline != nullptr) {
+                VirtualMemory::FreeDMA(trampoline, TRAMPOLINE_PAGES);
+            }
+
+            Log::putsSafe("[SMP] No memory below 1MB for the startup trampoline, application processors stay offline\n\r");
+            return;
+        }
+
+        // DMA memory is identity mapped in every address space
+        Utils::memcpy(trampoline, AP_TRAMPOLINE_START, AP_TRAMPOLINE_END - AP_TRAMPOLINE_START);
+
+        uint8_t* const bootPML4 = trampoline + ShdMem::PAGE_SIZE;
+        Utils::memcpy(bootPML4, Paging::GetPML4Address(), ShdMem::PAGE_SIZE);
+
+        auto& parameters = *reinterpret_cast<TrampolineParameters*>(
+            trampoline + (AP_TRAMPOLINE_PARAMETERS - AP_TRAMPOLINE_START)
+        );
+
+        parameters.bootCR3 = reinterpret_cast<uint64_t>(bootPML4);
+        __asm__ volatile("mov %%cr0, %0" : "=r"(parameters.CR0));
+        __asm__ volatile("mov %%cr3, %0" : "=r"(parameters.CR3));
+        __asm__ volatile("mov %%cr4, %0" : "=r"(parameters.CR4));
+        parameters.EFER = ReadEFER() & ~EFER_LMA;
+        parameters.entry = reinterpret_cast<uint64_t>(&ProcessorEntry);
+
+        const uint8_t page = static_cast<uint8_t>(reinterpret_cast<uint64_t>(trampoline) / ShdMem::PAGE_SIZE);
+        size_t online = 1;
+        bool stranded = false;
+
+        for (size_t i = 0; i < count; ++i) {
+            auto& processor = UnattachedSelf::AccessProcessor(i);
+
+            // online capable entries are hot-pluggable slots, nothing answers the startup IPIs
+            if (&processor == &bootstrap || !processor.IsEnabled()) {
+                continue;
+            }
+
+            bool signalled = false;
+
+            if (!StartProcessor(processor, parameters, page, signalled).IsSuccess()) {
+                Log::printfSafe("[SMP] Processor 0x%.2hhx did not come online\n\r", processor.GetID());
+                stranded |= signalled;
+                continue;
+            }
+
+            ++online;
+        }
+
+        Log::printfSafe("[SMP] %llu processors online\n\r", online);
+
+        // a processor that missed its timeout may still be running the trampoline
+        if (!stranded) {
+            VirtualMemory::FreeDMA(trampoline, TRAMPOLINE_PAGES);
+        }
+    }
+}
@@ -15,6 +15,7 @@
 BITS 64
 
 extern SCHEDULER_IRQ_DISPATCHER
+extern SCHEDULER_SWITCH_COMPLETE
 
 section .text
 global SCHEDULER_IRQ_HANDLER
@@ -65,6 +66,11 @@ SCHEDULER_IRQ_HANDLER:
     mov cr3, rax
     mov rsp, rcx
 
+    ; off the outgoing stack, its task can be handed to other processors
+    sub rsp, 32
+    call SCHEDULER_SWITCH_COMPLETE
+    add rsp, 32
+
 .no_switch:
     pop r15
     pop r14
@@ -129,6 +135,11 @@ SCHEDULER_SOFT_IRQ_HANDLER:
     mov cr3, rax
     mov rsp, rcx
 
+    ; off the outgoing stack, its task can be handed to other processors
+    sub rsp, 32
+    call SCHEDULER_SWITCH_COMPLETE
+    add rsp, 32
+
 .no_switch:
     pop r15
     pop r14
@@ -12,6 +12,7 @@
 // You should have received a copy of the GNU General Public License along with this program.
 // If not, see <https://www.gnu.org/licenses/>. 
 
+#include <cpuid.h>
 #include <cstddef>
 #include <cstdint>
 
@@ -22,6 +23,8 @@
 #include <interrupts/Timer.hpp>
 
 #include <mm/Heap.hpp>
+#include <mm/Paging.hpp>
+#include <mm/PhysicalMemory.hpp>
 
 #include <sched/Self.hpp>
 #include <sched/TaskContext.hpp>
@@ -74,10 +77,37 @@ namespace {
         uint64_t GetCountMillis() const final {
             return PIT::GetCountMillis();
         }
+
+        bool IsTickless() const final {
+            return false;
+        }
+
+        void SetDeadline(uint64_t) final {}
     } static PITWrapper;
 
+    static constexpr uint32_t IA32_GS_BASE = 0xC0000101;
+    static constexpr uint32_t IA32_TSC_DEADLINE = 0x000006E0;
+
+    static constexpr uint32_t CPUID_ECX_TSC_DEADLINE = 0x01000000;
+    static constexpr uint32_t CPUID_EDX_INVARIANT_TSC = 0x00000100;
+
+    static inline uint64_t ReadTSC() {
+        uint32_t low, high;
+        __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+        return (static_cast<uint64_t>(high) << 32) | low;
+    }
+
+    static void WriteGSBase(const void* base) {
+        const uint64_t value = reinterpret_cast<uint64_t>(base);
+        __asm__ volatile("wrmsr" :: "a"(static_cast<uint32_t>(value)), "d"(static_cast<uint32_t>(value >> 32)), "c"(IA32_GS_BASE));
+    }
+
     static void IdleTask() {
         while (true) {
+            // spare cycles go into clearing frames, so that page tables and faults
+            // do not have to pay for it later
+            while (PhysicalMemory::PrepareZeroedFrame()) {}
+
             __asm__ volatile("hlt");
         }
     }
@@ -118,22 +148,54 @@ void UnattachedSelf::APICTimerWrapper::Initialize() {
 
     const uint64_t target = PIT::GetCountMillis() + CONFIG_GRANULARITY_MS;
     APIC::Timer::SetTimerInitialCount(TIMER_INITIAL_COUNT);
+    const uint64_t tsc_start = ReadTSC();
 
     while (PIT::GetCountMillis() < target) {
         __asm__ volatile("pause");
     }
 
     const uint64_t end_count = APIC::Timer::GetTimerCurrentCount();
-    const uint64_t ticks = (0xFFFFFFFF - end_count) / CONFIG_GRANULARITY_MS;
+    const uint64_t tsc_end = ReadTSC();
+
+    ticks_per_ms = (0xFFFFFFFF - end_count) / CONFIG_GRANULARITY_MS;
+    tsc_per_us = (tsc_end - tsc_start) / (CONFIG_GRANULARITY_MS * 1000);
 
     PIT::Disable();
 
-    APIC::Timer::SetTimerInitialCount(static_cast<uint32_t>(ticks));
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+
+    // without an invariant TSC there is no clock to read between interrupts
+    tickless = (edx & CPUID_EDX_INVARIANT_TSC) != 0 && tsc_per_us != 0;
+
+    if (tickless) {
+        __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+        tsc_deadline = (ecx & CPUID_ECX_TSC_DEADLINE) != 0;
+
+        if (tsc_origin == 0) {
+            tsc_origin = tsc_start;
+        }
+
+        APIC::Timer::SetTimerLVT(vector, tsc_deadline ? APIC::Timer::Mode::TSC_DEADLINE : APIC::Timer::Mode::ONE_SHOT);
+        APIC::Timer::SetTimerInitialCount(0);
+
+        // orders the LVT write before the first write to the deadline MSR
+        __asm__ volatile("mfence" ::: "memory");
+    }
+    else {
+        APIC::Timer::SetTimerInitialCount(static_cast<uint32_t>(ticks_per_ms));
+    }
 
     Interrupts::RegisterIRQ(vector, &provider);
     APIC::Timer::UnmaskTimerLVT();
 
-    Log::printfSafe("[CPU %u] Configured APIC timer for 1ms intervals\n\r", APIC::GetLAPICID());
+    if (tickless) {
+        Log::printfSafe("[CPU %u] Configured APIC timer for tickless operation (%s)\n\r",
+            APIC::GetLAPICID(), tsc_deadline ? "TSC deadline" : "one-shot");
+    }
+    else {
+        Log::printfSafe("[CPU %u] Configured APIC timer for 1ms intervals\n\r", APIC::GetLAPICID());
+    }
 }
 
 bool UnattachedSelf::APICTimerWrapper::IsEnabled() const {
@@ -163,7 +225,9 @@ void UnattachedSelf::APICTimerWrapper::ReleaseIRQ() {
 }
 
 void UnattachedSelf::APICTimerWrapper::SignalIRQ() {
-    millis_counter += MILLIS_INTERVAL;
+    if (!tickless) {
+        millis_counter += MILLIS_INTERVAL;
+    }
 }
 
 void UnattachedSelf::APICTimerWrapper::SendEOI() const {
@@ -175,13 +239,55 @@ void UnattachedSelf::APICTimerWrapper::SetHandler(void (*handler)()) {
 }
 
 uint64_t UnattachedSelf::APICTimerWrapper::GetCountMicros() const {
+    if (tickless) {
+        return (ReadTSC() - tsc_origin) / tsc_per_us;
+    }
+
     return millis_counter * 1000;
 }
 
 uint64_t UnattachedSelf::APICTimerWrapper::GetCountMillis() const {
+    if (tickless) {
+        return GetCountMicros() / 1000;
+    }
+
     return millis_counter;
 }
 
+bool UnattachedSelf::APICTimerWrapper::IsTickless() const {
+    return tickless;
+}
+
+void UnattachedSelf::APICTimerWrapper::SetDeadline(uint64_t micros) {
+    if (!tickless) {
+        return;
+    }
+
+    if (tsc_deadline) {
+        // a deadline already past fires right away, 0 disarms
+        const uint64_t value = micros != 0 ? tsc_origin + micros * tsc_per_us : 0;
+        __asm__ volatile("wrmsr" :: "a"(static_cast<uint32_t>(value)), "d"(static_cast<uint32_t>(value >> 32)), "c"(IA32_TSC_DEADLINE));
+    }
+    else if (micros == 0) {
+        APIC::Timer::SetTimerInitialCount(0);
+    }
+    else {
+        const uint64_t now = GetCountMicros();
+        const uint64_t count = micros > now ? (micros - now) * ticks_per_ms / 1000 : 0;
+
+        // a count of 0 would stop the timer instead
+        APIC::Timer::SetTimerInitialCount(
+            count == 0 ? 1 :
+            count > 0xFFFFFFFF ? 0xFFFFFFFF
+            : static_cast<uint32_t>(count)
+        );
+    }
+}
+
+uint8_t UnattachedSelf::APICTimerWrapper::GetVector() const {
+    return vector;
+}
+
 UnattachedSelf::UnattachedSelf(uint8_t apic_id, uint8_t apic_uid, bool enabled, bool online_capable)
     : enabled(enabled), online_capable(online_capable), apic_id(apic_id), apic_uid(apic_uid) {
     
@@ -190,8 +296,9 @@ UnattachedSelf::UnattachedSelf(uint8_t apic_id, uint8_t apic_uid, bool enabled,
         Panic::PanicShutdown("COULD NOT CREATE IDLE TASK\n\r");
     }
 
-    // create non-blockable idle task
-    task_manager.AddTask(idle_context.GetValue(), false);
+    if (!task_manager.SetIdleTask(idle_context.GetValue()).IsSuccess()) {
+        Panic::PanicShutdown("COULD NOT SET IDLE TASK\n\r");
+    }
 }
 
 UnattachedSelf* UnattachedSelf::AllocateProcessors(size_t count) {
@@ -221,7 +328,25 @@ UnattachedSelf& UnattachedSelf::AccessRemote(uint8_t id) {
     Panic::Panic("ILLEGAL ACCESS TO INVALID REMOTE PROCESSOR\n\r");
 }
 
+UnattachedSelf& UnattachedSelf::AccessProcessor(size_t index) {
+    if (index >= allocated_processors) {
+        Panic::Panic("ILLEGAL ACCESS TO INVALID REMOTE PROCESSOR\n\r");
+    }
+
+    return processors[index];
+}
+
+size_t UnattachedSelf::GetProcessorCount() {
+    return allocated_processors;
+}
+
 UnattachedSelf& UnattachedSelf::Attach() {
+    UnattachedSelf* self = TryAttach();
+
+    if (self != nullptr) {
+        return *self;
+    }
+
     uint8_t apic_id = APIC::GetLAPICID();
 
     for (size_t i = 0; i < processor_count; i++) {
@@ -233,6 +358,20 @@ UnattachedSelf& UnattachedSelf::Attach() {
     Panic::Panic("COULD NOT FIND OWN PROCESSOR\n\r");
 }
 
+UnattachedSelf* UnattachedSelf::TryAttach() {
+    UnattachedSelf* self;
+    __asm__ volatile("mov %%gs:0, %0" : "=r"(self));
+    return self;
+}
+
+void UnattachedSelf::PrepareBinding() {
+    WriteGSBase(&unbound_reference);
+}
+
+void UnattachedSelf::Bind() {
+    WriteGSBase(&self_reference);
+}
+
 bool UnattachedSelf::IsEnabled() const {
     return enabled;
 }
@@ -241,6 +380,18 @@ bool UnattachedSelf::IsOnlineCapable() const {
     return online_capable;
 }
 
+bool UnattachedSelf::IsOnline() const {
+    return online;
+}
+
+void UnattachedSelf::SetOnline() {
+    online = true;
+
+    // shootdowns skipped this processor until now, whatever it cached may be stale
+    __asm__ volatile("mfence" ::: "memory");
+    Paging::InvalidateAllContexts();
+}
+
 uint8_t UnattachedSelf::GetID() const {
     return apic_id;
 }
@@ -295,6 +446,13 @@ void UnattachedSelf::Yield() {
     __asm__ volatile("int %0" :: "N"(Interrupts::SOFTWARE_YIELD_IRQ));
 }
 
+void UnattachedSelf::Kick() {
+    // the timer vector leads to the scheduler, which reschedules on every tickless interrupt
+    if (online && local_timer.IsTickless()) {
+        APIC::SendFixedIPI(apic_id, local_timer.GetVector());
+    }
+}
+
 Timer& UnattachedSelf::GetPIT() {
     return PITWrapper;
 }
@@ -307,6 +465,22 @@ Scheduling::TaskManager& UnattachedSelf::GetTaskManager() {
     return task_manager;
 }
 
+Magazine::ProcessorCache& UnattachedSelf::GetMemoryCache() {
+    return memory_cache;
+}
+
+uint64_t& UnattachedSelf::GetContextIDGeneration() {
+    return context_id_generation;
+}
+
+Scheduling::ExtendedState::ProcessorState& UnattachedSelf::GetExtendedState() {
+    return extended_state;
+}
+
+Interrupts::Deferred::ProcessorQueue& UnattachedSelf::GetDeferredQueue() {
+    return deferred_queue;
+}
+
 UnattachedSelf& Self() {
     return UnattachedSelf::Attach();
 }
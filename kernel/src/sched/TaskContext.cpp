@@ -115,11 +115,10 @@ namespace Scheduling {
         return reinterpret_cast<void*>(VirtualMemoryLayout::KernelStackReserve.start);
     }
 
-    Optional<KernelTaskContext> KernelTaskContext::Create(void* InstructionPointer, uint64_t argument) {
+    Optional<KernelTaskContext> KernelTaskContext::FromAddressSpace(void* CR3, void* InstructionPointer, uint64_t argument) {
         /// FIXME: make a method to completely free a PML4 in case of failure
         /// current status: leaking memory on every failure
         
-        void* CR3 = VirtualMemory::DeriveNewFreshCR3();
         if (CR3 == nullptr) {
             return Optional<KernelTaskContext>();
         }
@@ -137,4 +136,12 @@ namespace Scheduling {
 
         return Optional(context);
     }
+
+    Optional<KernelTaskContext> KernelTaskContext::Create(void* InstructionPointer, uint64_t argument) {
+        return FromAddressSpace(VirtualMemory::DeriveNewFreshCR3(), InstructionPointer, argument);
+    }
+
+    Optional<KernelTaskContext> KernelTaskContext::Clone(void* InstructionPointer, uint64_t argument) {
+        return FromAddressSpace(VirtualMemory::CloneCR3(), InstructionPointer, argument);
+    }
 }
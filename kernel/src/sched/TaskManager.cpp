@@ -12,152 +12,736 @@
 // You should have received a copy of the GNU General Public License along with this program.
 // If not, see <https://www.gnu.org/licenses/>. 
 
+#include <cstddef>
 #include <cstdint>
 
 #include <new>
 
+#include <shared/LockGuard.hpp>
+
+#include <interrupts/InterruptGuard.hpp>
+
 #include <mm/Heap.hpp>
 
+#include <sched/ExtendedState.hpp>
+#include <sched/Self.hpp>
 #include <sched/TaskContext.hpp>
 #include <sched/TaskManager.hpp>
 
 namespace Scheduling {
+    namespace {
+        static constexpr uint64_t SLOT_BITS = 12;
+        static constexpr uint64_t SLOT_COUNT = static_cast<uint64_t>(1) << SLOT_BITS;
+        static constexpr uint64_t SLOT_MASK = SLOT_COUNT - 1;
+
+        static constexpr uint8_t STATE_RUNNING  = 0;    // running, or being switched away from
+        static constexpr uint8_t STATE_READY    = 1;    // in a run queue, or pending on one
+        static constexpr uint8_t STATE_PARKED   = 2;    // blocked, and in no queue at all
+
+        // per priority step, so that the default priority gets 10ms
+        static constexpr uint32_t FAIR_SLICE_US = 2500;
+        static constexpr uint32_t IDLE_SLICE_US = 10000;
+        // periodic timers have the idle task look for work this often
+        static constexpr uint32_t IDLE_POLL_US = 10000;
+        // one-shot timers may fire slightly early, which still ends the slice
+        static constexpr uint64_t SLICE_SLACK_US = 50;
+        // already past, fires as soon as interrupts are enabled
+        static constexpr uint64_t DEADLINE_NOW = 1;
+    }
+
+    // The low bits of an id are the slot of the task, so that it is found in O(1), and the
+    // high bits tell apart the tasks that used the same slot over time.
+    struct TaskManager::Index {
+        Utils::Lock lock;
+        Task* slots[SLOT_COUNT];
+        uint64_t cursor;
+        uint64_t sequence;
+        uint64_t count;
+    };
+
+    TaskManager::Index TaskManager::index{};
+
+    bool TaskManager::RunQueue::Push(Task* task) {
+        const uint64_t b = bottom.load<Utils::MemoryOrder::RELAXED>();
+        const uint64_t t = top.load<Utils::MemoryOrder::ACQUIRE>();
+
+        if (b - t >= CAPACITY) {
+            return false;
+        }
+
+        slots[b % CAPACITY] = task;
+        bottom.store<Utils::MemoryOrder::RELEASE>(b + 1);
+
+        return true;
+    }
+
+    TaskManager::Task* TaskManager::RunQueue::Steal() {
+        uint64_t t = top.load<Utils::MemoryOrder::ACQUIRE>();
+        const uint64_t b = bottom.load<Utils::MemoryOrder::ACQUIRE>();
+
+        if (t >= b) {
+            return nullptr;
+        }
+
+        Task* const task = slots[t % CAPACITY];
+
+        // the slot can only have been reused after the top moved, which fails the exchange
+        if (!top.compare_exchange(t, t + 1)) {
+            return nullptr;
+        }
+
+        return task;
+    }
+
+    uint64_t TaskManager::RunQueue::Size() const {
+        const uint64_t t = top.load<Utils::MemoryOrder::RELAXED>();
+        const uint64_t b = bottom.load<Utils::MemoryOrder::RELAXED>();
+
+        return b > t ? b - t : 0;
+    }
+
     uint64_t TaskManager::GetTaskCount() const {
-        return task_count;
+        return index.count;
+    }
+
+    TaskManager::Task* TaskManager::FindTask(uint64_t task_id) {
+        Task* const task = index.slots[task_id & SLOT_MASK];
+
+        if (task != nullptr && task->id == task_id) {
+            return task;
+        }
+
+        return nullptr;
+    }
+
+    void TaskManager::DestroyTask(Task* task) {
+        ExtendedState::Release(task->context);
+        task->context.Destroy();
+        Heap::Free(task);
+    }
+
+    bool TaskManager::IsRunnable(Task* task) {
+        Utils::LockGuard _{task->lock};
+
+        return !task->removed && !(task->blockable && task->blocked);
+    }
+
+    bool TaskManager::Claim(Task* task) {
+        {
+            Utils::LockGuard _{task->lock};
+
+            if (!task->removed) {
+                if (task->blockable && task->blocked) {
+                    task->state = STATE_PARKED;
+                    return false;
+                }
+
+                task->state = STATE_RUNNING;
+                return true;
+            }
+        }
+
+        // removed tasks are out of the index, nothing else can reach them
+        DestroyTask(task);
+
+        return false;
+    }
+
+    TaskManager::Task* TaskManager::TakeFrom(RunQueue& queue, TaskManager* thief) {
+        while (queue.Size() > 0) {
+            Task* const task = queue.Steal();
+
+            if (task == nullptr) {
+                continue;
+            }
+
+            // taken from under its owner, a pinned task goes straight back
+            if (thief != nullptr && task->pinned_to != nullptr && task->pinned_to != thief) {
+                task->pinned_to->Wake(task);
+                continue;
+            }
+
+            if (Claim(task)) {
+                return task;
+            }
+        }
+
+        return nullptr;
+    }
+
+    TaskManager::Task* TaskManager::TakeBest(TaskManager& manager, size_t limit, TaskManager* thief) {
+        for (size_t level = 0; level < limit; ++level) {
+            Task* const task = TakeFrom(manager.run_queues[level], thief);
+
+            if (task != nullptr) {
+                return task;
+            }
+        }
+
+        return nullptr;
+    }
+
+    Success TaskManager::ResolveLevel(SchedulingClass scheduling_class, uint8_t priority, uint8_t& level, uint32_t& slice) {
+        switch (scheduling_class) {
+            case SchedulingClass::REALTIME:
+                if (priority >= REALTIME_PRIORITIES) {
+                    return Failure();
+                }
+
+                level = REALTIME_PRIORITIES - 1 - priority;
+                slice = 0;
+                break;
+            case SchedulingClass::FAIR:
+                if (priority >= FAIR_PRIORITIES) {
+                    return Failure();
+                }
+
+                level = REALTIME_PRIORITIES;
+                slice = (priority + 1) * FAIR_SLICE_US;
+                break;
+            case SchedulingClass::IDLE:
+                level = REALTIME_PRIORITIES + 1;
+                slice = IDLE_SLICE_US;
+                break;
+            default:
+                return Failure();
+        }
+
+        return Success();
+    }
+
+    uint64_t TaskManager::GetQueuedCount() const {
+        uint64_t queued = 0;
+
+        for (const RunQueue& queue : run_queues) {
+            queued += queue.Size();
+        }
+
+        return queued;
+    }
+
+    bool TaskManager::IsSliceOver(uint64_t now) const {
+        return slice_end != 0 && now + SLICE_SLACK_US >= slice_end;
     }
 
-    TaskManager::Task* TaskManager::FindTask(uint64_t task_id) const {
-        auto* ptr = head;
-        auto* const loop_ref = ptr;
+    void TaskManager::Enqueue(Task* task) {
+        uint64_t head = pending.load();
+
+        do {
+            task->next_pending = reinterpret_cast<Task*>(head);
+        } while (!pending.compare_exchange(head, reinterpret_cast<uint64_t>(task)));
+    }
+
+    void TaskManager::DrainPending() {
+        Task* task = reinterpret_cast<Task*>(pending.exchange(0));
+
+        while (task != nullptr) {
+            Task* const next = task->next_pending;
 
-        if (ptr != nullptr) {
-            if (ptr->id == task_id) {
-                return ptr;
+            // a full run queue leaves the task pending until the next switch
+            if (!run_queues[task->level].Push(task)) {
+                Enqueue(task);
             }
 
-            ptr = ptr->next;
+            task = next;
+        }
+    }
+
+    void TaskManager::Settle(Task* task) {
+        bool removed = false;
+        uint8_t level = 0;
+
+        {
+            Utils::LockGuard _{task->lock};
 
-            while (ptr != loop_ref && ptr->id != task_id) {
-                ptr = ptr->next;
+            removed = task->removed;
+
+            if (!removed && task->blockable && task->blocked) {
+                task->state = STATE_PARKED;
+                return;
             }
 
-            if (ptr != loop_ref) {
-                return ptr;
+            task->state = STATE_READY;
+            level = task->level;
+        }
+
+        if (removed) {
+            DestroyTask(task);
+        }
+        else if (!run_queues[level].Push(task)) {
+            Enqueue(task);
+        }
+    }
+
+    void TaskManager::Wake(Task* task) {
+        if (task->pinned_to != nullptr && task->pinned_to != this) {
+            task->pinned_to->Wake(task);
+            return;
+        }
+
+        Interrupts::InterruptGuard irqGuard{};
+        const Task* const running = current;
+
+        // a better task preempts the running one right away
+        if (running == nullptr || running == idle || task->level < running->level) {
+            Enqueue(task);
+            RequestReschedule();
+            return;
+        }
+
+        // otherwise an idle processor takes it, rather than have it wait for the slice to end
+        UnattachedSelf* const processor = task->pinned_to == nullptr ? FindIdleProcessor() : nullptr;
+        TaskManager& manager = processor != nullptr ? processor->GetTaskManager() : *this;
+
+        manager.Enqueue(task);
+
+        if (&manager != this) {
+            manager.RequestReschedule();
+        }
+    }
+
+    void TaskManager::RequestReschedule() {
+        reschedule = true;
+
+        UnattachedSelf& self = Self();
+
+        // a tickless timer fires as soon as interrupts are enabled again, a periodic one
+        // sees the request on its next tick
+        if (&self.GetTaskManager() == this) {
+            self.GetTimer().SetDeadline(DEADLINE_NOW);
+            return;
+        }
+
+        for (size_t i = 0; i < UnattachedSelf::GetProcessorCount(); ++i) {
+            UnattachedSelf& processor = UnattachedSelf::AccessProcessor(i);
+
+            if (&processor.GetTaskManager() == this) {
+                processor.Kick();
+                return;
+            }
+        }
+    }
+
+    UnattachedSelf* TaskManager::FindIdleProcessor() const {
+        for (size_t i = 0; i < UnattachedSelf::GetProcessorCount(); ++i) {
+            UnattachedSelf& processor = UnattachedSelf::AccessProcessor(i);
+            const TaskManager& manager = processor.GetTaskManager();
+
+            if (&manager != this && processor.IsOnline() && manager.current == manager.idle) {
+                return &processor;
             }
         }
 
         return nullptr;
     }
 
-    uint64_t TaskManager::AddTask(const TaskContext& context, bool blockable) {        
+    void TaskManager::KickIdleProcessor() {
+        UnattachedSelf* const processor = FindIdleProcessor();
+
+        if (processor != nullptr) {
+            processor->GetTaskManager().RequestReschedule();
+        }
+    }
+
+    TaskManager::Task* TaskManager::StealFromBusiest(uint64_t load, size_t limit) {
+        TaskManager* busiest = nullptr;
+        uint64_t busiest_queued = load;
+
+        // only steal from a processor with more tasks waiting than this one has in total,
+        // so that tasks do not bounce between processors that are already balanced
+        for (size_t i = 0; i < UnattachedSelf::GetProcessorCount(); ++i) {
+            TaskManager& manager = UnattachedSelf::AccessProcessor(i).GetTaskManager();
+            const uint64_t queued = manager.GetQueuedCount();
+
+            if (&manager != this && queued > busiest_queued) {
+                busiest = &manager;
+                busiest_queued = queued;
+            }
+        }
+
+        if (busiest == nullptr) {
+            return nullptr;
+        }
+
+        Task* const task = TakeBest(*busiest, limit, this);
+
+        if (task != nullptr) {
+            ++steals;
+        }
+
+        return task;
+    }
+
+    Success TaskManager::SetIdleTask(const TaskContext& context) {
         if (context.CR3 == nullptr || context.InstructionPointer == nullptr || context.StackPointer == nullptr) {
-            return 0;
+            return Failure();
         }
-        
+
         Task* new_task = static_cast<Task*>(
             Heap::Allocate(sizeof(Task))
         );
 
         if (new_task == nullptr) {
-            return 0;
+            return Failure();
         }
 
-        Utils::LockGuard _{modify_lock};
-
         new (new_task) Task {
-            .blockable = blockable,
+            .blockable = false,
             .blocked = false,
-            .id = ++task_count, // id = number of tasks added since reset
-            .prev = nullptr,
-            .next = nullptr,
+            .removed = false,
+            .state = STATE_READY,
+            .level = LEVEL_COUNT - 1,
+            .lock = {},
+            .slice = IDLE_POLL_US,
+            .id = 0,
+            .pinned_to = this,
+            .next_pending = nullptr,
             .context = context
         };
 
-        if (head == nullptr) {
-            head = new_task;
-            new_task->prev = new_task;
-            new_task->next = new_task;
+        idle = new_task;
+
+        return Success();
+    }
+
+    uint64_t TaskManager::AddTask(const TaskContext& context, bool blockable, SchedulingClass scheduling_class, uint8_t priority, bool pinned) {
+        if (context.CR3 == nullptr || context.InstructionPointer == nullptr || context.StackPointer == nullptr) {
+            return 0;
         }
-        else {
-            Task* tail = head->prev;
 
-            tail->next = new_task;
-            new_task->prev = tail;
-            new_task->next = head;
-            head->prev = new_task;
+        uint8_t level = 0;
+        uint32_t slice = 0;
+
+        if (!ResolveLevel(scheduling_class, priority, level, slice).IsSuccess()) {
+            return 0;
         }
+        
+        Task* new_task = static_cast<Task*>(
+            Heap::Allocate(sizeof(Task))
+        );
+
+        if (new_task == nullptr) {
+            return 0;
+        }
+
+        uint64_t id = 0;
+
+        {
+            Interrupts::InterruptGuard irqGuard{};
+            Utils::LockGuard _{index.lock};
+
+            if (index.count < SLOT_COUNT) {
+                while (index.slots[index.cursor] != nullptr) {
+                    index.cursor = (index.cursor + 1) & SLOT_MASK;
+                }
+
+                id = (++index.sequence << SLOT_BITS) | index.cursor;
+
+                new (new_task) Task {
+                    .blockable = blockable,
+                    .blocked = false,
+                    .removed = false,
+                    .state = STATE_READY,
+                    .level = level,
+                    .lock = {},
+                    .slice = slice,
+                    .id = id,
+                    .pinned_to = pinned ? this : nullptr,
+                    .next_pending = nullptr,
+                    .context = context
+                };
+
+                index.slots[index.cursor] = new_task;
+                ++index.count;
+            }
+        }
+
+        if (id == 0) {
+            Heap::Free(new_task);
+            return 0;
+        }
+
+        Wake(new_task);
 
-        return new_task->id;
+        return id;
     }
 
     void TaskManager::RemoveTask(uint64_t task_id) {
-        Utils::LockGuard _{modify_lock};
+        Interrupts::InterruptGuard irqGuard{};
+        Task* parked = nullptr;
 
-        auto* task = FindTask(task_id);
+        {
+            Utils::LockGuard _{index.lock};
 
-        // refuse to delete task if it is the only one left
-        if (!(task == head && task->next == task)) {
-            if (head == task) {
-                head = task->next;
+            Task* const task = FindTask(task_id);
+
+            if (task == nullptr) {
+                return;
+            }
+
+            index.slots[task_id & SLOT_MASK] = nullptr;
+            --index.count;
+
+            Utils::LockGuard task_guard{task->lock};
+
+            task->removed = true;
+
+            // a parked task is in no queue, so it is queued again for a processor to destroy it
+            if (task->state == STATE_PARKED) {
+                task->state = STATE_READY;
+                parked = task;
             }
+        }
 
-            task->prev = task->next;
-            task->context.Destroy();
-            Heap::Free(task);
+        if (parked != nullptr) {
+            Enqueue(parked);
         }
     }
 
     void TaskManager::BlockTask(uint64_t task_id) const {
-        Utils::LockGuard _{modify_lock};
+        Interrupts::InterruptGuard irqGuard{};
+        Utils::LockGuard _{index.lock};
 
-        auto* task = FindTask(task_id);
+        Task* const task = FindTask(task_id);
 
         if (task != nullptr && task->blockable) {
+            Utils::LockGuard task_guard{task->lock};
             task->blocked = true;
         }
     }
 
-    void TaskManager::UnblockTask(uint64_t task_id) const {
-        Utils::LockGuard _{modify_lock};
-        
-        auto* task = FindTask(task_id);
+    void TaskManager::UnblockTask(uint64_t task_id) {
+        Interrupts::InterruptGuard irqGuard{};
+        Task* woken = nullptr;
+
+        {
+            Utils::LockGuard _{index.lock};
+
+            Task* const task = FindTask(task_id);
+
+            if (task == nullptr) {
+                return;
+            }
+
+            Utils::LockGuard task_guard{task->lock};
 
-        if (task != nullptr) {
             task->blocked = false;
+
+            if (task->state == STATE_PARKED) {
+                task->state = STATE_READY;
+                woken = task;
+            }
+        }
+
+        if (woken != nullptr) {
+            Wake(woken);
         }
     }
 
-    TaskContext* TaskManager::TaskSwitch(void* stack_context) {
-        if (head == nullptr) {
-            return nullptr;
+    uint64_t TaskManager::GetCurrentTaskID() const {
+        return current != nullptr && current != idle ? current->id : 0;
+    }
+
+    void TaskManager::UpdateNextWakeup() {
+        uint64_t earliest = 0;
+
+        for (size_t i = 0; i < wakeup_count; ++i) {
+            if (earliest == 0 || wakeups[i].deadline < earliest) {
+                earliest = wakeups[i].deadline;
+            }
         }
-        else if (!modify_lock.trylock()) {
-            return nullptr; // if can't change task, stay in current task
+
+        next_wakeup = earliest;
+    }
+
+    bool TaskManager::SetWakeup(uint64_t task_id, uint64_t deadline) {
+        Interrupts::InterruptGuard irqGuard{};
+        Utils::LockGuard _{wakeup_lock};
+
+        for (size_t i = 0; i < wakeup_count; ++i) {
+            if (wakeups[i].task_id == task_id) {
+                wakeups[i].deadline = deadline;
+                UpdateNextWakeup();
+                return true;
+            }
+        }
+
+        if (wakeup_count == WAKEUP_CAPACITY) {
+            return false;
         }
 
-        auto* next = head->next;
-        auto* const current = head;
+        wakeups[wakeup_count++] = Wakeup{ .deadline = deadline, .task_id = task_id };
 
-        while (next != current && next->blocked) {
-            next = next->next;
+        if (next_wakeup == 0 || deadline < next_wakeup) {
+            next_wakeup = deadline;
         }
 
-        if (switches++ != 0) {
-            current->context.StackPointer = stack_context;
+        return true;
+    }
+
+    void TaskManager::CancelWakeup(uint64_t task_id) {
+        Interrupts::InterruptGuard irqGuard{};
+        Utils::LockGuard _{wakeup_lock};
+
+        for (size_t i = 0; i < wakeup_count; ++i) {
+            if (wakeups[i].task_id == task_id) {
+                wakeups[i] = wakeups[--wakeup_count];
+                UpdateNextWakeup();
+                return;
+            }
+        }
+    }
+
+    void TaskManager::FireWakeups(uint64_t now) {
+        uint64_t expired[WAKEUP_CAPACITY];
+        size_t count = 0;
+
+        {
+            Utils::LockGuard _{wakeup_lock};
+
+            for (size_t i = 0; i < wakeup_count;) {
+                if (wakeups[i].deadline <= now) {
+                    expired[count++] = wakeups[i].task_id;
+                    wakeups[i] = wakeups[--wakeup_count];
+                }
+                else {
+                    ++i;
+                }
+            }
+
+            UpdateNextWakeup();
+        }
+
+        timeouts += count;
+
+        // unblocked outside of the lock, which cancellations from other processors spin on
+        for (size_t i = 0; i < count; ++i) {
+            UnblockTask(expired[i]);
+        }
+    }
+
+    Success TaskManager::SetScheduling(uint64_t task_id, SchedulingClass scheduling_class, uint8_t priority) {
+        uint8_t level = 0;
+        uint32_t slice = 0;
+
+        if (!ResolveLevel(scheduling_class, priority, level, slice).IsSuccess()) {
+            return Failure();
+        }
+
+        Interrupts::InterruptGuard irqGuard{};
+        Utils::LockGuard _{index.lock};
+
+        Task* const task = FindTask(task_id);
+
+        if (task == nullptr) {
+            return Failure();
+        }
+
+        Utils::LockGuard task_guard{task->lock};
+
+        task->level = level;
+        task->slice = slice;
+
+        return Success();
+    }
+
+    bool TaskManager::Tick(uint64_t now) {
+        ++interrupts;
+
+        if (next_wakeup != 0 && now >= next_wakeup) {
+            FireWakeups(now);
+        }
+
+        return reschedule || IsSliceOver(now);
+    }
+
+    TaskContext* TaskManager::TaskSwitch(void* stack_context, uint64_t now, bool yielding) {
+        // a switch that never happened, as with a task without address space, left it here
+        FinishSwitch();
+
+        DrainPending();
+        reschedule = false;
+
+        Task* const previous = current;
+
+        if (previous != nullptr) {
+            previous->context.StackPointer = stack_context;
+        }
+
+        const bool can_continue = previous != nullptr && previous != idle && IsRunnable(previous);
+
+        // a task that can go on only gives way to better levels, and to its own one once
+        // its slice is over or it yields
+        size_t limit = LEVEL_COUNT;
+
+        if (can_continue) {
+            limit = previous->level + ((yielding || IsSliceOver(now)) ? 1 : 0);
+        }
+
+        Task* next = TakeBest(*this, limit);
+
+        if (next == nullptr) {
+            next = StealFromBusiest(can_continue ? 1 : 0, limit);
+        }
+
+        if (next == nullptr) {
+            if (can_continue) {
+                if (IsSliceOver(now)) {
+                    slice_end = now + previous->slice;
+                }
+
+                return nullptr; // signal no change in task
+            }
+
+            next = idle;
         }
-        else {
-            modify_lock.unlock();
-            return &current->context;
+
+        if (previous != nullptr && previous != idle) {
+            outgoing = previous;
         }
 
-        head = next;
+        slice_end = next != nullptr && next->slice != 0 ? now + next->slice : 0;
 
-        modify_lock.unlock();
+        // tasks left waiting here go to a processor with nothing to do
+        if (GetQueuedCount() > 0) {
+            KickIdleProcessor();
+        }
 
-        if (next == current) {
-            return nullptr; // signal no change in task
+        if (next == nullptr || next == previous) {
+            return nullptr;
         }
 
-        return &head->context;
+        current = next;
+        ++switches;
+
+        return &next->context;
+    }
+
+    void TaskManager::FinishSwitch() {
+        // an unblock that came while the task was still running is seen here, so that a
+        // processor going idle never sits on a woken task
+        if (outgoing != nullptr) {
+            Settle(outgoing);
+            outgoing = nullptr;
+        }
+    }
+
+    uint64_t TaskManager::GetDeadline() const {
+        const uint64_t deadline = current == idle ? 0 : slice_end;
+
+        // idle processors still wake up for the timeouts of their waiting tasks
+        if (next_wakeup != 0 && (deadline == 0 || next_wakeup < deadline)) {
+            return next_wakeup;
+        }
+
+        return deadline;
+    }
+
+    void TaskManager::QueryStatistics(Statistics& stats) const {
+        stats.switches = switches;
+        stats.steals = steals;
+        stats.queued = GetQueuedCount();
+        stats.interrupts = interrupts;
+        stats.timeouts = timeouts;
     }
 }
@@ -0,0 +1,140 @@
+;; SPDX-License-Identifier: GPL-3.0-only
+;;
+;; Copyright (C) 2026 Alexandre Boissiere
+;; This file is part of the BadLands operating system.
+;;
+;; This program is free software: you can redistribute it and/or modify it under the terms of the
+;; GNU General Public License as published by the Free Software Foundation, version 3.
+;; This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+;; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+;; See the GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License along with this program.
+;; If not, see <https://www.gnu.org/licenses/>. 
+
+BITS 16
+
+section .text
+global AP_TRAMPOLINE_START
+global AP_TRAMPOLINE_PARAMETERS
+global AP_TRAMPOLINE_END
+
+%define CODE_SEGMENT    0x0008
+%define DATA_SEGMENT    0x0010
+
+%define CR0_PE          0x00000001
+%define CR0_PG          0x80000000
+%define CR4_PAE         0x00000020
+%define IA32_EFER       0xC0000080
+
+; The trampoline is copied on a page below 1MB, and the startup IPI enters it in real
+; mode with CS:IP = page:0000, so everything is addressed relative to its start.
+%define OFFSET(label)       ((label) - AP_TRAMPOLINE_START)
+%define PARAMETERS          OFFSET(AP_TRAMPOLINE_PARAMETERS)
+
+; filled by the bootstrap processor, see SMP.cpp
+struc TrampolineParameters
+    .boot_cr3:  resq 1  ; copy of the kernel PML4 below 4GB, to enable paging from real mode
+    .cr0:       resq 1
+    .cr3:       resq 1
+    .cr4:       resq 1
+    .efer:      resq 1
+    .stack:     resq 1
+    .entry:     resq 1
+    .argument:  resq 1
+    .started:   resq 1  ; set as soon as the processor runs the trampoline
+endstruc
+
+AP_TRAMPOLINE_START:
+    cli
+    cld
+
+    mov ax, cs
+    mov ds, ax
+
+    ; linear address of the trampoline
+    xor ebx, ebx
+    mov bx, ax
+    shl ebx, 4
+
+    mov dword [PARAMETERS + TrampolineParameters.started], 1
+
+    lea eax, [ebx + OFFSET(GDT)]
+    mov [OFFSET(GDTP) + 2], eax
+    lea eax, [ebx + OFFSET(long_mode)]
+    mov [OFFSET(LONG_MODE_POINTER)], eax
+
+    o32 lgdt [OFFSET(GDTP)]
+
+    mov eax, CR4_PAE
+    mov cr4, eax
+
+    mov eax, [PARAMETERS + TrampolineParameters.boot_cr3]
+    mov cr3, eax
+
+    mov ecx, IA32_EFER
+    mov eax, [PARAMETERS + TrampolineParameters.efer]
+    mov edx, [PARAMETERS + TrampolineParameters.efer + 4]
+    wrmsr
+
+    ; straight from real mode to long mode
+    mov eax, cr0
+    or eax, CR0_PE | CR0_PG
+    mov cr0, eax
+
+    o32 jmp far [OFFSET(LONG_MODE_POINTER)]
+
+BITS 64
+long_mode:
+    mov eax, DATA_SEGMENT
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    xor eax, eax
+    mov fs, ax
+    mov gs, ax
+
+    ; the upper half of rbx is undefined after the mode switch
+    mov ebx, ebx
+
+    ; switch to the kernel address space and the control registers of the bootstrap processor
+    mov rax, [rbx + PARAMETERS + TrampolineParameters.cr4]
+    mov cr4, rax
+    mov rax, [rbx + PARAMETERS + TrampolineParameters.cr3]
+    mov cr3, rax
+    mov rax, [rbx + PARAMETERS + TrampolineParameters.cr0]
+    mov cr0, rax
+
+    mov rsp, [rbx + PARAMETERS + TrampolineParameters.stack]
+    mov rcx, [rbx + PARAMETERS + TrampolineParameters.argument]
+    mov rax, [rbx + PARAMETERS + TrampolineParameters.entry]
+
+    ; reserve shadow space
+    sub rsp, 32
+
+    call rax
+
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+    align 8
+GDT:
+    dq 0x0000000000000000   ; null
+    dq 0x00209A0000000000   ; kernel code
+    dq 0x0000920000000000   ; kernel data
+GDT_END:
+
+GDTP:
+    dw GDT_END - GDT - 1
+    dd 0
+
+LONG_MODE_POINTER:
+    dd 0
+    dw CODE_SEGMENT
+
+    align 8
+AP_TRAMPOLINE_PARAMETERS:
+    times TrampolineParameters_size db 0
+AP_TRAMPOLINE_END:
@@ -0,0 +1,238 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Copyright (C) 2026 Alexandre Boissiere
+// This file is part of the BadLands operating system.
+//
+// This program is free software: you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation, version 3.
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program.
+// If not, see <https://www.gnu.org/licenses/>. 
+
+#include <cstdint>
+
+#include <new>
+
+#include <shared/LockGuard.hpp>
+
+#include <interrupts/InterruptGuard.hpp>
+
+#include <mm/Heap.hpp>
+
+#include <sched/Self.hpp>
+#include <sched/TaskManager.hpp>
+#include <sched/WaitQueue.hpp>
+
+namespace Scheduling {
+    namespace {
+        static constexpr uint64_t RFLAGS_IF = 1 << 9;
+        static constexpr uint64_t MICROS_PER_MILLI = 1000;
+
+        // 0 outside of a task, or with interrupts disabled, where nothing could switch away
+        static uint64_t GetBlockableTaskID() {
+            uint64_t rflags = 0;
+            __asm__ volatile("pushfq\n\tpop %0" : "=r"(rflags));
+
+            if ((rflags & RFLAGS_IF) == 0) {
+                return 0;
+            }
+
+            // the task could move to another processor between reading Self and its manager
+            Interrupts::InterruptGuard irqGuard{};
+
+            return Self().GetTaskManager().GetCurrentTaskID();
+        }
+
+        // when no waiter could be allocated, the task checks again every time it is scheduled
+        static bool Poll(uint64_t deadline, bool (*predicate)(void*), void* args) {
+            while (!predicate(args)) {
+                if (deadline != 0 && Self().GetTimer().GetCountMicros() >= deadline) {
+                    return false;
+                }
+
+                Self().Yield();
+            }
+
+            return true;
+        }
+    }
+
+    void WaitQueue::Enlist(Waiter& waiter) {
+        Utils::IRQLockGuard _{lock};
+
+        waiter.previous = nullptr;
+        waiter.next = head;
+
+        if (head != nullptr) {
+            head->previous = &waiter;
+        }
+
+        head = &waiter;
+    }
+
+    void WaitQueue::Delist(Waiter& waiter) {
+        Utils::IRQLockGuard _{lock};
+
+        if (waiter.previous != nullptr) {
+            waiter.previous->next = waiter.next;
+        }
+        else {
+            head = waiter.next;
+        }
+
+        if (waiter.next != nullptr) {
+            waiter.next->previous = waiter.previous;
+        }
+    }
+
+    bool WaitQueue::Block(uint64_t task_id, uint64_t deadline, bool (*predicate)(void*), void* args) {
+        Waiter* const waiter = static_cast<Waiter*>(Heap::Allocate(sizeof(Waiter)));
+
+        if (waiter == nullptr) {
+            return Poll(deadline, predicate, args);
+        }
+
+        new (waiter) Waiter{ .task_id = task_id, .next = nullptr, .previous = nullptr };
+        TaskManager* wakeup_owner = nullptr;
+        bool satisfied = false;
+
+        Enlist(*waiter);
+
+        while (true) {
+            // blocked before the check, so that a wake-up coming in between unblocks it again
+            Self().GetTaskManager().BlockTask(task_id);
+
+            if (predicate(args)) {
+                satisfied = true;
+                break;
+            }
+
+            Interrupts::InterruptGuard irqGuard{};
+            UnattachedSelf& self = Self();
+            TaskManager& manager = self.GetTaskManager();
+
+            if (deadline != 0) {
+                if (self.GetTimer().GetCountMicros() >= deadline) {
+                    break;
+                }
+
+                if (wakeup_owner != nullptr && wakeup_owner != &manager) {
+                    wakeup_owner->CancelWakeup(task_id);
+                    wakeup_owner = nullptr;
+                }
+
+                // with no room left for the wake-up, the task polls every time it is scheduled
+                if (manager.SetWakeup(task_id, deadline)) {
+                    wakeup_owner = &manager;
+                }
+                else {
+                    manager.UnblockTask(task_id);
+                }
+            }
+
+            self.Yield();
+        }
+
+        Self().GetTaskManager().UnblockTask(task_id);
+
+        if (wakeup_owner != nullptr) {
+            wakeup_owner->CancelWakeup(task_id);
+        }
+
+        Delist(*waiter);
+        Heap::Free(waiter);
+
+        return satisfied;
+    }
+
+    bool WaitQueue::WaitFor(uint64_t ms, bool (*predicate)(void*), void* args) {
+        if (predicate(args)) {
+            return true;
+        }
+
+        const uint64_t task_id = GetBlockableTaskID();
+
+        if (task_id == 0) {
+            return Self().SpinWaitMillsFor(ms, predicate, args);
+        }
+
+        return Block(task_id, Self().GetTimer().GetCountMicros() + ms * MICROS_PER_MILLI, predicate, args);
+    }
+
+    void WaitQueue::Wait(bool (*predicate)(void*), void* args) {
+        if (predicate(args)) {
+            return;
+        }
+
+        const uint64_t task_id = GetBlockableTaskID();
+
+        if (task_id == 0) {
+            while (!predicate(args)) { __asm__ volatile("pause"); }
+            return;
+        }
+
+        Block(task_id, 0, predicate, args);
+    }
+
+    void WaitQueue::WakeAll() {
+        Utils::IRQLockGuard _{lock};
+
+        for (Waiter* waiter = head; waiter != nullptr; waiter = waiter->next) {
+            Self().GetTaskManager().UnblockTask(waiter->task_id);
+        }
+    }
+
+    void Completion::Complete() {
+        done.store<Utils::MemoryOrder::RELEASE>(true);
+        waiters.WakeAll();
+    }
+
+    void Completion::Reset() {
+        done.store<Utils::MemoryOrder::RELEASE>(false);
+    }
+
+    bool Completion::IsComplete() const {
+        return done.load<Utils::MemoryOrder::ACQUIRE>();
+    }
+
+    bool Completion::WaitFor(uint64_t ms) {
+        static constexpr auto COMPLETE_PREDICATE = [](void* arg) {
+            return static_cast<const Completion*>(arg)->IsComplete();
+        };
+
+        return waiters.WaitFor(ms, COMPLETE_PREDICATE, this);
+    }
+
+    void Completion::Wait() {
+        static constexpr auto COMPLETE_PREDICATE = [](void* arg) {
+            return static_cast<const Completion*>(arg)->IsComplete();
+        };
+
+        waiters.Wait(COMPLETE_PREDICATE, this);
+    }
+
+    bool Mutex::trylock() {
+        bool expected = false;
+
+        return locked.compare_exchange(expected, true);
+    }
+
+    void Mutex::lock() {
+        static constexpr auto UNLOCKED_PREDICATE = [](void* arg) {
+            return !static_cast<const Mutex*>(arg)->locked.load();
+        };
+
+        // woken up along with every other waiter, so the lock may be gone again
+        while (!trylock()) {
+            waiters.Wait(UNLOCKED_PREDICATE, this);
+        }
+    }
+
+    void Mutex::unlock() {
+        locked.store(false);
+        waiters.WakeAll();
+    }
+}
@@ -17,6 +17,7 @@
 
 #include <exports.hpp>
 
+#include <shared/SimpleAtomic.hpp>
 #include <shared/memory/defs.hpp>
 
 #include <devices/KeyboardDispatcher/Converter.hpp>
@@ -27,12 +28,21 @@
 #include <fs/IFNode.hpp>
 #include <fs/VFS.hpp>
 
+#include <interrupts/Deferred.hpp>
+#include <interrupts/InterruptGuard.hpp>
 #include <interrupts/Panic.hpp>
 
+#include <mm/CopyOnWrite.hpp>
 #include <mm/Heap.hpp>
+#include <mm/Swap.hpp>
 #include <mm/Utils.hpp>
+#include <mm/VirtualMemory.hpp>
 
+#include <sched/ContextID.hpp>
+#include <sched/ExtendedState.hpp>
 #include <sched/Self.hpp>
+#include <sched/TaskContext.hpp>
+#include <sched/TaskManager.hpp>
 
 #include <screen/Log.hpp>
 
@@ -316,6 +326,179 @@ namespace {
         }
     };
 
+    // CPU-bound tasks of the schedbench command, created by its first run and parked between runs
+    static constexpr size_t BENCH_TASKS = 8;
+    static constexpr uint64_t BENCH_DURATION_MS = 2000;
+
+    static volatile bool benchRunning = false;
+    static volatile uint64_t benchTaskIDs[BENCH_TASKS] = { 0 };
+    static volatile uint64_t benchIterations[BENCH_TASKS] = { 0 };
+
+    static void BenchTask(uint64_t index) {
+        while (true) {
+            if (benchRunning) {
+                benchIterations[index] = benchIterations[index] + 1;
+                continue;
+            }
+
+            Self().GetTaskManager().BlockTask(benchTaskIDs[index]);
+
+            // the next run may have started before the task blocked
+            if (benchRunning) {
+                Self().GetTaskManager().UnblockTask(benchTaskIDs[index]);
+            }
+            else {
+                Self().Yield();
+            }
+        }
+    }
+
+    static void RunSchedulerBenchmark() {
+        const size_t processors = UnattachedSelf::GetProcessorCount();
+
+        auto* const before = static_cast<Scheduling::TaskManager::Statistics*>(
+            Heap::Allocate(processors * sizeof(Scheduling::TaskManager::Statistics))
+        );
+
+        if (before == nullptr) {
+            Log::putsSafe("[SHELL] Failed to allocate memory for the benchmark\n\r");
+            return;
+        }
+
+        for (size_t i = 0; i < BENCH_TASKS; ++i) {
+            if (benchTaskIDs[i] == 0) {
+                const auto task = Scheduling::KernelTaskContext::Create(reinterpret_cast<void*>(&BenchTask), i);
+                const uint64_t id = task.HasValue() ? Self().GetTaskManager().AddTask(task.GetValue()) : 0;
+
+                if (id == 0) {
+                    Log::putsSafe("[SHELL] Failed to create the benchmark tasks\n\r");
+                    Heap::Free(before);
+                    return;
+                }
+
+                benchTaskIDs[i] = id;
+            }
+
+            benchIterations[i] = 0;
+        }
+
+        for (size_t i = 0; i < processors; ++i) {
+            UnattachedSelf::AccessProcessor(i).GetTaskManager().QueryStatistics(before[i]);
+        }
+
+        benchRunning = true;
+
+        for (size_t i = 0; i < BENCH_TASKS; ++i) {
+            Self().GetTaskManager().UnblockTask(benchTaskIDs[i]);
+        }
+
+        Self().SpinWaitMillis(BENCH_DURATION_MS);
+
+        benchRunning = false;
+
+        for (size_t i = 0; i < processors; ++i) {
+            auto& processor = UnattachedSelf::AccessProcessor(i);
+
+            Scheduling::TaskManager::Statistics after;
+            processor.GetTaskManager().QueryStatistics(after);
+
+            Log::printfSafe("CPU 0x%.2hhx: %llu switches/s, %llu steals\n\r",
+                processor.GetID(),
+                (after.switches - before[i].switches) * 1000 / BENCH_DURATION_MS,
+                after.steals - before[i].steals);
+        }
+
+        uint64_t least = benchIterations[0];
+        uint64_t most = benchIterations[0];
+
+        for (size_t i = 1; i < BENCH_TASKS; ++i) {
+            least = benchIterations[i] < least ? benchIterations[i] : least;
+            most = benchIterations[i] > most ? benchIterations[i] : most;
+        }
+
+        // 100 when every task made the same progress
+        Log::printfSafe("%llu tasks, balance: %llu percent\n\r", BENCH_TASKS, most == 0 ? 0 : least * 100 / most);
+
+        Heap::Free(before);
+    }
+
+    static constexpr uint64_t ATOMIC_BENCH_ITERATIONS = 1000000;
+
+    static volatile uint64_t atomicBenchValue = 0;
+
+    static inline uint64_t ReadTSC() {
+        uint32_t low, high;
+        __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+        return (static_cast<uint64_t>(high) << 32) | low;
+    }
+
+    // average cycles per operation, without interrupts getting in the way
+    template<typename Operation>
+    static uint64_t MeasureAtomic(Operation operation) {
+        Interrupts::InterruptGuard irqGuard{};
+        const uint64_t start = ReadTSC();
+
+        for (uint64_t i = 0; i < ATOMIC_BENCH_ITERATIONS; ++i) {
+            operation();
+        }
+
+        return (ReadTSC() - start) / ATOMIC_BENCH_ITERATIONS;
+    }
+
+    static void RunAtomicBenchmark() {
+        namespace Assembly = Utils::Atomic::Assembly;
+        namespace Builtin = Utils::Atomic::Builtin;
+        using Utils::MemoryOrder;
+
+        struct Result {
+            const char* operation;
+            uint64_t assembly;
+            uint64_t builtin;
+        };
+
+        const Result results[] = {
+            {
+                "load relaxed",
+                MeasureAtomic([] { Assembly::Load<MemoryOrder::RELAXED>(&atomicBenchValue); }),
+                MeasureAtomic([] { Builtin::Load<MemoryOrder::RELAXED>(&atomicBenchValue); })
+            },
+            {
+                "load seq_cst",
+                MeasureAtomic([] { Assembly::Load<MemoryOrder::SEQ_CST>(&atomicBenchValue); }),
+                MeasureAtomic([] { Builtin::Load<MemoryOrder::SEQ_CST>(&atomicBenchValue); })
+            },
+            {
+                "store release",
+                MeasureAtomic([] { Assembly::Store<MemoryOrder::RELEASE>(&atomicBenchValue, static_cast<uint64_t>(0)); }),
+                MeasureAtomic([] { Builtin::Store<MemoryOrder::RELEASE>(&atomicBenchValue, static_cast<uint64_t>(0)); })
+            },
+            {
+                "store seq_cst",
+                MeasureAtomic([] { Assembly::Store<MemoryOrder::SEQ_CST>(&atomicBenchValue, static_cast<uint64_t>(0)); }),
+                MeasureAtomic([] { Builtin::Store<MemoryOrder::SEQ_CST>(&atomicBenchValue, static_cast<uint64_t>(0)); })
+            },
+            {
+                "add",
+                MeasureAtomic([] { Assembly::AddFetch<MemoryOrder::SEQ_CST>(&atomicBenchValue, static_cast<uint64_t>(1)); }),
+                MeasureAtomic([] { Builtin::AddFetch<MemoryOrder::SEQ_CST>(&atomicBenchValue, static_cast<uint64_t>(1)); })
+            },
+            {
+                "exchange",
+                MeasureAtomic([] { Assembly::Exchange<MemoryOrder::SEQ_CST>(&atomicBenchValue, static_cast<uint64_t>(0)); }),
+                MeasureAtomic([] { Builtin::Exchange<MemoryOrder::SEQ_CST>(&atomicBenchValue, static_cast<uint64_t>(0)); })
+            },
+            {
+                "compare exchange",
+                MeasureAtomic([] { uint64_t expected = 0; Assembly::CompareExchange<MemoryOrder::SEQ_CST>(&atomicBenchValue, expected, expected); }),
+                MeasureAtomic([] { uint64_t expected = 0; Builtin::CompareExchange<MemoryOrder::SEQ_CST>(&atomicBenchValue, expected, expected); })
+            }
+        };
+
+        for (const Result& result : results) {
+            Log::printfSafe("%s: %llu cycles (asm), %llu cycles (inline)\n\r", result.operation, result.assembly, result.builtin);
+        }
+    }
+
     void OnExecute(const CommandString& cmd, CommandContext& context) {
         const char* const cmd_string = cmd.command;
 
@@ -406,6 +589,96 @@ namespace {
                     }
                 }
             }
+            else if (cmd.length == 4 && Utils::memcmp(cmd_string, "heap", 4) == 0) {
+                Heap::Statistics stats;
+                Heap::QueryStatistics(stats);
+
+                uint64_t slabAllocations = 0;
+                uint64_t refills = 0;
+
+                for (size_t i = 0; i < Heap::SIZE_CLASSES; ++i) {
+                    const Heap::SizeClassStatistics& sc = stats.classes[i];
+
+                    Log::printfSafe("%llu B: %llu allocs, %llu frees, %llu refills, %llu pages\n\r",
+                        sc.objectSize, sc.allocations, sc.frees, sc.refills, sc.pages);
+
+                    slabAllocations += sc.allocations;
+                    refills += sc.refills;
+                }
+
+                const uint64_t total = slabAllocations + stats.largeAllocations;
+                const uint64_t hits = slabAllocations > refills ? slabAllocations - refills : 0;
+
+                Log::printfSafe("large: %llu allocs, %llu frees\n\r", stats.largeAllocations, stats.largeFrees);
+                Log::printfSafe("slab share: %llu percent, magazine hit rate: %llu percent\n\r",
+                    total == 0 ? 0 : slabAllocations * 100 / total,
+                    slabAllocations == 0 ? 0 : hits * 100 / slabAllocations);
+            }
+            else if (cmd.length == 6 && Utils::memcmp(cmd_string, "faults", 6) == 0) {
+                VirtualMemory::FaultStatistics stats;
+                VirtualMemory::QueryFaultStatistics(stats);
+
+                Log::printfSafe("faults: %llu, pages populated by faults: %llu, on map: %llu\n\r",
+                    stats.faults, stats.faultPopulatedPages, stats.mapPopulatedPages);
+            }
+            else if (cmd.length == 4 && Utils::memcmp(cmd_string, "pcid", 4) == 0) {
+                Scheduling::ContextID::Statistics stats;
+                Scheduling::ContextID::QueryStatistics(stats);
+
+                Log::printfSafe("switches: %llu, flushing: %llu, generation: %llu\n\r",
+                    stats.switches, stats.flushingSwitches, stats.generations);
+            }
+            else if (cmd.length == 3 && Utils::memcmp(cmd_string, "cow", 3) == 0) {
+                CopyOnWrite::Statistics stats;
+                CopyOnWrite::QueryStatistics(stats);
+
+                Log::printfSafe("shared frames: %llu, copies: %llu, reused: %llu\n\r",
+                    stats.sharedFrames, stats.copies, stats.reuses);
+            }
+            else if (cmd.length == 5 && Utils::memcmp(cmd_string, "sched", 5) == 0) {
+                for (size_t i = 0; i < UnattachedSelf::GetProcessorCount(); ++i) {
+                    auto& processor = UnattachedSelf::AccessProcessor(i);
+
+                    Scheduling::TaskManager::Statistics stats;
+                    processor.GetTaskManager().QueryStatistics(stats);
+
+                    Log::printfSafe("CPU 0x%.2hhx: %llu switches, %llu steals, %llu queued, %llu timer interrupts, %llu timeouts (%s)\n\r",
+                        processor.GetID(), stats.switches, stats.steals, stats.queued, stats.interrupts, stats.timeouts,
+                        processor.GetTimer().IsTickless() ? "tickless" : "periodic");
+                }
+            }
+            else if (cmd.length == 10 && Utils::memcmp(cmd_string, "schedbench", 10) == 0) {
+                RunSchedulerBenchmark();
+            }
+            else if (cmd.length == 11 && Utils::memcmp(cmd_string, "atomicbench", 11) == 0) {
+                RunAtomicBenchmark();
+            }
+            else if (cmd.length == 4 && Utils::memcmp(cmd_string, "simd", 4) == 0) {
+                Scheduling::ExtendedState::Statistics stats;
+                Scheduling::ExtendedState::QueryStatistics(stats);
+
+                Log::printfSafe("simd: %llu switches (%llu cycles avg), %llu saves (%llu cycles avg), %llu restores (%llu cycles avg)\n\r",
+                    stats.switches, stats.switches != 0 ? stats.switchCycles / stats.switches : 0,
+                    stats.saves, stats.saves != 0 ? stats.saveCycles / stats.saves : 0,
+                    stats.restores, stats.restores != 0 ? stats.restoreCycles / stats.restores : 0);
+            }
+            else if (cmd.length == 3 && Utils::memcmp(cmd_string, "irq", 3) == 0) {
+                Interrupts::Deferred::Statistics stats;
+                Interrupts::Deferred::QueryStatistics(stats);
+
+                Log::printfSafe("irq: %llu top halves (%llu cycles avg, %llu max), %llu bottom halves (%llu cycles avg)\n\r",
+                    stats.topHalves, stats.topHalves != 0 ? stats.topHalfCycles / stats.topHalves : 0, stats.maxTopHalfCycles,
+                    stats.bottomHalves, stats.bottomHalves != 0 ? stats.bottomHalfCycles / stats.bottomHalves : 0);
+                Log::printfSafe("irq: bottom halves start %llu cycles avg after being scheduled, %llu max\n\r",
+                    stats.bottomHalves != 0 ? stats.latencyCycles / stats.bottomHalves : 0, stats.maxLatencyCycles);
+            }
+            else if (cmd.length == 4 && Utils::memcmp(cmd_string, "swap", 4) == 0) {
+                Swap::Statistics stats;
+                Swap::QueryStatistics(stats);
+
+                Log::printfSafe("swap: %llu of %llu pages used, %llu out, %llu in\n\r",
+                    stats.usedSlots, stats.slots, stats.pagesOut, stats.pagesIn);
+            }
             else {
                 Log::putsSafe("[SHELL] Unknown command: ");
                 Log::putsSafe(cmd_string);
@@ -467,8 +740,6 @@ namespace Services {
                         inputBuffer.OnKeyEvent(Devices::KeyboardDispatcher::GetVirtualKeyPacket(packet));
                     }
                 }
-
-                Self().Yield();
             }
         }
     }